@@ -21,6 +21,7 @@
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
 #include <osgDB/WriteFile>
+#include <OpenThreads/Thread>
 
 #include <osgEarth/Common>
 #include <osgEarth/FileUtils>
@@ -49,12 +50,14 @@ usage( const std::string& msg = "" )
 
     std::cout
         << std::endl
-        << "USAGE: osgearth_backfill <tms.xml>" << std::endl
+        << "USAGE: osgearth_backfill <tms.xml | file.mbtiles>" << std::endl
         << std::endl        
         << "            --bounds xmin ymin xmax ymax    : bounds to backfill in (in map coordinates; default=entire map)\n"
         << "            [--min-level <num>]             : The minimum level to stop backfilling to.  (default=0)\n"
         << "            [--max-level <num>]             : The level to start backfilling from(default=inf)\n"                
         << "            [--db-options]                : db options string to pass to the image writer in quotes (e.g., \"JPEG_QUALITY 60\")\n"
+        << "            [--concurrency <num>]           : number of threads to build tiles with (default=number of cores)\n"
+        << "            [--cache-size <num>]            : number of newly built tiles to keep in memory (default=1024)\n"
         << std::endl
         << "         [--quiet]               : suppress progress output" << std::endl;
 
@@ -107,6 +110,14 @@ main(int argc, char** argv)
 
     osg::ref_ptr<osgDB::Options> options = new osgDB::Options(dbOptions);
 
+    // number of threads to build tiles with
+    unsigned concurrency = OpenThreads::GetNumberOfProcessors();
+    args.read( "--concurrency", concurrency );
+
+    // number of built tiles to keep in memory for the next level
+    unsigned cacheSize = 1024;
+    args.read( "--cache-size", cacheSize );
+
 
     std::string tmsPath;
 
@@ -121,7 +132,7 @@ main(int argc, char** argv)
 
     if (tmsPath.empty())
     {
-        return usage( "Please provide a path to a TMS TileMap" );
+        return usage( "Please provide a path to a TMS TileMap or MBTiles database" );
     }
     
 
@@ -129,5 +140,8 @@ main(int argc, char** argv)
     backfiller.setMinLevel( minLevel );
     backfiller.setMaxLevel( maxLevel );
     backfiller.setBounds( bounds );
+    backfiller.setNumThreads( concurrency );
+    backfiller.setCacheSize( cacheSize );
+    backfiller.setVerbose( verbose );
     backfiller.process( tmsPath, options.get() );
 }
@@ -141,6 +141,8 @@ makeTMS( osg::ArgumentParser& args )
     std::string tileList;
     while (args.read( "--tiles", tileList ) );
 
+    bool worker = args.read("--worker");
+
     bool verbose = args.read("--verbose");
 
     unsigned int batchSize = 0;
@@ -256,6 +258,14 @@ makeTMS( osg::ArgumentParser& args )
         writeXML = false;
     }
 
+    // A worker process for --mp reads its keys from the parent process.
+    else if (worker)
+    {
+        visitor = new TileKeyStreamVisitor();
+        writeXML = false;
+        verbose = false;
+    }
+
     // If we dont' have a visitor create one.
     if (!visitor.valid())
     {
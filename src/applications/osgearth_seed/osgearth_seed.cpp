@@ -40,6 +40,8 @@
 #include <osgEarthFeatures/FeatureCursor>
 
 #include <osgEarthDrivers/feature_ogr/OGRFeatureOptions>
+#include <osgEarthDrivers/cache_pack/PackCacheOptions>
+#include <osgEarthDrivers/cache_pack/PackCacheMigration>
 
 #include <iostream>
 #include <sstream>
@@ -47,12 +49,14 @@
 
 using namespace osgEarth;
 using namespace osgEarth::Drivers;
+using namespace osgEarth::Drivers::PackCache;
 
 #define LC "[osgearth_cache] "
 
 int list( osg::ArgumentParser& args );
 int seed( osg::ArgumentParser& args );
 int purge( osg::ArgumentParser& args );
+int migrate( osg::ArgumentParser& args );
 int usage( const std::string& msg );
 int message( const std::string& msg );
 
@@ -68,6 +72,8 @@ int
         return list( args );
     else if ( args.read( "--purge" ) )
         return purge( args );        
+    else if ( args.read( "--migrate" ) )
+        return migrate( args );
     else
     return usage("");
 }
@@ -93,11 +99,17 @@ int
         << "        [--bounds xmin ymin xmax ymax]* ; Geospatial bounding box to seed (in map coordinates; default=entire map)" << std::endl
         << "        [--index shapefile]             ; Use the feature extents in a shapefile to set the bounding boxes for seeding" << std::endl
         << "        [--mp]                          ; Use multiprocessing to process the tiles.  Useful for GDAL sources as this avoids the global GDAL lock" << std::endl
-        << "        [--mt]                          ; Use multithreading to process the tiles." << std::endl
+        << "        [--mt]                          ; Use multithreading to process the tiles, one level at a time." << std::endl
         << "        [--concurrency]                 ; The number of threads or processes to use if --mp or --mt are provided." << std::endl
+        << "        [--worker]                      ; Internal: run as a worker process for --mp, reading tiles from standard input." << std::endl
+        << "        [--batchsize]                   ; The number of tiles per task or process if --mp or --mt are provided." << std::endl
+        << "        [--checkpoint path]             ; With --mt, save progress to files at this path and resume from them if they exist." << std::endl
         << "        [--verbose]                     ; Displays progress of the seed operation" << std::endl
         << std::endl
         << "    --purge file.earth                  ; Purges a layer cache in a .earth file (interactive)" << std::endl
+        << std::endl
+        << "    --migrate from_path to_path         ; Copies a filesystem cache into a new pack cache" << std::endl
+        << "        [--verbose]                     ; Displays progress of the migration" << std::endl
         << std::endl;
 
     return -1;
@@ -143,11 +155,16 @@ seed( osg::ArgumentParser& args )
     std::string tileList;
     while (args.read( "--tiles", tileList ) );
 
+    bool worker = args.read("--worker");
+
     bool verbose = args.read("--verbose");
 
     unsigned int batchSize = 0;
     args.read("--batchsize", batchSize);
 
+    std::string checkpointPath;
+    args.read("--checkpoint", checkpointPath);
+
     // Read the concurrency level
     unsigned int concurrency = 0;
     args.read("-c", concurrency);
@@ -241,6 +258,13 @@ seed( osg::ArgumentParser& args )
         visitor = v;        
         OE_DEBUG << "Read task list with " << tasks.getKeys().size() << " tasks" << std::endl;
     }
+
+    // If we are a worker process for --mp, read the keys from the parent process
+    else if (worker)
+    {
+        visitor = new TileKeyStreamVisitor();
+        verbose = false;
+    }
   
 
     // If we dont' have a visitor create one.
@@ -249,11 +273,16 @@ seed( osg::ArgumentParser& args )
         if (args.read("--mt"))
         {
             // Create a multithreaded visitor
-            MultithreadedTileVisitor* v = new MultithreadedTileVisitor();
+            LevelParallelTileVisitor* v = new LevelParallelTileVisitor();
             if (concurrency > 0)
             {
                 v->setNumThreads(concurrency);
             }
+
+            if (batchSize > 0)
+            {
+                v->setBatchSize(batchSize);
+            }
             visitor = v;            
         }
         else if (args.read("--mp"))
@@ -314,6 +343,7 @@ seed( osg::ArgumentParser& args )
     // Initialize the seeder
     CacheSeed seeder;
     seeder.setVisitor(visitor.get());
+    seeder.setCheckpointPath(checkpointPath);
 
     osgEarth::Map* map = mapNode->getMap();
 
@@ -589,4 +619,41 @@ purge( osg::ArgumentParser& args )
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+int
+migrate( osg::ArgumentParser& args )
+{
+    bool verbose = args.read("--verbose");
+
+    if ( args.argc() < 3 )
+        return usage( "Missing source and destination folders." );
+
+    std::string from = args[1];
+    std::string to   = args[2];
+
+    if ( osgDB::fileType(from) != osgDB::DIRECTORY )
+        return usage( "Source cache folder does not exist." );
+
+    PackCacheOptions options;
+    options.rootPath() = to;
+
+    osg::ref_ptr<Cache> cache = CacheFactory::create(options);
+    if ( !cache.valid() || !cache->isOK() )
+        return usage( "Failed to create the pack cache; is the osgearth_cache_pack plugin available?" );
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    PackCacheMigration migration;
+    migration.verbose() = verbose;
+    unsigned total  = migration.run(from, cache.get());
+    unsigned errors = migration.getNumErrors();
+
+    osg::Timer_t end = osg::Timer::instance()->tick();
+    std::cout
+        << "Migrated " << total << " records in "
+        << prettyPrintTime( osg::Timer::instance()->delta_s(start, end) )
+        << " (" << errors << " errors)" << std::endl;
+
+    return errors > 0 ? 1 : 0;
+}
@@ -252,6 +252,18 @@ CacheBin::writeNode(const std::string&    key,
                     osg::Node*            node,
                     const Config&         metadata,
                     const osgDB::Options* writeOptions)
+{
+    prepareForWriting(node, writeOptions);
+
+    // finally, write the graph to the bin:
+    write(key, node, metadata, writeOptions);
+
+    return true;
+}
+
+void
+CacheBin::prepareForWriting(osg::Node*            node,
+                            const osgDB::Options* writeOptions)
 {
     // Preparation step - removes things like UserDataContainers
     PrepareForCaching prep;
@@ -260,11 +272,6 @@ CacheBin::writeNode(const std::string&    key,
     // Write external refs (like texture images) to the cache bin
     WriteExternalReferencesToCache writeRefs(this, writeOptions);
     node->accept( writeRefs );
-
-    // finally, write the graph to the bin:
-    write(key, node, metadata, writeOptions);
-
-    return true;
 }
 
 
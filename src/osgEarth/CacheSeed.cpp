@@ -22,6 +22,7 @@
 
 #include <osgEarth/CacheSeed>
 #include <osgEarth/ImageLayer>
+#include <osgEarth/StringUtils>
 
 #define LC "[CacheSeed] "
 
@@ -113,8 +114,24 @@ void CacheSeed::setVisitor(TileVisitor* visitor)
     _visitor = visitor;
 }
 
+void CacheSeed::setCheckpointPath(const std::string& path)
+{
+    _checkpointPath = path;
+}
+
+const std::string& CacheSeed::getCheckpointPath() const
+{
+    return _checkpointPath;
+}
+
 void CacheSeed::run( TerrainLayer* layer, const Map* map )
 {
+    LevelParallelTileVisitor* parallel = dynamic_cast< LevelParallelTileVisitor* >( _visitor.get() );
+    if (parallel && !_checkpointPath.empty())
+    {
+        parallel->setCheckpointFile( Stringify() << _checkpointPath << "." << map->getIndexOfLayer(layer) );
+    }
+
     _visitor->setTileHandler( new CacheTileHandler( layer, map ) );
     _visitor->run( map->getProfile() );
 }
\ No newline at end of file
@@ -21,6 +21,9 @@
 #include <osgEarth/Progress>
 #include <osgEarth/Metrics>
 #include <osgEarth/URI>
+#include <osgEarth/TaskService>
+#include <osgEarth/StringUtils>
+#include <cstdlib>
 
 using namespace osgEarth;
 using namespace OpenThreads;
@@ -719,6 +722,35 @@ osg::MixinVector< osg::ref_ptr<ElevationLayer> >( rhs )
     //nop
 }
 
+namespace
+{
+    Threading::Mutex          s_fetchServiceMutex;
+    osg::ref_ptr<TaskService> s_fetchService;
+}
+
+void
+ElevationLayerVector::setFetchTaskService(TaskService* service)
+{
+    Threading::ScopedMutexLock lock(s_fetchServiceMutex);
+    s_fetchService = service;
+}
+
+TaskService*
+ElevationLayerVector::getFetchTaskService()
+{
+    Threading::ScopedMutexLock lock(s_fetchServiceMutex);
+    if (!s_fetchService.valid())
+    {
+        int numThreads = 4;
+        const char* env = ::getenv("OSGEARTH_ELEVATION_FETCH_THREADS");
+        if (env)
+            numThreads = osg::maximum(as<int>(env, numThreads), 1);
+
+        s_fetchService = new TaskService("ElevationLayerVector", numThreads);
+    }
+    return s_fetchService.get();
+}
+
 
 
 namespace
@@ -732,6 +764,141 @@ namespace
     //typedef std::pair<RefElevationLayer, TileKey> LayerAndKey;
     typedef std::vector<LayerData>              LayerDataVector;
 
+    /**
+     * Fetches one layer's heightfield for a tile, falling back on parent keys
+     * if requested. Runs on the fetch TaskService, but whichever thread gets
+     * to it first runs it: the tile's own thread runs any fetch that hasn't
+     * started by the time it needs the result, so a tile never waits on a
+     * queued task (and nested fetches can't deadlock the pool).
+     */
+    struct FetchHeightField : public TaskRequest
+    {
+        FetchHeightField(ElevationLayer* layer, const TileKey& key, bool fallback, float priority, ProgressCallback* progress) :
+            TaskRequest(priority),
+            _layer(layer), _key(key), _actualKey(key), _fallback(fallback), _progress(progress),
+            _claimed(false), _latency_s(0.0) { }
+
+        void operator()(ProgressCallback*)
+        {
+            if (claim())
+                fetch();
+        }
+
+        //! Blocks until the result is available, running the fetch here if no one has started it.
+        void wait()
+        {
+            if (claim())
+                fetch();
+            else
+                _done.wait();
+        }
+
+        //! Makes sure the fetch never starts, or waits for it to finish if it already has.
+        void abandon()
+        {
+            if (claim())
+                _done.set();
+            else
+                _done.wait();
+        }
+
+        bool claim()
+        {
+            Threading::ScopedMutexLock lock(_claimMutex);
+            if (_claimed)
+                return false;
+            _claimed = true;
+            return true;
+        }
+
+        void fetch()
+        {
+            if (!_progress || !_progress->isCanceled())
+            {
+                METRIC_SCOPED_EX("ElevationLayer fetch", 1, "layer", _layer->getName().c_str());
+                osg::Timer_t start = osg::Timer::instance()->tick();
+
+                if (!_fallback)
+                {
+                    _result = _layer->createHeightField(_actualKey, _progress);
+                }
+
+                // fall back on parent keys to make sure that we have data at the location even if it's fallback.
+                else while (!_result.valid() && _actualKey.valid() && _layer->isKeyInLegalRange(_actualKey))
+                {
+                    if (_progress && _progress->isCanceled())
+                        break;
+
+                    _result = _layer->createHeightField(_actualKey, _progress);
+                    if (!_result.valid())
+                        _actualKey = _actualKey.createParentKey();
+                }
+
+                _latency_s = osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+            }
+            _done.set();
+        }
+
+        osg::ref_ptr<ElevationLayer>   _layer;
+        TileKey                        _key;
+        TileKey                        _actualKey;
+        bool                           _fallback;
+        ProgressCallback*              _progress; // caller's; it waits for every fetch
+        Threading::Mutex               _claimMutex;
+        bool                           _claimed;
+        Threading::Event               _done;
+        GeoHeightField                 _result;
+        double                         _latency_s;
+    };
+
+    /**
+     * The fetches started for one tile, indexed like the contenders followed by
+     * the offsets. Each one is taken at most once. On destruction, fetches no
+     * one took are dropped if they haven't started and waited for if they have,
+     * since they hold the caller's ProgressCallback.
+     */
+    struct FetchHeightFields : public std::vector< osg::ref_ptr<FetchHeightField> >
+    {
+        FetchHeightFields(unsigned size) : std::vector< osg::ref_ptr<FetchHeightField> >(size) { }
+
+        ~FetchHeightFields()
+        {
+            for (iterator i = begin(); i != end(); ++i)
+            {
+                if (i->valid())
+                    (*i)->abandon();
+            }
+        }
+
+        //! Waits for fetch "i" if there is one and returns its result and actual key.
+        bool take(unsigned i, GeoHeightField& out_hf, TileKey& out_key)
+        {
+            osg::ref_ptr<FetchHeightField> fetch = (*this)[i].get();
+            if (!fetch.valid())
+                return false;
+
+            (*this)[i] = 0L;
+            fetch->wait();
+            Metrics::counter("ElevationLayer fetch latency (ms)", fetch->_layer->getName(), 1000.0*fetch->_latency_s);
+
+            out_hf = fetch->_result;
+            out_key = fetch->_actualKey;
+            return true;
+        }
+    };
+
+    //! Whether one of the layer's data extents covers the whole extent.
+    bool coversExtent(const ElevationLayer* layer, const GeoExtent& extent)
+    {
+        const DataExtentList& dataExtents = layer->getDataExtents();
+        for (DataExtentList::const_iterator i = dataExtents.begin(); i != dataExtents.end(); ++i)
+        {
+            if (i->contains(extent))
+                return true;
+        }
+        return false;
+    }
+
     //! Gets the normal vector for elevation data at column s, row t.
     osg::Vec3 getNormal(const GeoExtent& extent, const osg::HeightField* hf, int s, int t)
     {
@@ -980,6 +1147,7 @@ ElevationLayerVector::populateHeightFieldAndNormalMap(osg::HeightField*      hf,
     GeoHeightFieldVector offsetFields(offsets.size());
     std::vector<bool>    heightFallback(contenders.size(), false);
     std::vector<bool>    heightFailed(contenders.size(), false);
+    std::vector<unsigned> heightLOD(contenders.size(), 0u); // LOD of the data actually loaded
     std::vector<bool>    offsetFailed(offsets.size(), false);
 
     // The maximum number of heightfields to keep in this local cache
@@ -995,8 +1163,6 @@ ElevationLayerVector::populateHeightFieldAndNormalMap(osg::HeightField*      hf,
     // query resolution interval (x, y) of each sample.
     osg::ref_ptr<osg::ShortArray> deltaLOD = new osg::ShortArray(total);
     
-    int nodataCount = 0;
-
     TileKey scratchKey; // Storage if a new key needs to be constructed
 
     bool requiresResample = true;
@@ -1011,6 +1177,11 @@ ElevationLayerVector::populateHeightFieldAndNormalMap(osg::HeightField*      hf,
         GeoHeightField layerHF = layer->createHeightField(contenderKey, progress);
         if (layerHF.valid())
         {
+            // keep it for the resampling loop in case the sizes differ
+            heightFields[0] = layerHF;
+            heightLOD[0] = contenderKey.getLOD();
+            numHeightFieldsInCache++;
+
             if (layerHF.getHeightField()->getNumColumns() == hf->getNumColumns() &&
                 layerHF.getHeightField()->getNumRows() == hf->getNumRows())
             {
@@ -1025,12 +1196,64 @@ ElevationLayerVector::populateHeightFieldAndNormalMap(osg::HeightField*      hf,
         }
     }
 
+    // With more than one layer to composite, fetch heightfields in parallel so the tile
+    // waits for the slowest fetch instead of the sum of them all. Only the contenders down
+    // to the first one whose data covers the whole tile are fetched ahead, in priority
+    // order; the ones below it are loaded in the resampling loop only if holes remain.
+    // The fetches are taken lazily, when the loop first needs each heightfield.
+    FetchHeightFields fetches(contenders.size() + offsets.size());
+    if (requiresResample && contenders.size() + offsets.size() > 1)
+    {
+        TaskService* service = getFetchTaskService();
+
+        // don't fetch ahead more than the local cache may hold. The queue runs
+        // lower priority values first, so the fetches start in priority order.
+        unsigned budget = maxHeightFields;
+
+        for (unsigned i = 0; i < contenders.size() && budget > 0; ++i)
+        {
+            fetches[i] = new FetchHeightField(contenders[i].layer.get(), contenders[i].key, true, (float)i, progress);
+            --budget;
+            if (coversExtent(contenders[i].layer.get(), keyToUse.getExtent()))
+                break;
+        }
+
+        for (unsigned i = 0; i < offsets.size() && budget > 0; ++i, --budget)
+        {
+            fetches[contenders.size()+i] = new FetchHeightField(offsets[i].layer.get(), offsets[i].key, false, (float)(contenders.size()+i), progress);
+        }
+
+        // skip the first one; this thread will run it when the loop asks for it.
+        bool first = true;
+        for (unsigned i = 0; i < fetches.size(); ++i)
+        {
+            if (fetches[i].valid())
+            {
+                if (!first)
+                    service->add(fetches[i].get());
+                first = false;
+            }
+        }
+    }
+
     // If we need to mosaic multiple layers or resample it to a new output tilesize go through a resampling loop.
+    // Work one row at a time, in memory order: each contender samples all the row's
+    // remaining holes in one batch (one SRS transform per row instead of per point),
+    // and lower-priority contenders only see the columns still unresolved.
     if (requiresResample)
     {
+        std::vector<double> xs(numColumns);
         for (unsigned c = 0; c < numColumns; ++c)
+            xs[c] = xmin + (dx * (double)c);
+
+        std::vector<int>        resolvedIndex(numColumns);
+        std::vector<unsigned>   holes, remaining, targets;
+        std::vector<osg::Vec3d> points;
+        std::vector<float>      elevations;
+
+        for (unsigned r = 0; r < numRows; ++r)
         {
-            double x = xmin + (dx * (double)c);
+            double y = ymin + (dy * (double)r);
 
             // periodically check for cancelation
             if (progress && progress->isCanceled())
@@ -1038,151 +1261,195 @@ ElevationLayerVector::populateHeightFieldAndNormalMap(osg::HeightField*      hf,
                 return false;
             }
 
-            for (unsigned r = 0; r < numRows; ++r)
+            // every column starts out as a hole.
+            holes.resize(numColumns);
+            for (unsigned c = 0; c < numColumns; ++c)
             {
-                double y = ymin + (dy * (double)r);
-
-                // Collect elevations from each layer as necessary.
-                int resolvedIndex = -1;
+                holes[c] = c;
+                resolvedIndex[c] = -1;
+            }
 
-                osg::Vec3 normal_sum(0, 0, 0);
+            for (int i = 0; i < contenders.size() && !holes.empty(); ++i)
+            {
+                ElevationLayer* layer = contenders[i].layer.get();
+                TileKey& contenderKey = contenders[i].key;
+                int index = contenders[i].index;
 
-                for (int i = 0; i < contenders.size() && resolvedIndex < 0; ++i)
-                {
-                    ElevationLayer* layer = contenders[i].layer.get();
-                    TileKey& contenderKey = contenders[i].key;
-                    int index = contenders[i].index;
+                if (heightFailed[i])
+                    continue;
 
-                    if (heightFailed[i])
-                        continue;
+                TileKey* actualKey = &contenderKey;
 
-                    TileKey* actualKey = &contenderKey;
+                GeoHeightField& layerHF = heightFields[i];
 
-                    GeoHeightField& layerHF = heightFields[i];
+                // Take the heightfield fetched ahead for this layer, if there is one.
+                if (!layerHF.valid() && fetches.take(i, layerHF, scratchKey))
+                {
+                    if (layerHF.valid())
+                    {
+                        heightFallback[i] = (scratchKey != contenderKey);
+                        heightLOD[i] = scratchKey.getLOD();
+                        numHeightFieldsInCache++;
+                    }
+                    else
+                    {
+                        heightFailed[i] = true;
+                        continue;
+                    }
+                }
 
-                    if (!layerHF.valid())
+                if (!layerHF.valid())
+                {
+                    // We couldn't get the heightfield from the cache, so try to create it.
+                    // We also fallback on parent layers to make sure that we have data at the location even if it's fallback.
+                    while (!layerHF.valid() && actualKey->valid() && layer->isKeyInLegalRange(*actualKey))
                     {
-                        // We couldn't get the heightfield from the cache, so try to create it.
-                        // We also fallback on parent layers to make sure that we have data at the location even if it's fallback.
-                        while (!layerHF.valid() && actualKey->valid() && layer->isKeyInLegalRange(*actualKey))
+                        layerHF = layer->createHeightField(*actualKey, progress);
+                        if (!layerHF.valid())
                         {
-                            layerHF = layer->createHeightField(*actualKey, progress);
-                            if (!layerHF.valid())
+                            if (actualKey != &scratchKey)
                             {
-                                if (actualKey != &scratchKey)
-                                {
-                                    scratchKey = *actualKey;
-                                    actualKey = &scratchKey;
-                                }
-                                *actualKey = actualKey->createParentKey();
+                                scratchKey = *actualKey;
+                                actualKey = &scratchKey;
                             }
+                            *actualKey = actualKey->createParentKey();
                         }
+                    }
 
-                        // Mark this layer as fallback if necessary.
-                        if (layerHF.valid())
-                        {
-                            heightFallback[i] = (*actualKey != contenderKey); // actualKey != contenders[i].second;
-                            numHeightFieldsInCache++;
-                        }
-                        else
-                        {
-                            heightFailed[i] = true;
+                    // Mark this layer as fallback if necessary.
+                    if (layerHF.valid())
+                    {
+                        heightFallback[i] = (*actualKey != contenderKey); // actualKey != contenders[i].second;
+                        heightLOD[i] = actualKey->getLOD();
+                        numHeightFieldsInCache++;
+                    }
+                    else
+                    {
+                        heightFailed[i] = true;
 #ifdef ANALYZE
-                            layerAnalysis[layer].failed = true;
-                            layerAnalysis[layer].actualKeyValid = actualKey->valid();
-                            if (progress) layerAnalysis[layer].message = progress->message();
+                        layerAnalysis[layer].failed = true;
+                        layerAnalysis[layer].actualKeyValid = actualKey->valid();
+                        if (progress) layerAnalysis[layer].message = progress->message();
 #endif
-                            continue;
-                        }
+                        continue;
                     }
+                }
 
-                    if (layerHF.valid())
-                    {
-                        bool isFallback = heightFallback[i];
+                if (layerHF.valid())
+                {
+                    bool isFallback = heightFallback[i];
 #ifdef ANALYZE
-                        layerAnalysis[layer].fallback = isFallback;
+                    layerAnalysis[layer].fallback = isFallback;
 #endif
 
-                        // We only have real data if this is not a fallback heightfield.
-                        if (!isFallback)
-                        {
-                            realData = true;
-                        }
+                    // We only have real data if this is not a fallback heightfield.
+                    if (!isFallback)
+                    {
+                        realData = true;
+                    }
 
-                        float elevation;
-                        if (layerHF.getElevation(keySRS, x, y, interpolation, keySRS, elevation))
+                    // sample all the remaining holes in this row at once:
+                    points.resize(holes.size());
+                    for (unsigned k = 0; k < holes.size(); ++k)
+                        points[k].set(xs[holes[k]], y, 0.0);
+
+                    layerHF.getElevations(keySRS, points, interpolation, keySRS, elevations);
+
+                    remaining.clear();
+                    for (unsigned k = 0; k < holes.size(); ++k)
+                    {
+                        unsigned c = holes[k];
+                        if (elevations[k] != NO_DATA_VALUE)
                         {
-                            if (elevation != NO_DATA_VALUE)
-                            {
-                                // remember the index so we can only apply offset layers that
-                                // sit on TOP of this layer.
-                                resolvedIndex = index;
+                            // remember the index so we can only apply offset layers that
+                            // sit on TOP of this layer.
+                            resolvedIndex[c] = index;
 
-                                hf->setHeight(c, r, elevation);
+                            hf->setHeight(c, r, elevations[k]);
 
 #ifdef ANALYZE
-                                layerAnalysis[layer].samples++;
+                            layerAnalysis[layer].samples++;
 #endif
 
-                                if (deltaLOD)
-                                {
-                                    (*deltaLOD)[r*numColumns + c] = key.getLOD() - actualKey->getLOD();
-                                }
-                            }
-                            else
+                            if (deltaLOD)
                             {
-                                ++nodataCount;
+                                (*deltaLOD)[r*numColumns + c] = key.getLOD() - heightLOD[i];
                             }
                         }
+                        else
+                        {
+                            remaining.push_back(c);
+                        }
                     }
+                    holes.swap(remaining);
+                }
 
-
-                    // Clear the heightfield cache if we have too many heightfields in the cache.
-                    if (numHeightFieldsInCache >= maxHeightFields)
+                // Clear the heightfield cache if we have too many heightfields in the cache.
+                if (numHeightFieldsInCache >= maxHeightFields)
+                {
+                    //OE_NOTICE << "Clearing cache" << std::endl;
+                    for (unsigned int k = 0; k < heightFields.size(); k++)
                     {
-                        //OE_NOTICE << "Clearing cache" << std::endl;
-                        for (unsigned int k = 0; k < heightFields.size(); k++)
-                        {
-                            heightFields[k] = GeoHeightField::INVALID;
-                            heightFallback[k] = false;
-                        }
-                        numHeightFieldsInCache = 0;
+                        heightFields[k] = GeoHeightField::INVALID;
+                        heightFallback[k] = false;
                     }
+                    numHeightFieldsInCache = 0;
                 }
+            }
 
-                for (int i = offsets.size() - 1; i >= 0; --i)
+            for (int i = offsets.size() - 1; i >= 0; --i)
+            {
+                TileKey &contenderKey = offsets[i].key;
+
+                if (offsetFailed[i] == true)
+                    continue;
+
+                // Only apply an offset layer where it sits on top of the resolved layer
+                // (or where there was no resolved layer).
+                targets.clear();
+                for (unsigned c = 0; c < numColumns; ++c)
                 {
-                    // Only apply an offset layer if it sits on top of the resolved layer
-                    // (or if there was no resolved layer).
-                    if (resolvedIndex >= 0 && offsets[i].index < resolvedIndex)
-                        continue;
+                    if (resolvedIndex[c] < 0 || offsets[i].index >= resolvedIndex[c])
+                        targets.push_back(c);
+                }
 
-                    TileKey &contenderKey = offsets[i].key;
+                if (targets.empty())
+                    continue;
 
-                    if (offsetFailed[i] == true)
-                        continue;
+                GeoHeightField& layerHF = offsetFields[i];
+                if (!layerHF.valid() && fetches.take(contenders.size()+i, layerHF, scratchKey) && !layerHF.valid())
+                {
+                    offsetFailed[i] = true;
+                    continue;
+                }
 
-                    GeoHeightField& layerHF = offsetFields[i];
+                if (!layerHF.valid())
+                {
+                    ElevationLayer* offset = offsets[i].layer.get();
+
+                    layerHF = offset->createHeightField(contenderKey, progress);
                     if (!layerHF.valid())
                     {
-                        ElevationLayer* offset = offsets[i].layer.get();
-
-                        layerHF = offset->createHeightField(contenderKey, progress);
-                        if (!layerHF.valid())
-                        {
-                            offsetFailed[i] = true;
-                            continue;
-                        }
+                        offsetFailed[i] = true;
+                        continue;
                     }
+                }
 
-                    // If we actually got a layer then we have real data
-                    realData = true;
+                // If we actually got a layer then we have real data
+                realData = true;
+
+                points.resize(targets.size());
+                for (unsigned k = 0; k < targets.size(); ++k)
+                    points[k].set(xs[targets[k]], y, 0.0);
 
-                    float elevation = 0.0f;
-                    if (layerHF.getElevation(keySRS, x, y, interpolation, keySRS, elevation) &&
-                        elevation != NO_DATA_VALUE)
+                layerHF.getElevations(keySRS, points, interpolation, keySRS, elevations);
+
+                for (unsigned k = 0; k < targets.size(); ++k)
+                {
+                    if (elevations[k] != NO_DATA_VALUE)
                     {
-                        hf->getHeight(c, r) += elevation;
+                        unsigned c = targets[k];
+                        hf->getHeight(c, r) += elevations[k];
 
                         // Update the resolution tracker to account for the offset. Sadly this
                         // will wipe out the resolution of the actual data, and might result in 
@@ -19,6 +19,7 @@
 #include <osgEarth/ElevationPool>
 #include <osgEarth/Map>
 #include <osgEarth/Metrics>
+#include <osgEarth/HeightFieldUtils>
 
 using namespace osgEarth;
 
@@ -28,23 +29,14 @@ using namespace osgEarth;
 
 
 ElevationPool::ElevationPool() :
-_entries(0u),
 _maxEntries( 128u ),
-_tileSize( 257u )
+_tileSize( 257u ),
+_nextPendingId( 0u ),
+_ownTaskService( false ),
+_numThreads( 2u )
 {
-    //nop
-    //_opQueue = Registry::instance()->getAsyncOperationQueue();
-    if (!_opQueue.valid())
-    {
-        _opQueue = new osg::OperationQueue();
-        for (unsigned i=0; i<2; ++i)
-        {
-            osg::OperationThread* thread = new osg::OperationThread();
-            thread->setOperationQueue(_opQueue.get());
-            thread->start();
-            _opThreads.push_back(thread);
-        }
-    }
+    setMaxEntries(_maxEntries);
+    setTaskService(0L);
 }
 
 ElevationPool::~ElevationPool()
@@ -70,10 +62,51 @@ ElevationPool::clear()
 void
 ElevationPool::stopThreading()
 {
-    _opQueue->releaseAllOperations();
-    
-    for (unsigned i = 0; i<_opThreads.size(); ++i)
-    _opThreads[i]->setDone(true);
+    // never stop a shared service; its owner is responsible for that.
+    if (_ownTaskService && _taskService.valid())
+        _taskService->cancelAll();
+}
+
+void
+ElevationPool::setMaxEntries(unsigned maxEntries)
+{
+    _maxEntries = maxEntries;
+
+    // spread the budget so the shards add up to exactly maxEntries.
+    for (unsigned i = 0; i < NUM_SHARDS; ++i)
+    {
+        Threading::ScopedMutexLock lock(_shards[i]._mutex);
+        _shards[i]._maxEntries = maxEntries / NUM_SHARDS + (i < maxEntries % NUM_SHARDS ? 1u : 0u);
+    }
+}
+
+void
+ElevationPool::setNumThreads(unsigned value)
+{
+    _numThreads = osg::maximum(value, 1u);
+    if (_ownTaskService)
+        _taskService->setNumThreads(_numThreads);
+}
+
+unsigned
+ElevationPool::getNumThreads() const
+{
+    return _taskService.valid() ? _taskService->getNumThreads() : _numThreads;
+}
+
+void
+ElevationPool::setTaskService(TaskService* service)
+{
+    if (service)
+    {
+        _taskService = service;
+        _ownTaskService = false;
+    }
+    else if (!_ownTaskService || !_taskService.valid())
+    {
+        _taskService = new TaskService("ElevationPool", _numThreads);
+        _ownTaskService = true;
+    }
 }
 
 void
@@ -93,29 +126,173 @@ ElevationPool::setTileSize(unsigned value)
 }
 
 Future<ElevationSample>
-ElevationPool::getElevation(const GeoPoint& point, unsigned lod)
+ElevationPool::getElevation(const GeoPoint& point, unsigned lod, float priority)
+{
+    PendingKey key;
+    key._srs = point.getSRS();
+    key._x = point.x();
+    key._y = point.y();
+    key._lod = lod;
+
+    Promise<ElevationSample> promise;
+    Future<ElevationSample> result = promise.getFuture();
+
+    Threading::ScopedMutexLock lock(_pendingMutex);
+
+    PendingQueries::iterator i = _pending.find(key);
+    if (i != _pending.end())
+    {
+        // an identical query is already waiting; it answers this one too.
+        PendingQuery& query = i->second;
+        query._promises.push_back(promise);
+
+        // a more urgent duplicate queues another op at its own priority;
+        // whichever op runs first answers everyone.
+        if (priority <= query._priority)
+            return result;
+
+        query._priority = priority;
+        ++query._numOps;
+        _taskService->add(new GetElevationOp(this, point, lod, priority, key, query._id));
+        return result;
+    }
+
+    PendingQuery& query = _pending[key];
+    query._id = _nextPendingId++;
+    query._priority = priority;
+    query._numOps = 1u;
+    query._promises.push_back(promise);
+    _taskService->add(new GetElevationOp(this, point, lod, priority, key, query._id));
+    return result;
+}
+
+bool
+ElevationPool::takePending(const PendingKey& key, unsigned id, bool ran, ElevationPromises& out)
+{
+    Threading::ScopedMutexLock lock(_pendingMutex);
+
+    PendingQueries::iterator i = _pending.find(key);
+    if (i == _pending.end() || i->second._id != id)
+        return false;
+
+    --i->second._numOps;
+    if (!ran && i->second._numOps > 0u)
+        return false;
+
+    out.swap(i->second._promises);
+    _pending.erase(i);
+    return true;
+}
+
+Future<ElevationSamples>
+ElevationPool::getElevations(const std::vector<GeoPoint>& points, unsigned lod, float priority)
 {
-    GetElevationOp* op = new GetElevationOp(this, point, lod);
-    Future<ElevationSample> result = op->_promise.getFuture();
-    _opQueue->add(op);
+    GetElevationsOp* op = new GetElevationsOp(this, points, lod, priority);
+    Future<ElevationSamples> result = op->_promise.getFuture();
+    _taskService->add(op);
     return result;
 }
 
-ElevationPool::GetElevationOp::GetElevationOp(ElevationPool* pool, const GeoPoint& point, unsigned lod) :
-_pool(pool), _point(point), _lod(lod)
+// Note: TaskService runs lower priority values first, hence the negation.
+ElevationPool::GetElevationOp::GetElevationOp(ElevationPool* pool, const GeoPoint& point, unsigned lod, float priority,
+                                              const PendingKey& key, unsigned id) :
+TaskRequest(-priority), _pool(pool), _point(point), _lod(lod), _key(key), _pendingId(id), _ran(false)
 {
     //nop
 }
 
+ElevationPool::GetElevationOp::~GetElevationOp()
+{
+    // Canceled, or dropped by a TaskService shutting down. If no other op is
+    // left for the query, fail it so nobody waits on it forever.
+    if (_ran)
+        return;
+
+    osg::ref_ptr<ElevationPool> pool;
+    ElevationPromises promises;
+    if (_pool.lock(pool) && pool->takePending(_key, _pendingId, false, promises))
+    {
+        for (ElevationPromises::iterator p = promises.begin(); p != promises.end(); ++p)
+            p->resolve(0L);
+    }
+}
+
 void
-ElevationPool::GetElevationOp::operator()(osg::Object*)
+ElevationPool::GetElevationOp::operator()(ProgressCallback*)
 {
+    _ran = true;
+
+    // Take every promise for this query; new queries for the point start a
+    // fresh one. Nothing to do if another op already answered it.
     osg::ref_ptr<ElevationPool> pool;
-    if (!_promise.isAbandoned() && _pool.lock(pool))
+    ElevationPromises promises;
+    if (!_pool.lock(pool) || !pool->takePending(_key, _pendingId, true, promises))
+        return;
+
+    bool wanted = false;
+    for (ElevationPromises::const_iterator p = promises.begin(); p != promises.end() && !wanted; ++p)
+        wanted = !p->isAbandoned();
+
+    osg::ref_ptr<ElevationSample> sample;
+    if (wanted)
     {
         osg::ref_ptr<ElevationEnvelope> env = pool->createEnvelope(_point.getSRS(), _lod);
-        std::pair<float, float> r = env->getElevationAndResolution(_point.x(), _point.y());
-        _promise.resolve(new ElevationSample(r.first, r.second));
+        if (env.valid())
+        {
+            std::pair<float, float> r = env->getElevationAndResolution(_point.x(), _point.y());
+            sample = new ElevationSample(r.first, r.second);
+        }
+    }
+
+    // resolve them all, with NULL on failure, so no one waits for nothing.
+    for (ElevationPromises::iterator p = promises.begin(); p != promises.end(); ++p)
+        p->resolve(sample.get());
+}
+
+ElevationPool::GetElevationsOp::GetElevationsOp(ElevationPool* pool, const std::vector<GeoPoint>& points, unsigned lod, float priority) :
+TaskRequest(-priority), _pool(pool), _points(points), _lod(lod)
+{
+    //nop
+}
+
+void
+ElevationPool::GetElevationsOp::operator()(ProgressCallback*)
+{
+    osg::ref_ptr<ElevationPool> pool;
+    if (!_promise.isAbandoned() && _pool.lock(pool))
+    {
+        osg::ref_ptr<ElevationSamples> result = new ElevationSamples();
+        result->elevations.assign(_points.size(), NO_DATA_VALUE);
+
+        // group the points by SRS so each group is one batched envelope query:
+        typedef std::map<const SpatialReference*, std::vector<unsigned> > Groups;
+        Groups groups;
+        for (unsigned i = 0; i < _points.size(); ++i)
+        {
+            if (_points[i].isValid())
+                groups[_points[i].getSRS()].push_back(i);
+        }
+
+        std::vector<osg::Vec3d> input;
+        std::vector<float> output;
+        for (Groups::const_iterator g = groups.begin(); g != groups.end(); ++g)
+        {
+            osg::ref_ptr<ElevationEnvelope> env = pool->createEnvelope(g->first, _lod);
+            if (!env.valid())
+                continue;
+
+            const std::vector<unsigned>& indices = g->second;
+            input.resize(indices.size());
+            for (unsigned i = 0; i < indices.size(); ++i)
+                input[i] = _points[indices[i]].vec3d();
+
+            env->getElevations(input, output);
+
+            for (unsigned i = 0; i < indices.size(); ++i)
+                result->elevations[indices[i]] = output[i];
+        }
+
+        _promise.resolve(result.get());
     }
 }
 
@@ -160,155 +337,163 @@ ElevationPool::fetchTileFromMap(const TileKey& key, const ElevationLayerVector&
 }
 
 void
-ElevationPool::popMRU()
+ElevationPool::Shard::link(Tile* tile)
 {
-    // first rememeber the key of the item we're about the pop:
-    TileKey key = _mru.back()->_key;
+    tile->_lruPrev = 0L;
+    tile->_lruNext = _head;
+    if (_head)
+        _head->_lruPrev = tile;
+    _head = tile;
+    if (!_tail)
+        _tail = tile;
+    ++_entries;
+}
 
-    // establish a temporary observer on the item:
-    osg::observer_ptr<Tile> temp = _mru.back().get();
+void
+ElevationPool::Shard::unlink(Tile* tile)
+{
+    if (tile->_lruPrev)
+        tile->_lruPrev->_lruNext = tile->_lruNext;
+    else
+        _head = tile->_lruNext;
 
-    // pop the Tile from the MRU:
-    _mru.pop_back();
+    if (tile->_lruNext)
+        tile->_lruNext->_lruPrev = tile->_lruPrev;
+    else
+        _tail = tile->_lruPrev;
 
-    // if our observer went to NULL, we know there are no more pointers
-    // to that Tile in the MRU, and we can remove it from the main list:
-    if (!temp.valid())
+    tile->_lruPrev = tile->_lruNext = 0L;
+    --_entries;
+}
+
+void
+ElevationPool::Shard::clear()
+{
+    for (Tile* t = _head; t; )
     {
-        _tiles.erase(key);
+        Tile* next = t->_lruNext;
+        t->_lruPrev = t->_lruNext = 0L;
+        t = next;
     }
+    _head = _tail = 0L;
+    _entries = 0u;
+    _tiles.clear();
 }
 
-bool
-ElevationPool::tryTile(const TileKey& key, const ElevationLayerVector& layers, osg::ref_ptr<Tile>& out)
+ElevationPool::Shard&
+ElevationPool::getShard(const TileKey& key)
 {
-    // first see whether the tile is available
-    _tilesMutex.lock();
+    unsigned h =
+        (key.getTileX() * 73856093u) ^
+        (key.getTileY() * 19349663u) ^
+        (key.getLOD()   * 83492791u);
+    return _shards[h % NUM_SHARDS];
+}
 
-    // locate the tile in the local tile cache:
-    osg::observer_ptr<Tile>& tile_obs = _tiles[key];
+void
+ElevationPool::clearImpl()
+{
+    for (unsigned i = 0; i < NUM_SHARDS; ++i)
+    {
+        Threading::ScopedMutexLock lock(_shards[i]._mutex);
+        _shards[i].clear();
+    }
+}
 
-    osg::ref_ptr<Tile> tile;
+CacheStats
+ElevationPool::getStats() const
+{
+    unsigned entries = 0u;
+    for (unsigned i = 0; i < NUM_SHARDS; ++i)
+        entries += _shards[i]._entries;
 
-    // Get a safe pointer to it. If this is NULL, we need to create and
-    // fetch a new tile from the Map.
-    if (!tile_obs.lock(tile))
+    unsigned hits = _hits, misses = _misses;
+    unsigned queries = hits + misses;
+    return CacheStats(entries, _maxEntries, queries, queries > 0 ? (float)hits / (float)queries : 0.0f);
+}
+
+bool
+ElevationPool::getTile(const TileKey& key, const ElevationLayerVector& layers, osg::ref_ptr<ElevationPool::Tile>& output)
+{
+    Shard& shard = getShard(key);
+
+    osg::ref_ptr<Tile> tile;
+    bool fetch = false;
     {
-        // a new tile; status -> EMPTY
-        tile = new Tile();
-        tile->_key = key;
+        Threading::ScopedMutexLock lock(shard._mutex);
 
-        // update the LRU:
-        _mru.push_front(tile.get());
+        Shard::Tiles::iterator i = shard._tiles.find(key);
+        if (i != shard._tiles.end())
+        {
+            OE_TEST << "  getTile(" << key.str() << ") -> hit\n";
+            tile = i->second.get();
 
-        // prune the MRU if necessary:
-        if (++_entries > _maxEntries )
+            // Mark this tile as recently used:
+            shard.unlink(tile.get());
+            shard.link(tile.get());
+            ++_hits;
+        }
+        else
         {
-            popMRU();
-            --_entries;
+            OE_TEST << "  getTile(" << key.str() << ") -> fetch from map\n";
+
+            // a new tile; this thread will fetch it, and anyone else asking
+            // for the same key in the meantime will wait on its _loaded event.
+            tile = new Tile();
+            tile->_key = key;
+            tile->_status.exchange(STATUS_IN_PROGRESS);
+            shard._tiles[key] = tile.get();
+            shard.link(tile.get());
+            fetch = true;
+            ++_misses;
+
+            // prune the LRU if necessary:
+            while (shard._entries > shard._maxEntries)
+            {
+                Tile* oldest = shard._tail;
+                TileKey oldestKey = oldest->_key;
+                shard.unlink(oldest);
+                shard._tiles.erase(oldestKey); // may destruct "oldest"
+                ++_evictions;
+            }
         }
-
-        // add to the main cache (after putting it on the LRU).
-        tile_obs = tile;
     }
-       
-    // This means the tile object exists but has yet to be populated:
-    if ( tile->_status == STATUS_EMPTY )
-    {
-        OE_TEST << "  getTile(" << key.str() << ") -> fetch from map\n";
-        tile->_status.exchange(STATUS_IN_PROGRESS);
-        _tilesMutex.unlock();
 
+    if (fetch)
+    {
         bool ok = fetchTileFromMap(key, layers, tile.get());
         tile->_status.exchange( ok ? STATUS_AVAILABLE : STATUS_FAIL );
-        
-        out = ok ? tile.get() : 0L;
-        return ok;
+        tile->_loaded.set();
     }
 
-    // This means the tile object is populated and available for use:
-    else if ( tile->_status == STATUS_AVAILABLE )
+    else if (tile->_status == STATUS_IN_PROGRESS)
     {
-        OE_TEST << "  getTile(" << key.str() << ") -> available\n";
-        out = tile.get();
-
-        // Mark this tile as recently used:
-        _mru.push_front(tile.get());
-
-        // prune the MRU if necessary
-        if (++_entries > _maxEntries)
+        // another thread is fetching the tile from the map; wait for it.
+        OE_DEBUG << "  getTile(" << key.str() << ") -> in progress...waiting\n";
+        const unsigned timeout_ms = 30000u;
+        if (!tile->_loaded.wait(timeout_ms) && tile->_status == STATUS_IN_PROGRESS)
         {
-            popMRU();
-            --_entries;
+            // this means we timed out trying to fetch the map tile.
+            OE_TEST << LC << "Timeout fetching tile " << key.str() << std::endl;
+            return false;
         }
-
-        _tilesMutex.unlock();
-        return true;
     }
 
-    // This means the attempt to populate the tile with data failed.
-    else if ( tile->_status == STATUS_FAIL )
+    if (tile->_status != STATUS_AVAILABLE)
     {
         OE_TEST << "  getTile(" << key.str() << ") -> fail\n";
-        _tilesMutex.unlock();
-        out = 0L;
         return false;
     }
 
-    // This means tile data fetch is still in progress (in another thread)
-    // and the caller should check back later.
-    else //if ( tile->_status == STATUS_IN_PROGRESS )
-    {
-        OE_DEBUG << "  getTile(" << key.str() << ") -> in progress...waiting\n";
-        _tilesMutex.unlock();
-        out = 0L;
-        return true;            // out:NULL => check back later please.
-    }
-}
-
-void
-ElevationPool::clearImpl()
-{
-    // assumes the tiles lock is taken.
-    _tiles.clear();
-    _mru.clear();
-    _entries = 0u;
-}
-
-bool
-ElevationPool::getTile(const TileKey& key, const ElevationLayerVector& layers, osg::ref_ptr<ElevationPool::Tile>& output)
-{   
-    OE_START_TIMER(get);
-
-    const double timeout = 30.0;
-    osg::ref_ptr<Tile> tile;
-    while( tryTile(key, layers, tile) && !tile.valid() && OE_GET_TIMER(get) < timeout)
-    {
-        // condition: another thread is working on fetching the tile from the map,
-        // so wait and try again later. Do this until we succeed or time out.
-        OpenThreads::Thread::YieldCurrentThread();
-    }
-
-    if ( !tile.valid() && OE_GET_TIMER(get) >= timeout )
-    {
-        // this means we timed out trying to fetch the map tile.
-        OE_TEST << LC << "Timeout fetching tile " << key.str() << std::endl;
-    }
-
-    if ( tile.valid() )
+    if ( !tile->_hf.valid() )
     {
-        if ( tile->_hf.valid() )
-        {
-            // got a valid tile, so push it to the query set.
-            output = tile.get();
-        }
-        else
-        {
-            OE_WARN << LC << "Got a tile with an invalid HF (" << key.str() << ")\n";
-        }
+        OE_WARN << LC << "Got a tile with an invalid HF (" << key.str() << ")\n";
+        return false;
     }
 
-    return tile.valid();
+    // got a valid tile, so push it to the query set.
+    output = tile.get();
+    return true;
 }
 
 ElevationEnvelope*
@@ -361,62 +546,173 @@ ElevationEnvelope::sample(double x, double y, float& out_elevation, float& out_r
 {
     out_elevation = NO_DATA_VALUE;
     out_resolution = 0.0f;
-    bool foundTile = false;
 
     GeoPoint p(_inputSRS.get(), x, y, 0.0f, ALTMODE_ABSOLUTE);
 
     if (p.transformInPlace(_mapProfile->getSRS()))
     {
-        // find the tile containing the point:
-        for(ElevationPool::QuerySet::const_iterator tile_ref = _tiles.begin();
-            tile_ref != _tiles.end();
-            ++tile_ref)
+        sampleMapCoords(p.x(), p.y(), out_elevation, out_resolution);
+    }
+    else
+    {
+        OE_WARN << LC << "sample: xform failed" << std::endl;
+    }
+
+    // push the result, even if it was not found and it's NO_DATA_VALUE
+    return out_elevation != NO_DATA_VALUE;
+}
+
+ElevationPool::Tile*
+ElevationEnvelope::findTile(double x, double y)
+{
+    // find the tile containing the point; the query set is sorted
+    // from high to low resolution, so the first hit is the best one.
+    for(ElevationPool::QuerySet::const_iterator tile_ref = _tiles.begin();
+        tile_ref != _tiles.end();
+        ++tile_ref)
+    {
+        ElevationPool::Tile* tile = tile_ref->get();
+        if (tile->_bounds.contains(x, y))
+            return tile;
+    }
+
+    // If we didn't find a tile containing the point, we need to ask the clamper
+    // for the tile so we can add it to the query set.
+    TileKey key = _mapProfile->createTileKey(x, y, _lod);
+    osg::ref_ptr<ElevationPool::Tile> tile;
+
+    osg::ref_ptr<ElevationPool> pool;
+
+    if (_pool.lock(pool) && pool->getTile(key, _layers, tile))
+    {
+        // Got the new tile; put it in the query set:
+        _tiles.insert(tile.get());
+        return tile.get();
+    }
+
+    return 0L;
+}
+
+void
+ElevationEnvelope::sampleMapCoords(double x, double y, float& out_elevation, float& out_resolution)
+{
+    out_elevation = NO_DATA_VALUE;
+    out_resolution = 0.0f;
+    bool foundTile = false;
+
+    // find the tile containing the point:
+    for(ElevationPool::QuerySet::const_iterator tile_ref = _tiles.begin();
+        tile_ref != _tiles.end();
+        ++tile_ref)
+    {
+        ElevationPool::Tile* tile = tile_ref->get();
+
+        if (tile->_bounds.contains(x, y))
         {
-            ElevationPool::Tile* tile = tile_ref->get();
+            foundTile = true;
 
-            if (tile->_bounds.contains(p.x(), p.y()))
+            // Found an intersecting tile; sample the elevation:
+            if (tile->_hf.getElevation(0L, x, y, INTERP_BILINEAR, 0L, out_elevation))
             {
-                foundTile = true;
-
-                // Found an intersecting tile; sample the elevation:
-                if (tile->_hf.getElevation(0L, p.x(), p.y(), INTERP_BILINEAR, 0L, out_elevation))
-                {
-                    out_resolution = tile->_hf.getXInterval();
-                    // got it; finished
-                    break;
-                }
+                out_resolution = tile->_hf.getXInterval();
+                // got it; finished
+                break;
             }
         }
+    }
 
-        // If we didn't find a tile containing the point, we need to ask the clamper
-        // for the tile so we can add it to the query set.
-        if (!foundTile)
+    // If we didn't find a tile containing the point, we need to ask the clamper
+    // for the tile so we can add it to the query set.
+    if (!foundTile)
+    {
+        ElevationPool::Tile* tile = findTile(x, y);
+        if (tile)
         {
-            TileKey key = _mapProfile->createTileKey(p.x(), p.y(), _lod);
-            osg::ref_ptr<ElevationPool::Tile> tile;
-
-            osg::ref_ptr<ElevationPool> pool;
-
-            if (_pool.lock(pool) && pool->getTile(key, _layers, tile))
+            // Then sample the elevation:
+            if (tile->_hf.getElevation(0L, x, y, INTERP_BILINEAR, 0L, out_elevation))
             {
-                // Got the new tile; put it in the query set:
-                _tiles.insert(tile.get());
-
-                // Then sample the elevation:
-                if (tile->_hf.getElevation(0L, p.x(), p.y(), INTERP_BILINEAR, 0L, out_elevation))
-                {
-                    out_resolution = 0.5*(tile->_hf.getXInterval() + tile->_hf.getYInterval());
-                }
+                out_resolution = 0.5*(tile->_hf.getXInterval() + tile->_hf.getYInterval());
             }
         }
     }
-    else
+}
+
+namespace
+{
+    /**
+     * Bilinearly samples a batch of points (already in the heightfield's SRS)
+     * from a single heightfield. Coordinates and results are contiguous arrays
+     * and each pass is a straight loop with no data-dependent branches, so the
+     * compiler can vectorize the index math and the interpolation. Cells that
+     * touch NO_DATA fall back to HeightFieldUtils so the results match
+     * GeoHeightField::getElevation exactly.
+     */
+    void sampleBilinear(const GeoHeightField& geohf,
+                        const double* xs, const double* ys, unsigned count,
+                        float* out)
     {
-        OE_WARN << LC << "sample: xform failed" << std::endl;
-    }
+        const osg::HeightField* hf = geohf.getHeightField();
+        const GeoExtent& ex = geohf.getExtent();
+        const int cols = hf->getNumColumns();
+        const int rows = hf->getNumRows();
+        const double xMin = ex.xMin(), yMin = ex.yMin();
+        const double xInterval = ex.width()  / (double)(cols-1);
+        const double yInterval = ex.height() / (double)(rows-1);
+
+        if (cols < 2 || rows < 2)
+        {
+            for (unsigned i = 0; i < count; ++i)
+                out[i] = HeightFieldUtils::getHeightAtLocation(hf, xs[i], ys[i], xMin, yMin, xInterval, yInterval, INTERP_BILINEAR);
+            return;
+        }
 
-    // push the result, even if it was not found and it's NO_DATA_VALUE
-    return out_elevation != NO_DATA_VALUE;
+        const float* heights = &hf->getFloatArray()->front();
+        const double maxCol = (double)(cols-1), maxRow = (double)(rows-1);
+
+        std::vector<double> fx(count), fy(count);
+        std::vector<int> base(count);
+        std::vector<float> ll(count), lr(count), ul(count), ur(count);
+
+        // pass 1: pixel coordinates, lower-left cell index and cell fractions.
+        for (unsigned i = 0; i < count; ++i)
+        {
+            double c = osg::clampBetween((xs[i] - xMin) / xInterval, 0.0, maxCol);
+            double r = osg::clampBetween((ys[i] - yMin) / yInterval, 0.0, maxRow);
+            int c0 = osg::minimum((int)c, cols-2);
+            int r0 = osg::minimum((int)r, rows-2);
+            fx[i] = c - (double)c0;
+            fy[i] = r - (double)r0;
+            base[i] = r0*cols + c0;
+        }
+
+        // pass 2: gather the four corner samples.
+        for (unsigned i = 0; i < count; ++i)
+        {
+            const float* cell = heights + base[i];
+            ll[i] = cell[0];
+            lr[i] = cell[1];
+            ul[i] = cell[cols];
+            ur[i] = cell[cols+1];
+        }
+
+        // pass 3: interpolate.
+        for (unsigned i = 0; i < count; ++i)
+        {
+            double r1 = (1.0-fx[i])*(double)ll[i] + fx[i]*(double)lr[i];
+            double r2 = (1.0-fx[i])*(double)ul[i] + fx[i]*(double)ur[i];
+            out[i] = (float)((1.0-fy[i])*r1 + fy[i]*r2);
+        }
+
+        // pass 4: cells with NO_DATA get the legacy treatment.
+        for (unsigned i = 0; i < count; ++i)
+        {
+            if (ll[i] == NO_DATA_VALUE || lr[i] == NO_DATA_VALUE ||
+                ul[i] == NO_DATA_VALUE || ur[i] == NO_DATA_VALUE)
+            {
+                out[i] = HeightFieldUtils::getHeightAtLocation(hf, xs[i], ys[i], xMin, yMin, xInterval, yInterval, INTERP_BILINEAR);
+            }
+        }
+    }
 }
 
 float
@@ -443,18 +739,64 @@ ElevationEnvelope::getElevations(const std::vector<osg::Vec3d>& input,
 {
     METRIC_SCOPED_EX("ElevationEnvelope::getElevations", 1, "num", toString(input.size()).c_str());
 
-    unsigned count = 0u;
+    output.assign(input.size(), NO_DATA_VALUE);
 
-    output.reserve(input.size());
-    output.clear();
+    if (input.empty())
+        return 0u;
 
-    // for each input point:
-    for (std::vector<osg::Vec3d>::const_iterator v = input.begin(); v != input.end(); ++v)
+    // transform all the points into the map SRS in a single call:
+    std::vector<osg::Vec3d> mapPoints(input);
+    if (!_inputSRS->transform(mapPoints, _mapProfile->getSRS()))
     {
-        float elevation, resolution;
-        sample(v->x(), v->y(), elevation, resolution);
-        output.push_back(elevation);
-        if (elevation != NO_DATA_VALUE)
+        // at least one point failed; revert to the per-point path, which
+        // reports each failure individually.
+        unsigned count = 0u;
+        for (unsigned i = 0; i < input.size(); ++i)
+        {
+            float resolution;
+            if (sample(input[i].x(), input[i].y(), output[i], resolution))
+                ++count;
+        }
+        return count;
+    }
+
+    // bucket the points by the pooled tile that will service them:
+    typedef std::map<ElevationPool::Tile*, std::vector<unsigned> > Buckets;
+    Buckets buckets;
+    for (unsigned i = 0; i < mapPoints.size(); ++i)
+    {
+        ElevationPool::Tile* tile = findTile(mapPoints[i].x(), mapPoints[i].y());
+        if (tile)
+            buckets[tile].push_back(i);
+    }
+
+    // sample each bucket as a contiguous batch:
+    std::vector<double> xs, ys;
+    std::vector<float> zs;
+    for (Buckets::iterator b = buckets.begin(); b != buckets.end(); ++b)
+    {
+        const std::vector<unsigned>& indices = b->second;
+        unsigned num = indices.size();
+
+        xs.resize(num);
+        ys.resize(num);
+        zs.resize(num);
+        for (unsigned i = 0; i < num; ++i)
+        {
+            xs[i] = mapPoints[indices[i]].x();
+            ys[i] = mapPoints[indices[i]].y();
+        }
+
+        sampleBilinear(b->first->_hf, &xs[0], &ys[0], num, &zs[0]);
+
+        for (unsigned i = 0; i < num; ++i)
+            output[indices[i]] = zs[i];
+    }
+
+    unsigned count = 0u;
+    for (unsigned i = 0; i < output.size(); ++i)
+    {
+        if (output[i] != NO_DATA_VALUE)
             ++count;
     }
 
@@ -470,15 +812,17 @@ ElevationEnvelope::getElevationExtrema(const std::vector<osg::Vec3d>& input,
 
     min = FLT_MAX, max = -FLT_MAX;
 
+    std::vector<float> elevations;
+    getElevations(input, elevations);
+
     osg::Vec3d centroid;
 
-    for (std::vector<osg::Vec3d>::const_iterator v = input.begin(); v != input.end(); ++v)
+    for (unsigned i = 0; i < input.size(); ++i)
     {
-        centroid += *v;
+        centroid += input[i];
 
-        float elevation, resolution;
-        
-        if (sample(v->x(), v->y(), elevation, resolution))
+        float elevation = elevations[i];
+        if (elevation != NO_DATA_VALUE)
         {
             if (elevation < min) min = elevation;
             if (elevation > max) max = elevation;
@@ -2521,6 +2521,88 @@ GeoHeightField::getElevation(const SpatialReference* inputSRS,
     }
 }
 
+unsigned
+GeoHeightField::getElevations(const SpatialReference*        inputSRS,
+                              const std::vector<osg::Vec3d>& points,
+                              ElevationInterpolation         interp,
+                              const SpatialReference*        outputSRS,
+                              std::vector<float>&            out_elevations) const
+{
+    out_elevations.assign(points.size(), NO_DATA_VALUE);
+
+    if (points.empty() || !valid())
+        return 0u;
+
+    const SpatialReference* extentSRS = _extent.getSRS();
+
+    // first xform all the points into our local SRS in one call:
+    std::vector<osg::Vec3d> local(points);
+    if (inputSRS && inputSRS != extentSRS)
+    {
+        if (!inputSRS->transform(local, extentSRS))
+        {
+            // at least one point failed; revert to the per-point path.
+            unsigned count = 0u;
+            for (unsigned i = 0; i < points.size(); ++i)
+            {
+                if (getElevation(inputSRS, points[i].x(), points[i].y(), interp, outputSRS, out_elevations[i]) &&
+                    out_elevations[i] != NO_DATA_VALUE)
+                {
+                    ++count;
+                }
+                else
+                {
+                    out_elevations[i] = NO_DATA_VALUE;
+                }
+            }
+            return count;
+        }
+    }
+
+    double xInterval = _extent.width()  / (double)(_heightField->getNumColumns()-1);
+    double yInterval = _extent.height() / (double)(_heightField->getNumRows()-1);
+
+    unsigned count = 0u;
+    for (unsigned i = 0; i < local.size(); ++i)
+    {
+        // (note: since it's sampling the HF, it will return an MSL height if applicable)
+        if (_extent.contains(local[i].x(), local[i].y()))
+        {
+            out_elevations[i] = HeightFieldUtils::getHeightAtLocation(
+                _heightField.get(),
+                local[i].x(), local[i].y(),
+                _extent.xMin(), _extent.yMin(),
+                xInterval, yInterval,
+                interp);
+
+            if (out_elevations[i] != NO_DATA_VALUE)
+                ++count;
+        }
+    }
+
+    // if the vertical datums don't match, do a conversion. This requires lat/long points:
+    if (count > 0u && outputSRS && !extentSRS->isVertEquivalentTo(outputSRS))
+    {
+        if (!extentSRS->isGeographic())
+        {
+            extentSRS->transform(local, extentSRS->getGeographicSRS());
+        }
+
+        for (unsigned i = 0; i < local.size(); ++i)
+        {
+            if (out_elevations[i] != NO_DATA_VALUE)
+            {
+                VerticalDatum::transform(
+                    extentSRS->getVerticalDatum(),
+                    outputSRS->getVerticalDatum(),
+                    local[i].y(), local[i].x(), out_elevations[i]);
+            }
+        }
+    }
+
+    return count;
+}
+
 bool
 GeoHeightField::getElevationAndNormal(const SpatialReference* inputSRS,
                                       double                  x,
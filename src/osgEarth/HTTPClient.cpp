@@ -21,6 +21,7 @@
 #include <osgEarth/Metrics>
 #include <osgDB/ReadFile>
 #include <osgDB/FileNameUtils>
+#include <list>
 #include <curl/curl.h>
 
 // Whether to use WinInet instead of cURL - CMAKE option
@@ -388,6 +389,8 @@ namespace
     static osg::ref_ptr< URLRewriter > s_rewriter;
 
     static osg::ref_ptr< CurlConfigHandler > s_curlConfigHandler;
+
+    static optional<unsigned>          s_maxConnectionsPerHost;
 }
 
 HTTPClient&
@@ -559,6 +562,24 @@ void HTTPClient::setCurlConfighandler(CurlConfigHandler* handler)
     s_curlConfigHandler = handler;
 }
 
+void HTTPClient::setMaxConnectionsPerHost(unsigned value)
+{
+    s_maxConnectionsPerHost = osg::maximum(value, 1u);
+}
+
+unsigned HTTPClient::getMaxConnectionsPerHost()
+{
+    if (!s_maxConnectionsPerHost.isSet())
+    {
+        unsigned value = 6u;
+        const char* env = ::getenv("OSGEARTH_HTTP_MAX_CONNECTIONS_PER_HOST");
+        if (env)
+            value = osgEarth::as<unsigned>(std::string(env), value);
+        s_maxConnectionsPerHost = osg::maximum(value, 1u);
+    }
+    return s_maxConnectionsPerHost.get();
+}
+
 void
 HTTPClient::globalInit()
 {
@@ -733,6 +754,615 @@ HTTPClient::download(const std::string& uri,
 }
 
 
+/****************************************************************************/
+
+#ifdef OSGEARTH_USE_WININET_FOR_HTTP
+
+// WinInet has no shared multi-transfer engine; resolve synchronously.
+Threading::Future<AsyncHTTPResponse>
+HTTPClient::getAsync(const HTTPRequest&    request,
+                     const osgDB::Options* options,
+                     ProgressCallback*     progress)
+{
+    Threading::Promise<AsyncHTTPResponse> promise;
+    Threading::Future<AsyncHTTPResponse> result = promise.getFuture();
+
+    osg::ref_ptr<AsyncHTTPResponse> out = new AsyncHTTPResponse();
+    out->_response = getClient().doGet(request, options, progress);
+    promise.resolve(out.get());
+    return result;
+}
+
+#else // OSGEARTH_USE_WININET_FOR_HTTP
+
+/**
+ * Services every asynchronous request through one curl multi handle so that
+ * connections, TLS sessions, DNS lookups and HTTP/2 streams are shared by all
+ * callers. Callers configure the easy handle on their own thread; the
+ * dispatcher thread only schedules, drives and completes transfers.
+ */
+class HTTPClient::AsyncDispatcher : public OpenThreads::Thread
+{
+public:
+    struct Job : public osg::Referenced
+    {
+        Job() :
+            _part(new HTTPResponse::Part()),
+            _stream(&_part->_stream),
+            _easy(0L),
+            _headers(0L),
+            _start(0)
+        {
+            _errorBuf[0] = 0;
+        }
+
+        std::string                           _url;
+        std::string                           _host;
+        std::string                           _userpwd;
+        std::string                           _proxy;
+        std::string                           _proxyAuth;
+        osg::ref_ptr<HTTPResponse::Part>      _part;
+        StreamObject                          _stream;
+        CURL*                                 _easy;
+        struct curl_slist*                    _headers;
+        osg::ref_ptr<ProgressCallback>        _progress;
+        Threading::Promise<AsyncHTTPResponse> _promise;
+        osg::Timer_t                          _start;
+        char                                  _errorBuf[CURL_ERROR_SIZE];
+
+        // true if nobody is waiting for this result any more.
+        bool isCanceled() const
+        {
+            return
+                _promise.isAbandoned() ||
+                (_progress.valid() && _progress->isCanceled());
+        }
+    };
+
+    static AsyncDispatcher& instance();
+
+    AsyncDispatcher();
+
+    ~AsyncDispatcher();
+
+    Threading::Future<AsyncHTTPResponse> submit(
+        const HTTPRequest&    request,
+        const osgDB::Options* options,
+        ProgressCallback*     progress);
+
+    void run();
+
+private:
+    typedef std::list< osg::ref_ptr<Job> > JobList;
+    typedef std::map< CURL*, osg::ref_ptr<Job> > RunningJobs;
+    typedef std::map< std::string, unsigned > HostCounts;
+
+    // stops the dispatcher thread at shutdown.
+    struct Cleanup { ~Cleanup(); };
+
+    static AsyncDispatcher* s_instance;
+    static Threading::Mutex s_instanceMutex;
+    static Cleanup          s_cleanup;
+
+    CURLM*           _multi;
+    long             _simResponseCode;
+    volatile bool    _done;
+    unsigned         _hostLimit;
+
+    Threading::Mutex _submitMutex;
+    JobList          _submitted;   // new requests, guarded by _submitMutex
+    Threading::Event _wake;
+
+    // the remainder is only touched by the dispatcher thread:
+    JobList          _waiting;     // requests waiting for a free host slot
+    RunningJobs      _running;
+    HostCounts       _active;
+
+    void configure(Job* job, const HTTPRequest& request, const osgDB::Options* options);
+    void schedule();
+    void reap();
+    void complete(CURL* easy, CURLcode res);
+    void cancel(Job* job);
+    void release(Job* job);
+    void wakeup();
+
+    static std::string getHostKey(const std::string& url);
+    static int progressCallback(void* clientp, double dltotal, double dlnow, double ultotal, double ulnow);
+};
+
+HTTPClient::AsyncDispatcher*          HTTPClient::AsyncDispatcher::s_instance = 0L;
+Threading::Mutex                      HTTPClient::AsyncDispatcher::s_instanceMutex;
+HTTPClient::AsyncDispatcher::Cleanup  HTTPClient::AsyncDispatcher::s_cleanup;
+
+HTTPClient::AsyncDispatcher::Cleanup::~Cleanup()
+{
+    delete s_instance;
+    s_instance = 0L;
+}
+
+HTTPClient::AsyncDispatcher&
+HTTPClient::AsyncDispatcher::instance()
+{
+    if (!s_instance)
+    {
+        Threading::ScopedMutexLock lock(s_instanceMutex);
+        if (!s_instance)
+        {
+            AsyncDispatcher* dispatcher = new AsyncDispatcher();
+            dispatcher->start();
+            s_instance = dispatcher;
+        }
+    }
+    return *s_instance;
+}
+
+HTTPClient::AsyncDispatcher::AsyncDispatcher() :
+_multi          ( 0L ),
+_simResponseCode( -1L ),
+_done           ( false ),
+_hostLimit      ( 0u )
+{
+    _multi = curl_multi_init();
+
+#if LIBCURL_VERSION_NUM >= 0x072b00
+    // Multiplex requests over a single HTTP/2 connection when the server
+    // supports it. (HTTP/1.1 pipelining is obsolete and removed from curl.)
+    curl_multi_setopt(_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+
+    const char* simCode = getenv("OSGEARTH_SIMULATE_HTTP_RESPONSE_CODE");
+    if (simCode)
+        _simResponseCode = osgEarth::as<long>(std::string(simCode), 404L);
+
+    if (getenv("OSGEARTH_HTTP_DISABLE"))
+        _simResponseCode = 503L; // SERVICE UNAVAILABLE
+}
+
+HTTPClient::AsyncDispatcher::~AsyncDispatcher()
+{
+    _done = true;
+    wakeup();
+    join();
+
+    // anything left over never completed:
+    for (RunningJobs::iterator i = _running.begin(); i != _running.end(); ++i)
+        cancel(i->second.get());
+    _running.clear();
+
+    for (JobList::iterator i = _waiting.begin(); i != _waiting.end(); ++i)
+        cancel(i->get());
+    _waiting.clear();
+
+    for (JobList::iterator i = _submitted.begin(); i != _submitted.end(); ++i)
+        cancel(i->get());
+    _submitted.clear();
+
+    if (_multi)
+        curl_multi_cleanup(_multi);
+    _multi = 0L;
+}
+
+std::string
+HTTPClient::AsyncDispatcher::getHostKey(const std::string& url)
+{
+    // scheme://[user@]host[:port]/path -> scheme://host[:port]
+    std::string::size_type schemeEnd = url.find("://");
+    std::string::size_type start = schemeEnd == std::string::npos ? 0 : schemeEnd + 3;
+    std::string::size_type end = url.find_first_of("/?#", start);
+    std::string authority = url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+    std::string::size_type at = authority.rfind('@');
+    if (at != std::string::npos)
+        authority = authority.substr(at + 1);
+    return url.substr(0, start) + toLower(authority);
+}
+
+int
+HTTPClient::AsyncDispatcher::progressCallback(void* clientp, double dltotal, double dlnow, double ultotal, double ulnow)
+{
+    Job* job = (Job*)clientp;
+    if (job->_promise.isAbandoned())
+        return 1;
+    return CurlProgressCallback(job->_progress.get(), dltotal, dlnow, ultotal, ulnow);
+}
+
+void
+HTTPClient::AsyncDispatcher::configure(Job* job, const HTTPRequest& request, const osgDB::Options* options)
+{
+    job->_url = request.getURL();
+
+    osg::ref_ptr< URLRewriter > rewriter = getURLRewriter();
+    if ( rewriter.valid() )
+        job->_url = rewriter->rewrite( job->_url );
+
+    job->_host = getHostKey(job->_url);
+
+    // Proxy: global settings, then the options, then the environment.
+    std::string proxy_host;
+    std::string proxy_port = "8080";
+    if (s_proxySettings.isSet())
+    {
+        proxy_host = s_proxySettings.get().hostName();
+        proxy_port = toString<int>(s_proxySettings.get().port());
+        if (!s_proxySettings.get().userName().empty() && !s_proxySettings.get().password().empty())
+            job->_proxyAuth = s_proxySettings.get().userName() + ":" + s_proxySettings.get().password();
+    }
+
+    getClient().readOptions( options, proxy_host, proxy_port );
+
+    optional< ProxySettings > proxySettings;
+    if (ProxySettings::fromOptions( options, proxySettings ))
+    {
+        proxy_host = proxySettings.get().hostName();
+        proxy_port = toString<int>(proxySettings.get().port());
+    }
+
+    const char* proxyEnvAddress = getenv("OSG_CURL_PROXY");
+    if (proxyEnvAddress)
+    {
+        proxy_host = std::string(proxyEnvAddress);
+        const char* proxyEnvPort = getenv("OSG_CURL_PROXYPORT");
+        if (proxyEnvPort)
+            proxy_port = std::string(proxyEnvPort);
+    }
+
+    const char* proxyEnvAuth = getenv("OSGEARTH_CURL_PROXYAUTH");
+    if (proxyEnvAuth)
+        job->_proxyAuth = std::string(proxyEnvAuth);
+
+    if (!proxy_host.empty())
+        job->_proxy = proxy_host + ":" + proxy_port;
+
+    std::string userAgent = s_userAgent;
+    const char* userAgentEnv = getenv("OSGEARTH_USERAGENT");
+    if (userAgentEnv)
+        userAgent = std::string(userAgentEnv);
+
+    long timeout = s_timeout;
+    const char* timeoutEnv = getenv("OSGEARTH_HTTP_TIMEOUT");
+    if (timeoutEnv)
+        timeout = osgEarth::as<long>(std::string(timeoutEnv), 0);
+
+    long connectTimeout = s_connectTimeout;
+    const char* connectTimeoutEnv = getenv("OSGEARTH_HTTP_CONNECTTIMEOUT");
+    if (connectTimeoutEnv)
+        connectTimeout = osgEarth::as<long>(std::string(connectTimeoutEnv), 0);
+
+    CURL* easy = curl_easy_init();
+    job->_easy = easy;
+
+    curl_easy_setopt( easy, CURLOPT_PRIVATE, (void*)job );
+    curl_easy_setopt( easy, CURLOPT_URL, job->_url.c_str() );
+    curl_easy_setopt( easy, CURLOPT_USERAGENT, userAgent.c_str() );
+    curl_easy_setopt( easy, CURLOPT_WRITEFUNCTION, osgEarth::StreamObjectReadCallback );
+    curl_easy_setopt( easy, CURLOPT_HEADERFUNCTION, osgEarth::StreamObjectHeaderCallback );
+    curl_easy_setopt( easy, CURLOPT_WRITEDATA, (void*)&job->_stream );
+    curl_easy_setopt( easy, CURLOPT_HEADERDATA, (void*)&job->_stream );
+    curl_easy_setopt( easy, CURLOPT_FOLLOWLOCATION, (void*)1 );
+    curl_easy_setopt( easy, CURLOPT_MAXREDIRS, (void*)5 );
+    curl_easy_setopt( easy, CURLOPT_PROGRESSFUNCTION, &AsyncDispatcher::progressCallback );
+    curl_easy_setopt( easy, CURLOPT_PROGRESSDATA, (void*)job );
+    curl_easy_setopt( easy, CURLOPT_NOPROGRESS, (void*)0 );
+    curl_easy_setopt( easy, CURLOPT_FILETIME, true );
+    curl_easy_setopt( easy, CURLOPT_ENCODING, "" );
+    curl_easy_setopt( easy, CURLOPT_TIMEOUT, timeout );
+    curl_easy_setopt( easy, CURLOPT_CONNECTTIMEOUT, connectTimeout );
+    curl_easy_setopt( easy, CURLOPT_ERRORBUFFER, (void*)job->_errorBuf );
+    curl_easy_setopt( easy, CURLOPT_SSL_VERIFYPEER, (void*)0 );
+    curl_easy_setopt( easy, CURLOPT_NOSIGNAL, 1L );
+
+#if LIBCURL_VERSION_NUM >= 0x072f00
+    // Negotiate HTTP/2 over TLS; plain http:// stays on HTTP/1.1.
+    curl_easy_setopt( easy, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS );
+#endif
+#if LIBCURL_VERSION_NUM >= 0x072b00
+    // Prefer waiting for an existing connection to multiplex over opening a new one.
+    curl_easy_setopt( easy, CURLOPT_PIPEWAIT, 1L );
+#endif
+
+    if (!job->_proxy.empty())
+    {
+        curl_easy_setopt( easy, CURLOPT_PROXY, job->_proxy.c_str() );
+        if (!job->_proxyAuth.empty())
+            curl_easy_setopt( easy, CURLOPT_PROXYUSERPWD, job->_proxyAuth.c_str() );
+    }
+
+    const osgDB::AuthenticationMap* authenticationMap = (options && options->getAuthenticationMap()) ?
+        options->getAuthenticationMap() :
+        osgDB::Registry::instance()->getAuthenticationMap();
+
+    const osgDB::AuthenticationDetails* details = authenticationMap ?
+        authenticationMap->getAuthenticationDetails( job->_url ) :
+        0;
+
+    if (details)
+    {
+        job->_userpwd = details->username + ":" + details->password;
+        curl_easy_setopt( easy, CURLOPT_USERPWD, job->_userpwd.c_str() );
+#if LIBCURL_VERSION_NUM >= 0x070a07
+        curl_easy_setopt( easy, CURLOPT_HTTPAUTH, details->httpAuthentication );
+#endif
+    }
+
+    for (Headers::const_iterator itr = request.getHeaders().begin(); itr != request.getHeaders().end(); ++itr)
+    {
+        std::string header = itr->first + ": " + itr->second;
+        job->_headers = curl_slist_append(job->_headers, header.c_str());
+    }
+    job->_headers = curl_slist_append(job->_headers, "Pragma: ");
+    curl_easy_setopt( easy, CURLOPT_HTTPHEADER, job->_headers );
+
+    osg::ref_ptr< CurlConfigHandler > curlConfigHandler = getCurlConfigHandler();
+    if (curlConfigHandler.valid())
+    {
+        curlConfigHandler->onInitialize(easy);
+        curlConfigHandler->onGet(easy);
+    }
+}
+
+Threading::Future<AsyncHTTPResponse>
+HTTPClient::AsyncDispatcher::submit(const HTTPRequest&    request,
+                                    const osgDB::Options* options,
+                                    ProgressCallback*     progress)
+{
+    osg::ref_ptr<Job> job = new Job();
+    job->_progress = progress;
+    Threading::Future<AsyncHTTPResponse> result = job->_promise.getFuture();
+
+    if (_simResponseCode >= 0)
+    {
+        // simulate failure with a custom response code
+        osg::ref_ptr<AsyncHTTPResponse> out = new AsyncHTTPResponse(_simResponseCode);
+        out->_response._message = curl_easy_strerror(
+            _simResponseCode == 408 ? CURLE_OPERATION_TIMEDOUT : CURLE_COULDNT_CONNECT);
+        job->_promise.resolve(out.get());
+        return result;
+    }
+
+    configure(job.get(), request, options);
+    job->_start = osg::Timer::instance()->tick();
+
+    {
+        Threading::ScopedMutexLock lock(_submitMutex);
+        _submitted.push_back(job.get());
+    }
+    wakeup();
+
+    return result;
+}
+
+void
+HTTPClient::AsyncDispatcher::wakeup()
+{
+    _wake.set();
+#if LIBCURL_VERSION_NUM >= 0x074400
+    if (_multi)
+        curl_multi_wakeup(_multi);
+#endif
+}
+
+void
+HTTPClient::AsyncDispatcher::release(Job* job)
+{
+    if (job->_easy)
+    {
+        curl_easy_cleanup(job->_easy);
+        job->_easy = 0L;
+    }
+    if (job->_headers)
+    {
+        curl_slist_free_all(job->_headers);
+        job->_headers = 0L;
+    }
+}
+
+void
+HTTPClient::AsyncDispatcher::cancel(Job* job)
+{
+    if (job->_easy && _running.find(job->_easy) != _running.end())
+        curl_multi_remove_handle(_multi, job->_easy);
+    release(job);
+
+    osg::ref_ptr<AsyncHTTPResponse> out = new AsyncHTTPResponse(0L);
+    out->_response._cancelled = true;
+    job->_promise.resolve(out.get());
+}
+
+void
+HTTPClient::AsyncDispatcher::schedule()
+{
+    {
+        Threading::ScopedMutexLock lock(_submitMutex);
+        _waiting.splice(_waiting.end(), _submitted);
+    }
+
+    unsigned limit = HTTPClient::getMaxConnectionsPerHost();
+    if (limit != _hostLimit)
+    {
+        _hostLimit = limit;
+#if LIBCURL_VERSION_NUM >= 0x071e00
+        curl_multi_setopt(_multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)limit);
+#endif
+    }
+
+    for (JobList::iterator i = _waiting.begin(); i != _waiting.end(); )
+    {
+        Job* job = i->get();
+        if (job->isCanceled())
+        {
+            cancel(job);
+            i = _waiting.erase(i);
+        }
+        else
+        {
+            unsigned& active = _active[job->_host];
+            if (active < _hostLimit)
+            {
+                ++active;
+                _running[job->_easy] = job;
+                curl_multi_add_handle(_multi, job->_easy);
+                i = _waiting.erase(i);
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+}
+
+void
+HTTPClient::AsyncDispatcher::reap()
+{
+    // curl only polls the progress callback about once a second on an idle
+    // transfer, so look for canceled requests here too.
+    for (RunningJobs::iterator i = _running.begin(); i != _running.end(); )
+    {
+        Job* job = i->second.get();
+        if (job->isCanceled())
+        {
+            HostCounts::iterator h = _active.find(job->_host);
+            if (h != _active.end() && --h->second == 0)
+                _active.erase(h);
+
+            osg::ref_ptr<Job> ref = job;
+            cancel(job);
+            _running.erase(i++);
+        }
+        else
+        {
+            ++i;
+        }
+    }
+}
+
+void
+HTTPClient::AsyncDispatcher::complete(CURL* easy, CURLcode res)
+{
+    RunningJobs::iterator r = _running.find(easy);
+    if (r == _running.end())
+        return;
+
+    osg::ref_ptr<Job> job = r->second;
+    _running.erase(r);
+
+    HostCounts::iterator h = _active.find(job->_host);
+    if (h != _active.end() && --h->second == 0)
+        _active.erase(h);
+
+    curl_multi_remove_handle(_multi, easy);
+
+    long response_code = 0L;
+    curl_easy_getinfo( easy, CURLINFO_RESPONSE_CODE, &response_code );
+
+    osg::ref_ptr<AsyncHTTPResponse> out = new AsyncHTTPResponse(response_code);
+    HTTPResponse& response = out->_response;
+
+    char* content_type_cp = 0L;
+    curl_easy_getinfo( easy, CURLINFO_CONTENT_TYPE, &content_type_cp );
+    if ( content_type_cp != NULL )
+        response._mimeType = content_type_cp;
+
+    response._lastModified = getCurlFileTime( easy );
+
+    if (res == CURLE_OK)
+    {
+        if (response._mimeType.length() > 9 &&
+            ::strstr( response._mimeType.c_str(), "multipart" ) == response._mimeType.c_str() )
+        {
+            getClient().decodeMultipartStream( "wcs", job->_part.get(), response._parts );
+        }
+        else
+        {
+            job->_part->_headers = job->_stream._headers;
+            response._parts.push_back( job->_part.get() );
+        }
+    }
+    else if (res == CURLE_ABORTED_BY_CALLBACK || res == CURLE_OPERATION_TIMEDOUT)
+    {
+        response._cancelled = true;
+    }
+    else
+    {
+        response._message = job->_errorBuf[0] ? job->_errorBuf : curl_easy_strerror(res);
+    }
+
+    response._duration_s = osg::Timer::instance()->delta_s(job->_start, osg::Timer::instance()->tick());
+
+    if ( s_HTTP_DEBUG )
+    {
+        OE_NOTICE << LC
+            << "GET-ASYNC(" << response_code << ") " << response._mimeType << ": \""
+            << job->_url << "\" t="
+            << std::setprecision(4) << response.getDuration() << "s" << std::endl;
+    }
+
+    release(job.get());
+    job->_promise.resolve(out.get());
+}
+
+void
+HTTPClient::AsyncDispatcher::run()
+{
+    while (!_done)
+    {
+        _wake.reset();
+
+        schedule();
+
+        int stillRunning = 0;
+        curl_multi_perform(_multi, &stillRunning);
+
+        unsigned numCompleted = 0u;
+        int msgsLeft = 0;
+        CURLMsg* msg;
+        while ((msg = curl_multi_info_read(_multi, &msgsLeft)) != 0L)
+        {
+            if (msg->msg == CURLMSG_DONE)
+            {
+                complete(msg->easy_handle, msg->data.result);
+                ++numCompleted;
+            }
+        }
+
+        reap();
+
+        if (_done)
+            break;
+
+        // a slot opened up; start the next queued request right away.
+        if (numCompleted > 0u && !_waiting.empty())
+            continue;
+
+        if (_running.empty())
+        {
+            // idle: sleep until a new request arrives (or a queued one
+            // is canceled, which we notice on the periodic timeout).
+            _wake.wait(_waiting.empty() ? 1000u : 50u);
+        }
+        else
+        {
+            int numfds = 0;
+#if LIBCURL_VERSION_NUM >= 0x074400
+            curl_multi_poll(_multi, 0L, 0, 100, &numfds);
+#else
+            // no wakeup support; keep the timeout short so new
+            // submissions start promptly.
+            curl_multi_wait(_multi, 0L, 0, 10, &numfds);
+#endif
+        }
+    }
+}
+
+Threading::Future<AsyncHTTPResponse>
+HTTPClient::getAsync(const HTTPRequest&    request,
+                     const osgDB::Options* options,
+                     ProgressCallback*     progress)
+{
+    return AsyncDispatcher::instance().submit(request, options, progress);
+}
+
+#endif // OSGEARTH_USE_WININET_FOR_HTTP
+
 #ifdef OSGEARTH_USE_WININET_FOR_HTTP
 
 namespace
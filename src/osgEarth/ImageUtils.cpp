@@ -992,6 +992,107 @@ ImageUtils::upSampleNN(const osg::Image* src, int quadrant)
     return dst;
 }
 
+namespace
+{
+    // Averages two rows of 8-bit pixels down to one row of half the width.
+    // The pixel size is a template argument so that the compiler can unroll
+    // the inner loop and vectorize the whole row.
+    template<unsigned BPP>
+    void reduceRow8(const unsigned char* r0, const unsigned char* r1, unsigned char* out, int cols)
+    {
+        for(int col=0; col<cols; ++col, r0 += 2*BPP, r1 += 2*BPP, out += BPP)
+        {
+            for(unsigned c=0; c<BPP; ++c)
+            {
+                out[c] = (unsigned char)((r0[c] + r0[BPP+c] + r1[c] + r1[BPP+c] + 2u) >> 2);
+            }
+        }
+    }
+}
+
+osg::Image*
+ImageUtils::reduce2x2(const osg::Image* ul, const osg::Image* ur, const osg::Image* ll, const osg::Image* lr)
+{
+    const osg::Image* quads[4] = { ul, ur, ll, lr };
+
+    for(unsigned q=0; q<4; ++q)
+    {
+        if (!sameFormat(ul, quads[q]) ||
+            quads[q]->s() != ul->s() ||
+            quads[q]->t() != ul->t() ||
+            quads[q]->r() != 1 ||
+            isCompressed(quads[q]))
+        {
+            return 0L;
+        }
+    }
+
+    if ((ul->s() & 1) != 0 || (ul->t() & 1) != 0)
+        return 0L;
+
+    int halfS = ul->s()/2, halfT = ul->t()/2;
+
+    osg::ref_ptr<osg::Image> output = new osg::Image();
+    output->allocateImage(ul->s(), ul->t(), 1, ul->getPixelFormat(), ul->getDataType(), ul->getPacking());
+    output->setInternalTextureFormat(ul->getInternalTextureFormat());
+    markAsNormalized(output.get(), isNormalized(ul));
+
+    unsigned bpp = osg::Image::computePixelSizeInBits(ul->getPixelFormat(), ul->getDataType()) / 8u;
+
+    if (ul->getDataType() == GL_UNSIGNED_BYTE && bpp >= 1u && bpp <= 4u)
+    {
+        for(unsigned q=0; q<4; ++q)
+        {
+            // image rows run bottom-up, so the upper children fill the top half.
+            int soff = (q == 0 || q == 2) ? 0 : halfS;
+            int toff = (q == 0 || q == 1) ? halfT : 0;
+
+            for(int t=0; t<halfT; ++t)
+            {
+                const unsigned char* r0 = quads[q]->data(0, 2*t);
+                const unsigned char* r1 = quads[q]->data(0, 2*t+1);
+                unsigned char* out = output->data(soff, toff+t);
+
+                switch(bpp)
+                {
+                case 1: reduceRow8<1>(r0, r1, out, halfS); break;
+                case 2: reduceRow8<2>(r0, r1, out, halfS); break;
+                case 3: reduceRow8<3>(r0, r1, out, halfS); break;
+                default: reduceRow8<4>(r0, r1, out, halfS); break;
+                }
+            }
+        }
+    }
+    else
+    {
+        if (!PixelReader::supports(ul) || !PixelWriter::supports(output.get()))
+            return 0L;
+
+        PixelWriter write(output.get());
+
+        for(unsigned q=0; q<4; ++q)
+        {
+            int soff = (q == 0 || q == 2) ? 0 : halfS;
+            int toff = (q == 0 || q == 1) ? halfT : 0;
+
+            PixelReader read(quads[q]);
+
+            for(int t=0; t<halfT; ++t)
+            {
+                for(int s=0; s<halfS; ++s)
+                {
+                    osg::Vec4 value =
+                        read(2*s, 2*t) + read(2*s+1, 2*t) +
+                        read(2*s, 2*t+1) + read(2*s+1, 2*t+1);
+                    write(value * 0.25f, soff+s, toff+t);
+                }
+            }
+        }
+    }
+
+    return output.release();
+}
+
 bool
 ImageUtils::isSingleColorImage(const osg::Image* image, float threshold)
 {
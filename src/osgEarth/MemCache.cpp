@@ -17,45 +17,220 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include <osgEarth/MemCache>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/Texture>
+#include <osg/NodeVisitor>
+#include <algorithm>
+#include <list>
+#include <set>
+#include <stdint.h>
 
 using namespace osgEarth;
 
 #define LC "[MemCacheBin] "
 
+#define OSGEARTH_ENV_MEMCACHE_MAX_MB "OSGEARTH_MEMCACHE_MAX_MB"
+
 //------------------------------------------------------------------------
 
 namespace
 {
-    typedef std::pair<osg::ref_ptr<const osg::Object>, Config> MemCacheEntry;
-    typedef LRUCache<std::string, MemCacheEntry> MemCacheLRU;
+    // Adds up the memory held by a scene graph's arrays, primitive sets
+    // and texture images.
+    struct SizeVisitor : public osg::NodeVisitor
+    {
+        SizeVisitor() : osg::NodeVisitor(TRAVERSE_ALL_CHILDREN), _bytes(0u) { }
+
+        void apply(osg::Node& node)
+        {
+            _bytes += sizeof(osg::Node);
+            addStateSet( node.getStateSet() );
+            traverse( node );
+        }
+
+        void apply(osg::Geode& geode)
+        {
+            _bytes += sizeof(osg::Geode);
+            addStateSet( geode.getStateSet() );
+            for(unsigned i=0; i<geode.getNumDrawables(); ++i)
+                addDrawable( geode.getDrawable(i) );
+        }
+
+        void addDrawable(const osg::Drawable* drawable)
+        {
+            if ( !drawable || !_seen.insert(drawable).second )
+                return;
+
+            _bytes += sizeof(osg::Drawable);
+            addStateSet( drawable->getStateSet() );
+
+            const osg::Geometry* geom = drawable->asGeometry();
+            if ( geom )
+            {
+                osg::Geometry::ArrayList arrays;
+                geom->getArrayList( arrays );
+                for(unsigned i=0; i<arrays.size(); ++i)
+                    if ( arrays[i].valid() && _seen.insert(arrays[i].get()).second )
+                        _bytes += arrays[i]->getTotalDataSize();
+
+                for(unsigned i=0; i<geom->getNumPrimitiveSets(); ++i)
+                    _bytes += geom->getPrimitiveSet(i)->getTotalDataSize();
+            }
+        }
+
+        void addStateSet(const osg::StateSet* stateSet)
+        {
+            if ( !stateSet || !_seen.insert(stateSet).second )
+                return;
+
+            for(unsigned unit=0; unit<stateSet->getTextureAttributeList().size(); ++unit)
+            {
+                const osg::Texture* tex = dynamic_cast<const osg::Texture*>(
+                    stateSet->getTextureAttribute(unit, osg::StateAttribute::TEXTURE) );
+
+                if ( tex )
+                {
+                    for(unsigned i=0; i<tex->getNumImages(); ++i)
+                    {
+                        const osg::Image* image = tex->getImage(i);
+                        if ( image && _seen.insert(image).second )
+                            _bytes += image->getTotalSizeInBytesIncludingMipmaps();
+                    }
+                }
+            }
+        }
+
+        size_t                _bytes;
+        std::set<const void*> _seen;
+    };
 
-    struct MemCacheBin : public CacheBin
+    // Approximate access counts for a bin's keys (a count-min sketch of
+    // 4-bit counters), halved periodically so that old popularity fades.
+    class FrequencySketch
     {
-        MemCacheBin( const std::string& id, unsigned maxSize )
-            : CacheBin( id ),
-              _lru    ( true /* MT-safe */, maxSize )
+    public:
+        FrequencySketch(unsigned capacity) : _additions(0u)
         {
-            //nop
+            // Wide enough that keys streaming past a small bin don't
+            // saturate the counters (4 rows x 1024 bytes minimum).
+            unsigned width = 1024u;
+            while( width < capacity*8u )
+                width <<= 1;
+            _mask = width - 1u;
+            _sampleSize = width * 10u;
+            _table.assign( width*4u, 0u );
         }
 
-        ReadResult readObject(const std::string& key, const osgDB::Options*)
+        void increment(uint64_t hash)
         {
-            MemCacheLRU::Record rec;
-            _lru.get(key, rec);
+            uint32_t h1 = (uint32_t)hash, h2 = (uint32_t)(hash >> 32) | 1u;
+            for(unsigned row=0; row<4u; ++row)
+            {
+                unsigned char& c = _table[row*(_mask+1u) + ((h1 + row*h2) & _mask)];
+                if ( c < 15u )
+                    ++c;
+            }
 
-            // clone required since the cache is in memory
+            if ( ++_additions >= _sampleSize )
+            {
+                for(unsigned i=0; i<_table.size(); ++i)
+                    _table[i] >>= 1;
+                _additions /= 2u;
+            }
+        }
+
+        unsigned estimate(uint64_t hash) const
+        {
+            uint32_t h1 = (uint32_t)hash, h2 = (uint32_t)(hash >> 32) | 1u;
+            unsigned result = 15u;
+            for(unsigned row=0; row<4u; ++row)
+                result = osg::minimum(result, (unsigned)_table[row*(_mask+1u) + ((h1 + row*h2) & _mask)]);
+            return result;
+        }
+
+    private:
+        std::vector<unsigned char> _table;
+        unsigned _mask;
+        unsigned _sampleSize;
+        unsigned _additions;
+    };
+
+    uint64_t hashKey(const std::string& key)
+    {
+        uint64_t h = 0xcbf29ce484222325ull;
+        for(std::string::const_iterator i = key.begin(); i != key.end(); ++i)
+        {
+            h ^= (unsigned char)(*i);
+            h *= 0x100000001b3ull;
+        }
+        return h;
+    }
 
-            if ( rec.valid() )
+    struct MemCacheEntry
+    {
+        std::string                     _key;
+        uint64_t                        _hash;
+        osg::ref_ptr<const osg::Object> _object;
+        Config                          _meta;
+        size_t                          _bytes;
+    };
+
+    typedef std::list<MemCacheEntry> MemCacheLRU;
+    typedef std::map<std::string, MemCacheLRU::iterator> MemCacheIndex;
+
+    // Note: a bin never calls into its budget while holding its own mutex;
+    // the budget does lock bins (to evict) while holding its own.
+    struct MemCacheBin : public CacheBin, public MemCacheBudget::Client
+    {
+        MemCacheBin( const std::string& id, unsigned maxSize, MemCacheBudget* budget )
+            : CacheBin   ( id ),
+              _maxEntries( maxSize ),
+              _budget    ( budget ),
+              _sketch    ( maxSize ),
+              _bytes     ( 0u ),
+              _queries   ( 0u ),
+              _hits      ( 0u ),
+              _evictions ( 0u ),
+              _rejections( 0u )
+        {
+            _budget->addClient( this );
+        }
+
+        virtual ~MemCacheBin()
+        {
+            _budget->removeClient( this );
+            _budget->charge( 0u, _bytes );
+        }
+
+        ReadResult readObject(const std::string& key, const osgDB::Options*)
+        {
+            osg::ref_ptr<const osg::Object> object;
+            Config meta;
             {
-                //OE_INFO << LC << "hits: " << _lru.getStats()._hitRatio*100.0f << "%" << std::endl;
+                Threading::ScopedMutexLock lock( _mutex );
+                ++_queries;
+                _sketch.increment( hashKey(key) );
 
+                MemCacheIndex::iterator i = _index.find(key);
+                if ( i != _index.end() )
+                {
+                    _lru.splice( _lru.begin(), _lru, i->second );
+                    object = i->second->_object.get();
+                    meta = i->second->_meta;
+                    ++_hits;
+                }
+            }
+
+            // clone required since the cache is in memory
+            if ( object.valid() )
+            {
                 return ReadResult( 
-                   osg::clone(rec.value().first.get(), osg::CopyOp::DEEP_COPY_ALL),
-                   rec.value().second );
+                   osg::clone(object.get(), osg::CopyOp::DEEP_COPY_ALL),
+                   meta );
             }
             else
             {
-                //OE_INFO << LC << "hits: " << _lru.getStats()._hitRatio*100.0f << "%" << std::endl;
                 return ReadResult();
             }
         }
@@ -72,65 +247,345 @@ namespace
 
         bool write( const std::string& key, const osg::Object* object, const Config& meta, const osgDB::Options* writeOptions)
         {
-            if ( object ) 
+            if ( !object ) 
+                return false;
+
+            osg::ref_ptr<const osg::Object> cloned = osg::clone(object, osg::CopyOp::DEEP_COPY_ALL);
+            size_t bytes = MemCache::getSizeInBytes(cloned.get()) + key.size() + sizeof(MemCacheEntry);
+            bool budgetFull = _budget->wouldExceed(bytes);
+
+            size_t added = 0u, removed = 0u;
             {
-                osg::ref_ptr<const osg::Object> cloned = osg::clone(object, osg::CopyOp::DEEP_COPY_ALL);
-                _lru.insert( key, std::make_pair(cloned.get(), meta) );
-                return true;
+                Threading::ScopedMutexLock lock( _mutex );
+
+                uint64_t hash = hashKey(key);
+                MemCacheIndex::iterator i = _index.find(key);
+                if ( i != _index.end() )
+                {
+                    MemCacheEntry& entry = *i->second;
+                    removed += entry._bytes;
+                    entry._object = cloned.get();
+                    entry._meta = meta;
+                    entry._bytes = bytes;
+                    _lru.splice( _lru.begin(), _lru, i->second );
+                }
+                else
+                {
+                    // Full? Then only admit the newcomer if it's been asked
+                    // for at least as often as the entry it would displace.
+                    bool full = _index.size() >= _maxEntries || budgetFull;
+                    if ( full && !_lru.empty() && _sketch.estimate(hash) < _sketch.estimate(_lru.back()._hash) )
+                    {
+                        ++_rejections;
+                        return false;
+                    }
+
+                    _lru.push_front( MemCacheEntry() );
+                    MemCacheEntry& entry = _lru.front();
+                    entry._key = key;
+                    entry._hash = hash;
+                    entry._object = cloned.get();
+                    entry._meta = meta;
+                    entry._bytes = bytes;
+                    _index[key] = _lru.begin();
+
+                    while( _index.size() > _maxEntries )
+                        removed += evictTail();
+                }
+
+                added = bytes;
+                _bytes = _bytes + added - osg::minimum(removed, _bytes + added);
             }
-            else
-                return false;
+
+            _budget->charge( added, removed );
+            return true;
         }
 
         bool remove(const std::string& key)
         {
-            _lru.erase(key);
+            size_t removed = 0u;
+            {
+                Threading::ScopedMutexLock lock( _mutex );
+                MemCacheIndex::iterator i = _index.find(key);
+                if ( i == _index.end() )
+                    return true;
+
+                removed = i->second->_bytes;
+                _bytes -= osg::minimum(removed, _bytes);
+                _lru.erase( i->second );
+                _index.erase( i );
+            }
+
+            _budget->charge( 0u, removed );
             return true;
         }
 
         bool touch(const std::string& key)
         {
-            // just doing a get will put it at the front of the LRU list
-            MemCacheLRU::Record dummy;
-            return _lru.get(key, dummy);
+            Threading::ScopedMutexLock lock( _mutex );
+            _sketch.increment( hashKey(key) );
+
+            MemCacheIndex::iterator i = _index.find(key);
+            if ( i == _index.end() )
+                return false;
+
+            _lru.splice( _lru.begin(), _lru, i->second );
+            return true;
         }
 
         RecordStatus getRecordStatus( const std::string& key )
         {
             // ignore minTime; MemCache does not support expiration
-            return _lru.has(key) ? STATUS_OK : STATUS_NOT_FOUND;
+            Threading::ScopedMutexLock lock( _mutex );
+            return _index.find(key) != _index.end() ? STATUS_OK : STATUS_NOT_FOUND;
         }
 
-        bool purge()
+        bool clear()
         {
-            _lru.clear();
+            size_t removed;
+            {
+                Threading::ScopedMutexLock lock( _mutex );
+                removed = _bytes;
+                _bytes = 0u;
+                _lru.clear();
+                _index.clear();
+            }
+
+            _budget->charge( 0u, removed );
             return true;
         }
 
+        CacheStats getStats() const
+        {
+            size_t maxBytes = _budget->getMaxBytes();
+
+            Threading::ScopedMutexLock lock( _mutex );
+            CacheStats stats(
+                _index.size(),
+                _maxEntries,
+                _queries,
+                _queries > 0u ? (float)_hits/(float)_queries : 0.0f );
+
+            stats._bytes      = _bytes;
+            stats._maxBytes   = maxBytes;
+            stats._evictions  = _evictions;
+            stats._rejections = _rejections;
+            return stats;
+        }
+
         std::string getHashedKey(const std::string& key) const
         {
             return key;
         }
 
-        MemCacheLRU _lru;
+    public: // MemCacheBudget::Client
+
+        size_t getBytes() const
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            return _bytes;
+        }
+
+        size_t evictOne()
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            if ( _lru.empty() )
+                return 0u;
+
+            size_t bytes = evictTail();
+            _bytes -= osg::minimum(bytes, _bytes);
+            return bytes;
+        }
+
+    private:
+
+        // removes the LRU entry and returns its cost; caller holds the mutex
+        size_t evictTail()
+        {
+            MemCacheEntry& entry = _lru.back();
+            size_t bytes = entry._bytes;
+            _index.erase( entry._key );
+            _lru.pop_back();
+            ++_evictions;
+            return bytes;
+        }
+
+        unsigned                     _maxEntries;
+        osg::ref_ptr<MemCacheBudget> _budget;
+        MemCacheLRU                  _lru;
+        MemCacheIndex                _index;
+        FrequencySketch              _sketch;
+        size_t                       _bytes;
+        unsigned                     _queries;
+        unsigned                     _hits;
+        unsigned                     _evictions;
+        unsigned                     _rejections;
+        mutable Threading::Mutex     _mutex;
     };
     
 
     static Threading::Mutex s_defaultBinMutex;
+    static Threading::Mutex s_defaultBudgetMutex;
 }
 
 //------------------------------------------------------------------------
 
-MemCache::MemCache( unsigned maxBinSize ) :
-_maxBinSize( osg::maximum(maxBinSize, 1u) )
+MemCacheBudget::MemCacheBudget(size_t maxBytes) :
+_maxBytes( maxBytes ),
+_bytes   ( 0u )
 {
     //nop
 }
 
+MemCacheBudget*
+MemCacheBudget::getDefault()
+{
+    static osg::ref_ptr<MemCacheBudget> s_default;
+    if ( !s_default.valid() )
+    {
+        Threading::ScopedMutexLock lock( s_defaultBudgetMutex );
+        if ( !s_default.valid() )
+        {
+            size_t maxBytes = 0u;
+            const char* value = ::getenv(OSGEARTH_ENV_MEMCACHE_MAX_MB);
+            if ( value )
+            {
+                maxBytes = (size_t)as<unsigned>(std::string(value), 0u) * 1048576u;
+                OE_INFO << LC << "Memory cache budget set from environment: " << (maxBytes/1048576u) << " MB" << std::endl;
+            }
+            s_default = new MemCacheBudget(maxBytes);
+        }
+    }
+    return s_default.get();
+}
+
+void
+MemCacheBudget::setMaxBytes(size_t value)
+{
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        _maxBytes = value;
+    }
+    enforce();
+}
+
+size_t
+MemCacheBudget::getMaxBytes() const
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    return _maxBytes;
+}
+
+size_t
+MemCacheBudget::getBytes() const
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    return _bytes;
+}
+
+void
+MemCacheBudget::addClient(Client* client)
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    _clients.push_back( client );
+}
+
+void
+MemCacheBudget::removeClient(Client* client)
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    std::vector<Client*>::iterator i = std::find(_clients.begin(), _clients.end(), client);
+    if ( i != _clients.end() )
+        _clients.erase( i );
+}
+
+bool
+MemCacheBudget::wouldExceed(size_t bytes) const
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    return _maxBytes > 0u && _bytes + bytes > _maxBytes;
+}
+
+void
+MemCacheBudget::charge(size_t added, size_t removed)
+{
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        _bytes += added;
+        _bytes -= osg::minimum(removed, _bytes);
+    }
+
+    if ( added > 0u )
+        enforce();
+}
+
+void
+MemCacheBudget::enforce()
+{
+    Threading::ScopedMutexLock lock( _mutex );
+
+    // Take from the biggest bin until we're back under the limit.
+    while( _maxBytes > 0u && _bytes > _maxBytes )
+    {
+        Client* victim = 0L;
+        size_t  victimBytes = 0u;
+        for(std::vector<Client*>::const_iterator i = _clients.begin(); i != _clients.end(); ++i)
+        {
+            size_t bytes = (*i)->getBytes();
+            if ( bytes > victimBytes )
+                victim = *i, victimBytes = bytes;
+        }
+
+        size_t freed = victim ? victim->evictOne() : 0u;
+        if ( freed == 0u )
+            break;
+
+        _bytes -= osg::minimum(freed, _bytes);
+    }
+}
+
+//------------------------------------------------------------------------
+
+MemCache::MemCache( unsigned maxBinSize, MemCacheBudget* budget ) :
+_maxBinSize( osg::maximum(maxBinSize, 1u) ),
+_budget    ( budget ? budget : MemCacheBudget::getDefault() )
+{
+    //nop
+}
+
+size_t
+MemCache::getSizeInBytes(const osg::Object* object)
+{
+    if ( !object )
+        return 0u;
+
+    const osg::Image* image = dynamic_cast<const osg::Image*>(object);
+    if ( image )
+        return sizeof(osg::Image) + image->getTotalSizeInBytesIncludingMipmaps();
+
+    const osg::HeightField* hf = dynamic_cast<const osg::HeightField*>(object);
+    if ( hf )
+        return sizeof(osg::HeightField) + (hf->getFloatArray() ? hf->getFloatArray()->getTotalDataSize() : 0u);
+
+    const osg::Node* node = dynamic_cast<const osg::Node*>(object);
+    if ( node )
+    {
+        SizeVisitor sv;
+        const_cast<osg::Node*>(node)->accept( sv );
+        return sv._bytes;
+    }
+
+    const StringObject* str = dynamic_cast<const StringObject*>(object);
+    if ( str )
+        return sizeof(StringObject) + str->getString().size();
+
+    return sizeof(osg::Object);
+}
+
 CacheBin*
 MemCache::addBin( const std::string& binID )
 {
-    return _bins.getOrCreate( binID, new MemCacheBin(binID, _maxBinSize) );
+    return _bins.getOrCreate( binID, new MemCacheBin(binID, _maxBinSize, _budget.get()) );
 }
 
 CacheBin*
@@ -151,7 +606,7 @@ MemCache::getOrCreateDefaultBin()
         // double check
         if ( !_defaultBin.valid() )
         {
-            _defaultBin = new MemCacheBin("__default", _maxBinSize);
+            _defaultBin = new MemCacheBin("__default", _maxBinSize, _budget.get());
         }
     }
 
@@ -162,7 +617,15 @@ MemCache::getOrCreateDefaultBin()
 void
 MemCache::dumpStats(const std::string& binID)
 {
-    MemCacheBin* bin = static_cast<MemCacheBin*>(getBin(binID));
-    CacheStats stats = bin->_lru.getStats();
-    OE_INFO << LC << "hit ratio = " << stats._hitRatio << std::endl;
+    CacheBin* bin = getBin(binID);
+    if ( !bin )
+        return;
+
+    CacheStats stats = bin->getStats();
+    OE_INFO << LC << "hit ratio = " << stats._hitRatio
+        << ", entries = " << stats._entries
+        << ", bytes = " << stats._bytes
+        << ", evictions = " << stats._evictions
+        << ", rejections = " << stats._rejections
+        << std::endl;
 }
@@ -21,8 +21,13 @@
 #include <osgEarth/Registry>
 #include <osgEarth/Cube>
 #include <osgEarth/LocalTangentPlane>
+#include <osgEarth/StringUtils>
+#include <osgEarth/ThreadingUtils>
 #include <ogr_spatialref.h>
 #include <cpl_conv.h>
+#include <cstdlib>
+#include <map>
+#include <set>
 
 #define LC "[SpatialReference] "
 
@@ -32,6 +37,120 @@ using namespace osgEarth;
 
 namespace
 {
+    // Ids for the WKT of every live SRS. SRS objects with the same WKT share an
+    // id; an id is retired when its last SRS is destroyed and is never reused.
+    struct WKTRegistry
+    {
+        struct Entry { unsigned _id, _refs; };
+        typedef std::map<std::string, Entry> Entries;
+
+        Threading::Mutex    _mutex;
+        Entries             _entries;
+        std::set<unsigned>  _live;
+        unsigned            _nextId;
+        OpenThreads::Atomic _retired; // bumped each time an id retires
+
+        WKTRegistry() : _nextId(0u) { }
+
+        unsigned acquire(const std::string& wkt)
+        {
+            if (wkt.empty())
+                return 0u;
+            Threading::ScopedMutexLock lock(_mutex);
+            Entries::iterator i = _entries.find(wkt);
+            if (i == _entries.end())
+            {
+                Entry e = { ++_nextId, 0u };
+                i = _entries.insert(Entries::value_type(wkt, e)).first;
+                _live.insert(e._id);
+            }
+            ++i->second._refs;
+            return i->second._id;
+        }
+
+        void release(const std::string& wkt)
+        {
+            Threading::ScopedMutexLock lock(_mutex);
+            Entries::iterator i = _entries.find(wkt);
+            if (i != _entries.end() && --i->second._refs == 0u)
+            {
+                _live.erase(i->second._id);
+                _entries.erase(i);
+                ++_retired;
+            }
+        }
+    };
+
+    // never destroyed, since SRS objects may outlive static destruction
+    WKTRegistry& wktRegistry()
+    {
+        static WKTRegistry* s_registry = new WKTRegistry();
+        return *s_registry;
+    }
+
+    // One thread's OGR transformation handles, keyed by (source, target) WKT id.
+    // A handle is only used by the thread that created it, so transforms need no
+    // lock. Handles for retired ids are dropped the next time the thread looks
+    // one up, and the rest when the thread exits.
+    struct TransformHandles
+    {
+        typedef std::map<std::pair<unsigned, unsigned>, void*> Handles;
+        Handles  _handles;
+        unsigned _retired;
+
+        TransformHandles() : _retired(wktRegistry()._retired) { }
+
+        ~TransformHandles()
+        {
+            for (Handles::iterator i = _handles.begin(); i != _handles.end(); ++i)
+            {
+                if (i->second)
+                    OCTDestroyCoordinateTransformation(i->second);
+            }
+        }
+
+        void dropRetired()
+        {
+            WKTRegistry& registry = wktRegistry();
+            _retired = registry._retired;
+
+            Threading::ScopedMutexLock lock(registry._mutex);
+            for (Handles::iterator i = _handles.begin(); i != _handles.end(); )
+            {
+                if (registry._live.count(i->first.first) == 0 || registry._live.count(i->first.second) == 0)
+                {
+                    if (i->second)
+                        OCTDestroyCoordinateTransformation(i->second);
+                    _handles.erase(i++);
+                }
+                else ++i;
+            }
+        }
+    };
+
+    void OE_THREAD_LOCAL_CLEANUP destroyTransformHandles(void* ptr)
+    {
+        delete static_cast<TransformHandles*>(ptr);
+    }
+
+    // The calling thread's handles. Looking them up takes no lock.
+    TransformHandles& getTransformHandles()
+    {
+        static Threading::ThreadLocalPointer* s_handles = new Threading::ThreadLocalPointer(destroyTransformHandles);
+
+        TransformHandles* handles = static_cast<TransformHandles*>(s_handles->get());
+        if (!handles)
+        {
+            handles = new TransformHandles();
+            s_handles->set(handles);
+        }
+        else if (handles->_retired != (unsigned)wktRegistry()._retired)
+        {
+            handles->dropRetired();
+        }
+        return *handles;
+    }
+
     std::string
     getOGRAttrValue( void* _handle, const std::string& name, int child_num, bool lowercase =false)
     {
@@ -74,6 +193,195 @@ namespace
             points[i].set( osg::RadiansToDegrees(lon), osg::RadiansToDegrees(lat), alt );
         }
     }
+
+    // Closed-form kernels for the SRS pairs that dominate real use, so they
+    // don't have to go through OGR. Each works in place on contiguous x/y
+    // arrays; the loops carry no dependencies so the compiler can vectorize
+    // them where the math library allows.
+    namespace FastPath
+    {
+        const double WGS84_A = 6378137.0;
+        const double WGS84_F = 1.0/298.257223563;
+        const double UTM_K0  = 0.9996;
+        const double UTM_FE  = 500000.0;
+        const double UTM_FN_SOUTH = 10000000.0;
+
+        // PROJ normalizes longitudes to [-180..180] on the way in and out
+        inline double wrapLongitude(double lon)
+        {
+            return fabs(lon) <= 180.0 ? lon : lon - 360.0*floor((lon+180.0)/360.0);
+        }
+
+        // spherical (web) mercator <-> long/lat degrees
+        void geographicToSphericalMercator(double* x, double* y, unsigned count)
+        {
+            const double r = osg::DegreesToRadians(1.0);
+            for(unsigned i=0; i<count; ++i)
+            {
+                double lat = osg::clampBetween(y[i], -89.999999, 89.999999);
+                x[i] = WGS84_A * r * wrapLongitude(x[i]);
+                y[i] = WGS84_A * log(tan(osg::PI_4 + 0.5*r*lat));
+            }
+        }
+
+        void sphericalMercatorToGeographic(double* x, double* y, unsigned count)
+        {
+            const double d = osg::RadiansToDegrees(1.0);
+            for(unsigned i=0; i<count; ++i)
+            {
+                x[i] = wrapLongitude(d * x[i] / WGS84_A);
+                y[i] = d * (2.0*atan(exp(y[i]/WGS84_A)) - osg::PI_2);
+            }
+        }
+
+        // Transverse mercator by Kruger's series to 6th order in n
+        // (Karney, "Transverse Mercator with an accuracy of a few nanometers", 2011).
+        // Same method as PROJ's default (extended) tmerc.
+        struct UTMSeries
+        {
+            double e, A, alpha[7], beta[7];
+
+            UTMSeries()
+            {
+                double n = WGS84_F/(2.0-WGS84_F);
+                double n2=n*n, n3=n2*n, n4=n3*n, n5=n4*n, n6=n5*n;
+                e = sqrt(WGS84_F*(2.0-WGS84_F));
+                A = WGS84_A/(1.0+n) * (1.0 + n2/4.0 + n4/64.0 + n6/256.0);
+
+                alpha[0] = 0.0;
+                alpha[1] = n/2.0 - 2.0*n2/3.0 + 5.0*n3/16.0 + 41.0*n4/180.0 - 127.0*n5/288.0 + 7891.0*n6/37800.0;
+                alpha[2] = 13.0*n2/48.0 - 3.0*n3/5.0 + 557.0*n4/1440.0 + 281.0*n5/630.0 - 1983433.0*n6/1935360.0;
+                alpha[3] = 61.0*n3/240.0 - 103.0*n4/140.0 + 15061.0*n5/26880.0 + 167603.0*n6/181440.0;
+                alpha[4] = 49561.0*n4/161280.0 - 179.0*n5/168.0 + 6601661.0*n6/7257600.0;
+                alpha[5] = 34729.0*n5/80640.0 - 3418889.0*n6/1995840.0;
+                alpha[6] = 212378941.0*n6/319334400.0;
+
+                beta[0] = 0.0;
+                beta[1] = n/2.0 - 2.0*n2/3.0 + 37.0*n3/96.0 - n4/360.0 - 81.0*n5/512.0 + 96199.0*n6/604800.0;
+                beta[2] = n2/48.0 + n3/15.0 - 437.0*n4/1440.0 + 46.0*n5/105.0 - 1118711.0*n6/3870720.0;
+                beta[3] = 17.0*n3/480.0 - 37.0*n4/840.0 - 209.0*n5/4480.0 + 5569.0*n6/90720.0;
+                beta[4] = 4397.0*n4/161280.0 - 11.0*n5/504.0 - 830251.0*n6/7257600.0;
+                beta[5] = 4583.0*n5/161280.0 - 108847.0*n6/3991680.0;
+                beta[6] = 20648693.0*n6/638668800.0;
+            }
+        };
+
+        const UTMSeries& utmSeries()
+        {
+            static UTMSeries s_series;
+            return s_series;
+        }
+
+        inline double atanh_(double x) { return 0.5*log((1.0+x)/(1.0-x)); }
+
+        void geographicToUTM(double* x, double* y, unsigned count, int zone)
+        {
+            const UTMSeries& s = utmSeries();
+            const double lon0 = (double)(abs(zone)*6 - 183);
+            const double kA = UTM_K0 * s.A;
+            const double fn = zone < 0 ? UTM_FN_SOUTH : 0.0;
+
+            for(unsigned i=0; i<count; ++i)
+            {
+                double phi = osg::DegreesToRadians(y[i]);
+                double lam = osg::DegreesToRadians(wrapLongitude(x[i] - lon0));
+                double sinphi = sin(phi);
+                double t = sinh(atanh_(sinphi) - s.e*atanh_(s.e*sinphi));
+                double xip = atan2(t, cos(lam));
+                double etap = atanh_(sin(lam)/sqrt(1.0+t*t));
+
+                double xi = xip, eta = etap;
+                for(int j=1; j<=6; ++j)
+                {
+                    xi  += s.alpha[j] * sin(2.0*j*xip) * cosh(2.0*j*etap);
+                    eta += s.alpha[j] * cos(2.0*j*xip) * sinh(2.0*j*etap);
+                }
+
+                x[i] = UTM_FE + kA*eta;
+                y[i] = fn + kA*xi;
+            }
+        }
+
+        void utmToGeographic(double* x, double* y, unsigned count, int zone)
+        {
+            const UTMSeries& s = utmSeries();
+            const double lon0 = (double)(abs(zone)*6 - 183);
+            const double kA = UTM_K0 * s.A;
+            const double fn = zone < 0 ? UTM_FN_SOUTH : 0.0;
+            const double e2 = s.e*s.e;
+
+            for(unsigned i=0; i<count; ++i)
+            {
+                double xi  = (y[i] - fn)/kA;
+                double eta = (x[i] - UTM_FE)/kA;
+
+                double xip = xi, etap = eta;
+                for(int j=1; j<=6; ++j)
+                {
+                    xip  -= s.beta[j] * sin(2.0*j*xi) * cosh(2.0*j*eta);
+                    etap -= s.beta[j] * cos(2.0*j*xi) * sinh(2.0*j*eta);
+                }
+
+                double sinhetap = sinh(etap), cosxip = cos(xip);
+                double taup = sin(xip)/sqrt(sinhetap*sinhetap + cosxip*cosxip);
+                double lam = atan2(sinhetap, cosxip);
+
+                // solve for tan(phi) by Newton's method; converges in 2-3 steps
+                double tau = taup;
+                for(int k=0; k<5; ++k)
+                {
+                    double s1 = sqrt(1.0+tau*tau);
+                    double sig = sinh(s.e*atanh_(s.e*tau/s1));
+                    double taui = tau*sqrt(1.0+sig*sig) - sig*s1;
+                    double dtau = (taup-taui)/sqrt(1.0+taui*taui) * (1.0+(1.0-e2)*tau*tau) / ((1.0-e2)*s1);
+                    tau += dtau;
+                    if (fabs(dtau) < 1e-14)
+                        break;
+                }
+
+                x[i] = wrapLongitude(lon0 + osg::RadiansToDegrees(lam));
+                y[i] = osg::RadiansToDegrees(atan(tau));
+            }
+        }
+
+        // parses a PROJ4 string into key/value pairs ("+south" => "south":"")
+        void parseProj4(const std::string& proj4, std::map<std::string,std::string>& out)
+        {
+            StringTokenizer tok(" ", "");
+            StringVector tokens;
+            tok.tokenize(proj4, tokens);
+            for(StringVector::const_iterator i = tokens.begin(); i != tokens.end(); ++i)
+            {
+                if (i->empty() || (*i)[0] != '+')
+                    continue;
+                std::string::size_type eq = i->find('=');
+                if (eq == std::string::npos)
+                    out[toLower(i->substr(1))] = "";
+                else
+                    out[toLower(i->substr(1, eq-1))] = toLower(i->substr(eq+1));
+            }
+        }
+
+        bool isZero(const std::string& value)
+        {
+            if (value.empty())
+                return true;
+            StringVector parts;
+            StringTokenizer(value, parts, ",", "", false, true);
+            for(StringVector::const_iterator i = parts.begin(); i != parts.end(); ++i)
+                if (as<double>(*i, 1.0) != 0.0)
+                    return false;
+            return true;
+        }
+
+        // true if the parameters describe WGS84 with no datum shift
+        bool isWGS84(std::map<std::string,std::string>& p)
+        {
+            if (p.count("datum"))
+                return p["datum"] == "wgs84" && isZero(p["towgs84"]);
+            return p["ellps"] == "wgs84" && isZero(p["towgs84"]);
+        }
+    }
 }
 
 //------------------------------------------------------------------------
@@ -381,7 +689,10 @@ _is_contiguous  ( false ),
 _is_user_defined( false ),
 _is_ltp         ( false ),
 _is_spherical_mercator( false ),
-_ellipsoidId(0u)
+_ellipsoidId(0u),
+_fastPath(FAST_PATH_NONE),
+_utmZone(0),
+_wktId(0u)
 {
     // nop
 }
@@ -401,7 +712,10 @@ _is_contiguous  ( false ),
 _is_user_defined( false ),
 _is_ltp         ( false ),
 _is_spherical_mercator( false ),
-_ellipsoidId(0u)
+_ellipsoidId(0u),
+_fastPath(FAST_PATH_NONE),
+_utmZone(0),
+_wktId(0u)
 {
     //nop
 }
@@ -419,11 +733,6 @@ SpatialReference::~SpatialReference()
             OE_DEBUG << LC << "Destroying [unitialized SRS]" << std::endl;
         }
 
-        for (TransformHandleCache::iterator itr = _transformHandleCache.begin(); itr != _transformHandleCache.end(); ++itr)
-        {
-            OCTDestroyCoordinateTransformation(itr->second);
-        }
-
         if ( _owns_handle )
         {
             OSRDestroySpatialReference( _handle );
@@ -431,6 +740,11 @@ SpatialReference::~SpatialReference()
 
         _handle = NULL;
     }
+
+    if ( _wktId )
+    {
+        wktRegistry().release( _wkt );
+    }
 }
 
 bool
@@ -1102,31 +1416,74 @@ SpatialReference::transform2D(double x, double y,
 }
 
 
+bool
+SpatialReference::transformXYPointArraysFast(double*  x,
+                                             double*  y,
+                                             unsigned count,
+                                             const SpatialReference* out_srs) const
+{
+    if ( !_initialized )
+        const_cast<SpatialReference*>(this)->init();
+    if ( !out_srs->_initialized )
+        const_cast<SpatialReference*>(out_srs)->init();
+
+    // subclasses may reinterpret coordinates, so leave them to OGR
+    if ( _fastPath == FAST_PATH_NONE || out_srs->_fastPath == FAST_PATH_NONE ||
+         _is_user_defined || out_srs->_is_user_defined )
+    {
+        return false;
+    }
+
+    // to long/lat:
+    if ( _fastPath == FAST_PATH_SPHERICAL_MERCATOR )
+        FastPath::sphericalMercatorToGeographic( x, y, count );
+    else if ( _fastPath == FAST_PATH_UTM )
+        FastPath::utmToGeographic( x, y, count, _utmZone );
+
+    // and on to the output:
+    if ( out_srs->_fastPath == FAST_PATH_SPHERICAL_MERCATOR )
+        FastPath::geographicToSphericalMercator( x, y, count );
+    else if ( out_srs->_fastPath == FAST_PATH_UTM )
+        FastPath::geographicToUTM( x, y, count, out_srs->_utmZone );
+
+    return true;
+}
+
 bool
 SpatialReference::transformXYPointArrays(double*  x,
                                          double*  y,
                                          unsigned count,
                                          const SpatialReference* out_srs) const
 {  
-    // Transform the X and Y values inside an exclusive GDAL/OGR lock
-    GDAL_SCOPED_LOCK;
+    if ( transformXYPointArraysFast(x, y, count, out_srs) )
+        return true;
 
     //OE_INFO << LC << "Attempt transfrom from \n"
     //    << "    " << getHorizInitString() << "\n"
     //    << " -> " << out_srs->getHorizInitString() << std::endl;
 
+    // This thread's own transformation handle, so no global lock is needed to use it.
+    // SRS objects without a WKT id get a handle just for this call.
+    bool cacheable = _wktId != 0u && out_srs->_wktId != 0u;
+    TransformHandles::Handles* cache = cacheable ? &getTransformHandles()._handles : 0L;
+    std::pair<unsigned, unsigned> cacheKey(_wktId, out_srs->_wktId);
+
     void* xform_handle = NULL;
-    TransformHandleCache::const_iterator itr = _transformHandleCache.find(out_srs->getWKT());
-    if (itr != _transformHandleCache.end())
+    TransformHandles::Handles::const_iterator itr;
+    if (cache && (itr = cache->find(cacheKey)) != cache->end())
     {
         //OE_DEBUG << LC << "using cached transform handle" << std::endl;
         xform_handle = itr->second;
     }
     else
     {
+        // Creating the handle reads both OGR spatial references, so lock for that.
+        // The handle keeps its own copies of them.
+        GDAL_SCOPED_LOCK;
         OE_DEBUG << LC << "allocating new OCT Transform" << std::endl;
         xform_handle = OCTNewCoordinateTransformation( _handle, out_srs->_handle);
-        const_cast<SpatialReference*>(this)->_transformHandleCache[out_srs->getWKT()] = xform_handle;
+        if (cache)
+            (*cache)[cacheKey] = xform_handle;
     }
 
     if ( !xform_handle )
@@ -1144,7 +1501,12 @@ SpatialReference::transformXYPointArrays(double*  x,
         return false;
     }
 
-    return OCTTransform( xform_handle, count, x, y, 0L ) > 0;
+    bool ok = OCTTransform( xform_handle, count, x, y, 0L ) > 0;
+
+    if (!cache)
+        OCTDestroyCoordinateTransformation(xform_handle);
+
+    return ok;
 }
 
 
@@ -1550,6 +1912,12 @@ SpatialReference::_init()
         CPLFree( wktbuf );
     }
 
+    // Share per-thread transformation handles with every SRS that has this WKT.
+    if ( _wktId == 0u )
+    {
+        _wktId = wktRegistry().acquire( _wkt );
+    }
+
     // Build a 'normalized' initialization key.
     if ( !_proj4.empty() )
     {
@@ -1569,6 +1937,64 @@ SpatialReference::_init()
         _key.vertLower = toLower(_key.vert);
     }
 
+    // Detect the SRS types that have closed-form transforms. Any parameter
+    // we don't know about rules the fast path out.
+    _fastPath = FAST_PATH_NONE;
+    _utmZone = 0;
+    if ( !_proj4.empty() )
+    {
+        std::map<std::string,std::string> p;
+        FastPath::parseProj4(_proj4, p);
+
+        static const char* known[] = {
+            "proj", "datum", "ellps", "a", "b", "r", "lat_ts", "lon_0", "x_0", "y_0", "k", "k_0",
+            "units", "nadgrids", "towgs84", "wktext", "no_defs", "zone", "south", "type", 0L };
+
+        bool allKnown = true;
+        for(std::map<std::string,std::string>::const_iterator i = p.begin(); i != p.end() && allKnown; ++i)
+        {
+            allKnown = false;
+            for(unsigned k=0; known[k] && !allKnown; ++k)
+                allKnown = (i->first == known[k]);
+        }
+
+        if ( allKnown && (p["units"].empty() || p["units"] == "m") )
+        {
+            const std::string& proj = p["proj"];
+
+            if ( (proj == "longlat" || proj == "latlong") && p["nadgrids"].empty() && FastPath::isWGS84(p) )
+            {
+                _fastPath = FAST_PATH_GEOGRAPHIC;
+            }
+
+            else if (
+                proj == "merc" &&
+                p["nadgrids"] == "@null" &&
+                ( (as<double>(p["a"], 0.0) == FastPath::WGS84_A && as<double>(p["b"], 0.0) == FastPath::WGS84_A) ||
+                  as<double>(p["r"], 0.0) == FastPath::WGS84_A ) &&
+                FastPath::isZero(p["lat_ts"]) && FastPath::isZero(p["lon_0"]) &&
+                FastPath::isZero(p["x_0"]) && FastPath::isZero(p["y_0"]) &&
+                as<double>(p["k"], 1.0) == 1.0 && as<double>(p["k_0"], 1.0) == 1.0 &&
+                FastPath::isZero(p["towgs84"]) )
+            {
+                _fastPath = FAST_PATH_SPHERICAL_MERCATOR;
+            }
+
+            else if (
+                proj == "utm" &&
+                p["nadgrids"].empty() && 
+                FastPath::isWGS84(p) )
+            {
+                int zone = as<int>(p["zone"], 0);
+                if ( zone >= 1 && zone <= 60 )
+                {
+                    _fastPath = FAST_PATH_UTM;
+                    _utmZone = p.count("south") ? -zone : zone;
+                }
+            }
+        }
+    }
+
     _initialized = true;
 }
 
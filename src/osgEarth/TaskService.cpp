@@ -17,6 +17,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include <osgEarth/TaskService>
+#include <osg/Math>
 
 using namespace osgEarth;
 using namespace OpenThreads;
@@ -67,120 +68,325 @@ TaskRequest::wasCanceled() const
 
 //------------------------------------------------------------------------
 
-TaskRequestQueue::TaskRequestQueue(unsigned int maxSize) :
+TaskRequestQueue::Slot::Slot(OpenThreads::Atomic& numRequests) :
+_numRequests( numRequests ),
+_bestBucket( NUM_PRIORITY_BUCKETS )
+{
+    //nop
+}
+
+void
+TaskRequestQueue::Slot::updateBestBucket()
+{
+    int b = 0;
+    while( b < NUM_PRIORITY_BUCKETS && _buckets[b].empty() )
+        ++b;
+    _bestBucket = b;
+}
+
+void
+TaskRequestQueue::Slot::push( TaskRequest* request )
+{
+    unsigned int b = getPriorityBucket( request->getPriority() );
+    ScopedLock<Mutex> lock( _mutex );
+    _buckets[b].push_back( request );
+    ++_numRequests;
+    if ( (int)b < _bestBucket )
+        _bestBucket = b;
+}
+
+bool
+TaskRequestQueue::Slot::pop( osg::ref_ptr<TaskRequest>& out )
+{
+    ScopedLock<Mutex> lock( _mutex );
+    int b = _bestBucket;
+    if ( b >= NUM_PRIORITY_BUCKETS )
+        return false;
+
+    out = _buckets[b].front();
+    _buckets[b].pop_front();
+    --_numRequests;
+    if ( _buckets[b].empty() )
+        updateBestBucket();
+    return true;
+}
+
+void
+TaskRequestQueue::Slot::drain( TaskRequestList& out )
+{
+    ScopedLock<Mutex> lock( _mutex );
+    for( int b = 0; b < NUM_PRIORITY_BUCKETS; ++b )
+    {
+        for( unsigned int i = 0; i < _buckets[b].size(); ++i )
+            --_numRequests;
+        out.insert( out.end(), _buckets[b].begin(), _buckets[b].end() );
+        _buckets[b].clear();
+    }
+    _bestBucket = NUM_PRIORITY_BUCKETS;
+}
+
+//------------------------------------------------------------------------
+
+TaskRequestQueue::TaskRequestQueue(unsigned int maxSize, unsigned int numSlots) :
 osg::Referenced( true ),
 _done( false ),
+_poisoned( false ),
 _maxSize( maxSize ),
+_numReserved( 0u ),
+_numWorkers( 0u ),
 _stamp(0)
 {
-    //nop
+    if ( numSlots == 0 )
+        numSlots = osg::maximum( 1, OpenThreads::GetNumberOfProcessors() );
+
+    _slots.resize( numSlots );
+    for( unsigned int i = 0; i < numSlots; ++i )
+        _slots[i] = new Slot( _numRequests );
+}
+
+TaskRequestQueue::~TaskRequestQueue()
+{
+    for( unsigned int i = 0; i < _slots.size(); ++i )
+        delete _slots[i];
+}
+
+unsigned int
+TaskRequestQueue::getPriorityBucket( float priority )
+{
+    // Squash the (unbounded) priority into [0..1) so that any value maps to a
+    // bucket, with the most resolution around zero where most callers live.
+    // Order is preserved: a lower priority value never lands in a later bucket.
+    if ( !(priority == priority) ) // NaN
+        return NUM_PRIORITY_BUCKETS-1;
+
+    double t = 0.5 + atan( (double)priority ) / osg::PI;
+    int b = (int)( t * (double)NUM_PRIORITY_BUCKETS );
+    return (unsigned int)osg::clampBetween( b, 0, (int)NUM_PRIORITY_BUCKETS-1 );
 }
 
 void
 TaskRequestQueue::clear()
 {
-    ScopedLock<Mutex> lock(_mutex);
-    _requests.clear();
+    TaskRequestList dropped;
+    for( unsigned int i = 0; i < _slots.size(); ++i )
+        _slots[i]->drain( dropped );
+
+    releaseRoom( dropped.size() ); // wakes blocked producers
 }
 
 void
 TaskRequestQueue::cancel()
 {
-    ScopedLock<Mutex> lock(_mutex);
-    for (TaskRequestPriorityMap::iterator it = _requests.begin(); it != _requests.end(); ++it)
-        (*it).second->cancel();
+    TaskRequestList dropped;
+    for( unsigned int i = 0; i < _slots.size(); ++i )
+        _slots[i]->drain( dropped );
+
+    for( TaskRequestList::iterator it = dropped.begin(); it != dropped.end(); ++it )
+    {
+        (*it)->cancel();
+    }
 
-    _requests.clear();
+    releaseRoom( dropped.size() ); // wakes blocked producers
 }
 
 bool
 TaskRequestQueue::isFull() const
 {
-    return _maxSize > 0 && (_maxSize == _requests.size());
+    return _maxSize > 0 && (_numReserved >= _maxSize);
 }
 
 bool
 TaskRequestQueue::isEmpty() const
 {
-    return !_done && _requests.empty();
+    return !_done && ((unsigned)_numRequests == 0u);
 }
 
 unsigned int
 TaskRequestQueue::getNumRequests() const
 {
-    ScopedLock<Mutex> lock(const_cast<TaskRequestQueue*>(this)->_mutex);
-    return _requests.size();
+    return _numRequests;
 }
 
 void 
 TaskRequestQueue::add( TaskRequest* request )
 {
+    // If the caller is one of our own worker threads, keep the new work local
+    // to that worker; otherwise spread it round-robin across the slots.
+    TaskThread* worker = dynamic_cast<TaskThread*>( OpenThreads::Thread::CurrentThread() );
+    if ( worker && worker->getQueue() == this )
+    {
+        add( request, worker->getSlot() );
+    }
+    else
+    {
+        add( request, (unsigned)(++_nextSlot) );
+    }
+}
+
+void 
+TaskRequestQueue::add( TaskRequest* request, unsigned int slot )
+{
+    // A poison pill isn't queued; it tells the workers to exit once the queue
+    // runs dry, and get() hands each of them a pill of its own at that point.
+    if ( dynamic_cast<PoisonPill*>( request ) )
+    {
+        osg::ref_ptr<TaskRequest> pill = request; // in case the caller didn't hold a reference
+        ScopedLock<Mutex> lock( _sleepMutex );
+        _poisoned = true;
+        for(int i=0; i<128; i++) // see setDone()
+            _notEmpty.signal();
+        return;
+    }
+
     request->setState( TaskRequest::STATE_PENDING );
 
     // install a progress callback if one isn't already installed
     if ( !request->getProgressCallback() )
         request->setProgressCallback( new ProgressCallback() );
 
+    // bounded queue: block until there is room, and take it under the lock
+    // so that concurrent producers can't all squeeze past a full queue.
+    if ( _maxSize > 0 )
+    {
+        ScopedLock<Mutex> lock( _sleepMutex );
+        if ( isFull() )
+        {
+            ++_numSleepingProducers;
+            while( isFull() && !_done )
+            {
+                _notFull.wait( &_sleepMutex );
+            }
+            --_numSleepingProducers;
+        }
+        ++_numReserved;
+    }
+
+    _slots[slot % _slots.size()]->push( request );
+
+    // since there is data in the queue, wake up one sleeping task thread.
+    // (Taking the lock here closes the window between a worker's final
+    // emptiness check and its wait.)
+    if ( (unsigned)_numSleepingWorkers > 0u )
     {
-        // Lock on the add mutex so no one else can add.
-        ScopedLock<Mutex> lock( _mutex );
+        ScopedLock<Mutex> lock( _sleepMutex );
+        _notEmpty.signal();
+    }
+}
+
+bool
+TaskRequestQueue::tryGet( unsigned int slot, osg::ref_ptr<TaskRequest>& out )
+{
+    unsigned int numSlots = _slots.size();
+    unsigned int home = slot % numSlots;
 
-        while(isFull())
+    // Find the slot advertising the best priority bucket, preferring our own
+    // slot on a tie. The hints are read without locking so this is approximate.
+    unsigned int best = home;
+    int bestBucket = _slots[home]->_bestBucket;
+    for( unsigned int i = 1; i < numSlots && bestBucket > 0; ++i )
+    {
+        unsigned int s = (home + i) % numSlots;
+        int b = _slots[s]->_bestBucket;
+        if ( b < bestBucket )
         {
-            _notFull.wait(&_mutex);
+            best = s;
+            bestBucket = b;
         }
+    }
+
+    if ( bestBucket < NUM_PRIORITY_BUCKETS && _slots[best]->pop( out ) )
+    {
+        if ( best != home )
+            ++_numSteals;
+        return true;
+    }
 
-        // Check to make sure the bounded queue is working correctly.
-        if (_maxSize > 0 && _requests.size() > _maxSize)
+    // the hint was stale; sweep every slot once.
+    for( unsigned int i = 0; i < numSlots; ++i )
+    {
+        unsigned int s = (home + i) % numSlots;
+        if ( _slots[s]->pop( out ) )
         {
-            OE_NOTICE << "ERROR:  TaskRequestQueue requests " << getNumRequests() << " > max size of " << _maxSize << std::endl;
+            if ( s != home )
+                ++_numSteals;
+            return true;
         }
+    }
+
+    return false;
+}
 
-        // insert by priority.
-        _requests.insert( std::pair<float,TaskRequest*>(request->getPriority(), request) );
+void
+TaskRequestQueue::releaseRoom( unsigned int count )
+{
+    if ( _maxSize > 0 && count > 0u )
+    {
+        ScopedLock<Mutex> lock( _sleepMutex );
+        _numReserved -= osg::minimum( count, _numReserved );
+        for( unsigned int i = 0; i < count && i < (unsigned)_numSleepingProducers; ++i )
+            _notFull.signal();
     }
+}
 
-    //OE_NOTICE << "There are now " << _requests.size() << " tasks" << std::endl;
+void
+TaskRequestQueue::addWorker()
+{
+    ScopedLock<Mutex> lock( _sleepMutex );
+    ++_numWorkers;
+}
 
-    // since there is data in the queue, wake up one waiting task thread.
-    _notEmpty.signal(); 
+void
+TaskRequestQueue::removeWorker()
+{
+    // The last worker out spends any outstanding pill, so threads added
+    // later by TaskService::setNumThreads() don't exit straight away.
+    ScopedLock<Mutex> lock( _sleepMutex );
+    if ( _numWorkers > 0u && --_numWorkers == 0u )
+        _poisoned = false;
 }
 
 TaskRequest* 
-TaskRequestQueue::get()
+TaskRequestQueue::get( unsigned int slot )
 {
-    
     osg::ref_ptr<TaskRequest> next;
+
+    while( !_done )
     {
-        ScopedLock<Mutex> lock(_mutex);
+        if ( tryGet( slot, next ) )
+        {
+            // I'm done, someone else take a turn:
+            releaseRoom( 1u );
 
-        while ( isEmpty() )
-        {                
-            _notEmpty.wait( &_mutex );        
+            return next.release();
         }
 
-        if ( _done )
+        // Out of work after a poison pill: this worker is done, and leaves
+        // the queue before the next one checks.
+        if ( _poisoned )
         {
-            return 0L;
+            removeWorker();
+            next = new PoisonPill();
+            return next.release();
         }
 
-        next = _requests.begin()->second.get(); //_requests.front();
-        _requests.erase( _requests.begin() ); //_requests.pop_front();
+        // Nothing to do; sleep until a producer wakes us up.
+        ScopedLock<Mutex> lock( _sleepMutex );
+        ++_numSleepingWorkers;
+        while( isEmpty() && !_poisoned )
+        {
+            _notEmpty.wait( &_sleepMutex );
+        }
+        --_numSleepingWorkers;
     }
 
-    // I'm done, someone else take a turn:
-    // (technically this shouldn't be necessary since add() bumps the semaphore once
-    // for each request in the queue)    
-    _notFull.signal();    
-
-    return next.release();
+    return 0L;
 }
 
 void
 TaskRequestQueue::setDone()
 {
     // we need to obtain the mutex since we're using the Condition
-    ScopedLock<Mutex> lock(_mutex);
+    ScopedLock<Mutex> lock(_sleepMutex);
 
     _done = true;
 
@@ -196,31 +402,38 @@ TaskRequestQueue::setDone()
 
 //------------------------------------------------------------------------
 
-TaskThread::TaskThread( TaskRequestQueue* queue ) :
+TaskThread::TaskThread( TaskRequestQueue* queue, unsigned int slot ) :
 _queue( queue ),
+_slot( slot ),
 _done( false )
 {
-    //nop
+    // count the worker now rather than in run(), so that a pill added
+    // before the thread gets going still reaches it.
+    _queue->addWorker();
 }
 
 void
 TaskThread::run()
 {
+    bool poisoned = false;
+
     while( !_done )
     {
-        _request = _queue->get();
+        _request = _queue->get( _slot );
 
         if ( _done )
             break;
 
         if (_request.valid())
         { 
+            // the queue only hands out a pill once there is no work left,
+            // and every worker gets its own.
             PoisonPill* poison = dynamic_cast< PoisonPill* > ( _request.get());
             if ( poison )
             {
                 OE_DEBUG << this->getThreadId() << " received poison pill.  Shutting down" << std::endl;
-                // Add the poison pill back to the queue to kill any other threads.  If I'm going down, you're all going down with me!
-                _queue->add( poison );
+                _request = 0;
+                poisoned = true;
                 break;
             }
             
@@ -257,6 +470,10 @@ TaskThread::run()
         }
         
     }
+
+    // the queue already let go of a worker it poisoned.
+    if ( !poisoned )
+        _queue->removeWorker();
 }
 
 int
@@ -285,9 +502,12 @@ TaskService::TaskService( const std::string& name, int numThreads, unsigned int
 osg::Referenced( true ),
 _lastRemoveFinishedThreadsStamp(0),
 _name(name),
-_numThreads( 0 )
+_numThreads( 0 ),
+_nextThreadSlot( 0u )
 {
-    _queue = new TaskRequestQueue( maxSize );
+    // one work-stealing slot per core (or per thread if there are more threads)
+    unsigned int numSlots = (unsigned)osg::maximum( numThreads, OpenThreads::GetNumberOfProcessors() );
+    _queue = new TaskRequestQueue( maxSize, numSlots );
     setNumThreads( numThreads );
 }
 
@@ -393,7 +613,7 @@ TaskService::adjustThreadCount()
         //We need to add some threads
         for (int i = 0; i < diff; ++i)
         {
-            TaskThread* thread = new TaskThread( _queue.get() );
+            TaskThread* thread = new TaskThread( _queue.get(), _nextThreadSlot++ );
             _threads.push_back( thread );
             thread->start();
         }       
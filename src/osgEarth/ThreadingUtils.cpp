@@ -20,9 +20,14 @@
 
 #ifdef _WIN32
     extern "C" unsigned long __stdcall GetCurrentThreadId();
+    extern "C" unsigned long __stdcall FlsAlloc(void (__stdcall *)(void*));
+    extern "C" int __stdcall FlsFree(unsigned long);
+    extern "C" void* __stdcall FlsGetValue(unsigned long);
+    extern "C" int __stdcall FlsSetValue(unsigned long, void*);
 #elif defined(__APPLE__) || defined(__LINUX__) || defined(__FreeBSD__) || defined(__FreeBSD_kernel__) || defined(__ANDROID__)
 #   include <unistd.h>
 #   include <sys/syscall.h>
+#   include <pthread.h>
 #else
 #   include <pthread.h>
 #endif
@@ -56,6 +61,59 @@ unsigned osgEarth::Threading::getCurrentThreadId()
 
 //...................................................................
 
+#ifdef _WIN32
+
+// Fiber-local storage behaves like thread-local storage for threads that do
+// not use fibers, and unlike TlsAlloc it calls a cleanup function on exit.
+ThreadLocalPointer::ThreadLocalPointer(Cleanup cleanup) :
+_key(FlsAlloc(cleanup))
+{
+    //nop
+}
+
+ThreadLocalPointer::~ThreadLocalPointer()
+{
+    FlsFree(_key);
+}
+
+void* ThreadLocalPointer::get() const
+{
+    return FlsGetValue(_key);
+}
+
+void ThreadLocalPointer::set(void* value)
+{
+    FlsSetValue(_key, value);
+}
+
+#else
+
+ThreadLocalPointer::ThreadLocalPointer(Cleanup cleanup)
+{
+    pthread_key_t key;
+    pthread_key_create(&key, cleanup);
+    _key = (unsigned long)key;
+}
+
+ThreadLocalPointer::~ThreadLocalPointer()
+{
+    pthread_key_delete((pthread_key_t)_key);
+}
+
+void* ThreadLocalPointer::get() const
+{
+    return pthread_getspecific((pthread_key_t)_key);
+}
+
+void ThreadLocalPointer::set(void* value)
+{
+    pthread_setspecific((pthread_key_t)_key, value);
+}
+
+#endif
+
+//...................................................................
+
 Event::Event() :
 _set(false)
 {
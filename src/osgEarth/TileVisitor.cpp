@@ -19,6 +19,21 @@
 #include <osgEarth/TileVisitor>
 #include <osgEarth/CacheEstimator>
 #include <osgEarth/FileUtils>
+#include <osgEarth/StringUtils>
+#include <osgDB/FileUtils>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define OSGEARTH_HAVE_WORKER_PROCESSES 1
+#endif
 
 #if OSG_VERSION_GREATER_OR_EQUAL(3,5,10)
 #include <osg/os_utils>
@@ -332,9 +347,156 @@ const TileKeyList& TaskList::getKeys() const
 }
 
 /*****************************************************************************************/
+
+#ifdef OSGEARTH_HAVE_WORKER_PROCESSES
+
+/**
+ * A long-lived worker process, fed keys through a pipe to its standard input.
+ */
+struct MultiprocessTileVisitor::Worker : public osg::Referenced
+{
+    Worker( const std::string& command ) :
+        _command( command ), _pid( -1 ), _toWorker( 0L ), _fromWorker( 0L ) { }
+
+    ~Worker()
+    {
+        stop();
+    }
+
+    bool start()
+    {
+        return launch() && waitFor("ready");
+    }
+
+    bool launch()
+    {
+        int toWorker[2], fromWorker[2];
+        if (pipe(toWorker) != 0)
+            return false;
+        if (pipe(fromWorker) != 0)
+        {
+            close(toWorker[0]); close(toWorker[1]);
+            return false;
+        }
+
+        // Keep our ends out of the other workers, or closing a worker's input
+        // would never reach it.
+        fcntl(toWorker[1], F_SETFD, FD_CLOEXEC);
+        fcntl(fromWorker[0], F_SETFD, FD_CLOEXEC);
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            // child: only async-signal-safe calls from here on.
+            dup2(toWorker[0], STDIN_FILENO);
+            dup2(fromWorker[1], STDOUT_FILENO);
+            close(toWorker[0]); close(toWorker[1]);
+            close(fromWorker[0]); close(fromWorker[1]);
+            execl("/bin/sh", "sh", "-c", _command.c_str(), (char*)0L);
+            _exit(127);
+        }
+
+        close(toWorker[0]);
+        close(fromWorker[1]);
+
+        if (pid < 0)
+        {
+            close(toWorker[1]);
+            close(fromWorker[0]);
+            return false;
+        }
+
+        _pid = pid;
+        _toWorker = fdopen(toWorker[1], "w");
+        _fromWorker = fdopen(fromWorker[0], "r");
+        return _toWorker && _fromWorker;
+    }
+
+    void stop()
+    {
+        // end of input tells the worker to exit.
+        if (_toWorker)
+            fclose(_toWorker);
+        if (_fromWorker)
+            fclose(_fromWorker);
+        _toWorker = 0L;
+        _fromWorker = 0L;
+
+        if (_pid > 0)
+            waitpid(_pid, 0L, 0);
+        _pid = -1;
+    }
+
+    bool process( const TileKeyList& keys )
+    {
+        if (!_toWorker)
+            return false;
+
+        for (TileKeyList::const_iterator itr = keys.begin(); itr != keys.end(); ++itr)
+        {
+            fprintf(_toWorker, "%u, %u, %u\n", itr->getLevelOfDetail(), itr->getTileX(), itr->getTileY());
+        }
+        fprintf(_toWorker, "\n");
+
+        if (fflush(_toWorker) != 0)
+            return false;
+
+        return waitFor("done");
+    }
+
+    bool waitFor( const std::string& reply )
+    {
+        char line[256];
+        while (_fromWorker && fgets(line, sizeof(line), _fromWorker))
+        {
+            if (startsWith(line, reply))
+                return true;
+        }
+        return false;
+    }
+
+    std::string _command;
+    pid_t       _pid;
+    FILE*       _toWorker;
+    FILE*       _fromWorker;
+};
+
+/**
+ * Sends a batch of keys to an idle worker process and waits for it.
+ */
+struct MultiprocessTileVisitor::WorkerTask : public TaskRequest
+{
+    WorkerTask( MultiprocessTileVisitor* visitor, const TileKeyList& keys ) :
+      _visitor( visitor ),
+      _keys( keys )
+      {
+      }
+
+      virtual void operator()( ProgressCallback* progress )
+      {
+          if (progress && progress->isCanceled())
+              return;
+
+          _visitor->processInWorker( _keys );
+      }
+
+      MultiprocessTileVisitor* _visitor;
+      TileKeyList _keys;
+};
+
+#else
+
+struct MultiprocessTileVisitor::Worker : public osg::Referenced
+{
+};
+
+#endif // OSGEARTH_HAVE_WORKER_PROCESSES
+
 MultiprocessTileVisitor::MultiprocessTileVisitor():
     _numProcesses( OpenThreads::GetNumberOfProcessors() ),
-    _batchSize(100)
+    _batchSize(100),
+    _targetBatchTime(2.0),
+    _secondsPerTile(0.0)
 {
     osgDB::ObjectWrapper* wrapper = osgDB::Registry::instance()->getObjectWrapperManager()->findWrapper( "osg::Image" );
 }
@@ -342,8 +504,15 @@ MultiprocessTileVisitor::MultiprocessTileVisitor():
 MultiprocessTileVisitor::MultiprocessTileVisitor( TileHandler* handler ):
 TileVisitor( handler ),
     _numProcesses( OpenThreads::GetNumberOfProcessors() ),
-    _batchSize(100)
+    _batchSize(100),
+    _targetBatchTime(2.0),
+    _secondsPerTile(0.0)
+{
+}
+
+MultiprocessTileVisitor::~MultiprocessTileVisitor()
 {
+    stopWorkers();
 }
 
 unsigned int MultiprocessTileVisitor::getNumProcesses() const
@@ -366,11 +535,27 @@ void MultiprocessTileVisitor::setBatchSize( unsigned int batchSize )
     _batchSize = batchSize;
 }
 
+double MultiprocessTileVisitor::getTargetBatchTime() const
+{
+    return _targetBatchTime;
+}
+
+void MultiprocessTileVisitor::setTargetBatchTime( double seconds )
+{
+    _targetBatchTime = seconds;
+}
+
 
 void MultiprocessTileVisitor::run(const Profile* mapProfile)
 {                             
-    // Start up the task service          
-    _taskService = new TaskService( "MPTileHandler", _numProcesses, 1000 );
+    _secondsPerTile = 0.0;
+    _batch.clear();
+
+    bool useWorkers = startWorkers();
+
+    // Start up the task service. With workers, keep the queue short so that
+    // batches are sized from recent measurements.
+    _taskService = new TaskService( "MPTileHandler", _numProcesses, useWorkers ? 2 * _numProcesses : 1000 );
     
     // Produce the tiles
     TileVisitor::run( mapProfile );
@@ -393,13 +578,15 @@ void MultiprocessTileVisitor::run(const Profile* mapProfile)
         }
     }
     OE_INFO << "All threads have completed" << std::endl;
+
+    stopWorkers();
 }
 
 bool MultiprocessTileVisitor::handleTile( const TileKey& key )        
 {        
     _batch.push_back( key );
 
-    if (_batch.size() == _batchSize)
+    if (_batch.size() >= getCurrentBatchSize())
     {
         processBatch();
     }         
@@ -416,6 +603,116 @@ void MultiprocessTileVisitor::setEarthFile( const std::string& earthFile )
     _earthFile = earthFile;
 }
 
+bool MultiprocessTileVisitor::startWorkers()
+{
+#ifdef OSGEARTH_HAVE_WORKER_PROCESSES
+    stopWorkers();
+
+    if (!_tileHandler.valid() || _numProcesses == 0)
+        return false;
+
+    // A worker that dies would otherwise take us down with it on the next
+    // write; but leave any handler the application installed alone.
+    void (*previous)(int) = signal(SIGPIPE, SIG_IGN);
+    if (previous != SIG_DFL)
+        signal(SIGPIPE, previous);
+
+    std::string command = Stringify() << _tileHandler->getProcessString() << " --worker " << _earthFile;
+    OE_INFO << "Starting " << _numProcesses << " workers: " << command << std::endl;
+
+    // The first worker creates any missing cache bins before the rest open them.
+    osg::ref_ptr<Worker> first = new Worker( command );
+    if (!first->start())
+    {
+        OE_WARN << "Failed to start worker process \"" << command << "\"; running one process per batch instead" << std::endl;
+        return false;
+    }
+
+    // The rest load the earth file in parallel.
+    std::vector< osg::ref_ptr<Worker> > others;
+    for (unsigned int i = 1; i < _numProcesses; ++i)
+    {
+        others.push_back( new Worker( command ) );
+        others.back()->launch();
+    }
+
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _workersMutex );
+    _workers.push_back( first.get() );
+
+    for (unsigned int i = 0; i < others.size(); ++i)
+    {
+        if (others[i]->waitFor("ready"))
+            _workers.push_back( others[i].get() );
+        else
+            OE_WARN << "Failed to start worker process " << i+1 << std::endl;
+    }
+
+    for (unsigned int i = 0; i < _workers.size(); ++i)
+    {
+        _idleWorkers.push_back( _workers[i].get() );
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void MultiprocessTileVisitor::stopWorkers()
+{
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _workersMutex );
+    _idleWorkers.clear();
+    _workers.clear();
+}
+
+MultiprocessTileVisitor::Worker* MultiprocessTileVisitor::acquireWorker()
+{
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _workersMutex );
+    while (_idleWorkers.empty() && !_workers.empty())
+    {
+        _workerIdle.wait( &_workersMutex );
+    }
+
+    if (_idleWorkers.empty())
+        return 0L;
+
+    Worker* worker = _idleWorkers.back();
+    _idleWorkers.pop_back();
+    return worker;
+}
+
+void MultiprocessTileVisitor::releaseWorker( Worker* worker )
+{
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _workersMutex );
+    _idleWorkers.push_back( worker );
+    _workerIdle.signal();
+}
+
+void MultiprocessTileVisitor::recordBatch( unsigned int count, double seconds )
+{
+    if (count == 0)
+        return;
+
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _costMutex );
+    double secondsPerTile = seconds / (double)count;
+    _secondsPerTile = _secondsPerTile > 0.0 ? 0.8 * _secondsPerTile + 0.2 * secondsPerTile : secondsPerTile;
+}
+
+unsigned int MultiprocessTileVisitor::getCurrentBatchSize()
+{
+    unsigned int batchSize = osg::maximum( _batchSize, 1u );
+
+    // Only adapt for workers; a process per batch needs big batches to pay for its startup.
+    if (_workers.empty() || _targetBatchTime <= 0.0)
+        return batchSize;
+
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lock( _costMutex );
+    if (_secondsPerTile <= 0.0)
+        return batchSize;
+
+    double size = _targetBatchTime / _secondsPerTile;
+    return (unsigned int)osg::clampBetween( size, 1.0, 10.0 * (double)batchSize );
+}
+
 /**
 * Executes a command in an external process
 */
@@ -460,6 +757,18 @@ public:
 
 void MultiprocessTileVisitor::processBatch()
 {       
+    if (_batch.empty())
+        return;
+
+#ifdef OSGEARTH_HAVE_WORKER_PROCESSES
+    if (!_workers.empty())
+    {
+        _taskService->add( new WorkerTask(this, _batch) );
+        _batch.clear();
+        return;
+    }
+#endif
+
     TaskList tasks( 0 );
     for (unsigned int i = 0; i < _batch.size(); i++)
     {
@@ -481,6 +790,104 @@ void MultiprocessTileVisitor::processBatch()
     _batch.clear();
 }
 
+void MultiprocessTileVisitor::processInWorker( const TileKeyList& keys )
+{
+#ifdef OSGEARTH_HAVE_WORKER_PROCESSES
+    Worker* worker = acquireWorker();
+    if (!worker)
+        return;
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    bool ok = worker->process( keys );
+    if (!ok)
+    {
+        // The worker died; replace it and try the batch once more.
+        OE_WARN << "Worker process failed; restarting it" << std::endl;
+        worker->stop();
+        ok = worker->start() && worker->process( keys );
+        if (!ok)
+        {
+            OE_WARN << "Failed to process a batch of " << keys.size() << " tiles starting at " << keys.front().str() << std::endl;
+        }
+    }
+
+    if (ok)
+    {
+        recordBatch( keys.size(), osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick()) );
+    }
+
+    releaseWorker( worker );
+    incrementProgress( keys.size() );
+#endif
+}
+
+
+/*****************************************************************************************/
+TileKeyStreamVisitor::TileKeyStreamVisitor()
+{
+}
+
+void TileKeyStreamVisitor::run(const Profile* mapProfile)
+{
+    resetProgress();
+
+    // Standard output carries the replies to the parent process, so
+    // redirect everything else written there to standard error.
+    std::cout.flush();
+    fflush(stdout);
+#ifdef OSGEARTH_HAVE_WORKER_PROCESSES
+    FILE* reply = fdopen( dup(STDOUT_FILENO), "w" );
+    dup2( STDERR_FILENO, STDOUT_FILENO );
+#else
+    FILE* reply = stdout;
+#endif
+
+    process( mapProfile, std::cin, reply );
+
+#ifdef OSGEARTH_HAVE_WORKER_PROCESSES
+    fclose( reply );
+#endif
+}
+
+void TileKeyStreamVisitor::process(const Profile* mapProfile, std::istream& input, FILE* reply)
+{
+    fprintf( reply, "ready\n" );
+    fflush( reply );
+
+    TileKeyList batch;
+    std::string line;
+    while (getline( input, line ))
+    {
+        std::vector< std::string > parts;
+        StringTokenizer( line, parts, "," );
+
+        if (parts.size() >= 3)
+        {
+            batch.push_back( TileKey(
+                as<unsigned int>(parts[0], 0u),
+                as<unsigned int>(parts[1], 0u),
+                as<unsigned int>(parts[2], 0u),
+                mapProfile ) );
+        }
+        else if (trim(line).empty())
+        {
+            for (TileKeyList::iterator itr = batch.begin(); itr != batch.end(); ++itr)
+            {
+                if (_tileHandler)
+                {
+                    _tileHandler->handleTile( *itr, *this );
+                }
+            }
+            incrementProgress( batch.size() );
+
+            fprintf( reply, "done %u\n", (unsigned int)batch.size() );
+            fflush( reply );
+            batch.clear();
+        }
+    }
+}
+
 
 /*****************************************************************************************/
 TileKeyListVisitor::TileKeyListVisitor()
@@ -505,3 +912,405 @@ void TileKeyListVisitor::run(const Profile* mapProfile)
         }
     }
 }
+
+
+
+/*****************************************************************************************/
+
+namespace
+{
+    // Interleaves the bits of x and y so that sorting on the result puts the
+    // tiles of a level in Z-order.
+    unsigned long long zOrder( unsigned int x, unsigned int y )
+    {
+        unsigned long long code = 0ull;
+        for (unsigned int bit = 0; bit < 32; ++bit)
+        {
+            code |= (unsigned long long)((x >> bit) & 1u) << (2*bit);
+            code |= (unsigned long long)((y >> bit) & 1u) << (2*bit + 1);
+        }
+        return code;
+    }
+
+    struct SortByZOrder
+    {
+        bool operator()( const TileKey& lhs, const TileKey& rhs ) const
+        {
+            if (lhs.getLOD() != rhs.getLOD())
+                return lhs.getLOD() < rhs.getLOD();
+            return zOrder(lhs.getTileX(), lhs.getTileY()) < zOrder(rhs.getTileX(), rhs.getTileY());
+        }
+    };
+}
+
+/**
+ * A batch of neighboring keys, handled in one task. Whoever gets to it first
+ * runs it: a task thread, or the visitor when it waits on the batch.
+ */
+struct LevelParallelTileVisitor::Batch : public TaskRequest
+{
+    Batch( LevelParallelTileVisitor* visitor ) :
+        _visitor( visitor ), _numDone( 0 ), _claimed( false ) { }
+
+    virtual void operator()( ProgressCallback* )
+    {
+        if (claim())
+            process();
+    }
+
+    void wait()
+    {
+        if (claim())
+            process();
+        else
+            _done.wait();
+    }
+
+    bool claim()
+    {
+        Threading::ScopedMutexLock lock(_claimMutex);
+        if (_claimed)
+            return false;
+        _claimed = true;
+        return true;
+    }
+
+    void process()
+    {
+        unsigned int handled = 0;
+        for (; _numDone < _keys.size(); ++_numDone)
+        {
+            if (_visitor->_progress.valid() && _visitor->_progress->isCanceled())
+                break;
+
+            _visitor->visitKey( _keys[_numDone], _children, handled );
+        }
+
+        if (handled > 0)
+            _visitor->addProcessed( handled );
+
+        _done.set();
+    }
+
+    LevelParallelTileVisitor* _visitor;  // waits on every batch
+    TileKeyList               _keys;
+    TileKeyList               _children; // keys for the next level
+    unsigned int              _numDone;  // keys visited so far
+    Threading::Mutex          _claimMutex;
+    bool                      _claimed;
+    Threading::Event          _done;
+};
+
+LevelParallelTileVisitor::LevelParallelTileVisitor():
+_numThreads( OpenThreads::GetNumberOfProcessors() ),
+_batchSize( 64 ),
+_checkpointInterval( 60.0 ),
+_startTime( 0 ),
+_lastReportTime( 0 ),
+_lastCheckpointTime( 0 ),
+_startProcessed( 0 )
+{
+    // See MultithreadedTileVisitor
+    osgDB::ObjectWrapper* wrapper = osgDB::Registry::instance()->getObjectWrapperManager()->findWrapper( "osg::Image" );
+}
+
+LevelParallelTileVisitor::LevelParallelTileVisitor( TileHandler* handler ):
+TileVisitor( handler ),
+_numThreads( OpenThreads::GetNumberOfProcessors() ),
+_batchSize( 64 ),
+_checkpointInterval( 60.0 ),
+_startTime( 0 ),
+_lastReportTime( 0 ),
+_lastCheckpointTime( 0 ),
+_startProcessed( 0 )
+{
+    osgDB::ObjectWrapper* wrapper = osgDB::Registry::instance()->getObjectWrapperManager()->findWrapper( "osg::Image" );
+}
+
+unsigned int LevelParallelTileVisitor::getNumThreads() const
+{
+    return _numThreads;
+}
+
+void LevelParallelTileVisitor::setNumThreads( unsigned int numThreads )
+{
+    _numThreads = numThreads;
+}
+
+unsigned int LevelParallelTileVisitor::getBatchSize() const
+{
+    return _batchSize;
+}
+
+void LevelParallelTileVisitor::setBatchSize( unsigned int batchSize )
+{
+    _batchSize = osg::maximum( batchSize, 1u );
+}
+
+const std::string& LevelParallelTileVisitor::getCheckpointFile() const
+{
+    return _checkpointFile;
+}
+
+void LevelParallelTileVisitor::setCheckpointFile( const std::string& filename )
+{
+    _checkpointFile = filename;
+}
+
+double LevelParallelTileVisitor::getCheckpointInterval() const
+{
+    return _checkpointInterval;
+}
+
+void LevelParallelTileVisitor::setCheckpointInterval( double seconds )
+{
+    _checkpointInterval = seconds;
+}
+
+void LevelParallelTileVisitor::run( const Profile* mapProfile )
+{
+    _profile = mapProfile;
+
+    resetProgress();
+
+    estimate();
+
+    TileKeyList keys;
+    if (!loadCheckpoint( keys ))
+    {
+        mapProfile->getRootKeys( keys );
+        std::sort( keys.begin(), keys.end(), SortByZOrder() );
+    }
+
+    osg::Timer* timer = osg::Timer::instance();
+    _startTime = _lastReportTime = _lastCheckpointTime = timer->tick();
+    _startProcessed = _processed;
+
+    OE_INFO << "Starting " << _numThreads << std::endl;
+    osg::ref_ptr<TaskService> taskService = new TaskService( "LevelParallelTileVisitor", _numThreads );
+
+    bool canceled = false;
+
+    while (!keys.empty() && !canceled)
+    {
+        unsigned int lod = keys.front().getLOD();
+
+        // Split the level into batches. Children are added in Z-order, so
+        // keeping the batches in order keeps the next level in Z-order too.
+        std::vector< osg::ref_ptr<Batch> > batches;
+        for (unsigned int i = 0; i < keys.size(); i += _batchSize)
+        {
+            Batch* batch = new Batch( this );
+            unsigned int end = osg::minimum( i + _batchSize, (unsigned int)keys.size() );
+            batch->_keys.assign( keys.begin() + i, keys.begin() + end );
+            batches.push_back( batch );
+        }
+        keys.clear();
+
+        // Queue all but the first; this thread starts on the first, then helps
+        // with any batch that no task thread has taken yet.
+        for (unsigned int i = 1; i < batches.size(); ++i)
+        {
+            taskService->add( batches[i].get() );
+        }
+
+        TileKeyList next;
+        for (unsigned int i = 0; i < batches.size(); ++i)
+        {
+            batches[i]->wait();
+            next.insert( next.end(), batches[i]->_children.begin(), batches[i]->_children.end() );
+            batches[i]->_children.clear();
+
+            if (reportProgress( lod ))
+            {
+                canceled = true;
+            }
+
+            if (!canceled &&
+                !_checkpointFile.empty() &&
+                timer->delta_s( _lastCheckpointTime, timer->tick() ) >= _checkpointInterval)
+            {
+                saveCheckpoint( batches, i + 1, next );
+            }
+        }
+
+        if (canceled || (_progress.valid() && _progress->isCanceled()))
+        {
+            canceled = true;
+            if (!_checkpointFile.empty())
+            {
+                saveCheckpoint( batches, batches.size(), next );
+            }
+        }
+
+        keys.swap( next );
+    }
+
+    // Empty checkpoint marks the seed complete.
+    if (!canceled && !_checkpointFile.empty())
+    {
+        std::vector< osg::ref_ptr<Batch> > none;
+        saveCheckpoint( none, 0, TileKeyList() );
+    }
+
+    OE_INFO << "All threads have completed" << std::endl;
+}
+
+void LevelParallelTileVisitor::visitKey( const TileKey& key, TileKeyList& children, unsigned int& handled )
+{
+    // Same rules as TileVisitor::processKey, without the recursion.
+    if (_tileHandler.valid() && !_tileHandler->hasData(key))
+    {
+        return;
+    }
+
+    unsigned int lod = key.getLevelOfDetail();
+    bool traverseChildren = false;
+
+    if (intersects( key.getExtent() ))
+    {
+        if (lod < _minLevel)
+        {
+            traverseChildren = true;
+        }
+        else
+        {
+            if (_tileHandler.valid())
+            {
+                traverseChildren = _tileHandler->handleTile( key, *this );
+            }
+            ++handled;
+        }
+    }
+
+    if (traverseChildren && lod < _maxLevel)
+    {
+        for (unsigned int i = 0; i < 4; i++)
+        {
+            children.push_back( key.createChildKey(i) );
+        }
+    }
+}
+
+void LevelParallelTileVisitor::addProcessed( unsigned int amount )
+{
+    OpenThreads::ScopedLock< OpenThreads::Mutex > lk( _progressMutex );
+    _processed += amount;
+}
+
+bool LevelParallelTileVisitor::reportProgress( unsigned int lod )
+{
+    if (!_progress.valid())
+        return false;
+
+    // once a second is plenty
+    osg::Timer* timer = osg::Timer::instance();
+    osg::Timer_t now = timer->tick();
+    if (timer->delta_s( _lastReportTime, now ) < 1.0)
+        return false;
+    _lastReportTime = now;
+
+    unsigned int processed;
+    {
+        OpenThreads::ScopedLock< OpenThreads::Mutex > lk( _progressMutex );
+        processed = _processed;
+    }
+
+    double elapsed = timer->delta_s( _startTime, now );
+    double rate = elapsed > 0.0 ? (double)(processed - _startProcessed) / elapsed : 0.0;
+
+    std::stringstream buf;
+    buf << "level " << lod << ", " << (unsigned int)rate << " tiles/s";
+    if (rate > 0.0 && _total > processed)
+    {
+        buf << ", ETA " << prettyPrintTime( (double)(_total - processed) / rate );
+    }
+
+    if (_progress->reportProgress( processed, _total, buf.str() ))
+    {
+        _progress->cancel();
+        return true;
+    }
+    return _progress->isCanceled();
+}
+
+bool LevelParallelTileVisitor::loadCheckpoint( TileKeyList& keys )
+{
+    if (_checkpointFile.empty() || !osgDB::fileExists( _checkpointFile ))
+        return false;
+
+    std::ifstream in( _checkpointFile.c_str() );
+    std::string line;
+    if (!getline( in, line ) || !startsWith( line, "processed" ))
+    {
+        OE_WARN << "Ignoring invalid checkpoint " << _checkpointFile << std::endl;
+        return false;
+    }
+
+    unsigned int processed = as<unsigned int>( trim(line.substr(9)), 0u );
+
+    while (getline( in, line ))
+    {
+        std::vector< std::string > parts;
+        StringTokenizer( line, parts, "," );
+        if (parts.size() >= 3)
+        {
+            keys.push_back( TileKey(
+                as<unsigned int>(parts[0], 0u),
+                as<unsigned int>(parts[1], 0u),
+                as<unsigned int>(parts[2], 0u),
+                _profile.get() ) );
+        }
+    }
+
+    _processed = processed;
+    OE_INFO << "Resuming from checkpoint " << _checkpointFile << " with " << keys.size() << " keys left" << std::endl;
+    return true;
+}
+
+void LevelParallelTileVisitor::saveCheckpoint( const std::vector< osg::ref_ptr<Batch> >& batches, unsigned int numWaited, const TileKeyList& next )
+{
+    unsigned int processed;
+    {
+        OpenThreads::ScopedLock< OpenThreads::Mutex > lk( _progressMutex );
+        processed = _processed;
+    }
+
+    // Write next to the old file and swap, so an interruption never leaves a partial checkpoint.
+    std::string tempFile = _checkpointFile + ".tmp";
+    {
+        std::ofstream out( tempFile.c_str() );
+        out << "processed " << processed << std::endl;
+
+        // Keys left in this level: what the waited batches didn't get to, and all
+        // of the rest (some may be done already and will simply be visited again).
+        for (unsigned int i = 0; i < batches.size(); ++i)
+        {
+            const TileKeyList& keys = batches[i]->_keys;
+            for (unsigned int k = i < numWaited ? batches[i]->_numDone : 0; k < keys.size(); ++k)
+            {
+                out << keys[k].getLevelOfDetail() << ", " << keys[k].getTileX() << ", " << keys[k].getTileY() << std::endl;
+            }
+        }
+
+        // Then the next level found so far.
+        for (TileKeyList::const_iterator itr = next.begin(); itr != next.end(); ++itr)
+        {
+            out << itr->getLevelOfDetail() << ", " << itr->getTileX() << ", " << itr->getTileY() << std::endl;
+        }
+
+        if (!out)
+        {
+            OE_WARN << "Failed to write checkpoint " << tempFile << std::endl;
+            return;
+        }
+    }
+
+    ::remove( _checkpointFile.c_str() );
+    if (::rename( tempFile.c_str(), _checkpointFile.c_str() ) != 0)
+    {
+        OE_WARN << "Failed to write checkpoint " << _checkpointFile << std::endl;
+    }
+
+    _lastCheckpointTime = osg::Timer::instance()->tick();
+}
@@ -44,7 +44,9 @@ using namespace osgEarth::Drivers::LevelDBCache;
 LevelDBCacheImpl::LevelDBCacheImpl( const CacheOptions& options ) :
 osgEarth::Cache( options ),
 _options       ( options ),
-_active        ( true )
+_active        ( true ),
+_evictor       ( 0L ),
+_measure       ( 0L )
 {
     // Force OSG to initialize the image wrapper. Failure to do this can result
     // in a race condition within OSG when the cache is accessed from multiple threads.
@@ -103,6 +105,19 @@ _active        ( true )
 
 LevelDBCacheImpl::~LevelDBCacheImpl()
 {
+    if ( _evictor )
+    {
+        _tracker->stop();
+        _evictor->join();
+        delete _evictor;
+        _evictor = 0L;
+    }
+
+    if ( _db && _defaultBin.valid() && _tracker->isSizeKnown() )
+    {
+        static_cast<LevelDBCacheBin*>(_defaultBin.get())->writeSize( _tracker->getSize() );
+    }
+
     if ( _db )
     {
         // problem. This destructor causes a lockup sometimes. Perhaps try
@@ -129,10 +144,29 @@ LevelDBCacheImpl::init()
 
     open();
 
-    // Do an initial size check.
+    // Start from the size saved last time. From here on the tracker keeps
+    // count of what is written and removed.
     if ( _db )
     {
-        _tracker->calcSize();
+        LevelDBCacheBin* bin = static_cast<LevelDBCacheBin*>(getOrCreateDefaultBin());
+        ::off_t size;
+        if ( bin->readSize(size) )
+        {
+            _tracker->setSize(size);
+        }
+        else
+        {
+            // No saved size (a new cache, or one made by an older version), so
+            // the eviction thread adds up the records first. Take the snapshot
+            // now, so that writes from here on are counted exactly once.
+            _measure = _db->NewIterator(leveldb::ReadOptions());
+        }
+
+        if ( _measure || _tracker->hasSizeLimit() )
+        {
+            _evictor = new Evictor(this);
+            _evictor->start();
+        }
     }
 
     if ( _active )
@@ -204,7 +238,88 @@ LevelDBCacheImpl::getOrCreateDefaultBin()
 off_t
 LevelDBCacheImpl::getApproximateSize() const
 {
-    return _tracker->calcSize();
+    return _tracker->getSize();
+}
+
+void
+LevelDBCacheImpl::Evictor::run()
+{
+    _cache->evict();
+}
+
+void
+LevelDBCacheImpl::measure()
+{
+    ::off_t total = 0;
+    for(_measure->SeekToFirst(); _measure->Valid() && !_tracker->isStopped(); _measure->Next())
+    {
+        total += _measure->key().size() + _measure->value().size();
+    }
+    bool complete = !_measure->Valid() && _measure->status().ok();
+    delete _measure;
+    _measure = 0L;
+
+    if ( complete )
+    {
+        _tracker->addMeasuredBytes( total );
+        OE_INFO << LC << "Cache size = " << (_tracker->getSize()/1048576) << " MB" << std::endl;
+    }
+}
+
+void
+LevelDBCacheImpl::evict()
+{
+    LevelDBCacheBin* bin = static_cast<LevelDBCacheBin*>(getOrCreateDefaultBin());
+    if ( !bin )
+        return;
+
+    if ( _measure )
+    {
+        measure();
+        if ( !_tracker->isSizeKnown() )
+            return;
+        bin->writeSize( _tracker->getSize() );
+    }
+
+    if ( !_tracker->hasSizeLimit() )
+        return;
+
+    unsigned batchSize = osg::maximum(_options.evictBatchSize().value(), 1u);
+
+    while( _tracker->waitUntilOverLimit() )
+    {
+        unsigned total = 0;
+        ::off_t  freed = 0;
+
+        while( _tracker->isOverTarget() && !_tracker->isStopped() )
+        {
+            unsigned count;
+            ::off_t  bytes;
+            if ( !bin->purgeOldest(batchSize, count, bytes) )
+            {
+                // try again in a bit rather than spinning on a failing database.
+                OpenThreads::Thread::microSleep(1000000u);
+                break;
+            }
+
+            if ( count == 0 )
+            {
+                // Nothing left to remove, so the running total has drifted
+                // from what is really in the cache.
+                _tracker->setSize(0);
+                break;
+            }
+
+            total += count;
+            freed += bytes;
+        }
+
+        bin->writeSize( _tracker->getSize() );
+
+        OE_DEBUG << LC << "Evicted " << total << " record(s) for "
+            << (freed/1048576) << " MB; cache size = "
+            << (_tracker->getSize()/1048576) << " MB" << std::endl;
+    }
 }
 
 bool
@@ -232,6 +347,9 @@ LevelDBCacheImpl::clear()
     {
         _db->Delete(leveldb::WriteOptions(), it->key());
     }
+    delete it;
+
+    _tracker->setSize(0);
 
     return true;
 }
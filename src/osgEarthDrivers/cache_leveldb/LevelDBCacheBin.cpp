@@ -77,6 +77,7 @@ namespace
 #define OE_TEST OE_NOTICE
 
 #define TIME_FIELD "leveldb.time"
+#define SIZE_FIELD "leveldb.size"
 
 
 LevelDBCacheBin::LevelDBCacheBin(const std::string& binID,
@@ -379,27 +380,53 @@ LevelDBCacheBin::write(const std::string& key, const osg::Object* object, const
     {
         DateTime now;
         leveldb::WriteBatch batch;
+        ::off_t bytes = 0;
+
+        std::string tuple = binDataKeyTuple(key);
+        std::string metakey = metaKey(key);
+
+        // if this replaces a record, remove its time index entry and count
+        // only the difference in size.
+        ::off_t oldBytes = 0;
+        std::string oldmetavalue;
+        if ( _db->Get(leveldb::ReadOptions(), metakey, &oldmetavalue).ok() )
+        {
+            Config oldmetadata;
+            decodeMeta(oldmetavalue, oldmetadata);
+            batch.Delete( timeKey(DateTime(oldmetadata.value(TIME_FIELD)), key) );
+            oldBytes = storedSize(tuple, oldmetavalue, oldmetadata);
+        }
 
         // write the data:
         data = datastream.str();
         if ( _tracker->seed().isSet() )
             blend(data, _tracker->seed().value());
-        batch.Put( dataKey(key), data );
+        std::string datakey = dataKey(key);
+        batch.Put( datakey, data );
+        bytes += datakey.size() + data.size();
 
         // write the timestamp index:
-        batch.Put( timeKey(now, key), binDataKeyTuple(key) );
+        std::string timekey = timeKey(now, key);
+        batch.Put( timekey, tuple );
+        bytes += timekey.size() + tuple.size();
 
-        // write the metadata:
+        // write the metadata, including the size of the other two records:
         Config metadata(meta);
         metadata.set( TIME_FIELD, now.asCompactISO8601() );
+        metadata.set( SIZE_FIELD, bytes );
         encodeMeta( metadata, data );
-        batch.Put( metaKey(key), data );
+        batch.Put( metakey, data );
+        bytes += metakey.size() + data.size();
+
+        // if eviction has fallen behind, give it a chance to catch up.
+        _tracker->waitForRoom();
 
         objWriteOK = _db->Write( leveldb::WriteOptions(), &batch ).ok();
 
         if ( objWriteOK )
         {
             ++_tracker->writes;
+            _tracker->addBytes( bytes - oldBytes );
             postWrite();
             
             if ( _debug )
@@ -422,39 +449,42 @@ LevelDBCacheBin::write(const std::string& key, const osg::Object* object, const
 void
 LevelDBCacheBin::postWrite()
 {
-    if ( _tracker->hasSizeLimit() )
+    // The size limit is enforced by the cache's eviction thread, which the
+    // tracker wakes up as soon as the limit is exceeded.
+    if ( _tracker->isTimeToCheckSize() )
     {
-        if ( _tracker->isOverLimit() )
-        {
-            if ( _tracker->isTimeToPurge() )
-            {
-                this->purgeOldest(_tracker->numToPurge());
-
-                if (_debug)
-                {
-                    off_t size = _tracker->calcSize();
-                    OE_NOTICE 
-                        << LC << "Cache size = " << (size/1048576) << " MB; " 
-                        << "Hit ratio = " << (float)_tracker->hits/(float)_tracker->reads << std::endl;
-                }
-            }
-        }
-        else
+        off_t size = _tracker->getSize();
+        if ( _tracker->isSizeKnown() )
+            writeSize( size );
+
+        if ( _debug )
         {
-            if ( _tracker->isTimeToCheckSize() )
-            {
-                off_t size = _tracker->calcSize();
-                if ( _debug )
-                {
-                    OE_NOTICE 
-                        << LC << "Cache size = " << (size/1048576) << " MB; " 
-                        << "Hit ratio = " << (float)_tracker->hits/(float)_tracker->reads << std::endl;
-                }
-            }
+            OE_NOTICE 
+                << LC << "Cache size = " << (size/1048576) << " MB; " 
+                << "Hit ratio = " << (float)_tracker->hits/(float)_tracker->reads << std::endl;
         }
     }
 }
 
+::off_t
+LevelDBCacheBin::storedSize(const std::string& tuple, const std::string& metavalue, const Config& metadata)
+{
+    ::off_t bytes = metaKeyFromTuple(tuple).size() + metavalue.size();
+
+    ::off_t recorded = metadata.value< ::off_t >(SIZE_FIELD, (::off_t)-1);
+    if ( recorded >= 0 )
+        return bytes + recorded;
+
+    // Written before sizes were recorded; look at the data itself.
+    std::string datakey = dataKeyFromTuple(tuple);
+    std::string datavalue;
+    if ( _db->Get(leveldb::ReadOptions(), datakey, &datavalue).ok() )
+        bytes += datakey.size() + datavalue.size();
+
+    std::string timekey = "t" + SEP + DateTime(metadata.value(TIME_FIELD)).asCompactISO8601() + SEP + tuple;
+    return bytes + timekey.size() + tuple.size();
+}
+
 CacheBin::RecordStatus
 LevelDBCacheBin::getRecordStatus(const std::string& key)
 {
@@ -492,10 +522,16 @@ LevelDBCacheBin::remove(const std::string& key)
     decodeMeta(metavalue, metadata);
     DateTime t(metadata.value(TIME_FIELD));
 
+    std::string datakey = dataKey(key);
+    std::string metakey = metaKey(key);
+    std::string timekey = timeKey(t, key);
+
+    ::off_t bytes = storedSize(binDataKeyTuple(key), metavalue, metadata);
+
     leveldb::WriteBatch batch;
-    batch.Delete( dataKey(key) );
-    batch.Delete( metaKey(key) );
-    batch.Delete( timeKey(t, key) );
+    batch.Delete( datakey );
+    batch.Delete( metakey );
+    batch.Delete( timekey );
         
     leveldb::Status status = _db->Write(leveldb::WriteOptions(), &batch);
     if ( !status.ok() )
@@ -503,7 +539,10 @@ LevelDBCacheBin::remove(const std::string& key)
         OE_WARN << LC << "Failed to remove (" << key << ") from bin " << getID() << std::endl;
         return false;
     }
-    else if ( _debug )
+
+    _tracker->addBytes( -bytes );
+
+    if ( _debug )
     {
         OE_NOTICE << LC << "Removed (" << key << ") from bin " << getID() << std::endl;
     }
@@ -561,17 +600,21 @@ LevelDBCacheBin::clear()
     leveldb::WriteOptions wo;
     std::string binphrase = binPhrase();
     leveldb::WriteBatch batch;
+    ::off_t bytes = 0;
     leveldb::Iterator* i = _db->NewIterator(leveldb::ReadOptions());
     for(i->SeekToFirst(); i->Valid(); i->Next())
     {
         std::string key = i->key().ToString();
         if ( key.find(binphrase) != std::string::npos )
         {
-            _db->Delete( wo, i->key() );
+            if ( _db->Delete( wo, i->key() ).ok() )
+                bytes += i->key().size() + i->value().size();
         }
     }
     delete i;
 
+    _tracker->addBytes( -bytes );
+
     if ( _debug )
     {
         OE_NOTICE << LC << "Cleared bin " << getID() << std::endl;
@@ -654,41 +697,89 @@ LevelDBCacheBin::writeMetadata(const Config& conf)
 }
 
 bool
-LevelDBCacheBin::purgeOldest(unsigned maxnum)
+LevelDBCacheBin::purgeOldest(unsigned maxnum, unsigned& count, ::off_t& bytes)
 {
+    count = 0;
+    bytes = 0;
+
     if ( !binValidForWriting() )
         return false;
 
-    leveldb::Iterator* it = _db->NewIterator(leveldb::ReadOptions());
+    leveldb::ReadOptions ro;
+    leveldb::WriteBatch batch;
+    leveldb::Iterator* it = _db->NewIterator(ro);
 
-    unsigned count = 0;
     std::string limit = timeEndGlobal();
+    std::string metavalue;
 
     // note: this will delete records NOT OF THIS BIN as well!
     for(it->Seek(timeBeginGlobal());
         count < maxnum && it->Valid() && it->key().ToString() < limit;
         it->Next(), ++count )
     {
-        if ( !it->status().ok() )
-            break;
-
         std::string tuple = it->value().ToString();
+        std::string datakey = dataKeyFromTuple(tuple);
+        std::string metakey = metaKeyFromTuple(tuple);
+
+        if ( _db->Get(ro, metakey, &metavalue).ok() )
+        {
+            Config metadata;
+            decodeMeta(metavalue, metadata);
+            bytes += storedSize(tuple, metavalue, metadata);
+        }
+        else
+        {
+            // a stray index entry
+            bytes += it->key().size() + tuple.size();
+        }
 
-        // doing this in a WriteBatch did not work. The size of the
-        // database would never go down.
-        leveldb::WriteOptions wo;
-        _db->Delete( wo, dataKeyFromTuple(tuple) );
-        _db->Delete( wo, metaKeyFromTuple(tuple) );
-        _db->Delete( wo, it->key() );
+        batch.Delete( datakey );
+        batch.Delete( metakey );
+        batch.Delete( it->key() );
     }
 
+    bool ok = it->status().ok();
     delete it;
 
-    if ( _debug )
+    // The space on disk comes back as leveldb compacts the deleted records
+    // in the background; the tracker counts it as free right away.
+    if ( ok && count > 0 )
+    {
+        ok = _db->Write(leveldb::WriteOptions(), &batch).ok();
+        if ( ok )
+            _tracker->addBytes( -bytes );
+        else
+            OE_WARN << LC << "Failed to purge " << count << " record(s)" << std::endl;
+    }
+
+    if ( _debug && ok )
     {
         OE_NOTICE << LC << "Purged " << count << " record(s) for "
-            << (_tracker->calcSize()/1048576) << " MB" << std::endl;
+            << (bytes/1048576) << " MB" << std::endl;
     }
 
-    return true;
+    return ok;
+}
+
+bool
+LevelDBCacheBin::readSize(::off_t& bytes)
+{
+    if ( !binValidForReading() )
+        return false;
+
+    std::string value;
+    if ( !_db->Get(leveldb::ReadOptions(), "s" + SEP + "size", &value).ok() )
+        return false;
+
+    bytes = as< ::off_t >(value, (::off_t)-1);
+    return bytes >= 0;
+}
+
+bool
+LevelDBCacheBin::writeSize(::off_t bytes)
+{
+    if ( !binValidForWriting() )
+        return false;
+
+    return _db->Put(leveldb::WriteOptions(), "s" + SEP + "size", Stringify() << bytes).ok();
 }
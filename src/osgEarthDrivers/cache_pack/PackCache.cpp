@@ -0,0 +1,170 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2016 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "PackCache"
+#include "PackCacheBin"
+#include <osgEarth/URI>
+#include <osgEarth/ThreadingUtils>
+#include <osgDB/Registry>
+#include <osgDB/FileUtils>
+#include <osgDB/FileNameUtils>
+#include <osgDB/ObjectWrapper>
+
+#define LC "[PackCache] "
+
+using namespace osgEarth;
+using namespace osgEarth::Threading;
+using namespace osgEarth::Drivers::PackCache;
+
+
+PackCacheImpl::PackCacheImpl( const CacheOptions& options ) :
+osgEarth::Cache( options ),
+_options       ( options ),
+_active        ( true )
+{
+    // Force OSG to initialize the image wrapper. Failure to do this can result
+    // in a race condition within OSG when the cache is accessed from multiple threads.
+    osgDB::ObjectWrapperManager* owm = osgDB::Registry::instance()->getObjectWrapperManager();
+    owm->findWrapper("osg::Image");
+    owm->findWrapper("osg::HeightField");
+
+    if ( _options.rootPath().isSet() )
+    {
+        _rootPath = URI( *_options.rootPath(), options.referrer() ).full();
+    }
+    else
+    {
+        // read the root path from ENV is necessary:
+        const char* cachePath = ::getenv(OSGEARTH_ENV_CACHE_PATH);
+        if ( cachePath )
+        {
+            _rootPath = cachePath;           
+            OE_INFO << LC << "Cache location set from environment: \"" 
+                << cachePath << "\"" << std::endl;
+        }
+    }
+
+    if ( _rootPath.empty() )
+    {
+        _active = false;
+        _ok = false;
+        OE_WARN << LC << "Illegal: no root path set for cache!" << std::endl;
+    }
+    else if ( !osgDB::fileExists(_rootPath) && !osgDB::makeDirectory(_rootPath) )
+    {
+        _active = false;
+        _ok = false;
+        OE_WARN << LC << "Failed to create root cache folder \"" << _rootPath << "\"" << std::endl;
+    }
+    else
+    {
+        OE_INFO << LC << "Opened a cache at \"" << _rootPath << "\"" << std::endl;
+    }
+}
+
+PackStore*
+PackCacheImpl::getOrCreateStore( const std::string& binID )
+{
+    if ( !_active )
+        return 0L;
+
+    ScopedMutexLock lock( _storesMutex );
+
+    osg::ref_ptr<PackStore>& store = _stores[binID];
+    if ( !store.valid() )
+    {
+        store = new PackStore(
+            osgDB::concatPaths(_rootPath, binID),
+            (uint64_t)_options.maxSegmentSizeMB().value() * 1048576u,
+            _options.compactionThreshold().value() );
+
+        if ( !store->open() )
+        {
+            OE_WARN << LC << "Failed to open cache bin \"" << binID << "\"" << std::endl;
+            _stores.erase( binID );
+            return 0L;
+        }
+    }
+    return store.get();
+}
+
+CacheBin*
+PackCacheImpl::addBin( const std::string& name )
+{
+    CacheBin* bin = _bins.get( name );
+    if ( bin )
+        return bin;
+
+    PackStore* store = getOrCreateStore( name );
+    return store ?
+        _bins.getOrCreate(name, new PackCacheBin(name, store)) :
+        0L;
+}
+
+CacheBin*
+PackCacheImpl::getOrCreateDefaultBin()
+{    
+    if ( !_active )
+        return 0L;
+
+    static Threading::Mutex s_defaultBinMutex;
+    if ( !_defaultBin.valid() )
+    {
+        Threading::ScopedMutexLock lock( s_defaultBinMutex );
+        if ( !_defaultBin.valid() ) // double-check
+        {
+            PackStore* store = getOrCreateStore( "_default" );
+            if ( store )
+                _defaultBin = new PackCacheBin("_default", store);
+        }
+    }
+    return _defaultBin.get();
+}
+
+off_t
+PackCacheImpl::getApproximateSize() const
+{
+    ScopedMutexLock lock( _storesMutex );
+
+    off_t total = 0;
+    for(std::map<std::string, osg::ref_ptr<PackStore> >::const_iterator i = _stores.begin(); i != _stores.end(); ++i)
+        total += (off_t)i->second->getStorageSize();
+    return total;
+}
+
+bool
+PackCacheImpl::compact()
+{
+    ScopedMutexLock lock( _storesMutex );
+
+    bool ok = _active;
+    for(std::map<std::string, osg::ref_ptr<PackStore> >::iterator i = _stores.begin(); i != _stores.end(); ++i)
+        ok = i->second->compact() && ok;
+    return ok;
+}
+
+bool
+PackCacheImpl::clear()
+{
+    ScopedMutexLock lock( _storesMutex );
+
+    bool ok = _active;
+    for(std::map<std::string, osg::ref_ptr<PackStore> >::iterator i = _stores.begin(); i != _stores.end(); ++i)
+        ok = i->second->clear() && ok;
+    return ok;
+}
@@ -0,0 +1,273 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2016 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "PackCacheBin"
+#include <osgEarth/Cache>
+#include <osgEarth/Registry>
+#include <osgEarth/URI>
+#include <osgDB/Registry>
+#include <osgDB/FileUtils>
+#include <osgDB/FileNameUtils>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+using namespace osgEarth;
+using namespace osgEarth::Threading;
+using namespace osgEarth::Drivers::PackCache;
+
+#undef  LC
+#define LC "[PackCacheBin] "
+
+
+PackCacheBin::PackCacheBin(const std::string& binID,
+                           PackStore*         store) :
+osgEarth::CacheBin( binID ),
+_store            ( store ),
+_debug            ( false )
+{
+    // reader to parse data:
+    _rw = osgDB::Registry::instance()->getReaderWriterForExtension( "osgb" );
+
+    _metaPath = osgDB::concatPaths( store->getPath(), "osgearth_cacheinfo.json" );
+    
+    if ( ::getenv("OSGEARTH_CACHE_DEBUG") )
+        _debug = true;
+}
+
+PackCacheBin::~PackCacheBin()
+{
+    // nop
+}
+
+ReadResult
+PackCacheBin::readImage(const std::string& key, const osgDB::Options* readOptions)
+{
+    return read(key, ImageReader(_rw.get(), readOptions));
+}
+
+ReadResult
+PackCacheBin::readObject(const std::string& key, const osgDB::Options* readOptions)
+{
+    return read(key, ObjectReader(_rw.get(), readOptions));
+}
+
+ReadResult
+PackCacheBin::readNode(const std::string& key, const osgDB::Options* readOptions)
+{
+    return read(key, NodeReader(_rw.get(), readOptions));
+}
+
+ReadResult
+PackCacheBin::read(const std::string& key, const Reader& reader)
+{
+    std::string metavalue, datavalue;
+    TimeStamp lastModified = (TimeStamp)0;
+
+    if ( !_store->get(key, &metavalue, &datavalue, &lastModified) )
+        return ReadResult(ReadResult::RESULT_NOT_FOUND);
+
+    Config metadata;
+    if ( !metavalue.empty() )
+        metadata.fromJSON( metavalue );
+
+    // decode the OSGB stream into an object.
+    std::istringstream datastream(datavalue);
+    osgDB::ReaderWriter::ReadResult r = reader.read(datastream);
+    if ( !r.success() )
+    {
+        OE_WARN << LC << "Cache read failure!"
+            << "\n reader = " << reader.name()
+            << "\n error detail = " << r.message()
+            << "\n";
+
+        return ReadResult(ReadResult::RESULT_READER_ERROR);
+    }
+        
+    if ( _debug )
+    {
+        OE_NOTICE << LC << "Bin " << getID() << ": read (" << key << ")\n";
+    }
+
+    ReadResult rr(r.getObject(), metadata);
+    rr.setLastModifiedTime(lastModified);    
+    return rr;
+}
+
+ReadResult
+PackCacheBin::readString(const std::string& key, const osgDB::Options* readOptions)
+{
+    ReadResult r = readObject(key, readOptions);
+    if ( r.succeeded() )
+    {
+        if ( r.get<StringObject>() )
+            return r;
+        else
+            return ReadResult();
+    }
+    else
+    {
+        return r;
+    }
+}
+
+bool
+PackCacheBin::write(const std::string& key, const osg::Object* object, const Config& meta, const osgDB::Options* writeOptions)
+{
+    if ( !object ) 
+        return false;
+        
+    osgDB::ReaderWriter::WriteResult r;
+    bool objWriteOK = false;
+
+    std::stringstream datastream;
+
+    if ( dynamic_cast<const osg::Image*>(object) )
+    {
+        if ( (_rw->supportedFeatures() & _rw->FEATURE_WRITE_IMAGE) == 0 )
+        {
+            OE_WARN << LC << "Internal: tried to write image to " << _rw->className() << "\n";
+            return false;
+        }
+        r = _rw->writeImage( *static_cast<const osg::Image*>(object), datastream, writeOptions );
+        objWriteOK = r.success();
+    }
+    else if ( dynamic_cast<const osg::Node*>(object) )
+    {
+        if ( (_rw->supportedFeatures() & _rw->FEATURE_WRITE_NODE) == 0 )
+        {
+            OE_WARN << LC << "Internal: tried to write node to " << _rw->className() << "\n";
+            return false;
+        }
+        r = _rw->writeNode( *static_cast<const osg::Node*>(object), datastream, writeOptions );
+        objWriteOK = r.success();
+    }
+    else
+    {
+        if ( (_rw->supportedFeatures() & _rw->FEATURE_WRITE_OBJECT) == 0 )
+        {
+            OE_WARN << LC << "Internal: tried to write an object to " << _rw->className() << "\n";
+            return false;
+        }
+        r = _rw->writeObject( *object, datastream, writeOptions );
+        objWriteOK = r.success();
+    }
+
+    if ( objWriteOK )
+    {
+        std::string metavalue;
+        if ( !meta.empty() )
+            metavalue = meta.toJSON(false);
+
+        objWriteOK = _store->put( key, metavalue, datastream.str(), DateTime().asTimeStamp() );
+
+        if ( objWriteOK && _debug )
+        {
+            OE_NOTICE << LC << "Bin " << getID() << ": wrote (" << key << ")\n";
+        }
+    }
+        
+    if ( !objWriteOK )
+    {
+        OE_WARN << LC << "Bin " << getID() << ": FAILED to write (" << key << "); msg = \"" 
+            << r.message() << "\"\n";
+    }
+
+    return objWriteOK;
+}
+
+CacheBin::RecordStatus
+PackCacheBin::getRecordStatus(const std::string& key)
+{
+    return _store->exists(key, 0L) ? STATUS_OK : STATUS_NOT_FOUND;
+}
+
+bool
+PackCacheBin::remove(const std::string& key)
+{
+    bool ok = _store->remove(key);
+    if ( ok && _debug )
+    {
+        OE_NOTICE << LC << "Removed (" << key << ") from bin " << getID() << std::endl;
+    }
+    return ok;
+}
+
+bool
+PackCacheBin::touch(const std::string& key)
+{    
+    return _store->touch(key, DateTime().asTimeStamp());
+}
+
+bool
+PackCacheBin::clear()
+{
+    bool ok = _store->clear();
+    if ( ok && _debug )
+    {
+        OE_NOTICE << LC << "Cleared bin " << getID() << std::endl;
+    }
+    return ok;
+}
+
+bool
+PackCacheBin::compact()
+{
+    // Runs in the background; returns once the compaction has started.
+    return _store->compact();
+}
+
+unsigned
+PackCacheBin::getStorageSize()
+{
+    uint64_t size = _store->getStorageSize();
+    return size > 0xFFFFFFFFu ? 0xFFFFFFFFu : (unsigned)size;
+}
+
+Config
+PackCacheBin::readMetadata()
+{
+    ScopedMutexLock exclusiveLock( _metaMutex );
+
+    Config conf;
+    if ( osgDB::fileExists(_metaPath) )
+        conf.fromJSON( URI(_metaPath).getString() );
+    return conf;
+}
+
+bool
+PackCacheBin::writeMetadata(const Config& conf)
+{
+    ScopedMutexLock exclusiveLock( _metaMutex );
+
+    // inject the cache version
+    Config mutableConf(conf);
+    mutableConf.set("pack.cache_version", PACK_CACHE_VERSION);
+
+    std::fstream output( _metaPath.c_str(), std::ios_base::out );
+    if ( !output.is_open() )
+    {
+        OE_WARN << LC << "Failed to write metadata record for bin (" << getID() << ")" << std::endl;
+        return false;
+    }
+
+    output << mutableConf.toJSON(true);
+    output.flush();
+    output.close();
+    return true;
+}
@@ -0,0 +1,1178 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2016 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "PackStore"
+#include <osgEarth/Notify>
+#include <osgEarth/FileUtils>
+#include <osgDB/FileUtils>
+#include <osgDB/FileNameUtils>
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define LC "[PackStore] "
+
+using namespace osgEarth;
+using namespace osgEarth::Threading;
+using namespace osgEarth::Drivers::PackCache;
+
+#define SEGMENT_MAGIC       0x4B50454Fu // "OEPK"
+#define RECORD_MAGIC        0x5250454Fu // "OEPR"
+#define INDEX_MAGIC         0x4950454Fu // "OEPI"
+#define PACK_VERSION        1u
+
+#define SEGMENT_HEADER_SIZE 16u
+#define FLAG_TOMBSTONE      0x0001u
+
+#define EMPTY_SLOT          0u
+#define DELETED_SLOT        1u
+#define MIN_CAPACITY        4096u
+#define MAX_LOAD            0.7
+#define MAX_SEGMENT_ID      0xFFFFu
+
+//------------------------------------------------------------------------
+
+// On-disk structures. Fixed-size, native byte order.
+
+struct PackStore::IndexHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;   // number of slots; power of 2
+    uint64_t count;      // live slots
+    uint64_t deleted;    // slots marked deleted
+    uint64_t garbage;    // dead bytes across all segments
+    uint32_t dirty;      // non-zero while the store is open
+    uint32_t reserved[5];
+};
+
+struct PackStore::IndexSlot
+{
+    uint64_t hash;       // EMPTY_SLOT, DELETED_SLOT, or the key hash
+    uint64_t loc;        // segment id (high 16 bits) + byte offset
+};
+
+struct PackStore::Record
+{
+    uint32_t magic;
+    uint16_t flags;
+    uint16_t keyLen;
+    uint32_t metaLen;
+    uint32_t dataLen;
+    uint32_t checksum;   // over key, meta and data
+    uint32_t reserved;
+    int64_t  timestamp;
+};
+
+namespace
+{
+    inline uint64_t makeLoc(unsigned segment, uint64_t offset)
+    {
+        return ((uint64_t)segment << 48) | offset;
+    }
+
+    inline unsigned locSegment(uint64_t loc)
+    {
+        return (unsigned)(loc >> 48);
+    }
+
+    inline uint64_t locOffset(uint64_t loc)
+    {
+        return loc & 0x0000FFFFFFFFFFFFull;
+    }
+
+    // FNV-1a; 0 and 1 are reserved for empty/deleted slots.
+    uint64_t hashKey(const std::string& key)
+    {
+        uint64_t h = 0xcbf29ce484222325ull;
+        for(std::string::const_iterator i = key.begin(); i != key.end(); ++i)
+        {
+            h ^= (unsigned char)(*i);
+            h *= 0x100000001b3ull;
+        }
+        return h < 2u ? h + 2u : h;
+    }
+
+    uint32_t checksum(const char* buf, size_t len, uint32_t h =0x811c9dc5u)
+    {
+        for(size_t i=0; i<len; ++i)
+        {
+            h ^= (unsigned char)buf[i];
+            h *= 0x01000193u;
+        }
+        return h;
+    }
+
+    bool readFully(int fd, void* buf, size_t len, uint64_t offset)
+    {
+        char* ptr = (char*)buf;
+        while( len > 0 )
+        {
+            ssize_t n = ::pread(fd, ptr, len, (off_t)offset);
+            if ( n < 0 && errno == EINTR )
+                continue;
+            if ( n <= 0 )
+                return false;
+            ptr += n, len -= n, offset += n;
+        }
+        return true;
+    }
+
+    bool writeFully(int fd, const void* buf, size_t len, uint64_t offset)
+    {
+        const char* ptr = (const char*)buf;
+        while( len > 0 )
+        {
+            ssize_t n = ::pwrite(fd, ptr, len, (off_t)offset);
+            if ( n < 0 && errno == EINTR )
+                continue;
+            if ( n <= 0 )
+                return false;
+            ptr += n, len -= n, offset += n;
+        }
+        return true;
+    }
+
+    uint64_t fileSize(int fd)
+    {
+        struct stat st;
+        return ::fstat(fd, &st) == 0 ? (uint64_t)st.st_size : 0u;
+    }
+}
+
+//------------------------------------------------------------------------
+
+PackStore::Segment::~Segment()
+{
+    if ( _fd >= 0 )
+        ::close( _fd );
+}
+
+PackStore::Index::~Index()
+{
+    if ( _base )
+        ::munmap( _base, _length );
+}
+
+const PackStore::Segment*
+PackStore::Snapshot::segment(unsigned id) const
+{
+    std::map<unsigned, osg::ref_ptr<Segment> >::const_iterator i = _segments.find(id);
+    return i != _segments.end() ? i->second.get() : 0L;
+}
+
+PackStore::ReaderScope::ReaderScope(const PackStore* store) :
+_store( store )
+{
+    // Announce ourselves before looking at the snapshot, so that a writer
+    // that retires it afterwards will see us and hold off freeing it.
+    ++_store->_activeReaders;
+    _snapshot = __atomic_load_n(&_store->_current, __ATOMIC_SEQ_CST);
+}
+
+PackStore::ReaderScope::~ReaderScope()
+{
+    // A writer that retired a snapshot while we were here had to leave it
+    // alone; if we are the last reader out, free it now.
+    if ( --_store->_activeReaders == 0u && (unsigned)_store->_numRetired > 0u )
+        _store->reclaim();
+}
+
+void
+PackStore::Compactor::run()
+{
+    _store->compactNow();
+    --_store->_compacting;
+}
+
+//------------------------------------------------------------------------
+
+PackStore::PackStore(const std::string& path,
+                     uint64_t           maxSegmentSize,
+                     float              compactThreshold) :
+_path            ( path ),
+_maxSegmentSize  ( std::max(maxSegmentSize, (uint64_t)1048576u) ),
+_compactThreshold( compactThreshold ),
+_open            ( false ),
+_current         ( 0L ),
+_activeId        ( 0u ),
+_activeSize      ( 0u ),
+_totalBytes      ( 0u ),
+_generation      ( 0u ),
+_indexDirty      ( false ),
+_done            ( false ),
+_compactor       ( 0L )
+{
+    // offsets are stored in 48 bits.
+    _maxSegmentSize = std::min(_maxSegmentSize, (uint64_t)0x0000FFFFFFFFFFFFull);
+}
+
+PackStore::~PackStore()
+{
+    _done = true;
+    if ( _compactor )
+    {
+        _compactor->join();
+        delete _compactor;
+    }
+
+    sync();
+
+    delete _current;
+    for(unsigned i=0; i<_retired.size(); ++i)
+        delete _retired[i];
+}
+
+std::string
+PackStore::segmentPath(unsigned id) const
+{
+    char buf[32];
+    sprintf(buf, "seg-%08u.pack", id);
+    return osgDB::concatPaths(_path, buf);
+}
+
+std::string
+PackStore::indexPath() const
+{
+    return osgDB::concatPaths(_path, "index.idx");
+}
+
+bool
+PackStore::open()
+{
+    ScopedMutexLock lock(_writeMutex);
+
+    if ( _open )
+        return true;
+
+    if ( !osgDB::fileExists(_path) && !osgDB::makeDirectory(_path) )
+    {
+        OE_WARN << LC << "Failed to create folder \"" << _path << "\"" << std::endl;
+        return false;
+    }
+
+    // find the existing segments.
+    std::vector<unsigned> ids;
+    osgDB::DirectoryContents files = osgDB::getDirectoryContents(_path);
+    for(osgDB::DirectoryContents::const_iterator f = files.begin(); f != files.end(); ++f)
+    {
+        unsigned id;
+        char tail;
+        if ( sscanf(f->c_str(), "seg-%8u.pac%c", &id, &tail) == 2 && tail == 'k' && id > 0u && id <= MAX_SEGMENT_ID )
+            ids.push_back( id );
+    }
+    std::sort( ids.begin(), ids.end() );
+
+    if ( !openSegments(ids) )
+        return false;
+
+    osg::ref_ptr<Index> index;
+    if ( !ids.empty() && mapIndex(indexPath(), index) && index->_header->dirty == 0u )
+    {
+        _current->_index = index.get();
+    }
+    else
+    {
+        if ( !ids.empty() )
+        {
+            OE_INFO << LC << "Rebuilding index for \"" << _path << "\"" << std::endl;
+        }
+
+        if ( !rebuildIndex(ids) )
+            return false;
+    }
+
+    markDirty();
+    _open = true;
+    return true;
+}
+
+bool
+PackStore::createSegment(unsigned id, Segment*& seg, uint64_t& size)
+{
+    std::string path = segmentPath(id);
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if ( fd < 0 )
+    {
+        OE_WARN << LC << "Failed to create segment \"" << path << "\": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    uint32_t header[4] = { SEGMENT_MAGIC, PACK_VERSION, 0u, 0u };
+    if ( !writeFully(fd, header, SEGMENT_HEADER_SIZE, 0u) )
+    {
+        ::close(fd);
+        return false;
+    }
+
+    seg = new Segment(id, fd, path);
+    size = SEGMENT_HEADER_SIZE;
+    return true;
+}
+
+bool
+PackStore::openSegments(std::vector<unsigned>& ids)
+{
+    _current = new Snapshot();
+    _totalBytes = 0u;
+
+    for(std::vector<unsigned>::iterator i = ids.begin(); i != ids.end(); )
+    {
+        std::string path = segmentPath(*i);
+        int fd = ::open(path.c_str(), O_RDWR);
+        uint32_t header[4];
+        if ( fd < 0 || !readFully(fd, header, SEGMENT_HEADER_SIZE, 0u) || header[0] != SEGMENT_MAGIC || header[1] != PACK_VERSION )
+        {
+            OE_WARN << LC << "Ignoring unreadable segment \"" << path << "\"" << std::endl;
+            if ( fd >= 0 )
+                ::close(fd);
+            i = ids.erase(i);
+            continue;
+        }
+
+        _current->_segments[*i] = new Segment(*i, fd, path);
+        _activeId   = *i;
+        _activeSize = fileSize(fd);
+        _totalBytes += _activeSize;
+        ++i;
+    }
+
+    if ( ids.empty() )
+    {
+        Segment* seg;
+        if ( !createSegment(1u, seg, _activeSize) )
+            return false;
+        _current->_segments[1u] = seg;
+        _activeId = 1u;
+        _totalBytes = _activeSize;
+    }
+
+    return true;
+}
+
+bool
+PackStore::createIndex(uint64_t capacity, const std::string& filename, osg::ref_ptr<Index>& index)
+{
+    size_t length = sizeof(IndexHeader) + capacity*sizeof(IndexSlot);
+
+    int fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if ( fd < 0 || ::ftruncate(fd, (off_t)length) != 0 )
+    {
+        OE_WARN << LC << "Failed to create index \"" << filename << "\": " << strerror(errno) << std::endl;
+        if ( fd >= 0 )
+            ::close(fd);
+        return false;
+    }
+
+    void* base = ::mmap(0L, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if ( base == MAP_FAILED )
+    {
+        OE_WARN << LC << "Failed to map index \"" << filename << "\": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // a fresh file is all zeros, i.e. all slots are empty.
+    index = new Index();
+    index->_base   = base;
+    index->_length = length;
+    index->_header = (IndexHeader*)base;
+    index->_slots  = (IndexSlot*)((char*)base + sizeof(IndexHeader));
+    index->_mask   = capacity - 1u;
+
+    index->_header->magic    = INDEX_MAGIC;
+    index->_header->version  = PACK_VERSION;
+    index->_header->capacity = capacity;
+    index->_header->dirty    = 1u;
+    return true;
+}
+
+bool
+PackStore::mapIndex(const std::string& filename, osg::ref_ptr<Index>& index)
+{
+    int fd = ::open(filename.c_str(), O_RDWR);
+    if ( fd < 0 )
+        return false;
+
+    size_t length = (size_t)fileSize(fd);
+    if ( length < sizeof(IndexHeader) )
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void* base = ::mmap(0L, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if ( base == MAP_FAILED )
+        return false;
+
+    index = new Index();
+    index->_base   = base;
+    index->_length = length;
+    index->_header = (IndexHeader*)base;
+    index->_slots  = (IndexSlot*)((char*)base + sizeof(IndexHeader));
+
+    const IndexHeader& h = *index->_header;
+    if ( h.magic != INDEX_MAGIC ||
+         h.version != PACK_VERSION ||
+         h.capacity < MIN_CAPACITY ||
+         (h.capacity & (h.capacity-1u)) != 0u ||
+         length != sizeof(IndexHeader) + h.capacity*sizeof(IndexSlot) )
+    {
+        index = 0L;
+        return false;
+    }
+
+    index->_mask = h.capacity - 1u;
+    return true;
+}
+
+void
+PackStore::markDirty()
+{
+    // Flag the index so an unclean shutdown triggers a rebuild next time.
+    if ( !_indexDirty && _current && _current->_index.valid() )
+    {
+        Index* index = _current->_index.get();
+        index->_header->dirty = 1u;
+        ::msync(index->_base, sizeof(IndexHeader), MS_SYNC);
+        _indexDirty = true;
+    }
+}
+
+bool
+PackStore::rebuildIndex(const std::vector<unsigned>& ids)
+{
+    osg::ref_ptr<Index> index;
+    std::string temp = indexPath() + ".tmp";
+    if ( !createIndex(MIN_CAPACITY, temp, index) || ::rename(temp.c_str(), indexPath().c_str()) != 0 )
+        return false;
+
+    _current->_index = index.get();
+    _indexDirty = true;
+
+    std::string buf;
+
+    for(unsigned i=0; i<ids.size(); ++i)
+    {
+        const Segment* seg = _current->segment(ids[i]);
+        if ( !seg )
+            continue;
+
+        uint64_t size = fileSize(seg->_fd);
+        uint64_t offset = SEGMENT_HEADER_SIZE;
+
+        while( offset < size )
+        {
+            Record rec;
+            bool ok =
+                offset + sizeof(Record) <= size &&
+                readFully(seg->_fd, &rec, sizeof(Record), offset) &&
+                rec.magic == RECORD_MAGIC;
+
+            uint64_t payload = ok ? (uint64_t)rec.keyLen + rec.metaLen + rec.dataLen : 0u;
+            ok = ok && offset + sizeof(Record) + payload <= size;
+
+            if ( ok )
+            {
+                buf.resize( (size_t)payload );
+                ok =
+                    (payload == 0u || readFully(seg->_fd, &buf[0], buf.size(), offset + sizeof(Record))) &&
+                    checksum(buf.data(), buf.size()) == rec.checksum;
+            }
+
+            if ( !ok )
+            {
+                // A torn write at the end of the newest segment is expected after
+                // a crash. Anywhere else we lose the rest of the segment.
+                if ( ids[i] == _activeId )
+                {
+                    OE_WARN << LC << "Truncating segment \"" << seg->_path << "\" at " << offset << std::endl;
+                    if ( ::ftruncate(seg->_fd, (off_t)offset) == 0 )
+                    {
+                        _totalBytes -= (size - offset);
+                        _activeSize = offset;
+                    }
+                }
+                else
+                {
+                    OE_WARN << LC << "Corrupt record in \"" << seg->_path << "\" at " << offset << "; skipping the rest" << std::endl;
+                    _current->_index->_header->garbage += (size - offset);
+                }
+                break;
+            }
+
+            std::string key(buf.data(), rec.keyLen);
+            uint64_t loc = makeLoc(ids[i], offset);
+            uint64_t recSize = sizeof(Record) + payload;
+
+            if ( rec.flags & FLAG_TOMBSTONE )
+            {
+                erase( key, hashKey(key) );
+                _current->_index->_header->garbage += recSize;
+            }
+            else
+            {
+                insert( key, hashKey(key), loc );
+            }
+
+            offset += recSize;
+        }
+    }
+
+    return true;
+}
+
+bool
+PackStore::growIndex()
+{
+    Index* old = _current->_index.get();
+
+    uint64_t count = old->_header->count;
+    uint64_t capacity = std::max((uint64_t)MIN_CAPACITY, old->_header->capacity);
+    while( (double)(count+1u) > (double)capacity * 0.5 )
+        capacity *= 2u;
+
+    osg::ref_ptr<Index> index;
+    std::string temp = indexPath() + ".tmp";
+    if ( !createIndex(capacity, temp, index) )
+        return false;
+
+    // Live slots move over as-is; the deleted ones are dropped.
+    for(uint64_t i=0; i<=old->_mask; ++i)
+    {
+        const IndexSlot& s = old->_slots[i];
+        if ( s.hash > DELETED_SLOT )
+        {
+            uint64_t j = s.hash & index->_mask;
+            while( index->_slots[j].hash != EMPTY_SLOT )
+                j = (j+1u) & index->_mask;
+            index->_slots[j] = s;
+        }
+    }
+    index->_header->count   = count;
+    index->_header->garbage = old->_header->garbage;
+
+    if ( ::rename(temp.c_str(), indexPath().c_str()) != 0 )
+    {
+        OE_WARN << LC << "Failed to replace index \"" << indexPath() << "\": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    Snapshot* snap = new Snapshot(*_current);
+    snap->_index = index.get();
+    publish( snap );
+    return true;
+}
+
+void
+PackStore::publish(Snapshot* snap)
+{
+    Snapshot* old = _current;
+    __atomic_store_n(&_current, snap, __ATOMIC_SEQ_CST);
+    if ( old )
+    {
+        ScopedMutexLock lock(_retireMutex);
+        _retired.push_back( old );
+        ++_numRetired;
+    }
+    reclaim();
+}
+
+void
+PackStore::reclaim() const
+{
+    // Readers call this too, so it takes its own lock instead of the
+    // write mutex, which a compaction can hold for a while.
+    ScopedMutexLock lock(_retireMutex);
+    if ( _retired.empty() )
+        return;
+
+    // Any reader that arrives after this point sees the new snapshot, so if
+    // no readers are active now none can be holding a retired one.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if ( (unsigned)_activeReaders == 0u )
+    {
+        for(unsigned i=0; i<_retired.size(); ++i)
+        {
+            delete _retired[i];
+            --_numRetired;
+        }
+        _retired.clear();
+    }
+}
+
+bool
+PackStore::rollSegment()
+{
+    if ( _activeId >= MAX_SEGMENT_ID )
+    {
+        OE_WARN << LC << "Out of segment ids in \"" << _path << "\"; compact or clear the cache" << std::endl;
+        return false;
+    }
+
+    // Make sure everything in the sealed segment is on disk.
+    const Segment* sealed = _current->segment(_activeId);
+    if ( sealed )
+        ::fdatasync( sealed->_fd );
+
+    Segment* seg;
+    uint64_t size;
+    if ( !createSegment(_activeId+1u, seg, size) )
+        return false;
+
+    Snapshot* snap = new Snapshot(*_current);
+    snap->_segments[seg->_id] = seg;
+    publish( snap );
+
+    _activeId = seg->_id;
+    _activeSize = size;
+    _totalBytes += size;
+    return true;
+}
+
+//------------------------------------------------------------------------
+
+bool
+PackStore::readHeader(const Snapshot* snap, uint64_t loc, Record& rec, std::string* key) const
+{
+    const Segment* seg = snap->segment(locSegment(loc));
+    if ( !seg )
+        return false;
+
+    uint64_t offset = locOffset(loc);
+
+    // Most keys are short, so grab the header and key in one call.
+    char buf[sizeof(Record) + 128];
+    ssize_t n = ::pread(seg->_fd, buf, sizeof(buf), (off_t)offset);
+    if ( n < (ssize_t)sizeof(Record) )
+        return false;
+
+    memcpy(&rec, buf, sizeof(Record));
+    if ( rec.magic != RECORD_MAGIC )
+        return false;
+
+    if ( key )
+    {
+        size_t have = (size_t)n - sizeof(Record);
+        if ( rec.keyLen <= have )
+        {
+            key->assign(buf + sizeof(Record), rec.keyLen);
+        }
+        else
+        {
+            key->resize(rec.keyLen);
+            if ( !readFully(seg->_fd, &(*key)[0], rec.keyLen, offset + sizeof(Record)) )
+                return false;
+        }
+    }
+    return true;
+}
+
+bool
+PackStore::readRecord(const Snapshot* snap, uint64_t loc, Record& rec, std::string* meta, std::string* data) const
+{
+    const Segment* seg = snap->segment(locSegment(loc));
+    if ( !seg )
+        return false;
+
+    uint64_t offset = locOffset(loc) + sizeof(Record) + rec.keyLen;
+
+    if ( meta && data )
+    {
+        data->resize( rec.metaLen + rec.dataLen );
+        if ( !data->empty() && !readFully(seg->_fd, &(*data)[0], data->size(), offset) )
+            return false;
+        meta->assign( data->data(), rec.metaLen );
+        data->erase( 0, rec.metaLen );
+    }
+    else if ( meta )
+    {
+        meta->resize( rec.metaLen );
+        if ( !meta->empty() && !readFully(seg->_fd, &(*meta)[0], meta->size(), offset) )
+            return false;
+    }
+    else if ( data )
+    {
+        data->resize( rec.dataLen );
+        if ( !data->empty() && !readFully(seg->_fd, &(*data)[0], data->size(), offset + rec.metaLen) )
+            return false;
+    }
+    return true;
+}
+
+bool
+PackStore::probe(const Snapshot* snap, const std::string& key, uint64_t hash, uint64_t& slot) const
+{
+    const Index* index = snap->_index.get();
+    if ( !index )
+        return false;
+
+    std::string candidate;
+    Record rec;
+
+    // Linear probe. Slots are never reused after deletion, so an empty slot
+    // ends the search. Writers publish "loc" before "hash".
+    uint64_t i = hash & index->_mask;
+    for(uint64_t n = 0; n <= index->_mask; ++n, i = (i+1u) & index->_mask)
+    {
+        uint64_t h = __atomic_load_n(&index->_slots[i].hash, __ATOMIC_ACQUIRE);
+        if ( h == EMPTY_SLOT )
+        {
+            slot = i;
+            return false;
+        }
+        if ( h == hash )
+        {
+            uint64_t loc = __atomic_load_n(&index->_slots[i].loc, __ATOMIC_ACQUIRE);
+            if ( readHeader(snap, loc, rec, &candidate) && candidate == key )
+            {
+                slot = i;
+                return true;
+            }
+        }
+    }
+
+    slot = ~(uint64_t)0u;
+    return false;
+}
+
+bool
+PackStore::get(const std::string& key, std::string* meta, std::string* data, TimeStamp* timestamp) const
+{
+    ReaderScope reader(this);
+    const Snapshot* snap = reader._snapshot;
+    if ( !snap )
+        return false;
+
+    uint64_t slot;
+    if ( !probe(snap, key, hashKey(key), slot) )
+        return false;
+
+    uint64_t loc = __atomic_load_n(&snap->_index->_slots[slot].loc, __ATOMIC_ACQUIRE);
+    Record rec;
+    if ( !readHeader(snap, loc, rec, 0L) )
+        return false;
+
+    if ( timestamp )
+        *timestamp = (TimeStamp)rec.timestamp;
+
+    return readRecord(snap, loc, rec, meta, data);
+}
+
+bool
+PackStore::exists(const std::string& key, TimeStamp* timestamp) const
+{
+    return get(key, 0L, 0L, timestamp);
+}
+
+uint64_t
+PackStore::getNumRecords() const
+{
+    ReaderScope reader(this);
+    return reader._snapshot && reader._snapshot->_index.valid() ?
+        reader._snapshot->_index->_header->count : 0u;
+}
+
+uint64_t
+PackStore::getStorageSize() const
+{
+    ScopedMutexLock lock(_writeMutex);
+    uint64_t size = _totalBytes;
+    if ( _current && _current->_index.valid() )
+        size += _current->_index->_length;
+    return size;
+}
+
+//------------------------------------------------------------------------
+
+bool
+PackStore::append(const std::string& key,
+                  const std::string& meta,
+                  const std::string& data,
+                  TimeStamp          timestamp,
+                  uint16_t           flags,
+                  uint64_t&          loc)
+{
+    if ( key.size() > 0xFFFFu || meta.size() > 0xFFFFFFFFu || data.size() > 0xFFFFFFFFu )
+        return false;
+
+    Record rec;
+    rec.magic     = RECORD_MAGIC;
+    rec.flags     = flags;
+    rec.keyLen    = (uint16_t)key.size();
+    rec.metaLen   = (uint32_t)meta.size();
+    rec.dataLen   = (uint32_t)data.size();
+    rec.reserved  = 0u;
+    rec.timestamp = (int64_t)timestamp;
+    rec.checksum  = checksum(data.data(), data.size(), checksum(meta.data(), meta.size(), checksum(key.data(), key.size())));
+
+    uint64_t size = sizeof(Record) + key.size() + meta.size() + data.size();
+
+    if ( _activeSize + size > _maxSegmentSize && _activeSize > SEGMENT_HEADER_SIZE )
+    {
+        if ( !rollSegment() )
+            return false;
+    }
+
+    const Segment* seg = _current->segment(_activeId);
+    if ( !seg || _activeSize + size > 0x0000FFFFFFFFFFFFull )
+        return false;
+
+    std::string buf;
+    buf.reserve( (size_t)size );
+    buf.append( (const char*)&rec, sizeof(Record) );
+    buf.append( key );
+    buf.append( meta );
+    buf.append( data );
+
+    if ( !writeFully(seg->_fd, buf.data(), buf.size(), _activeSize) )
+    {
+        OE_WARN << LC << "Write failed on \"" << seg->_path << "\": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    markDirty();
+
+    loc = makeLoc(_activeId, _activeSize);
+    _activeSize += size;
+    _totalBytes += size;
+    return true;
+}
+
+void
+PackStore::addGarbage(uint64_t loc)
+{
+    Record rec;
+    if ( readHeader(_current, loc, rec, 0L) )
+    {
+        _current->_index->_header->garbage += sizeof(Record) + rec.keyLen + rec.metaLen + rec.dataLen;
+    }
+}
+
+bool
+PackStore::insert(const std::string& key, uint64_t hash, uint64_t loc)
+{
+    IndexHeader* h = _current->_index->_header;
+    if ( (double)(h->count + h->deleted + 1u) > (double)h->capacity * MAX_LOAD )
+    {
+        if ( !growIndex() )
+            return false;
+    }
+
+    Index* index = _current->_index.get();
+
+    uint64_t slot;
+    if ( probe(_current, key, hash, slot) )
+    {
+        addGarbage( index->_slots[slot].loc );
+        __atomic_store_n(&index->_slots[slot].loc, loc, __ATOMIC_RELEASE);
+    }
+    else if ( slot <= index->_mask )
+    {
+        __atomic_store_n(&index->_slots[slot].loc, loc, __ATOMIC_RELAXED);
+        __atomic_store_n(&index->_slots[slot].hash, hash, __ATOMIC_RELEASE);
+        ++index->_header->count;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+bool
+PackStore::erase(const std::string& key, uint64_t hash)
+{
+    Index* index = _current->_index.get();
+
+    uint64_t slot;
+    if ( !probe(_current, key, hash, slot) )
+        return false;
+
+    addGarbage( index->_slots[slot].loc );
+    __atomic_store_n(&index->_slots[slot].hash, (uint64_t)DELETED_SLOT, __ATOMIC_RELEASE);
+    --index->_header->count;
+    ++index->_header->deleted;
+    return true;
+}
+
+bool
+PackStore::put(const std::string& key, const std::string& meta, const std::string& data, TimeStamp timestamp)
+{
+    ScopedMutexLock lock(_writeMutex);
+    if ( !_open )
+        return false;
+
+    uint64_t loc;
+    if ( !append(key, meta, data, timestamp, 0u, loc) )
+        return false;
+
+    if ( !insert(key, hashKey(key), loc) )
+        return false;
+
+    maybeCompact();
+    return true;
+}
+
+bool
+PackStore::remove(const std::string& key)
+{
+    ScopedMutexLock lock(_writeMutex);
+    if ( !_open )
+        return false;
+
+    uint64_t hash = hashKey(key);
+    uint64_t slot, loc;
+    if ( !probe(_current, key, hash, slot) )
+        return false;
+
+    // The tombstone keeps the record dead if the index is ever rebuilt.
+    // It is garbage from the start, and compaction drops it.
+    if ( !append(key, std::string(), std::string(), DateTime().asTimeStamp(), FLAG_TOMBSTONE, loc) )
+        return false;
+
+    erase( key, hash );
+    addGarbage( loc );
+
+    maybeCompact();
+    return true;
+}
+
+bool
+PackStore::touch(const std::string& key, TimeStamp timestamp)
+{
+    ScopedMutexLock lock(_writeMutex);
+    if ( !_open )
+        return false;
+
+    uint64_t slot;
+    if ( !probe(_current, key, hashKey(key), slot) )
+        return false;
+
+    uint64_t loc = _current->_index->_slots[slot].loc;
+    const Segment* seg = _current->segment(locSegment(loc));
+    int64_t ts = (int64_t)timestamp;
+    return seg && writeFully(seg->_fd, &ts, sizeof(ts), locOffset(loc) + offsetof(Record, timestamp));
+}
+
+bool
+PackStore::clear()
+{
+    ScopedMutexLock lock(_writeMutex);
+    if ( !_open )
+        return false;
+
+    // A running compaction notices the new generation and stops.
+    ++_generation;
+
+    // Old files disappear right away; readers still holding the previous
+    // snapshot keep reading through their open descriptors.
+    for(std::map<unsigned, osg::ref_ptr<Segment> >::const_iterator i = _current->_segments.begin();
+        i != _current->_segments.end();
+        ++i)
+    {
+        ::unlink( i->second->_path.c_str() );
+    }
+
+    Segment* seg;
+    uint64_t size;
+    osg::ref_ptr<Index> index;
+    std::string temp = indexPath() + ".tmp";
+    if ( !createSegment(1u, seg, size) )
+        return false;
+
+    Snapshot* snap = new Snapshot();
+    snap->_segments[1u] = seg;
+
+    if ( !createIndex(MIN_CAPACITY, temp, index) || ::rename(temp.c_str(), indexPath().c_str()) != 0 )
+    {
+        delete snap;
+        return false;
+    }
+    snap->_index = index.get();
+
+    publish( snap );
+
+    _activeId   = 1u;
+    _activeSize = size;
+    _totalBytes = size;
+    _indexDirty = true;
+    return true;
+}
+
+void
+PackStore::sync()
+{
+    ScopedMutexLock lock(_writeMutex);
+    if ( !_current || !_current->_index.valid() )
+        return;
+
+    const Segment* seg = _current->segment(_activeId);
+    if ( seg )
+        ::fdatasync( seg->_fd );
+
+    Index* index = _current->_index.get();
+    ::msync( index->_base, index->_length, MS_SYNC );
+    index->_header->dirty = 0u;
+    ::msync( index->_base, sizeof(IndexHeader), MS_SYNC );
+    _indexDirty = false;
+}
+
+//------------------------------------------------------------------------
+
+bool
+PackStore::compact()
+{
+    ScopedMutexLock lock(_writeMutex);
+    if ( !_open )
+        return false;
+
+    startCompaction();
+    return true;
+}
+
+void
+PackStore::maybeCompact()
+{
+    if ( _compactThreshold > 0.0f && _totalBytes > _maxSegmentSize && _compacting == 0u )
+    {
+        uint64_t garbage = _current->_index->_header->garbage;
+        if ( (double)garbage > (double)_compactThreshold * (double)_totalBytes )
+        {
+            startCompaction();
+        }
+    }
+}
+
+void
+PackStore::startCompaction()
+{
+    if ( _compacting != 0u || _done )
+        return;
+
+    if ( _compactor )
+    {
+        _compactor->join();
+        delete _compactor;
+    }
+
+    ++_compacting;
+    _compactor = new Compactor(this);
+    _compactor->start();
+}
+
+void
+PackStore::compactNow()
+{
+    std::vector<osg::ref_ptr<Segment> > sealed;
+    unsigned generation;
+    {
+        ScopedMutexLock lock(_writeMutex);
+        generation = _generation;
+        for(std::map<unsigned, osg::ref_ptr<Segment> >::const_iterator i = _current->_segments.begin();
+            i != _current->_segments.end();
+            ++i)
+        {
+            if ( i->first != _activeId )
+                sealed.push_back( i->second.get() );
+        }
+    }
+
+    if ( sealed.empty() )
+        return;
+
+    OE_INFO << LC << "Compacting " << sealed.size() << " segment(s) in \"" << _path << "\"" << std::endl;
+
+    std::string key, meta, data;
+
+    // Oldest first. By the time a segment is dropped every older one is gone
+    // too, so the tombstones in it have nothing left to shadow.
+    for(unsigned s=0; s<sealed.size() && !_done; ++s)
+    {
+        Segment* seg = sealed[s].get();
+        uint64_t size = fileSize(seg->_fd);
+        uint64_t offset = SEGMENT_HEADER_SIZE;
+        uint64_t live = 0u;
+
+        while( offset < size && !_done )
+        {
+            ScopedMutexLock lock(_writeMutex);
+            if ( _generation != generation )
+                return;
+
+            Record rec;
+            Snapshot here;
+            here._segments[seg->_id] = seg;
+            if ( !readHeader(&here, makeLoc(seg->_id, offset), rec, &key) )
+                break;
+
+            uint64_t loc = makeLoc(seg->_id, offset);
+            uint64_t recSize = sizeof(Record) + rec.keyLen + rec.metaLen + rec.dataLen;
+
+            uint64_t slot;
+            if ( (rec.flags & FLAG_TOMBSTONE) == 0 &&
+                 probe(_current, key, hashKey(key), slot) &&
+                 _current->_index->_slots[slot].loc == loc &&
+                 readRecord(&here, loc, rec, &meta, &data) )
+            {
+                // still live; move it to the active segment.
+                uint64_t newLoc;
+                if ( !append(key, meta, data, (TimeStamp)rec.timestamp, 0u, newLoc) )
+                    return;
+
+                __atomic_store_n(&_current->_index->_slots[slot].loc, newLoc, __ATOMIC_RELEASE);
+                live += recSize;
+            }
+
+            offset += recSize;
+        }
+
+        if ( _done )
+            break;
+
+        ScopedMutexLock lock(_writeMutex);
+        if ( _generation != generation )
+            return;
+
+        std::map<unsigned, osg::ref_ptr<Segment> >::iterator i = _current->_segments.find(seg->_id);
+        if ( i != _current->_segments.end() && i->second.get() == seg )
+        {
+            Snapshot* snap = new Snapshot(*_current);
+            snap->_segments.erase( seg->_id );
+            publish( snap );
+
+            ::unlink( seg->_path.c_str() );
+
+            IndexHeader* h = _current->_index->_header;
+            uint64_t dead = size - SEGMENT_HEADER_SIZE - live;
+            h->garbage = h->garbage > dead ? h->garbage - dead : 0u;
+            _totalBytes -= size;
+        }
+    }
+
+    OE_INFO << LC << "Compaction of \"" << _path << "\" finished" << std::endl;
+}
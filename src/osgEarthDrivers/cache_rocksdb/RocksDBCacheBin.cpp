@@ -77,6 +77,7 @@ namespace
 #define OE_TEST OE_NOTICE
 
 #define TIME_FIELD "rocksdb.time"
+#define SIZE_FIELD "rocksdb.size"
 
 
 RocksDBCacheBin::RocksDBCacheBin(const std::string& binID,
@@ -373,27 +374,53 @@ RocksDBCacheBin::write(const std::string& key, const osg::Object* object, const
     {
         DateTime now;
         rocksdb::WriteBatch batch;
+        ::off_t bytes = 0;
+
+        std::string tuple = binDataKeyTuple(key);
+        std::string metakey = metaKey(key);
+
+        // if this replaces a record, remove its time index entry and count
+        // only the difference in size.
+        ::off_t oldBytes = 0;
+        std::string oldmetavalue;
+        if ( _db->Get(rocksdb::ReadOptions(), metakey, &oldmetavalue).ok() )
+        {
+            Config oldmetadata;
+            decodeMeta(oldmetavalue, oldmetadata);
+            batch.Delete( timeKey(DateTime(oldmetadata.value(TIME_FIELD)), key) );
+            oldBytes = storedSize(tuple, oldmetavalue, oldmetadata);
+        }
 
         // write the data:
         data = datastream.str();
         if ( _tracker->seed().isSet() )
             blend(data, _tracker->seed().value());
-        batch.Put( dataKey(key), data );
+        std::string datakey = dataKey(key);
+        batch.Put( datakey, data );
+        bytes += datakey.size() + data.size();
 
         // write the timestamp index:
-        batch.Put( timeKey(now, key), binDataKeyTuple(key) );
+        std::string timekey = timeKey(now, key);
+        batch.Put( timekey, tuple );
+        bytes += timekey.size() + tuple.size();
 
-        // write the metadata:
+        // write the metadata, including the size of the other two records:
         Config metadata(meta);
         metadata.set( TIME_FIELD, now.asCompactISO8601() );
+        metadata.set( SIZE_FIELD, bytes );
         encodeMeta( metadata, data );
-        batch.Put( metaKey(key), data );
+        batch.Put( metakey, data );
+        bytes += metakey.size() + data.size();
+
+        // if eviction has fallen behind, give it a chance to catch up.
+        _tracker->waitForRoom();
 
         objWriteOK = _db->Write( rocksdb::WriteOptions(), &batch ).ok();
 
         if ( objWriteOK )
         {
             ++_tracker->writes;
+            _tracker->addBytes( bytes - oldBytes );
             postWrite();
             
             if ( _debug )
@@ -416,39 +443,42 @@ RocksDBCacheBin::write(const std::string& key, const osg::Object* object, const
 void
 RocksDBCacheBin::postWrite()
 {
-    if ( _tracker->hasSizeLimit() )
+    // The size limit is enforced by the cache's eviction thread, which the
+    // tracker wakes up as soon as the limit is exceeded.
+    if ( _tracker->isTimeToCheckSize() )
     {
-        if ( _tracker->isOverLimit() )
-        {
-            if ( _tracker->isTimeToPurge() )
-            {
-                this->purgeOldest(_tracker->numToPurge());
-
-                if (_debug)
-                {
-                    off_t size = _tracker->calcSize();
-                    OE_NOTICE 
-                        << LC << "Cache size = " << (size/1048576) << " MB; " 
-                        << "Hit ratio = " << (float)_tracker->hits/(float)_tracker->reads << std::endl;
-                }
-            }
-        }
-        else
+        off_t size = _tracker->getSize();
+        if ( _tracker->isSizeKnown() )
+            writeSize( size );
+
+        if ( _debug )
         {
-            if ( _tracker->isTimeToCheckSize() )
-            {
-                off_t size = _tracker->calcSize();
-                if ( _debug )
-                {
-                    OE_NOTICE 
-                        << LC << "Cache size = " << (size/1048576) << " MB; " 
-                        << "Hit ratio = " << (float)_tracker->hits/(float)_tracker->reads << std::endl;
-                }
-            }
+            OE_NOTICE 
+                << LC << "Cache size = " << (size/1048576) << " MB; " 
+                << "Hit ratio = " << (float)_tracker->hits/(float)_tracker->reads << std::endl;
         }
     }
 }
 
+::off_t
+RocksDBCacheBin::storedSize(const std::string& tuple, const std::string& metavalue, const Config& metadata)
+{
+    ::off_t bytes = metaKeyFromTuple(tuple).size() + metavalue.size();
+
+    ::off_t recorded = metadata.value< ::off_t >(SIZE_FIELD, (::off_t)-1);
+    if ( recorded >= 0 )
+        return bytes + recorded;
+
+    // Written before sizes were recorded; look at the data itself.
+    std::string datakey = dataKeyFromTuple(tuple);
+    std::string datavalue;
+    if ( _db->Get(rocksdb::ReadOptions(), datakey, &datavalue).ok() )
+        bytes += datakey.size() + datavalue.size();
+
+    std::string timekey = "t" + SEP + DateTime(metadata.value(TIME_FIELD)).asCompactISO8601() + SEP + tuple;
+    return bytes + timekey.size() + tuple.size();
+}
+
 CacheBin::RecordStatus
 RocksDBCacheBin::getRecordStatus(const std::string& key)
 {
@@ -486,10 +516,16 @@ RocksDBCacheBin::remove(const std::string& key)
     decodeMeta(metavalue, metadata);
     DateTime t(metadata.value(TIME_FIELD));
 
+    std::string datakey = dataKey(key);
+    std::string metakey = metaKey(key);
+    std::string timekey = timeKey(t, key);
+
+    ::off_t bytes = storedSize(binDataKeyTuple(key), metavalue, metadata);
+
     rocksdb::WriteBatch batch;
-    batch.Delete( dataKey(key) );
-    batch.Delete( metaKey(key) );
-    batch.Delete( timeKey(t, key) );
+    batch.Delete( datakey );
+    batch.Delete( metakey );
+    batch.Delete( timekey );
         
     rocksdb::Status status = _db->Write(rocksdb::WriteOptions(), &batch);
     if ( !status.ok() )
@@ -497,7 +533,10 @@ RocksDBCacheBin::remove(const std::string& key)
         OE_WARN << LC << "Failed to remove (" << key << ") from bin " << getID() << std::endl;
         return false;
     }
-    else if ( _debug )
+
+    _tracker->addBytes( -bytes );
+
+    if ( _debug )
     {
         OE_NOTICE << LC << "Removed (" << key << ") from bin " << getID() << std::endl;
     }
@@ -555,17 +594,21 @@ RocksDBCacheBin::clear()
     rocksdb::WriteOptions wo;
     std::string binphrase = binPhrase();
     rocksdb::WriteBatch batch;
+    ::off_t bytes = 0;
     rocksdb::Iterator* i = _db->NewIterator(rocksdb::ReadOptions());
     for(i->SeekToFirst(); i->Valid(); i->Next())
     {
         std::string key = i->key().ToString();
         if ( key.find(binphrase) != std::string::npos )
         {
-            _db->Delete( wo, i->key() );
+            if ( _db->Delete( wo, i->key() ).ok() )
+                bytes += i->key().size() + i->value().size();
         }
     }
     delete i;
 
+    _tracker->addBytes( -bytes );
+
     if ( _debug )
     {
         OE_NOTICE << LC << "Cleared bin " << getID() << std::endl;
@@ -648,41 +691,89 @@ RocksDBCacheBin::writeMetadata(const Config& conf)
 }
 
 bool
-RocksDBCacheBin::purgeOldest(unsigned maxnum)
+RocksDBCacheBin::purgeOldest(unsigned maxnum, unsigned& count, ::off_t& bytes)
 {
+    count = 0;
+    bytes = 0;
+
     if ( !binValidForWriting() )
         return false;
 
-    rocksdb::Iterator* it = _db->NewIterator(rocksdb::ReadOptions());
+    rocksdb::ReadOptions ro;
+    rocksdb::WriteBatch batch;
+    rocksdb::Iterator* it = _db->NewIterator(ro);
 
-    unsigned count = 0;
     std::string limit = timeEndGlobal();
+    std::string metavalue;
 
     // note: this will delete records NOT OF THIS BIN as well!
     for(it->Seek(timeBeginGlobal());
         count < maxnum && it->Valid() && it->key().ToString() < limit;
         it->Next(), ++count )
     {
-        if ( !it->status().ok() )
-            break;
-
         std::string tuple = it->value().ToString();
+        std::string datakey = dataKeyFromTuple(tuple);
+        std::string metakey = metaKeyFromTuple(tuple);
+
+        if ( _db->Get(ro, metakey, &metavalue).ok() )
+        {
+            Config metadata;
+            decodeMeta(metavalue, metadata);
+            bytes += storedSize(tuple, metavalue, metadata);
+        }
+        else
+        {
+            // a stray index entry
+            bytes += it->key().size() + tuple.size();
+        }
 
-        // doing this in a WriteBatch did not work. The size of the
-        // database would never go down.
-        rocksdb::WriteOptions wo;
-        _db->Delete( wo, dataKeyFromTuple(tuple) );
-        _db->Delete( wo, metaKeyFromTuple(tuple) );
-        _db->Delete( wo, it->key() );
+        batch.Delete( datakey );
+        batch.Delete( metakey );
+        batch.Delete( it->key() );
     }
 
+    bool ok = it->status().ok();
     delete it;
 
-    if ( _debug )
+    // The space on disk comes back as RocksDB compacts the deleted records
+    // in the background; the tracker counts it as free right away.
+    if ( ok && count > 0 )
+    {
+        ok = _db->Write(rocksdb::WriteOptions(), &batch).ok();
+        if ( ok )
+            _tracker->addBytes( -bytes );
+        else
+            OE_WARN << LC << "Failed to purge " << count << " record(s)" << std::endl;
+    }
+
+    if ( _debug && ok )
     {
         OE_NOTICE << LC << "Purged " << count << " record(s) for "
-            << (_tracker->calcSize()/1048576) << " MB" << std::endl;
+            << (bytes/1048576) << " MB" << std::endl;
     }
 
-    return true;
+    return ok;
+}
+
+bool
+RocksDBCacheBin::readSize(::off_t& bytes)
+{
+    if ( !binValidForReading() )
+        return false;
+
+    std::string value;
+    if ( !_db->Get(rocksdb::ReadOptions(), "s" + SEP + "size", &value).ok() )
+        return false;
+
+    bytes = as< ::off_t >(value, (::off_t)-1);
+    return bytes >= 0;
+}
+
+bool
+RocksDBCacheBin::writeSize(::off_t bytes)
+{
+    if ( !binValidForWriting() )
+        return false;
+
+    return _db->Put(rocksdb::WriteOptions(), "s" + SEP + "size", Stringify() << bytes).ok();
 }
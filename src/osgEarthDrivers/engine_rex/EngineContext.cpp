@@ -104,43 +104,33 @@ namespace
             _policy = POLICY_FIND_ALL;
         }
 
+        // Checks every tile it is given; the policy decides how many tiles
+        // the registry hands over (see run).
         void operator()(const TileNodeRegistry::TileNodeMap& tiles) const
         {
-            if ( tiles.empty() ) return;
-            unsigned f = _stamp->getFrameNumber(), s = tiles.size();
+            for (TileNodeRegistry::TileNodeMap::const_iterator i = tiles.begin(); i != tiles.end(); ++i)
+            {
+                const TileNode* tile = i->second.tile.get();
+                if (tile->areSubTilesDormant(_stamp))
+                    _keys.push_back(i->first);
+            }
+        }
 
+        void run(const TileNodeRegistry& tiles) const
+        {
             switch (_policy)
             {
                 case POLICY_FIND_ALL:
-                {
-                    for (TileNodeRegistry::TileNodeMap::const_iterator i = tiles.begin(); i != tiles.end(); ++i)
-                    {
-                        const TileNode* tile = i->second.tile.get();
-                        if (tile->areSubTilesDormant(_stamp))
-                            _keys.push_back(i->first);
-                    }
-                }
-                break;
+                    tiles.run(*this);
+                    break;
 
                 case POLICY_FIND_ONE:
-                {
-                    const TileNode* tile = tiles.at(f%s);
-                    if (tile->areSubTilesDormant(_stamp))
-                    {
-                        _keys.push_back(tile->getKey());
-                    }
-                }
-                break;
+                    tiles.runOnNext(1u, *this);
+                    break;
 
                 default:
                 case POLICY_FIND_SOME:
-                {
-                    for(unsigned i=0; i<4; ++i) {
-                        const TileNode* tile = tiles.at((f+i)%s);
-                        if ( tile->areSubTilesDormant(_stamp) )
-                            _keys.push_back( tile->getKey() );
-                    }
-                }
+                    tiles.runOnNext(4u, *this);
             }
         }
     };
@@ -178,7 +168,7 @@ EngineContext::endCull(osgUtil::CullVisitor* cv)
     // Scan for tiles that need to be unloaded.
     std::vector<TileKey> tilesWithChildrenToUnload;
     Scanner scanner(tilesWithChildrenToUnload, cv->getFrameStamp());
-    _liveTiles->run( scanner );
+    scanner.run( *_liveTiles );
 
     if ( !tilesWithChildrenToUnload.empty() )
     {        
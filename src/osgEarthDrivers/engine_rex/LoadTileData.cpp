@@ -117,6 +117,23 @@ LoadTileData::apply(const osg::FrameStamp* stamp)
     }
 }
 
+unsigned
+LoadTileData::getMergeCost() const
+{
+    unsigned cost = 1u;
+    if (_dataModel.valid())
+    {
+        cost += _dataModel->colorLayers().size();
+        cost += _dataModel->patchLayers().size();
+        cost += _dataModel->sharedLayers().size();
+        if (_dataModel->elevationModel().valid())
+            ++cost;
+        if (_dataModel->normalModel().valid())
+            ++cost;
+    }
+    return cost;
+}
+
 namespace
 {
     // Fake attribute that compiles everything in the TerrainTileModel
@@ -42,8 +42,12 @@ Loader::Request::Request()
     _state = IDLE;
     _loadCount = 0;
     _priority = 0;
+    _screenSpaceError = 0.0f;
+    _mergePriority = 0.0f;
     _lastFrameSubmitted = 0;
     _lastTick = 0;
+    _cancelTick = 0;
+    _resultTick = 0;
 }
 
 void
@@ -220,8 +224,11 @@ namespace
 PagerLoader::PagerLoader(TerrainEngineNode* engine) :
 _checkpoint    ( (osg::Timer_t)0 ),
 _mergesPerFrame( 0 ),
+_mergeBudget_ms( 0.0f ),
+_mergeCostPerUnit_ms( 0.1 ),
 _frameNumber   ( 0 ),
-_numLODs       ( 20u )
+_numLODs       ( 20u ),
+_cancelAfterFrames( 2u )
 {
     _myNodePath.push_back( this );
 
@@ -236,6 +243,9 @@ _numLODs       ( 20u )
         _priorityScales[i] = 1.0f;
         _priorityOffsets[i] = 0.0f;
     }
+
+    for (unsigned i = 0; i < NUM_MERGE_TIME_BINS; ++i)
+        _mergeTimeHistogram[i] = 0u;
 }
 
 void
@@ -253,6 +263,18 @@ PagerLoader::setMergesPerFrame(int value)
     
 }
 
+void
+PagerLoader::setMergeBudget(float ms)
+{
+    _mergeBudget_ms = osg::maximum(ms, 0.0f);
+
+    // merging happens in the event traversal
+    if ( _mergeBudget_ms > 0.0f && getNumChildrenRequiringEventTraversal() == 0 )
+        ADJUST_EVENT_TRAV_COUNT(this, +1);
+
+    OE_INFO << LC << "Merge budget = " << _mergeBudget_ms << " ms/frame" << std::endl;
+}
+
 void
 PagerLoader::setLODPriorityScale(unsigned lod, float priorityScale)
 {
@@ -267,6 +289,40 @@ PagerLoader::setLODPriorityOffset(unsigned lod, float offset)
         _priorityOffsets[lod] = offset;
 }
 
+void
+PagerLoader::setCancelAfterFrames(unsigned frames)
+{
+    _cancelAfterFrames = osg::maximum(frames, 1u);
+}
+
+void
+PagerLoader::setCancelPriorityThreshold(float value)
+{
+    _cancelPriorityThreshold = value;
+}
+
+bool
+PagerLoader::isBelowCancelPriority(float normalizedPriority) const
+{
+    return
+        _cancelPriorityThreshold.isSet() &&
+        normalizedPriority < _cancelPriorityThreshold.get() / (float)(_numLODs+1);
+}
+
+void
+PagerLoader::cancel(Loader::Request* req)
+{
+    if (req->isRunning())
+    {
+        // RequestProgressCallback sees the IDLE state and aborts the invoke.
+        req->_cancelTick = osg::Timer::instance()->tick();
+        ++_stats._canceled;
+    }
+    req->setState( Request::IDLE );
+    if ( REPORT_ACTIVITY )
+        Registry::instance()->endActivity( req->getName() );
+}
+
 bool
 PagerLoader::load(Loader::Request* request, float priority, osg::NodeVisitor& nv)
 {
@@ -279,35 +335,67 @@ PagerLoader::load(Loader::Request* request, float priority, osg::NodeVisitor& nv
         if ( nv.getFrameStamp() )
         {
             fn = nv.getFrameStamp()->getFrameNumber();
-            request->setFrameNumber( fn );
         }
 
-        bool addToRequestSet = false;
+        // scale and bias the priority, and then normalize it to [0..1] range.
+        unsigned lod = request->getTileKey().getLOD();
+        float p = (priority * _priorityScales[lod] + _priorityOffsets[lod]) / (float)(_numLODs+1);
+
+        bool submit = true;
+        bool duplicate = false;
 
         // lock the request since multiple cull traversals might hit this function.
         request->lock();
         {
-            request->setState(Request::RUNNING);
-            
-            // remember the last tick at which this request was submitted
-            request->_lastTick = osg::Timer::instance()->tick();
+            if ( isBelowCancelPriority(p) )
+            {
+                // Too unimportant to load. Don't refresh the frame number; if the
+                // request is already running, the next update will cancel it.
+                request->_priority = p;
+                submit = false;
+            }
 
-            // update the priority, scale and bias it, and then normalize it to [0..1] range.
-            unsigned lod = request->getTileKey().getLOD();
-            float p = priority * _priorityScales[lod] + _priorityOffsets[lod];            
-            request->_priority = p / (float)(_numLODs+1);
+            else if ( request->isRunning() && fn != 0 && request->getLastFrameSubmitted() == fn )
+            {
+                // Another view (or cull pass) already submitted this request this
+                // frame. Only go back to the pager if this view needs it sooner.
+                duplicate = true;
+                submit = p > request->_priority;
+                if ( submit )
+                    request->_priority = p;
+            }
+
+            else
+            {
+                if ( !request->isRunning() )
+                    request->_cancelTick = 0;
 
-            // timestamp it
-            request->setFrameNumber( fn );
+                request->setState(Request::RUNNING);
 
-            // incremenet the load count.
-            request->_loadCount++;
+                // remember the last tick at which this request was submitted
+                request->_lastTick = osg::Timer::instance()->tick();
 
-            // if this is the first load request since idle, we need to remember this request.
-            addToRequestSet = (request->_loadCount == 1);
+                request->_priority = p;
+
+                // timestamp it
+                request->setFrameNumber( fn );
+
+                // incremenet the load count.
+                request->_loadCount++;
+            }
         }
         request->unlock();
 
+        if ( !submit )
+        {
+            if ( duplicate )
+            {
+                Threading::ScopedMutexLock lock( _requestsMutex );
+                ++_stats._deduplicated;
+            }
+            return false;
+        }
+
         char filename[64];
         //sprintf(filename, "%u.%u.osgearth_rex_loader", request->_uid, _engineUID);
         sprintf(filename, "%u.osgearth_rex_loader", request->_uid);
@@ -321,13 +409,34 @@ PagerLoader::load(Loader::Request* request, float priority, osg::NodeVisitor& nv
             _dboptions.get() );
 
         // remember the request:
-        if ( true ) // addToRequestSet // Not sure whether we need to keep doing this in order keep it sorted -- check it out.
+        if ( !duplicate )
         {
             Threading::ScopedMutexLock lock( _requestsMutex );
             _requests[request->getUID()] = request;
+
+            // A different request object for the same tile operation supersedes
+            // any older one still in flight (e.g. a tile that expired and was
+            // re-created before its first load finished).
+            std::pair<TileKey, std::string> id(request->getTileKey(), request->getName());
+            RequestIndex::iterator j = _requestIndex.find(id);
+            if ( j == _requestIndex.end() )
+            {
+                _requestIndex[id] = request->getUID();
+            }
+            else if ( j->second != request->getUID() )
+            {
+                Requests::iterator old = _requests.find(j->second);
+                if ( old != _requests.end() && !old->second->isMerging() )
+                {
+                    cancel( old->second.get() );
+                    ++_stats._deduplicated;
+                    _requests.erase( old );
+                }
+                j->second = request->getUID();
+            }
         }
 
-        return true;
+        return !duplicate;
     }
     return false;
 }
@@ -351,25 +460,7 @@ PagerLoader::traverse(osg::NodeVisitor& nv)
         }
 
         // process pending merges.
-        {
-            METRIC_BEGIN("loader.merge");
-            int count;
-            for(count=0; count < _mergesPerFrame && !_mergeQueue.empty(); ++count)
-            {
-                Request* req = _mergeQueue.begin()->get();
-                if ( req && req->_lastTick >= _checkpoint )
-                {
-                    OE_START_TIMER(req_apply);
-                    req->apply( getFrameStamp() );
-                    double s = OE_STOP_TIMER(req_apply);
-
-                    req->setState(Request::FINISHED);
-                }
-
-                _mergeQueue.erase( _mergeQueue.begin() );
-            }
-            METRIC_END("loader.merge");
-        }
+        merge();
 
         // cull finished requests.
         {
@@ -386,6 +477,7 @@ PagerLoader::traverse(osg::NodeVisitor& nv)
             {
                 Request* req = i->second.get();
                 const unsigned frameDiff = fn - req->getLastFrameSubmitted();
+                bool remove = true;
 
                 // Deal with completed requests:
                 if ( req->isFinished() )
@@ -394,17 +486,13 @@ PagerLoader::traverse(osg::NodeVisitor& nv)
                     req->setState( Request::IDLE );
                     if ( REPORT_ACTIVITY )
                         Registry::instance()->endActivity( req->getName() );
-                    _requests.erase( i++ );
                 }
 
-                // Discard requests that are no longer required:
-                else if ( !req->isMerging() && frameDiff > 2 )
+                // Cancel requests that are no longer required, or no longer important enough:
+                else if ( !req->isMerging() && (frameDiff > _cancelAfterFrames || isBelowCancelPriority(req->_priority)) )
                 {
                     //OE_INFO << LC << req->getName() << "(" << i->second->getUID() << ") died waiting after " << frameDiff << " frames" << std::endl; 
-                    req->setState( Request::IDLE );
-                    if ( REPORT_ACTIVITY )
-                        Registry::instance()->endActivity( req->getName() );
-                    _requests.erase( i++ );
+                    cancel( req );
                 }
 
                 // Prevent a request from getting stuck in the merge queue:
@@ -414,15 +502,55 @@ PagerLoader::traverse(osg::NodeVisitor& nv)
                     req->setState( Request::IDLE );
                     if ( REPORT_ACTIVITY )
                         Registry::instance()->endActivity( req->getName() );
-                    _requests.erase( i++ );
                 }
 
                 else // still valid.
+                {
+                    remove = false;
+                }
+
+                if ( remove )
+                {
+                    RequestIndex::iterator j = _requestIndex.find(std::make_pair(req->getTileKey(), req->getName()));
+                    if ( j != _requestIndex.end() && j->second == req->getUID() )
+                        _requestIndex.erase( j );
+
+                    _requests.erase( i++ );
+                }
+                else
                 {
                     ++i;
                 }
             }
 
+            Metrics::counter("RexLoader",
+                "Requests",     _requests.size(),
+                "Canceled",     _stats._canceled,
+                "Deduplicated", _stats._deduplicated);
+
+            Metrics::counter("RexLoader",
+                "Merged", _stats._merged,
+                "Merge latency (ms)",  _stats._merged > 0 ? 1000.0*_stats._mergeLatency_s/(double)_stats._merged : 0.0,
+                "Cancel latency (ms)", _stats._cancelLatencyCount > 0 ? 1000.0*_stats._cancelLatency_s/(double)_stats._cancelLatencyCount : 0.0);
+
+            Metrics::counter("RexLoader",
+                "Merge time (ms)", 1000.0*_stats._mergeTime_s,
+                "Merge queue", _mergeQueue.size(),
+                "Merge cost estimate (ms)", _mergeCostPerUnit_ms);
+
+            // frames that merged something, by total merge time (cumulative):
+            Metrics::counter("RexLoader merge time",
+                "< 1 ms",  _mergeTimeHistogram[0],
+                "1-2 ms",  _mergeTimeHistogram[1],
+                "2-4 ms",  _mergeTimeHistogram[2]);
+
+            Metrics::counter("RexLoader merge time",
+                "4-8 ms",  _mergeTimeHistogram[3],
+                "8-16 ms", _mergeTimeHistogram[4],
+                ">= 16 ms", _mergeTimeHistogram[5]);
+
+            _stats = Stats();
+
             //OE_NOTICE << LC << "PagerLoader: requests=" << _requests.size() << "; mergeQueue=" << _mergeQueue.size() << std::endl;
         }
     }
@@ -431,6 +559,66 @@ PagerLoader::traverse(osg::NodeVisitor& nv)
 }
 
 
+void
+PagerLoader::merge()
+{
+    METRIC_BEGIN("loader.merge");
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    double elapsed_ms = 0.0;
+    bool useBudget = _mergeBudget_ms > 0.0f;
+
+    // count only the requests actually merged, not the stale ones skipped
+    int count = 0;
+    while( !_mergeQueue.empty() )
+    {
+        if ( !useBudget && count >= _mergesPerFrame )
+            break;
+
+        Request* req = _mergeQueue.begin()->get();
+
+        if ( req && req->_lastTick >= _checkpoint )
+        {
+            unsigned cost = osg::maximum(req->getMergeCost(), 1u);
+
+            // Stop when the next merge is not expected to fit in what's left of
+            // the budget. Always merge at least one so the queue can't stall.
+            if ( useBudget && count > 0 && elapsed_ms + _mergeCostPerUnit_ms*(double)cost > _mergeBudget_ms )
+                break;
+
+            osg::Timer_t t0 = osg::Timer::instance()->tick();
+            req->apply( getFrameStamp() );
+            osg::Timer_t t1 = osg::Timer::instance()->tick();
+
+            req->setState(Request::FINISHED);
+
+            // refine the per-unit cost estimate (moving average)
+            double ms = osg::Timer::instance()->delta_m(t0, t1);
+            _mergeCostPerUnit_ms = 0.9*_mergeCostPerUnit_ms + 0.1*(ms/(double)cost);
+
+            ++_stats._merged;
+            _stats._mergeLatency_s += osg::Timer::instance()->delta_s(req->_resultTick, t1);
+            ++count;
+        }
+
+        _mergeQueue.erase( _mergeQueue.begin() );
+        elapsed_ms = osg::Timer::instance()->delta_m(start, osg::Timer::instance()->tick());
+    }
+
+    _stats._mergeTime_s = 0.001*elapsed_ms;
+
+    // only frames that merged something go in the histogram
+    if ( count > 0 )
+    {
+        unsigned bin = 0;
+        for(double limit = 1.0; bin < NUM_MERGE_TIME_BINS-1 && elapsed_ms >= limit; limit *= 2.0)
+            ++bin;
+        ++_mergeTimeHistogram[bin];
+    }
+
+    METRIC_END("loader.merge");
+}
+
 bool
 PagerLoader::addChild(osg::Node* node)
 {
@@ -444,8 +632,12 @@ PagerLoader::addChild(osg::Node* node)
             // and running (i.e. has not been canceled along the way)
             if (req->_lastTick >= _checkpoint && req->isRunning())
             {
-                if ( _mergesPerFrame > 0 )
+                if ( useMergeQueue() )
                 {
+                    req->_resultTick = osg::Timer::instance()->tick();
+                    // With a time budget, merge the tiles with the largest screen-space
+                    // error first; otherwise keep the order the requests were prioritized in.
+                    req->_mergePriority = _mergeBudget_ms > 0.0f ? req->getScreenSpaceError() : req->_priority;
                     _mergeQueue.insert( req );
                     req->setState( Request::MERGING );
                 }
@@ -508,6 +700,15 @@ PagerLoader::invokeAndRelease(UID requestUID)
 
         osg::ref_ptr<ProgressCallback> prog = new RequestProgressCallback(request);
         request->invoke(prog.get());
+
+        // Time from the loader canceling the request to the invoke giving up:
+        osg::Timer_t cancelTick = request->_cancelTick;
+        if ( cancelTick != 0 && prog->isCanceled() )
+        {
+            Threading::ScopedMutexLock lock( _requestsMutex );
+            _stats._cancelLatency_s += osg::Timer::instance()->delta_s(cancelTick, osg::Timer::instance()->tick());
+            ++_stats._cancelLatencyCount;
+        }
     }
 
     else
@@ -1029,6 +1029,10 @@ TileNode::load(TerrainCuller* culler)
     // (because of the biggest range), and second by distance.
     float priority = lodPriority + distPriority;
 
+    // Approximate screen-space error: a tile's geometric error scales with its
+    // size, so size over distance orders tiles by how visible their error is.
+    _loadRequest->setScreenSpaceError( getBound().radius() / osg::maximum(distance, 1.0f) );
+
     // Submit to the loader.
     _context->getLoader()->load( _loadRequest.get(), priority, *culler );
 }
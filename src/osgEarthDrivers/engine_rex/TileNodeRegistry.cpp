@@ -53,30 +53,127 @@ TileNodeRegistry::setNotifyNeighbors(bool value)
     _notifyNeighbors = value;
 }
 
-void
-TileNodeRegistry::setMapRevision(const Revision& rev,
-                                 bool            setToDirty)
+namespace
 {
-    if ( _revisioningEnabled )
+    struct SetMapRevision : public TileNodeRegistry::Tiles::Functor
     {
-        if ( _maprev != rev || setToDirty )
+        SetMapRevision(const Revision& rev, bool setToDirty) : _rev(rev), _setToDirty(setToDirty) { }
+        void operator()(TileNodeRegistry::TileNodeMap& tiles)
+        {
+            for( TileNodeRegistry::TileNodeMap::iterator i = tiles.begin(); i != tiles.end(); ++i )
+            {
+                i->second.tile->setMapRevision( _rev );
+                if ( _setToDirty )
+                {
+                    i->second.tile->setDirty( true );
+                }
+            }
+        }
+        const Revision& _rev;
+        bool _setToDirty;
+    };
+
+    struct SetDirty : public TileNodeRegistry::Tiles::Functor
+    {
+        SetDirty(const GeoExtent& extent, unsigned minLevel, unsigned maxLevel) :
+            _extent(extent), _minLevel(minLevel), _maxLevel(maxLevel) { }
+        void operator()(TileNodeRegistry::TileNodeMap& tiles)
         {
-            Threading::ScopedWriteLock exclusive( _tilesMutex );
+            bool checkSRS = false;
+            for( TileNodeRegistry::TileNodeMap::iterator i = tiles.begin(); i != tiles.end(); ++i )
+            {
+                const TileKey& key = i->first;
+                if (_minLevel <= key.getLOD() && 
+                    _maxLevel >= key.getLOD() &&
+                    _extent.intersects(i->first.getExtent(), checkSRS) )
+                {
+                    i->second.tile->setDirty( true );
+                }
+            }
+        }
+        const GeoExtent& _extent;
+        unsigned _minLevel, _maxLevel;
+    };
 
-            if ( _maprev != rev || setToDirty )
+    template<typename SET>
+    struct AddWaiter : public ShardedMap<TileKey, SET, TileKeyHash>::Functor
+    {
+        AddWaiter(const TileKey& target, const TileKey& waiter) : _target(target), _waiter(waiter) { }
+        void operator()(std::map<TileKey, SET>& notifiers)
+        {
+            notifiers[_target].insert(_waiter);
+        }
+        const TileKey& _target;
+        const TileKey& _waiter;
+    };
+
+    template<typename SET>
+    struct RemoveWaiter : public ShardedMap<TileKey, SET, TileKeyHash>::Functor
+    {
+        RemoveWaiter(const TileKey& target, const TileKey& waiter) : _target(target), _waiter(waiter), _removed(false) { }
+        void operator()(std::map<TileKey, SET>& notifiers)
+        {
+            typename std::map<TileKey, SET>::iterator i = notifiers.find(_target);
+            if (i != notifiers.end())
             {
-                _maprev = rev;
+                typename SET::iterator w = i->second.find(_waiter);
+                if (w != i->second.end())
+                {
+                    i->second.erase(w);
+                    _removed = true;
+                }
 
-                for( TileNodeMap::iterator i = _tiles.begin(); i != _tiles.end(); ++i )
+                // if the set is now empty, remove the set entirely
+                if (i->second.empty())
                 {
-                    i->second.tile->setMapRevision( _maprev );
-                    if ( setToDirty )
-                    {
-                        i->second.tile->setDirty( true );
-                    }
+                    notifiers.erase(i);
                 }
             }
         }
+        const TileKey& _target;
+        const TileKey& _waiter;
+        bool _removed;
+    };
+
+    struct FindAny : public TileNodeRegistry::Tiles::ConstFunctor
+    {
+        FindAny(TileKey& key) : _key(key) { }
+        void operator()(const TileNodeRegistry::TileNodeMap& tiles) const
+        {
+            if (!_key.valid() && !tiles.empty())
+                _key = tiles.begin()->first;
+        }
+        TileKey& _key;
+    };
+
+    struct RunOperation : public TileNodeRegistry::Tiles::Functor
+    {
+        RunOperation(TileNodeRegistry::Operation& op) : _op(op) { }
+        void operator()(TileNodeRegistry::TileNodeMap& tiles) { _op(tiles); }
+        TileNodeRegistry::Operation& _op;
+    };
+
+    struct RunConstOperation : public TileNodeRegistry::Tiles::ConstFunctor
+    {
+        RunConstOperation(const TileNodeRegistry::ConstOperation& op) : _op(op) { }
+        void operator()(const TileNodeRegistry::TileNodeMap& tiles) const { _op(tiles); }
+        const TileNodeRegistry::ConstOperation& _op;
+    };
+}
+
+void
+TileNodeRegistry::setMapRevision(const Revision& rev,
+                                 bool            setToDirty)
+{
+    if ( _revisioningEnabled )
+    {
+        if ( _maprev != rev || setToDirty )
+        {
+            _maprev = rev;
+
+            SetMapRevision op(_maprev, setToDirty);
+            _tiles.forEach( op );
+        }
     }
 }
 
@@ -88,25 +185,16 @@ TileNodeRegistry::setDirty(const GeoExtent& extent,
                            unsigned         minLevel,
                            unsigned         maxLevel)
 {
-    Threading::ScopedWriteLock exclusive( _tilesMutex );
-    
-    bool checkSRS = false;
-    for( TileNodeMap::iterator i = _tiles.begin(); i != _tiles.end(); ++i )
-    {
-        const TileKey& key = i->first;
-        if (minLevel <= key.getLOD() && 
-            maxLevel >= key.getLOD() &&
-            extent.intersects(i->first.getExtent(), checkSRS) )
-        {
-            i->second.tile->setDirty( true );
-        }
-    }
+    SetDirty op(extent, minLevel, maxLevel);
+    _tiles.forEach( op );
 }
 
 void
-TileNodeRegistry::addSafely(TileNode* tile)
+TileNodeRegistry::addImpl(TileNode* tile)
 {
-    _tiles.insert( tile->getKey(), tile );
+    Entry entry;
+    entry.tile = tile;
+    _tiles.insert( tile->getKey(), entry );
     
     if ( _revisioningEnabled )
         tile->setMapRevision( _maprev );
@@ -118,20 +206,19 @@ TileNodeRegistry::addSafely(TileNode* tile)
         startListeningFor(tile->getKey().createNeighborKey(0, 1), tile);
 
         // check for tiles that are waiting on this tile, and notify them!
-        TileKeyOneToMany::iterator notifier = _notifiers.find( tile->getKey() );
-        if ( notifier != _notifiers.end() )
+        // The tile is already in the map, so any listener that registers from
+        // now on will find it by itself.
+        TileKeySet listeners;
+        if ( _notifiers.erase( tile->getKey(), &listeners ) )
         {
-            TileKeySet& listeners = notifier->second;
-
             for(TileKeySet::iterator listener = listeners.begin(); listener != listeners.end(); ++listener)
             {
-                TileNode* listenerTile = _tiles.find( *listener );
-                if ( listenerTile )
+                osg::ref_ptr<TileNode> listenerTile;
+                if ( get( *listener, listenerTile ) )
                 {
-                    listenerTile->notifyOfArrival( tile );
+                    notify( listenerTile.get(), tile );
                 }
             }
-            _notifiers.erase( notifier );
         }
 
         OE_DEBUG << LC << _name 
@@ -143,24 +230,49 @@ TileNodeRegistry::addSafely(TileNode* tile)
     Metrics::counter("RexStats", "Tiles", _tiles.size());
 }
 
-void
-TileNodeRegistry::removeSafely(const TileKey& key)
+bool
+TileNodeRegistry::removeImpl(const TileKey& key, osg::ref_ptr<TileNode>& out_tile)
 {
-    TileNode* tile = _tiles.find(key);
-    if (tile)
+    Entry entry;
+    if ( !_tiles.erase( key, &entry ) )
+        return false;
+
+    out_tile = entry.tile.get();
+
+    if (_notifyNeighbors)
     {
-        if (_notifyNeighbors)
-        {
-            // remove neighbor listeners:
-            stopListeningFor(key.createNeighborKey(1, 0), tile);
-            stopListeningFor(key.createNeighborKey(0, 1), tile);
-        }
+        // remove neighbor listeners:
+        stopListeningFor(key.createNeighborKey(1, 0), out_tile.get());
+        stopListeningFor(key.createNeighborKey(0, 1), out_tile.get());
+    }
 
-        // remove the tile.
-        _tiles.erase( key );
+    Metrics::counter("RexStats", "Tiles", _tiles.size());
+    return true;
+}
 
-        Metrics::counter("RexStats", "Tiles", _tiles.size());
+void
+TileNodeRegistry::retire(TileNode* tile)
+{
+    // Epoch-based reclamation with the traversal frame as the epoch: a cull
+    // thread may still be working with a tile it found during the current
+    // frame, so keep the registry's reference until two frames have passed.
+    Threading::ScopedMutexLock lock( _retiredMutex );
+    _retired.push_back( std::make_pair((unsigned)_frameNumber, osg::ref_ptr<TileNode>(tile)) );
+}
+
+void
+TileNodeRegistry::releaseRetired()
+{
+    RetiredTiles expired;
+    {
+        Threading::ScopedMutexLock lock( _retiredMutex );
+        unsigned frame = _frameNumber;
+        RetiredTiles::iterator i = _retired.begin();
+        while ( i != _retired.end() && frame - i->first >= 2u )
+            ++i;
+        expired.splice( expired.end(), _retired, _retired.begin(), i );
     }
+    // expired tiles are released here, outside the lock.
 }
 
 void
@@ -168,8 +280,7 @@ TileNodeRegistry::add( TileNode* tile )
 {
     if ( tile )
     {
-        Threading::ScopedWriteLock exclusive( _tilesMutex );
-        addSafely( tile );
+        addImpl( tile );
     }
 }
 
@@ -178,11 +289,10 @@ TileNodeRegistry::add( const TileNodeVector& tiles )
 {
     if ( tiles.size() > 0 )
     {
-        Threading::ScopedWriteLock exclusive( _tilesMutex );
         for( TileNodeVector::const_iterator i = tiles.begin(); i != tiles.end(); ++i )
         {
             if ( i->valid() )
-                addSafely( i->get() );
+                addImpl( i->get() );
         }
         OE_TEST << LC << _name << ": tiles=" << _tiles.size() << std::endl;
     }
@@ -193,8 +303,11 @@ TileNodeRegistry::remove( TileNode* tile )
 {
     if ( tile )
     {
-        Threading::ScopedWriteLock exclusive( _tilesMutex );
-        removeSafely( tile->getKey() );
+        osg::ref_ptr<TileNode> removed;
+        if ( removeImpl( tile->getKey(), removed ) )
+        {
+            retire( removed.get() );
+        }
     }
 }
   
@@ -202,9 +315,11 @@ TileNodeRegistry::remove( TileNode* tile )
 bool
 TileNodeRegistry::get( const TileKey& key, osg::ref_ptr<TileNode>& out_tile )
 {
-    Threading::ScopedReadLock shared( _tilesMutex );
-
-    out_tile = _tiles.find(key);
+    Entry entry;
+    if ( _tiles.get(key, entry) )
+        out_tile = entry.tile.get();
+    else
+        out_tile = 0L;
     return out_tile.valid();
 }
 
@@ -212,23 +327,17 @@ TileNodeRegistry::get( const TileKey& key, osg::ref_ptr<TileNode>& out_tile )
 bool
 TileNodeRegistry::take( const TileKey& key, osg::ref_ptr<TileNode>& out_tile )
 {
-    Threading::ScopedWriteLock exclusive( _tilesMutex );
-
-    out_tile = _tiles.find(key);
-    if ( out_tile.valid() )
-    {
-        removeSafely( key );
-    }
-    return out_tile.valid();
+    out_tile = 0L;
+    return removeImpl( key, out_tile );
 }
 
 
 void
 TileNodeRegistry::run( TileNodeRegistry::Operation& op )
 {
-    Threading::ScopedWriteLock lock( _tilesMutex );
     unsigned size = _tiles.size();
-    op.operator()( _tiles );
+    RunOperation visitor( op );
+    _tiles.forEach( visitor );
     if ( size != _tiles.size() )
         OE_TEST << LC << _name << ": tiles=" << _tiles.size() << std::endl;
 }
@@ -237,65 +346,86 @@ TileNodeRegistry::run( TileNodeRegistry::Operation& op )
 void
 TileNodeRegistry::run( const TileNodeRegistry::ConstOperation& op ) const
 {
-    Threading::ScopedReadLock lock( _tilesMutex );
-    op.operator()( _tiles );
+    _tiles.forEach( RunConstOperation(op) );
     OE_TEST << LC << _name << ": tiles=" << _tiles.size() << std::endl;
 }
 
 
+void
+TileNodeRegistry::runOnNext( unsigned count, const TileNodeRegistry::ConstOperation& op ) const
+{
+    TileNodeMap tiles;
+    {
+        Threading::ScopedMutexLock lock( _cursorMutex );
+        _tiles.getNext( _cursor, count, tiles );
+    }
+    if ( !tiles.empty() )
+        op( tiles );
+}
+
+
 bool
 TileNodeRegistry::empty() const
 {
-    // don't bother mutex-protecteding this.
     return _tiles.empty();
 }
 
 void
 TileNodeRegistry::startListeningFor(const TileKey& tileToWaitFor, TileNode* waiter)
 {
-    // ASSUME EXCLUSIVE LOCK
-
-    TileNode* tile = _tiles.find( tileToWaitFor );
-    if ( tile )
+    // Register first, then look for the tile. addImpl() does the reverse
+    // (insert the tile, then collect its waiters), so at least one side
+    // always sees the other; whichever one removes the waiter from the set
+    // delivers the notification, so it happens exactly once.
+    AddWaiter<TileKeySet> addWaiter(tileToWaitFor, waiter->getKey());
+    _notifiers.update( tileToWaitFor, addWaiter );
+
+    osg::ref_ptr<TileNode> tile;
+    if ( get( tileToWaitFor, tile ) )
     {
         OE_DEBUG << LC << waiter->getKey().str() << " listened for " << tileToWaitFor.str()
             << ", but it was already in the repo.\n";
 
-        waiter->notifyOfArrival( tile );
+        RemoveWaiter<TileKeySet> removeWaiter(tileToWaitFor, waiter->getKey());
+        _notifiers.update( tileToWaitFor, removeWaiter );
+        if ( removeWaiter._removed )
+        {
+            notify( waiter, tile.get() );
+        }
     }
     else
     {
         OE_DEBUG << LC << waiter->getKey().str() << " listened for " << tileToWaitFor.str() << ".\n";
-        //_notifications[tileToWaitFor].push_back( waiter->getKey() );
-        _notifiers[tileToWaitFor].insert( waiter->getKey() );
     }
 }
 
 void
 TileNodeRegistry::stopListeningFor(const TileKey& tileToWaitFor, TileNode* waiter)
 {
-    // ASSUME EXCLUSIVE LOCK
-
-    TileKeyOneToMany::iterator i = _notifiers.find(tileToWaitFor);
-    if (i != _notifiers.end())
-    {
-        // remove the waiter from this set:
-        i->second.erase(waiter->getKey());
+    RemoveWaiter<TileKeySet> removeWaiter(tileToWaitFor, waiter->getKey());
+    _notifiers.update( tileToWaitFor, removeWaiter );
+}
 
-        // if the set is now empty, remove the set entirely
-        if (i->second.empty())
-        {
-            _notifiers.erase(i);
-        }
-    }
+void
+TileNodeRegistry::notify(TileNode* waiter, TileNode* arrival)
+{
+    // notifyOfArrival updates the waiter's normal map; tiles can arrive on
+    // several threads at once, so deliver one notification at a time.
+    Threading::ScopedMutexLock lock( _notifyMutex );
+    waiter->notifyOfArrival( arrival );
 }
         
 TileNode*
 TileNodeRegistry::takeAny()
 {
-    Threading::ScopedWriteLock exclusive( _tilesMutex );
-    osg::ref_ptr<TileNode> tile = _tiles.begin()->second.tile.get();
-    removeSafely( tile->getKey() );
+    osg::ref_ptr<TileNode> tile;
+    while ( !tile.valid() && !_tiles.empty() )
+    {
+        TileKey key;
+        _tiles.forEach( FindAny(key) );
+        if ( key.valid() )
+            removeImpl( key, tile );
+    }
     return tile.release();
 }
 
@@ -304,18 +434,20 @@ TileNodeRegistry::releaseAll(ResourceReleaser* releaser)
 {
     ResourceReleaser::ObjectList objects;
     {
-        Threading::ScopedWriteLock exclusive(_tilesMutex);
-
-        for (TileNodeMap::iterator i = _tiles.begin(); i != _tiles.end(); ++i)
+        std::vector<Entry> entries;
+        _tiles.clear( &entries );
+        for (std::vector<Entry>::iterator i = entries.begin(); i != entries.end(); ++i)
         {
-            objects.push_back(i->second.tile.get());
+            objects.push_back(i->tile.get());
         }
 
-        _tiles.clear();
         _notifiers.clear();
 
+        Threading::ScopedMutexLock lock( _retiredMutex );
+        _retired.clear();
+
         Metrics::counter("RexStats", "Tiles", _tiles.size());
     }
 
     releaser->push(objects);
-}
\ No newline at end of file
+}
@@ -89,6 +89,9 @@ UnloaderGroup::traverse(osg::NodeVisitor& nv)
 {
     if ( nv.getVisitorType() == nv.EVENT_VISITOR )
     {        
+        // once per frame, release tiles removed at least two frames ago.
+        _tiles->releaseRetired();
+
         if ( _parentKeys.size() > _threshold )
         {
             ScopedMetric m("Unloader expire");
@@ -21,6 +21,7 @@
 #include <osgEarthFeatures/Feature>
 #include <osgEarthFeatures/FilterContext>
 #include <osgEarth/Registry>
+#include <osgEarth/StringUtils>
 #include <osg/Math>
 #include <algorithm>
 
@@ -69,9 +70,109 @@ namespace
     }
 }
 
+namespace
+{
+    /**
+     * Holds the GDAL lock if asked to. Cursors with a pooled handle have their
+     * dataset to themselves; the others share it and must serialize.
+     */
+    struct OptionalGDALLock
+    {
+        OptionalGDALLock(bool lock) : _lock(lock) { if (_lock) osgEarth::getGDALMutex().lock(); }
+        ~OptionalGDALLock() { if (_lock) osgEarth::getGDALMutex().unlock(); }
+        bool _lock;
+    };
+}
+
+
+//------------------------------------------------------------------------
+
+OGRHandlePool::OGRHandlePool(const std::string& source,
+                             const std::string& layer,
+                             OGRSFDriverH       driver) :
+_source( source ),
+_layer ( layer ),
+_driver( driver )
+{
+    //nop
+}
+
+OGRHandlePool::~OGRHandlePool()
+{
+    OGR_SCOPED_LOCK;
+
+    for(std::vector<Handles>::iterator i = _idle.begin(); i != _idle.end(); ++i)
+    {
+        OGRReleaseDataSource( i->first );
+    }
+    _idle.clear();
+}
+
+OGRLayerH
+OGRHandlePool::openLayer(OGRDataSourceH dsHandle, const std::string& layer)
+{
+    OGRLayerH h = OGR_DS_GetLayerByName(dsHandle, layer.c_str());
+    if ( !h )
+    {
+        unsigned index = osgEarth::as<unsigned>(layer, 0);
+        h = OGR_DS_GetLayer(dsHandle, index);
+    }
+    return h;
+}
+
+bool
+OGRHandlePool::acquire(OGRDataSourceH& dsHandle, OGRLayerH& layerHandle)
+{
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        if ( !_idle.empty() )
+        {
+            dsHandle    = _idle.back().first;
+            layerHandle = _idle.back().second;
+            _idle.pop_back();
+            return true;
+        }
+    }
+
+    // nothing idle; open a new handle. Don't use OGROpenShared here: a shared
+    // dataset would hand the same handle to every thread.
+    OGR_SCOPED_LOCK;
+
+    dsHandle = OGROpen( _source.c_str(), 0, &_driver );
+    if ( !dsHandle )
+        return false;
+
+    layerHandle = openLayer( dsHandle, _layer );
+    if ( !layerHandle )
+    {
+        OGRReleaseDataSource( dsHandle );
+        dsHandle = 0L;
+        return false;
+    }
+
+    return true;
+}
+
+void
+OGRHandlePool::release(OGRDataSourceH dsHandle, OGRLayerH layerHandle)
+{
+    if ( !dsHandle )
+        return;
+
+    // clear any state the last cursor left on the layer.
+    OGR_L_SetSpatialFilter( layerHandle, 0L );
+    OGR_L_SetAttributeFilter( layerHandle, 0L );
+    OGR_L_ResetReading( layerHandle );
+
+    Threading::ScopedMutexLock lock( _mutex );
+    _idle.push_back( Handles(dsHandle, layerHandle) );
+}
+
+//------------------------------------------------------------------------
 
 FeatureCursorOGR::FeatureCursorOGR(OGRDataSourceH              dsHandle,
                                    OGRLayerH                   layerHandle,
+                                   OGRHandlePool*              pool,
                                    const FeatureSource*        source,
                                    const FeatureProfile*       profile,
                                    const Symbology::Query&     query,
@@ -81,6 +182,7 @@ FeatureCursor     ( progress ),
 _source           ( source ),
 _dsHandle         ( dsHandle ),
 _layerHandle      ( layerHandle ),
+_pool             ( pool ),
 _resultSetHandle  ( 0L ),
 _spatialFilter    ( 0L ),
 _query            ( query ),
@@ -91,7 +193,7 @@ _profile          ( profile ),
 _filters          ( filters )
 {
     {
-        OGR_SCOPED_LOCK;
+        OptionalGDALLock lock( !_pool.valid() );
 
         std::string expr;
         std::string from = OGR_FD_GetName( OGR_L_GetLayerDefn( _layerHandle ));        
@@ -187,19 +289,26 @@ _filters          ( filters )
 
 FeatureCursorOGR::~FeatureCursorOGR()
 {
-    OGR_SCOPED_LOCK;
+    OptionalGDALLock lock( !_pool.valid() );
 
     if ( _nextHandleToQueue )
         OGR_F_Destroy( _nextHandleToQueue );
 
-    if ( _resultSetHandle != _layerHandle )
+    if ( _resultSetHandle && _resultSetHandle != _layerHandle )
         OGR_DS_ReleaseResultSet( _dsHandle, _resultSetHandle );
 
     if ( _spatialFilter )
         OGR_G_DestroyGeometry( _spatialFilter );
 
-    if ( _dsHandle )
+    // hand the dataset back for the next cursor to use.
+    if ( _pool.valid() )
+    {
+        _pool->release( _dsHandle, _layerHandle );
+    }
+    else if ( _dsHandle )
+    {
         OGRReleaseDataSource( _dsHandle );
+    }
 }
 
 bool
@@ -227,14 +336,13 @@ FeatureCursorOGR::nextFeature()
 }
 
 // reads a chunk of features into a memory cache; do this for performance
-// and to avoid needing the OGR Mutex every time
 void
 FeatureCursorOGR::readChunk()
 {
     if ( !_resultSetHandle )
         return;
-    
-    OGR_SCOPED_LOCK;
+
+    OptionalGDALLock lock( !_pool.valid() );
 
     while( _queue.size() < _chunkSize && !_resultSetEndReached )
     {
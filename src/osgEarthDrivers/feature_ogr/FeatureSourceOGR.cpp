@@ -44,22 +44,6 @@ using namespace osgEarth::Drivers;
 
 #define OGR_SCOPED_LOCK GDAL_SCOPED_LOCK
 
-namespace
-{
-    // helper function.
-    OGRLayerH openLayer(OGRDataSourceH ds, const std::string& layer)
-    {
-        OGRLayerH h = OGR_DS_GetLayerByName(ds, layer.c_str());
-        if ( !h )
-        {
-            unsigned index = osgEarth::as<unsigned>(layer, 0);
-            h = OGR_DS_GetLayer(ds, index);
-        }
-        return h;
-    }
-}
-
-
 /**
  * A FeatureSource that reads features from an OGR driver.
  *
@@ -286,7 +270,7 @@ public:
             // Open a specific layer within the data source, if applicable:
             if (!_layerHandle)
             {
-                _layerHandle = openLayer(_dsHandle, _options.layer().value());
+                _layerHandle = OGRHandlePool::openLayer(_dsHandle, _options.layer().value());
             }
 
             if (!_layerHandle)
@@ -351,6 +335,13 @@ public:
             //Get the feature count
             _featureCount = OGR_L_GetFeatureCount( _layerHandle, 1 );
 
+            // read-only handles for cursors, so they can run in parallel. A writable
+            // source keeps sharing its own handle so cursors see unsynced edits.
+            if ( !_writable )
+            {
+                _cursorHandles = new OGRHandlePool( _source, _options.layer().value(), _ogrDriverHandle );
+            }
+
             // establish the feature schema:
             initSchema();
 
@@ -426,16 +417,23 @@ public:
             OGRDataSourceH dsHandle = 0L;
             OGRLayerH layerHandle = 0L;
 
-            // open the handles safely:
+            if ( _cursorHandles.valid() )
+            {
+                // Each cursor checks out a dataset handle of its own so that cursors
+                // on different threads can read at the same time. The cursor returns
+                // the handle to the pool when it's done.
+                _cursorHandles->acquire( dsHandle, layerHandle );
+            }
+            else
             {
+                // open the handles safely:
                 OGR_SCOPED_LOCK;
 
-                // Each cursor requires its own DS handle so that multi-threaded access will work.
                 // The cursor impl will dispose of the new DS handle.
                 dsHandle = OGROpenShared( _source.c_str(), 0, &_ogrDriverHandle );
                 if ( dsHandle )
                 {
-                    layerHandle = openLayer(dsHandle, _options.layer().get());
+                    layerHandle = OGRHandlePool::openLayer(dsHandle, _options.layer().get());
                 }
             }
 
@@ -452,7 +450,8 @@ public:
                 // cursor is responsible for the OGR handles.
                 return new FeatureCursorOGR( 
                     dsHandle,
-                    layerHandle, 
+                    layerHandle,
+                    _cursorHandles.get(),
                     this,
                     getFeatureProfile(),
                     newQuery,
@@ -461,7 +460,7 @@ public:
             }
             else
             {
-                if ( dsHandle )
+                if ( dsHandle && !_cursorHandles.valid() )
                 {
                     OGR_SCOPED_LOCK;
                     OGRReleaseDataSource( dsHandle );
@@ -476,10 +475,17 @@ public:
     {
         if (_writable && _layerHandle)
         {
+            // remember where the feature was, so the change can be localized.
+            GeoExtent extent;
+            osg::ref_ptr<Feature> feature = getFeature( fid );
+            if ( feature.valid() )
+                extent = feature->getExtent();
+
             OGR_SCOPED_LOCK;
             if (OGR_L_DeleteFeature( _layerHandle, fid ) == OGRERR_NONE)
             {
                 _needsSync = true;
+                dirtyFeature( fid, extent );
                 return true;
             }            
         }
@@ -577,6 +583,8 @@ public:
                 return false;
             }
 
+            feature->setFID( OGR_F_GetFID( feature_handle ) );
+
             // clean up the feature
             OGR_F_Destroy( feature_handle );
         }
@@ -587,7 +595,7 @@ public:
             return false;
         }
 
-        dirty();
+        dirtyFeature( feature->getFID(), feature->getExtent() );
 
         return true;
     }
@@ -639,6 +647,7 @@ private:
     OGRDataSourceH _dsHandle;
     OGRLayerH _layerHandle;
     OGRSFDriverH _ogrDriverHandle;
+    osg::ref_ptr<OGRHandlePool> _cursorHandles;
     osg::ref_ptr<Symbology::Geometry> _geometry; // explicit geometry.
     const OGRFeatureOptions _options;
     int _featureCount;
@@ -29,6 +29,7 @@
 #include <sstream>
 #include <iomanip>
 #include <algorithm>
+#include <cstdio>
 
 #include <sqlite3.h>
 
@@ -53,6 +54,29 @@ namespace
         }
         return rw;
     }
+
+    const char* SELECT_TILE_SQL = "SELECT tile_data from tiles where zoom_level = ? AND tile_column = ? AND tile_row = ?";
+    const char* INSERT_TILE_SQL = "INSERT OR REPLACE INTO tiles (zoom_level, tile_column, tile_row, tile_data) VALUES (?, ?, ?, ?)";
+
+    // SQLite URI filename for a path, see https://www.sqlite.org/uri.html
+    std::string makeURIFilename(const std::string& path)
+    {
+        std::string uri = "file:";
+        for(std::string::const_iterator c = path.begin(); c != path.end(); ++c)
+        {
+            if ( *c == '\\' )
+                uri += '/';
+            else if ( *c == '?' || *c == '#' || *c == '%' )
+            {
+                char escaped[4];
+                sprintf( escaped, "%%%02X", (unsigned)*c );
+                uri += escaped;
+            }
+            else
+                uri += *c;
+        }
+        return uri;
+    }
 }
 
 //......................................................................
@@ -61,19 +85,42 @@ MBTilesTileSource::MBTilesTileSource(const TileSourceOptions& options) :
 TileSource( options ),
 _options  ( options ),
 _database ( NULL ),
+_readWrite( false ),
 _minLevel ( 0 ),
 _maxLevel ( 20 ),
-_forceRGB ( false )
+_forceRGB ( false ),
+_selectTile( NULL ),
+_insertTile( NULL ),
+_batchCount( 0u )
 {
     //nop
 }
 
+MBTilesTileSource::~MBTilesTileSource()
+{
+    {
+        Threading::ScopedMutexLock exclusiveLock(_mutex);
+
+        commitBatch();
+
+        sqlite3_finalize( _selectTile );
+        sqlite3_finalize( _insertTile );
+        sqlite3_close( _database );
+    }
+
+    for(unsigned i = 0; i < _connections.size(); ++i)
+    {
+        closeConnection( _connections[i] );
+    }
+}
+
 Status
 MBTilesTileSource::initialize(const osgDB::Options* dbOptions)
 {
     _dbOptions = Registry::instance()->cloneOrCreateOptions( dbOptions );
 
-    bool readWrite = (MODE_WRITE & (int)getMode()) != 0;
+    _readWrite = (MODE_WRITE & (int)getMode()) != 0;
+    bool readWrite = _readWrite;
 
     std::string fullFilename = _options.filename()->full();
     if (!osgDB::fileExists(fullFilename))
@@ -85,6 +132,8 @@ MBTilesTileSource::initialize(const osgDB::Options* dbOptions)
 
     bool isNewDatabase = readWrite && !osgDB::fileExists(fullFilename);
 
+    _fullFilename = fullFilename;
+
     if ( isNewDatabase )
     {
         // For a NEW database, the profile MUST be set prior to initialization.
@@ -273,6 +322,18 @@ MBTilesTileSource::initialize(const osgDB::Options* dbOptions)
         }
     }
 
+    // In write mode, tiles are read and written on the main connection, so a
+    // read sees the tiles of a batch that isn't committed yet.
+    if ( readWrite )
+    {
+        if (SQLITE_OK != sqlite3_prepare_v2(_database, SELECT_TILE_SQL, -1, &_selectTile, 0L) ||
+            SQLITE_OK != sqlite3_prepare_v2(_database, INSERT_TILE_SQL, -1, &_insertTile, 0L))
+        {
+            return Status::Error( Status::ResourceUnavailable, Stringify()
+                << "Database \"" << fullFilename << "\": " << sqlite3_errmsg(_database) );
+        }
+    }
+
     // do we require RGB? for jpeg?
     _forceRGB =
         osgEarth::endsWith(_tileFormat, "jpg", false) ||
@@ -303,18 +364,30 @@ osg::Image*
 MBTilesTileSource::createImage(const TileKey&    key,
                                ProgressCallback* progress)
 {
-    Threading::ScopedMutexLock exclusiveLock(_mutex);
-
     int z = key.getLevelOfDetail();
     int x = key.getTileX();
     int y = key.getTileY();
 
-    if (z < (int)_minLevel)
+    // storeImage() can widen the levels in write mode, so read them under the lock.
+    unsigned int minLevel, maxLevel;
+    if ( _readWrite )
+    {
+        Threading::ScopedMutexLock exclusiveLock(_mutex);
+        minLevel = _minLevel;
+        maxLevel = _maxLevel;
+    }
+    else
+    {
+        minLevel = _minLevel;
+        maxLevel = _maxLevel;
+    }
+
+    if (z < (int)minLevel)
     {
         return _emptyImage.get();
     }
 
-    if (z > (int)_maxLevel)
+    if (z > (int)maxLevel)
     {
         //If we're at the max level, just return NULL
         return NULL;
@@ -325,65 +398,151 @@ MBTilesTileSource::createImage(const TileKey&    key,
     y  = numRows - y - 1;
 
     //Get the image
-    sqlite3_stmt* select = NULL;
-    std::string query = "SELECT tile_data from tiles where zoom_level = ? AND tile_column = ? AND tile_row = ?";
-    int rc = sqlite3_prepare_v2( _database, query.c_str(), -1, &select, 0L );
-    if ( rc != SQLITE_OK )
+    std::string dataBuffer;
+    if ( _readWrite )
     {
-        OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(_database) << std::endl;
-        return NULL;
+        Threading::ScopedMutexLock exclusiveLock(_mutex);
+        if ( !readTile(_database, _selectTile, z, x, y, dataBuffer) )
+            return NULL;
+    }
+    else
+    {
+        Connection* connection = acquireConnection();
+        if ( !connection )
+            return NULL;
+
+        bool found = readTile(connection->_database, connection->_selectTile, z, x, y, dataBuffer);
+        releaseConnection( connection );
+        if ( !found )
+            return NULL;
     }
 
-    bool valid = true;
+    // decompress if necessary:
+    if ( _compressor.valid() )
+    {
+        std::istringstream inputStream(dataBuffer);
+        std::string value;
+        if ( !_compressor->decompress(inputStream, value) )
+        {
+            if ( _options.filename().isSet() )
+                OE_WARN << LC << "Decompression failed: " << _options.filename()->base() << std::endl;
+            else
+                OE_WARN << LC << "Decompression failed" << std::endl;
+            return NULL;
+        }
+        dataBuffer.swap( value );
+    }
 
+    // decode the raw image data:
+    std::istringstream inputStream(dataBuffer);
+    return ImageUtils::readStream(inputStream, _dbOptions.get());
+}
+
+bool
+MBTilesTileSource::readTile(sqlite3*      database,
+                            sqlite3_stmt* select,
+                            int z, int x, int y,
+                            std::string&  data) const
+{
     sqlite3_bind_int( select, 1, z );
     sqlite3_bind_int( select, 2, x );
     sqlite3_bind_int( select, 3, y );
 
-    osg::Image* result = NULL;
-    rc = sqlite3_step( select );
+    bool found = false;
+    int rc = sqlite3_step( select );
     if ( rc == SQLITE_ROW)
     {
         // the pointer returned from _blob gets freed internally by sqlite, supposedly
-        const char* data = (const char*)sqlite3_column_blob( select, 0 );
-        int dataLen = sqlite3_column_bytes( select, 0 );
+        const char* blob = (const char*)sqlite3_column_blob( select, 0 );
+        int blobLen = sqlite3_column_bytes( select, 0 );
+        data.assign( blob, blobLen );
+        found = true;
+    }
+    else if ( rc != SQLITE_DONE )
+    {
+        OE_DEBUG << LC << "SQL QUERY failed for " << SELECT_TILE_SQL << ": " << sqlite3_errmsg(database) << std::endl;
+    }
 
-        std::string dataBuffer( data, dataLen );
+    // reset so the statement doesn't hold its read lock.
+    sqlite3_reset( select );
+    return found;
+}
 
-        // decompress if necessary:
-        if ( _compressor.valid() )
+MBTilesTileSource::Connection*
+MBTilesTileSource::acquireConnection()
+{
+    {
+        Threading::ScopedMutexLock lock(_connectionsMutex);
+        if ( !_connections.empty() )
         {
-            std::istringstream inputStream(dataBuffer);
-            std::string value;
-            if ( !_compressor->decompress(inputStream, value) )
-            {
-                if ( _options.filename().isSet() )
-                    OE_WARN << LC << "Decompression failed: " << _options.filename()->base() << std::endl;
-                else
-                    OE_WARN << LC << "Decompression failed" << std::endl;
-                valid = false;
-            }
-            else
-            {
-                dataBuffer = value;
-            }
+            Connection* connection = _connections.back();
+            _connections.pop_back();
+            return connection;
         }
+    }
+    return openConnection();
+}
 
-        // decode the raw image data:
-        if ( valid )
+void
+MBTilesTileSource::releaseConnection(Connection* connection)
+{
+    {
+        Threading::ScopedMutexLock lock(_connectionsMutex);
+        if ( _connections.size() < _options.connections().get() )
         {
-            std::istringstream inputStream(dataBuffer);
-            result = ImageUtils::readStream(inputStream, _dbOptions.get());
+            _connections.push_back( connection );
+            return;
         }
     }
-    else
+    closeConnection( connection );
+}
+
+MBTilesTileSource::Connection*
+MBTilesTileSource::openConnection()
+{
+    // Each connection is only ever used by one thread at a time.
+    int flags = SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX;
+    std::string filename = _fullFilename;
+
+#if SQLITE_VERSION_NUMBER >= 3008000
+    if ( _options.immutable() == true )
     {
-        OE_DEBUG << LC << "SQL QUERY failed for " << query << ": " << std::endl;
-        valid = false;
+        flags |= SQLITE_OPEN_URI;
+        filename = makeURIFilename(_fullFilename) + "?immutable=1";
     }
+#endif
 
-    sqlite3_finalize( select );
-    return result;
+    sqlite3* database = NULL;
+    if ( sqlite3_open_v2(filename.c_str(), &database, flags, 0L) != SQLITE_OK )
+    {
+        OE_WARN << LC << "Failed to open connection to \"" << _fullFilename << "\": " << sqlite3_errmsg(database) << std::endl;
+        sqlite3_close( database );
+        return NULL;
+    }
+
+    // wait out a writer in another process instead of failing the read.
+    sqlite3_busy_timeout( database, 1000 );
+
+    sqlite3_stmt* select = NULL;
+    if ( sqlite3_prepare_v2(database, SELECT_TILE_SQL, -1, &select, 0L) != SQLITE_OK )
+    {
+        OE_WARN << LC << "Failed to prepare SQL: " << SELECT_TILE_SQL << "; " << sqlite3_errmsg(database) << std::endl;
+        sqlite3_close( database );
+        return NULL;
+    }
+
+    Connection* connection = new Connection();
+    connection->_database = database;
+    connection->_selectTile = select;
+    return connection;
+}
+
+void
+MBTilesTileSource::closeConnection(Connection* connection)
+{
+    sqlite3_finalize( connection->_selectTile );
+    sqlite3_close( connection->_database );
+    delete connection;
 }
 
 bool
@@ -394,8 +553,6 @@ MBTilesTileSource::storeImage(const TileKey&    key,
     if ( (getMode() & MODE_WRITE) == 0 )
         return false;
 
-    Threading::ScopedMutexLock exclusiveLock(_mutex);
-
     // encode the data stream:
     std::stringstream buf;
     osgDB::ReaderWriter::WriteResult wr;
@@ -438,47 +595,87 @@ MBTilesTileSource::storeImage(const TileKey&    key,
     key.getProfile()->getNumTiles(key.getLevelOfDetail(), numCols, numRows);
     y  = numRows - y - 1;
 
-    // Prep the insert statement:
-    sqlite3_stmt* insert = NULL;
-    std::string query = "INSERT OR REPLACE INTO tiles (zoom_level, tile_column, tile_row, tile_data) VALUES (?, ?, ?, ?)";
-    int rc = sqlite3_prepare_v2( _database, query.c_str(), -1, &insert, 0L );
-    if ( rc != SQLITE_OK )
+    // Only the database access needs the lock; encoding can run in parallel.
+    Threading::ScopedMutexLock exclusiveLock(_mutex);
+
+    // Make the new tile readable even if it lies outside the levels found
+    // when the database was opened (e.g. when backfilling lower levels).
+    if ( z < (int)_minLevel )
+        _minLevel = z;
+    if ( z > (int)_maxLevel )
+        _maxLevel = z;
+
+    // Write tiles in batches so the database syncs once per transaction
+    // instead of once per tile.
+    unsigned batchSize = _options.batchSize().get();
+    if ( batchSize > 1u && _batchCount == 0u )
     {
-        OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(_database) << std::endl;
-        return false;
+        if (SQLITE_OK != sqlite3_exec(_database, "BEGIN TRANSACTION", 0L, 0L, 0L))
+        {
+            OE_WARN << LC << "Failed to begin transaction: " << sqlite3_errmsg(_database) << std::endl;
+        }
     }
 
     // bind parameters:
-    sqlite3_bind_int( insert, 1, z );
-    sqlite3_bind_int( insert, 2, x );
-    sqlite3_bind_int( insert, 3, y );
+    sqlite3_bind_int( _insertTile, 1, z );
+    sqlite3_bind_int( _insertTile, 2, x );
+    sqlite3_bind_int( _insertTile, 3, y );
 
     // bind the data blob:
-    sqlite3_bind_blob( insert, 4, value.c_str(), value.length(), SQLITE_STATIC );
+    sqlite3_bind_blob( _insertTile, 4, value.c_str(), value.length(), SQLITE_STATIC );
 
     // run the sql.
     bool ok = true;
+    int rc;
     int tries = 0;
     do {
-        rc = sqlite3_step(insert);
+        rc = sqlite3_step(_insertTile);
     }
     while (++tries < 100 && (rc == SQLITE_BUSY || rc == SQLITE_LOCKED));
 
     if (SQLITE_OK != rc && SQLITE_DONE != rc)
     {
 #if SQLITE_VERSION_NUMBER >= 3007015
-        OE_WARN << LC << "Failed query: " << query << "(" << rc << ")" << sqlite3_errstr(rc) << "; " << sqlite3_errmsg(_database) << std::endl;
+        OE_WARN << LC << "Failed query: " << INSERT_TILE_SQL << "(" << rc << ")" << sqlite3_errstr(rc) << "; " << sqlite3_errmsg(_database) << std::endl;
 #else
-        OE_WARN << LC << "Failed query: " << query << "(" << rc << ")" << rc << "; " << sqlite3_errmsg(_database) << std::endl;
+        OE_WARN << LC << "Failed query: " << INSERT_TILE_SQL << "(" << rc << ")" << rc << "; " << sqlite3_errmsg(_database) << std::endl;
 #endif
         ok = false;
     }
 
-    sqlite3_finalize( insert );
+    // release the blob, which is about to go out of scope.
+    sqlite3_reset( _insertTile );
+    sqlite3_clear_bindings( _insertTile );
+
+    if ( ++_batchCount >= batchSize )
+    {
+        ok = commitBatch() && ok;
+    }
 
     return ok;
 }
 
+bool
+MBTilesTileSource::commitBatch()
+{
+    // caller holds _mutex.
+    if ( _batchCount == 0u )
+        return true;
+
+    unsigned count = _batchCount;
+    _batchCount = 0u;
+
+    if ( _options.batchSize().get() <= 1u )
+        return true;
+
+    if (SQLITE_OK != sqlite3_exec(_database, "COMMIT TRANSACTION", 0L, 0L, 0L))
+    {
+        OE_WARN << LC << "Failed to commit " << count << " tiles: " << sqlite3_errmsg(_database) << std::endl;
+        return false;
+    }
+    return true;
+}
+
 bool
 MBTilesTileSource::getMetaData(const std::string& key, std::string& value)
 {
@@ -56,26 +56,31 @@ namespace
 
     static duk_ret_t oe_duk_save_feature(duk_context* ctx)
     {
-        // stack: [ptr]
+        // stack: [ptr, saveGeometry]
 
         // pull the feature ptr from argument #0
         Feature* feature = reinterpret_cast<Feature*>(duk_require_pointer(ctx, 0));
+        if ( !feature )
+            return 0;
+
+        // the geometry is only read back if the script ever touched it
+        bool saveGeometry = duk_get_boolean(ctx, 1) != 0;
 
         // Fetch the feature data:
-        duk_push_global_object(ctx);                    
-        // [ptr, global]
+        duk_push_global_object(ctx);
+        // [ptr, flag, global]
 
         if ( !duk_get_prop_string(ctx, -1, "feature") || !duk_is_object(ctx, -1))
             return 0;
 
-         // [ptr, global, feature]
+         // [ptr, flag, global, feature]
 
         if ( duk_get_prop_string(ctx, -1, "properties") && duk_is_object(ctx, -1) )
         {
-            // [ptr, global, feature, props]
-            duk_enum(ctx, -1, 0);                       
-        
-            // [ptr, global, feature, props, enum]
+            // [ptr, flag, global, feature, props]
+            duk_enum(ctx, -1, 0);
+
+            // [ptr, flag, global, feature, props, enum]
             while( duk_next(ctx, -1, 1/*get_value=true*/) )
             {
                 std::string key( duk_get_string(ctx, -2) );
@@ -99,114 +104,258 @@ namespace
             }
 
             duk_pop_2(ctx);
-            // [ptr, global, feature]
+            // [ptr, flag, global, feature]
         }
         else
-        {   // [ptr, global, feature, undefined]
+        {   // [ptr, flag, global, feature, undefined]
             duk_pop(ctx);
-            // [ptr, global, feature]
+            // [ptr, flag, global, feature]
         }
 
         // save the geometry, if set:
-        if ( duk_get_prop_string(ctx, -1, "geometry") )
+        if ( saveGeometry && duk_get_prop_string(ctx, -1, "geometry") )
         {
             if (duk_is_object(ctx, -1))
             {
-                // [ptr, global, feature, geometry]
-                std::string json( duk_json_encode(ctx, -1) ); // [ptr, global, feature, json]
+                // [ptr, flag, global, feature, geometry]
+                std::string json( duk_json_encode(ctx, -1) ); // [ptr, flag, global, feature, json]
                 Geometry* newGeom = GeometryUtils::geometryFromGeoJSON(json);
                 if ( newGeom )
                 {
                     feature->setGeometry( newGeom );
                 }
-                duk_pop(ctx); // [ptr, global, feature]
             }
             else
             {
                 feature->setGeometry(0L);
             }
         }
+
+        return 0;           // no return values.
+    }
+
+    // Decodes a feature's geometry the first time a script reads feature.geometry.
+    static duk_ret_t oe_duk_get_geometry(duk_context* ctx)
+    {
+        // stack: [ptr]
+        const Feature* feature = reinterpret_cast<const Feature*>(duk_get_pointer(ctx, 0));
+        std::string json = feature ? GeometryUtils::geometryToGeoJSON( feature->getGeometry() ) : "";
+        if ( !json.empty() )
+        {
+            duk_push_string(ctx, json.c_str()); // [ptr, json]
+            duk_json_decode(ctx, -1);           // [ptr, geometry]
+        }
         else
         {
-            // [ptr, global, feature, undefined]
+            duk_push_null(ctx);
         }
-        
-        // [ptr, global, feature]
-        duk_pop_2(ctx);     // [ptr] (as we found it)
-        return 0;           // no return values.
+        return 1;
     }
-}
 
-//............................................................................
+    // The feature the running script is looking at, or NULL.
+    const Feature* getCurrentFeature(duk_context* ctx)
+    {
+        duk_push_global_stash(ctx);                          // [stash]
+        duk_get_prop_string(ctx, -1, "oe_feature");          // [stash, ptr]
+        const Feature* feature = reinterpret_cast<const Feature*>(duk_get_pointer(ctx, -1));
+        duk_pop_2(ctx);                                      // []
+        return feature;
+    }
 
-namespace
-{
-    // Create a "feature" object in the global namespace.
-    void setFeature(duk_context* ctx, Feature const* feature, bool complete)
+    // Pushes an attribute value. The full profile pushes null for an unset
+    // value, the same as the GeoJSON encoding it used to go through; the
+    // minimal profile pushes the type's default value as it always has.
+    void pushAttr(duk_context* ctx, const AttributeValue& value, bool unsetAsNull)
     {
-        duk_push_global_object(ctx);                             // [global]
+        if ( unsetAsNull && !value.second.set )
+        {
+            duk_push_null(ctx);
+            return;
+        }
 
-        // Complete profile: properties, geometry, and API bindings.
-        if ( complete )
+        switch(value.first) {
+        case ATTRTYPE_DOUBLE: duk_push_number (ctx, value.getDouble()); break;
+        case ATTRTYPE_INT:    duk_push_int    (ctx, value.getInt()); break;
+        case ATTRTYPE_BOOL:   duk_push_boolean(ctx, value.getBool()); break;
+        case ATTRTYPE_STRING:
+        default:              duk_push_string (ctx, value.getString().c_str()); break;
+        }
+    }
+
+    // Finds an attribute by its exact name. The attribute table ignores case,
+    // but javascript property names don't.
+    const AttributeValue* findAttr(const Feature* feature, const char* name)
+    {
+        const AttributeTable& attrs = feature->getAttrs();
+        AttributeTable::const_iterator a = attrs.find( std::string(name) );
+        return a != attrs.end() && a->first == name ? &a->second : 0L;
+    }
+
+    // Values a minimal-profile script assigns to feature.properties live in
+    // an "overlay" object in the stash until the next feature comes along.
+    // Looks up the key at index 1 there; on success pushes the value.
+    bool pushOverlayValue(duk_context* ctx)
+    {
+        duk_push_global_stash(ctx);                          // [stash]
+        if ( !duk_get_prop_string(ctx, -1, "oe_overlay") )   // [stash, overlay|undefined]
         {
-            std::string geojson = feature->getGeoJSON();
-            duk_push_string(ctx, geojson.c_str());               // [global, json]
-            duk_json_decode(ctx, -1);                            // [global, feature]
-            duk_push_pointer(ctx, (void*)feature);               // [global, feature, ptr]
-            duk_put_prop_string(ctx, -2, "__ptr");               // [global, feature]
-            duk_put_prop_string(ctx, -2, "feature");             // [global]
-
-            // add the save() function and the "attributes" alias.
-            duk_eval_string_noresult(ctx,
-                "feature.save = function() {"
-                "    oe_duk_save_feature(this.__ptr);"
-                "} ");
-
-            duk_eval_string_noresult(ctx,
-                "Object.defineProperty(feature, 'attributes', {get:function() {return feature.properties;}});");
-
-            GeometryAPI::bindToFeature(ctx);
+            duk_pop_2(ctx);                                  // []
+            return false;
         }
 
-        // Minimal profile: ID and properties only. MUCH faster!
-        else
+        duk_dup(ctx, 1);                                     // [stash, overlay, key]
+        if ( !duk_has_prop(ctx, -2) )                        // [stash, overlay]
         {
-            duk_idx_t feature_i = duk_push_object(ctx);
+            duk_pop_2(ctx);                                  // []
+            return false;
+        }
+
+        duk_dup(ctx, 1);                                     // [stash, overlay, key]
+        duk_get_prop(ctx, -2);                               // [stash, overlay, value]
+        duk_remove(ctx, -2);                                 // [stash, value]
+        duk_remove(ctx, -2);                                 // [value]
+        return true;
+    }
+
+    // Proxy traps that expose the current feature's attributes as
+    // feature.properties without copying them into the javascript heap.
+
+    // get(target, key, receiver)
+    static duk_ret_t oe_duk_get_attr(duk_context* ctx)
+    {
+        if ( pushOverlayValue(ctx) )
+            return 1;
+
+        const Feature* feature = getCurrentFeature(ctx);
+        if ( feature && duk_is_string(ctx, 1) )
+        {
+            const AttributeValue* value = findAttr(feature, duk_get_string(ctx, 1));
+            if ( value )
             {
-                duk_push_int(ctx, feature->getFID());
-                duk_put_prop_string(ctx, feature_i, "id");
+                pushAttr(ctx, *value, false);
+                return 1;
+            }
+        }
 
-                duk_idx_t props_i = duk_push_object(ctx);
-                {
-                    const AttributeTable& attrs = feature->getAttrs();
-                    for(AttributeTable::const_iterator a = attrs.begin(); a != attrs.end(); ++a)
-                    {
-                        AttributeType type = a->second.first;
-                        switch(type) {
-                        case ATTRTYPE_DOUBLE: duk_push_number (ctx, a->second.getDouble()); break;
-                        case ATTRTYPE_INT:    duk_push_int    (ctx, a->second.getInt()); break;
-                        case ATTRTYPE_BOOL:   duk_push_boolean(ctx, a->second.getBool()); break;
-                        case ATTRTYPE_STRING:
-                        default:              duk_push_string (ctx, a->second.getString().c_str()); break;
-                        }
-                        duk_put_prop_string(ctx, props_i, a->first.c_str());
-                    }
-                }
-                duk_put_prop_string(ctx, feature_i, "properties");
+        // fall back on the target so the usual Object methods still resolve.
+        duk_dup(ctx, 1);
+        duk_get_prop(ctx, 0);
+        return 1;
+    }
+
+    // has(target, key)
+    static duk_ret_t oe_duk_has_attr(duk_context* ctx)
+    {
+        const Feature* feature = getCurrentFeature(ctx);
+        if ( feature && duk_is_string(ctx, 1) && findAttr(feature, duk_get_string(ctx, 1)) )
+        {
+            duk_push_true(ctx);
+            return 1;
+        }
+
+        if ( pushOverlayValue(ctx) )
+        {
+            duk_pop(ctx);
+            duk_push_true(ctx);
+            return 1;
+        }
+
+        duk_dup(ctx, 1);
+        duk_push_boolean(ctx, duk_has_prop(ctx, 0));
+        return 1;
+    }
+
+    // set(target, key, value, receiver): the minimal profile has no save(),
+    // so a write goes to the overlay and never reaches the Feature. (Storing
+    // it on the target would leak it into every feature that runs later.)
+    static duk_ret_t oe_duk_set_attr(duk_context* ctx)
+    {
+        duk_push_global_stash(ctx);                          // [stash]
+        if ( !duk_get_prop_string(ctx, -1, "oe_overlay") )   // [stash, overlay|undefined]
+        {
+            duk_pop(ctx);                                    // [stash]
+            duk_push_object(ctx);                            // [stash, overlay]
+            duk_push_null(ctx);
+            duk_set_prototype(ctx, -2);                      // no inherited keys
+            duk_dup_top(ctx);                                // [stash, overlay, overlay]
+            duk_put_prop_string(ctx, -3, "oe_overlay");      // [stash, overlay]
+        }
+
+        duk_dup(ctx, 1);                                     // [stash, overlay, key]
+        duk_dup(ctx, 2);                                     // [stash, overlay, key, value]
+        duk_put_prop(ctx, -3);                               // [stash, overlay]
+        duk_pop_2(ctx);                                      // []
+
+        duk_push_true(ctx);
+        return 1;
+    }
+
+    // enumerate(target) and ownKeys(target)
+    static duk_ret_t oe_duk_attr_keys(duk_context* ctx)
+    {
+        duk_idx_t keys_i = duk_push_array(ctx);
+        const Feature* feature = getCurrentFeature(ctx);
+        if ( feature )
+        {
+            duk_uarridx_t n = 0;
+            const AttributeTable& attrs = feature->getAttrs();
+            for(AttributeTable::const_iterator a = attrs.begin(); a != attrs.end(); ++a)
+            {
+                duk_push_string(ctx, a->first.c_str());
+                duk_put_prop_index(ctx, keys_i, n++);
             }
-            duk_put_prop_string(ctx, -2, "feature");
         }
 
-        duk_pop(ctx); 
+        // plus the new keys a script has added
+        duk_push_global_stash(ctx);                          // [keys, stash]
+        if ( duk_get_prop_string(ctx, -1, "oe_overlay") )    // [keys, stash, overlay]
+        {
+            duk_uarridx_t n = (duk_uarridx_t)duk_get_length(ctx, keys_i);
+            duk_enum(ctx, -1, DUK_ENUM_OWN_PROPERTIES_ONLY); // [keys, stash, overlay, enum]
+            while( duk_next(ctx, -1, 0) )                    // [keys, stash, overlay, enum, key]
+            {
+                if ( !feature || !findAttr(feature, duk_get_string(ctx, -1)) )
+                    duk_put_prop_index(ctx, keys_i, n++);
+                else
+                    duk_pop(ctx);
+            }
+            duk_pop(ctx);                                    // [keys, stash, overlay]
+        }
+        duk_pop_2(ctx);                                      // [keys]
+        return 1;
+    }
+}
+
+//............................................................................
+
+namespace
+{
+    // Pushes a new object holding a copy of all the feature's attributes.
+    void pushProperties(duk_context* ctx, Feature const* feature, bool unsetAsNull)
+    {
+        duk_idx_t props_i = duk_push_object(ctx);
+        const AttributeTable& attrs = feature->getAttrs();
+        for(AttributeTable::const_iterator a = attrs.begin(); a != attrs.end(); ++a)
+        {
+            pushAttr(ctx, a->second, unsetAsNull);
+            duk_put_prop_string(ctx, props_i, a->first.c_str());
+        }
     }
-    
+
+    // Compiled scripts are cached per heap, keyed by their source code. Past
+    // this many the cache starts over, so one-off snippets can't grow it forever.
+    const unsigned MAX_COMPILED_SCRIPTS = 1024u;
 }
 
 //............................................................................
 
-DuktapeEngine::Context::Context()
+DuktapeEngine::Context::Context() :
+_ctx        ( 0L ),
+_complete   ( false ),
+_numCompiled( 0u ),
+_featurePtr ( 0L )
 {
-    _ctx = 0L;
+    //nop
 }
 
 void
@@ -214,6 +363,8 @@ DuktapeEngine::Context::initialize(const ScriptEngineOptions& options, bool comp
 {
     if ( _ctx == 0L )
     {
+        _complete = complete;
+
         // new heap + context.
         _ctx = duk_create_heap_default();
 
@@ -230,6 +381,12 @@ DuktapeEngine::Context::initialize(const ScriptEngineOptions& options, bool comp
             duk_pop(_ctx); // []
         }
 
+        // cache of compiled scripts, keyed by source code.
+        duk_push_global_stash( _ctx );                  // [stash]
+        duk_push_object( _ctx );                        // [stash, cache]
+        duk_put_prop_string( _ctx, -2, "oe_compiled" ); // [stash]
+        duk_pop( _ctx );                                // []
+
         duk_push_global_object( _ctx );
 
         // Add global log function.
@@ -239,16 +396,242 @@ DuktapeEngine::Context::initialize(const ScriptEngineOptions& options, bool comp
         if ( complete )
         {
             // feature.save() callback
-            duk_push_c_function(_ctx, oe_duk_save_feature, 1/*numargs*/); // [global, function]
+            duk_push_c_function(_ctx, oe_duk_save_feature, 2/*numargs*/); // [global, function]
             duk_put_prop_string(_ctx, -2, "oe_duk_save_feature");         // [global]
 
+            // feature.geometry callback
+            duk_push_c_function(_ctx, oe_duk_get_geometry, 1/*numargs*/); // [global, function]
+            duk_put_prop_string(_ctx, -2, "oe_duk_get_geometry");         // [global]
+
             GeometryAPI::install(_ctx);
+
+            // Prototype for feature objects. The geometry is decoded from GeoJSON
+            // the first time a script reads it, and only saved back if it did.
+            duk_push_global_stash(_ctx);                                  // [global, stash]
+            duk_eval_string(_ctx,
+                "({"
+                "    save: function() {"
+                "        oe_duk_save_feature(this.__ptr, Object.prototype.hasOwnProperty.call(this, 'geometry'));"
+                "    },"
+                "    get attributes() {"
+                "        return this.properties;"
+                "    },"
+                "    get geometry() {"
+                "        var g = oe_duk_get_geometry(this.__ptr);"
+                "        if (g) oe_duk_bind_geometry_api(g);"
+                "        Object.defineProperty(this, 'geometry', {value:g, writable:true, enumerable:true, configurable:true});"
+                "        return g;"
+                "    },"
+                "    set geometry(g) {"
+                "        Object.defineProperty(this, 'geometry', {value:g, writable:true, enumerable:true, configurable:true});"
+                "    }"
+                "})");                                                    // [global, stash, proto]
+            duk_put_prop_string(_ctx, -2, "oe_feature_proto");            // [global, stash]
+            duk_pop(_ctx);                                                // [global]
+        }
+
+#ifdef DUK_USE_ES6_PROXY
+        else
+        {
+            // Minimal profile: one "feature" object for the life of the heap,
+            // whose properties read straight from the current Feature.
+            duk_push_object(_ctx);                           // [global, feature]
+            duk_push_int(_ctx, 0);
+            duk_put_prop_string(_ctx, -2, "id");
+
+            duk_get_prop_string(_ctx, -2, "Proxy");          // [global, feature, Proxy]
+            duk_push_object(_ctx);                           // [global, feature, Proxy, target]
+            duk_push_object(_ctx);                           // [global, feature, Proxy, target, handler]
+            duk_push_c_function(_ctx, oe_duk_get_attr, 3);
+            duk_put_prop_string(_ctx, -2, "get");
+            duk_push_c_function(_ctx, oe_duk_has_attr, 2);
+            duk_put_prop_string(_ctx, -2, "has");
+            duk_push_c_function(_ctx, oe_duk_set_attr, 4);
+            duk_put_prop_string(_ctx, -2, "set");
+            duk_push_c_function(_ctx, oe_duk_attr_keys, 1);
+            duk_put_prop_string(_ctx, -2, "enumerate");
+            duk_push_c_function(_ctx, oe_duk_attr_keys, 1);
+            duk_put_prop_string(_ctx, -2, "ownKeys");
+            duk_new(_ctx, 2);                                // [global, feature, proxy]
+            duk_put_prop_string(_ctx, -2, "properties");     // [global, feature]
+
+            duk_put_prop_string(_ctx, -2, "feature");        // [global]
         }
+#endif
 
         duk_pop(_ctx); // []
     }
 }
 
+bool
+DuktapeEngine::Context::compile(const std::string& code)
+{
+    duk_push_global_stash(_ctx);                               // [stash]
+    duk_get_prop_string(_ctx, -1, "oe_compiled");              // [stash, cache]
+    duk_push_lstring(_ctx, code.c_str(), code.length());       // [stash, cache, code]
+    duk_get_prop(_ctx, -2);                                    // [stash, cache, function|undefined]
+
+    if ( duk_is_function(_ctx, -1) )
+    {
+        duk_remove(_ctx, -2);                                  // [stash, function]
+        duk_remove(_ctx, -2);                                  // [function]
+        return true;
+    }
+    duk_pop(_ctx);                                             // [stash, cache]
+
+    if ( _numCompiled >= MAX_COMPILED_SCRIPTS )
+    {
+        duk_pop(_ctx);                                         // [stash]
+        duk_push_object(_ctx);                                 // [stash, cache]
+        duk_dup_top(_ctx);                                     // [stash, cache, cache]
+        duk_put_prop_string(_ctx, -3, "oe_compiled");          // [stash, cache]
+        _numCompiled = 0u;
+    }
+
+    // compile as eval code, so that calling the function returns the value
+    // of the last statement just like duk_peval does.
+    if ( duk_pcompile_lstring(_ctx, DUK_COMPILE_EVAL, code.c_str(), code.length()) != 0 )
+    {
+        // [stash, cache, error]
+        duk_remove(_ctx, -2);                                  // [stash, error]
+        duk_remove(_ctx, -2);                                  // [error]
+        return false;
+    }
+
+    // [stash, cache, function]
+    duk_push_lstring(_ctx, code.c_str(), code.length());       // [stash, cache, function, code]
+    duk_dup(_ctx, -2);                                         // [stash, cache, function, code, function]
+    duk_put_prop(_ctx, -4);                                    // [stash, cache, function]
+    ++_numCompiled;
+
+    duk_remove(_ctx, -2);                                      // [stash, function]
+    duk_remove(_ctx, -2);                                      // [function]
+    return true;
+}
+
+void
+DuktapeEngine::Context::setFeature(Feature const* feature)
+{
+#ifdef DUK_USE_ES6_PROXY
+    // what the last script assigned to feature.properties goes away, even
+    // if the next one runs on the same feature.
+    if ( !_complete )
+    {
+        duk_push_global_stash(_ctx);                         // [stash]
+        duk_del_prop_string(_ctx, -1, "oe_overlay");         // [stash]
+        duk_pop(_ctx);                                       // []
+    }
+#endif
+
+    // nothing to do if the script is already looking at this (live) feature
+    if ( feature == _featurePtr && feature == _feature.get() )
+        return;
+
+    _featurePtr = feature;
+    _feature    = feature;
+
+    // the native pointer the attribute and geometry callbacks read from
+    duk_push_global_stash(_ctx);                             // [stash]
+    duk_push_pointer(_ctx, (void*)feature);                  // [stash, ptr]
+    duk_put_prop_string(_ctx, -2, "oe_feature");             // [stash]
+    duk_pop(_ctx);                                           // []
+
+    duk_push_global_object(_ctx);                            // [global]
+
+    if ( !feature )
+    {
+        // detach whatever feature object the script still holds.
+        if ( _complete )
+        {
+            duk_get_prop_string(_ctx, -1, "feature");        // [global, feature|undefined]
+            if ( duk_is_object(_ctx, -1) )
+            {
+                duk_push_pointer(_ctx, 0L);                  // [global, feature, ptr]
+                duk_put_prop_string(_ctx, -2, "__ptr");      // [global, feature]
+            }
+            duk_pop(_ctx);                                   // [global]
+        }
+        duk_pop(_ctx);                                       // []
+        return;
+    }
+
+    // Complete profile: properties, geometry, and API bindings.
+    if ( _complete )
+    {
+        duk_idx_t feature_i = duk_push_object(_ctx);         // [global, feature]
+
+        duk_push_global_stash(_ctx);                         // [global, feature, stash]
+        duk_get_prop_string(_ctx, -1, "oe_feature_proto");   // [global, feature, stash, proto]
+        duk_remove(_ctx, -2);                                // [global, feature, proto]
+        duk_set_prototype(_ctx, feature_i);                  // [global, feature]
+
+        duk_push_string(_ctx, "Feature");
+        duk_put_prop_string(_ctx, feature_i, "type");
+
+        duk_push_number(_ctx, (double)feature->getFID());
+        duk_put_prop_string(_ctx, feature_i, "id");
+
+        pushProperties(_ctx, feature, true);
+        duk_put_prop_string(_ctx, feature_i, "properties");
+
+        duk_push_pointer(_ctx, (void*)feature);
+        duk_put_prop_string(_ctx, feature_i, "__ptr");
+
+        duk_put_prop_string(_ctx, -2, "feature");            // [global]
+    }
+
+    // Minimal profile: ID and properties only. MUCH faster!
+    else
+    {
+#ifdef DUK_USE_ES6_PROXY
+        // the properties proxy finds the new feature through the stash
+        // pointer, so only the ID changes here.
+        duk_get_prop_string(_ctx, -1, "feature");            // [global, feature]
+        duk_push_number(_ctx, (double)feature->getFID());
+        duk_put_prop_string(_ctx, -2, "id");
+        duk_pop(_ctx);                                       // [global]
+#else
+        duk_idx_t feature_i = duk_push_object(_ctx);         // [global, feature]
+        duk_push_number(_ctx, (double)feature->getFID());
+        duk_put_prop_string(_ctx, feature_i, "id");
+        pushProperties(_ctx, feature, false);
+        duk_put_prop_string(_ctx, feature_i, "properties");
+        duk_put_prop_string(_ctx, -2, "feature");            // [global]
+#endif
+    }
+
+    duk_pop(_ctx); // []
+}
+
+ScriptResult
+DuktapeEngine::Context::call(const std::string& code)
+{
+    // [function]
+    duk_dup_top(_ctx);                                       // [function, function]
+    duk_push_global_object(_ctx);                            // [function, function, this]
+
+    // run the script. On error, the top of stack will hold the error
+    // message instead of the return value.
+    bool ok = (duk_pcall_method(_ctx, 0) == DUK_EXEC_SUCCESS); // [function, result]
+
+    std::string resultString;
+    const char* resultVal = duk_safe_to_string(_ctx, -1);
+    if ( resultVal )
+        resultString = resultVal;
+
+    if ( !ok )
+    {
+        OE_DEBUG << LC << "Error: source =" << std::endl << code << std::endl;
+    }
+
+    // pop the return value:
+    duk_pop(_ctx); // [function]
+
+    return ok ?
+        ScriptResult(resultString, true) :
+        ScriptResult("", false, resultString);
+}
+
 DuktapeEngine::Context::~Context()
 {
     if ( _ctx )
@@ -279,7 +662,7 @@ DuktapeEngine::run(const std::string&   code,
 {
     if (code.empty())
         return ScriptResult(EMPTY_STRING, false, "Script is empty.");
-        
+
     bool complete = (getProfile() == "full");
 
 #ifdef MAXIMUM_ISOLATION
@@ -294,33 +677,77 @@ DuktapeEngine::run(const std::string&   code,
     duk_context* ctx = c._ctx;
 #endif
 
-	if ( feature && feature != c._feature.get() )
+    // fetch the compiled script; on error the top of stack holds the message.
+    if ( !c.compile(code) )
     {
-		// encode the feature in the global object and push a native pointer:
-		setFeature(ctx, feature, complete);
-	}
+        std::string message( duk_safe_to_string(ctx, -1) );
+        OE_DEBUG << LC << "Error: source =" << std::endl << code << std::endl;
+        duk_pop(ctx); // []
+        return ScriptResult("", false, message);
+    }
 
-    // remember the feature so we don't re-create it if not necessary
-    c._feature = feature;
+    // [function]
+    if ( feature )
+    {
+        c.setFeature( feature );
+    }
+    else if ( c._featurePtr && !c._feature.valid() )
+    {
+        // the last feature is gone; don't leave the script pointing at it.
+        c.setFeature( 0L );
+    }
 
-    // run the script. On error, the top of stack will hold the error
-    // message instead of the return value.
-    std::string resultString;
+    ScriptResult result = c.call( code );
 
-    bool ok = (duk_peval_string(ctx, code.c_str()) == 0); // [ "result" ]
-    const char* resultVal = duk_to_string(ctx, -1);
-    if ( resultVal )
-        resultString = resultVal;
+    duk_pop(ctx); // []
+    return result;
+}
 
-    if ( !ok )
+void
+DuktapeEngine::run(const std::string&         code,
+                   const FeatureList&         features,
+                   std::vector<ScriptResult>& results,
+                   FilterContext const*       context)
+{
+    unsigned numFeatures = features.size();
+    results.reserve( results.size() + numFeatures );
+
+    if (code.empty())
     {
+        results.resize( results.size() + numFeatures, ScriptResult(EMPTY_STRING, false, "Script is empty.") );
+        return;
+    }
+
+    bool complete = (getProfile() == "full");
+
+#ifdef MAXIMUM_ISOLATION
+    // brand new context every time
+    Context c;
+    c.initialize( _options, complete );
+    duk_context* ctx = c._ctx;
+#else
+    // cache the Context on a per-thread basis
+    Context& c = _contexts.get();
+    c.initialize( _options, complete );
+    duk_context* ctx = c._ctx;
+#endif
+
+    // compile once for the whole list:
+    if ( !c.compile(code) )
+    {
+        std::string message( duk_safe_to_string(ctx, -1) );
         OE_DEBUG << LC << "Error: source =" << std::endl << code << std::endl;
+        duk_pop(ctx); // []
+        results.resize( results.size() + numFeatures, ScriptResult("", false, message) );
+        return;
     }
 
-    // pop the return value:
-    duk_pop(ctx); // []
+    // [function]
+    for(FeatureList::const_iterator i = features.begin(); i != features.end(); ++i)
+    {
+        c.setFeature( i->get() );
+        results.push_back( c.call(code) );
+    }
 
-    return ok ?
-        ScriptResult(resultString, true) :
-        ScriptResult("", false, resultString);
+    duk_pop(ctx); // []
 }
@@ -452,3 +452,338 @@ AltitudeFilter::pushAndClamp( FeatureList& features, FilterContext& cx )
     double t = OE_GET_TIMER(pushAndClamp);
     OE_DEBUG << LC << "pushAndClamp: tpp = " << (t / (double)total)*1000000.0 << " us\n";
 }
+
+FilterContext
+AltitudeFilter::push( FeatureBatch& input, FilterContext& cx )
+{
+    // scripts run against Feature objects.
+    if ( _altitude.valid() && _altitude->script().isSet() )
+        return FeatureFilter::push( input, cx );
+
+    bool clampToMap = 
+        _altitude.valid()                                          && 
+        _altitude->clamping()  != AltitudeSymbol::CLAMP_NONE       &&
+        _altitude->technique() == AltitudeSymbol::TECHNIQUE_MAP    &&
+        cx.getSession()        != 0L                               &&
+        cx.profile()           != 0L;
+
+    if ( clampToMap )
+        pushAndClamp( input, cx );
+    else
+        pushAndDontClamp( input, cx );
+
+    return cx;
+}
+
+void
+AltitudeFilter::pushAndDontClamp( FeatureBatch& input, FilterContext& cx )
+{
+    NumericExpression scaleExpr;
+    if ( _altitude.valid() && _altitude->verticalScale().isSet() )
+        scaleExpr = *_altitude->verticalScale();
+
+    NumericExpression offsetExpr;
+    if ( _altitude.valid() && _altitude->verticalOffset().isSet() )
+        offsetExpr = *_altitude->verticalOffset();
+
+    bool gpuClamping =
+        _altitude.valid() &&
+        _altitude->technique() == _altitude->TECHNIQUE_GPU;
+
+    bool ignoreZ =
+        gpuClamping && 
+        _altitude->clamping() == _altitude->CLAMP_TO_TERRAIN;
+
+    unsigned minHATCol = input.addAttribute( "__min_hat", ATTRTYPE_DOUBLE );
+    unsigned maxHATCol = input.addAttribute( "__max_hat", ATTRTYPE_DOUBLE );
+    unsigned scaleCol  = gpuClamping ? input.addAttribute( "__oe_verticalScale",  ATTRTYPE_DOUBLE ) : 0u;
+    unsigned offsetCol = gpuClamping ? input.addAttribute( "__oe_verticalOffset", ATTRTYPE_DOUBLE ) : 0u;
+
+    std::vector<osg::Vec3d>& points = input.getPoints();
+
+    for( unsigned row = 0; row < input.size(); ++row )
+    {
+        if ( !input.hasGeometry(row) )
+            continue;
+
+        double minHAT       =  DBL_MAX;
+        double maxHAT       = -DBL_MAX;
+
+        double scaleZ = 1.0;
+        if ( _altitude.valid() && _altitude->verticalScale().isSet() )
+            scaleZ = input.eval( row, scaleExpr, &cx );
+
+        double offsetZ = 0.0;
+        if ( _altitude.valid() && _altitude->verticalOffset().isSet() )
+            offsetZ = input.eval( row, offsetExpr, &cx );
+
+        unsigned end = input.getFirstPoint(row) + input.getNumPoints(row);
+        for( unsigned i = input.getFirstPoint(row); i < end; ++i )
+        {
+            osg::Vec3d& p = points[i];
+
+            if ( ignoreZ )
+            {
+                p.z() = 0.0;
+            }
+
+            if ( !gpuClamping )
+            {
+                p.z() *= scaleZ;
+                p.z() += offsetZ;
+            }
+
+            if ( p.z() < minHAT )
+                minHAT = p.z();
+            if ( p.z() > maxHAT )
+                maxHAT = p.z();
+        }
+
+        if ( minHAT != DBL_MAX )
+        {
+            input.set( row, minHATCol, minHAT );
+            input.set( row, maxHATCol, maxHAT );
+        }
+
+        // encode the Z offset if
+        if ( gpuClamping )
+        {
+            input.set( row, scaleCol,  scaleZ );
+            input.set( row, offsetCol, offsetZ );
+        }
+    }
+}
+
+void
+AltitudeFilter::pushAndClamp( FeatureBatch& input, FilterContext& cx )
+{
+    OE_START_TIMER(pushAndClampBatch);
+
+    const Session* session = cx.getSession();
+
+    // the map against which we'll be doing elevation clamping
+    osg::ref_ptr<const Map> map = session->getMap();
+    if (!map.valid())
+        return;
+
+    const SpatialReference* mapSRS = map->getSRS();
+    osg::ref_ptr<const SpatialReference> featureSRS = cx.profile()->getSRS();
+
+    // establish an elevation query interface based on the features' SRS.
+    ElevationQuery eq(map.get());
+
+    NumericExpression scaleExpr;
+    if ( _altitude->verticalScale().isSet() )
+        scaleExpr = *_altitude->verticalScale();
+
+    NumericExpression offsetExpr;
+    if ( _altitude->verticalOffset().isSet() )
+        offsetExpr = *_altitude->verticalOffset();
+
+    AltitudeSymbol::Clamping clamping = _altitude->clamping().get();
+
+    // whether to clamp every vertex (or just the centroid)
+    bool perVertex =
+        _altitude->binding() == AltitudeSymbol::BINDING_VERTEX;
+
+    // whether the SRS's have a compatible vertical datum.
+    bool vertEquiv =
+        featureSRS->isVertEquivalentTo( mapSRS );
+
+    osg::ref_ptr<const SpatialReference> featureSRSwithMapVertDatum = !vertEquiv ?
+        SpatialReference::create(featureSRS->getHorizInitString(), mapSRS->getVertInitString()) : 0L;
+
+    std::vector<osg::Vec3d>& points = input.getPoints();
+
+    // Sample the terrain for the whole batch in one pass: every vertex, or
+    // every row's centroid.
+    std::vector<float> elevations;
+    std::vector<float> centroidElevations;
+
+    if ( perVertex )
+    {
+        if ( clamping == AltitudeSymbol::CLAMP_TO_TERRAIN )
+        {
+            eq.getElevations( points, featureSRS.get(), true, _maxRes );
+        }
+        else
+        {
+            elevations.reserve( points.size() );
+            eq.getElevations( points, featureSRS.get(), elevations, _maxRes );
+        }
+    }
+    else
+    {
+        // clamp each row as a whole (so multipolygons stay together) at its centroid.
+        std::vector<unsigned>   rows;
+        std::vector<osg::Vec3d> centroids;
+        for( unsigned row = 0; row < input.size(); ++row )
+        {
+            if ( input.getNumParts(row) > 0 )
+            {
+                osg::Vec2d center = input.getBounds(row).center2d();
+                centroids.push_back( osg::Vec3d(center.x(), center.y(), 0.0) );
+                rows.push_back( row );
+            }
+        }
+
+        std::vector<float> sampled;
+        sampled.reserve( centroids.size() );
+        eq.getElevations( centroids, featureSRS.get(), sampled, _maxRes );
+
+        // Check for NO_DATA_VALUE and use zero instead.
+        centroidElevations.assign( input.size(), 0.0f );
+        for( unsigned i = 0; i < rows.size() && i < sampled.size(); ++i )
+        {
+            if ( sampled[i] != NO_DATA_VALUE )
+                centroidElevations[rows[i]] = sampled[i];
+        }
+    }
+
+    unsigned minHATCol     = input.addAttribute( "__min_hat", ATTRTYPE_DOUBLE );
+    unsigned maxHATCol     = input.addAttribute( "__max_hat", ATTRTYPE_DOUBLE );
+    unsigned minTerrainCol = input.addAttribute( "__min_terrain_z", ATTRTYPE_DOUBLE );
+    unsigned maxTerrainCol = input.addAttribute( "__max_terrain_z", ATTRTYPE_DOUBLE );
+
+    for( unsigned row = 0; row < input.size(); ++row )
+    {
+        if ( !input.hasGeometry(row) )
+            continue;
+
+        double maxTerrainZ  = -DBL_MAX;
+        double minTerrainZ  =  DBL_MAX;
+        double minHAT       =  DBL_MAX;
+        double maxHAT       = -DBL_MAX;
+
+        double scaleZ = 1.0;
+        if ( _altitude->verticalScale().isSet() )
+            scaleZ = input.eval( row, scaleExpr, &cx );
+
+        double offsetZ = 0.0;
+        if ( _altitude->verticalOffset().isSet() )
+            offsetZ = input.eval( row, offsetExpr, &cx );
+
+        double centroidElevation = perVertex ? 0.0 : centroidElevations[row];
+
+        unsigned begin = input.getFirstPoint(row);
+        unsigned end   = begin + input.getNumPoints(row);
+
+        if ( !perVertex && input.getNumParts(row) > 0 )
+        {
+            if ( centroidElevation > maxTerrainZ )
+                maxTerrainZ = centroidElevation;
+            if ( centroidElevation < minTerrainZ )
+                minTerrainZ = centroidElevation;
+        }
+
+        for( unsigned i = begin; i < end; ++i )
+        {
+            osg::Vec3d& p = points[i];
+
+            // Absolute heights in Z. Only need to collect the HATs; the geometry
+            // remains unchanged.
+            if ( clamping == AltitudeSymbol::CLAMP_ABSOLUTE )
+            {
+                float elevation = perVertex ? elevations[i] : (float)centroidElevation;
+                if ( elevation == NO_DATA_VALUE )
+                    continue;
+
+                p.z() *= scaleZ;
+                p.z() += offsetZ;
+
+                double z = p.z();
+                if ( !vertEquiv )
+                {
+                    osg::Vec3d tempgeo;
+                    if ( !featureSRS->transform(p, mapSRS->getGeographicSRS(), tempgeo) )
+                        z = tempgeo.z();
+                }
+
+                double hat = z - elevation;
+
+                if ( hat > maxHAT )
+                    maxHAT = hat;
+                if ( hat < minHAT )
+                    minHAT = hat;
+
+                if ( perVertex )
+                {
+                    if ( elevation > maxTerrainZ )
+                        maxTerrainZ = elevation;
+                    if ( elevation < minTerrainZ )
+                        minTerrainZ = elevation;
+                }
+            }
+
+            // Heights-above-ground in Z. Need to resolve this to an absolute number
+            // and record HATs along the way.
+            else if ( clamping == AltitudeSymbol::CLAMP_RELATIVE_TO_TERRAIN )
+            {
+                float elevation = perVertex ? elevations[i] : (float)centroidElevation;
+                if ( elevation == NO_DATA_VALUE )
+                    continue;
+
+                p.z() *= scaleZ;
+                p.z() += offsetZ;
+
+                double hat = p.z();
+                p.z() = elevation + p.z();
+
+                // if necessary, convert the Z value (which is now in the map's SRS) back to
+                // the feature's SRS.
+                if ( !vertEquiv )
+                {
+                    featureSRSwithMapVertDatum->transform(p, featureSRS.get(), p);
+                }
+
+                if ( hat > maxHAT )
+                    maxHAT = hat;
+                if ( hat < minHAT )
+                    minHAT = hat;
+
+                if ( perVertex )
+                {
+                    if ( elevation > maxTerrainZ )
+                        maxTerrainZ = elevation;
+                    if ( elevation < minTerrainZ )
+                        minTerrainZ = elevation;
+                }
+            }
+
+            // Clamp - replace the geometry's Z with the terrain height.
+            else // CLAMP_TO_TERRAIN
+            {
+                // (per-vertex heights are already in place)
+                if ( !perVertex )
+                {
+                    p.z() = centroidElevation;
+                }
+
+                // if necessary, transform the Z values (which are now in the map SRS) back
+                // into the feature's SRS.
+                if ( !vertEquiv )
+                {
+                    featureSRSwithMapVertDatum->transform(p, featureSRS.get(), p);
+                }
+
+                p.z() *= scaleZ;
+                p.z() += offsetZ;
+            }
+        }
+
+        if ( minHAT != DBL_MAX )
+        {
+            input.set( row, minHATCol, minHAT );
+            input.set( row, maxHATCol, maxHAT );
+        }
+
+        if ( minTerrainZ != DBL_MAX )
+        {
+            input.set( row, minTerrainCol, minTerrainZ );
+            input.set( row, maxTerrainCol, maxTerrainZ );
+        }
+    }
+
+    double t = OE_GET_TIMER(pushAndClampBatch);
+    OE_DEBUG << LC << "pushAndClamp: tpp = " << (t / (double)points.size())*1000000.0 << " us\n";
+}
@@ -0,0 +1,1078 @@
+/* -*-c++-*- */
+/* osgEarth - Geospatial SDK for OpenSceneGraph
+ * Copyright 2019 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarthFeatures/BinaryNodeCache>
+#include <osgEarthFeatures/FeatureSourceIndexNode>
+#include <osgEarth/ObjectIndex>
+#include <osgEarth/Registry>
+#include <osgEarth/StringUtils>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/MatrixTransform>
+#include <osgDB/Registry>
+#include <cstring>
+#include <sstream>
+#include <typeinfo>
+
+#define LC "[BinaryNodeCache] "
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+
+namespace
+{
+    const char     MAGIC[4]      = { 'O', 'E', 'B', 'N' };
+    const unsigned VERSION       = 1u;
+    const unsigned BYTE_ORDER_ID = 0x01020304u;
+
+    // forget about states that are no longer in use once there are this many
+    const unsigned MAX_STATE_SETS = 4096u;
+
+    enum NodeType
+    {
+        NODE_GROUP,
+        NODE_GEODE,
+        NODE_MATRIX_TRANSFORM,
+        NODE_FEATURE_INDEX
+    };
+
+    enum Flags
+    {
+        FLAG_TAGGED           = 0x01, // carries object IDs
+        FLAG_USE_VBO          = 0x02,
+        FLAG_USE_DISPLAY_LIST = 0x04
+    };
+
+    enum StateKind
+    {
+        STATE_SHARED, // in its own record, by content hash
+        STATE_INLINE  // in the tile record
+    };
+
+    // array slots in a geometry record
+    enum Slot
+    {
+        SLOT_VERTEX          = 0,
+        SLOT_NORMAL          = 1,
+        SLOT_COLOR           = 2,
+        SLOT_SECONDARY_COLOR = 3,
+        SLOT_FOG_COORD       = 4,
+        SLOT_TEXCOORD        = 16,  // + unit
+        SLOT_VERTEX_ATTRIB   = 64   // + index
+    };
+
+    const unsigned MAX_TEXCOORD_UNITS  = SLOT_VERTEX_ATTRIB - SLOT_TEXCOORD;
+    const unsigned MAX_VERTEX_ATTRIBS  = 256 - SLOT_VERTEX_ATTRIB;
+
+    /** Appends plain values and aligned raw blocks to a string. */
+    struct Writer
+    {
+        std::string& _buf;
+
+        Writer(std::string& buf) : _buf(buf) { }
+
+        template<typename T> void write(const T& value)
+        {
+            _buf.append(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+
+        void writeString(const std::string& value)
+        {
+            write((unsigned)value.size());
+            _buf.append(value);
+        }
+
+        // raw data starts on an 8-byte boundary of the record
+        void writeBlock(const void* data, unsigned bytes)
+        {
+            write(bytes);
+            while (_buf.size() % 8u != 0u)
+                _buf.push_back('\0');
+            if (bytes > 0u)
+                _buf.append(static_cast<const char*>(data), bytes);
+        }
+    };
+
+    /** Reads back what a Writer wrote; every read is bounds-checked. */
+    struct Reader
+    {
+        const char* _begin;
+        const char* _ptr;
+        const char* _end;
+        bool        _ok;
+
+        Reader(const std::string& buf) :
+            _begin(buf.data()), _ptr(buf.data()), _end(buf.data() + buf.size()), _ok(true) { }
+
+        unsigned remaining() const
+        {
+            return (unsigned)(_end - _ptr);
+        }
+
+        bool has(unsigned bytes)
+        {
+            if (_ok && (unsigned)(_end - _ptr) < bytes)
+                _ok = false;
+            return _ok;
+        }
+
+        template<typename T> bool read(T& value)
+        {
+            if (!has(sizeof(T)))
+                return false;
+            ::memcpy(&value, _ptr, sizeof(T));
+            _ptr += sizeof(T);
+            return true;
+        }
+
+        bool readString(std::string& value)
+        {
+            unsigned size = 0u;
+            if (!read(size) || !has(size))
+                return false;
+            value.assign(_ptr, size);
+            _ptr += size;
+            return true;
+        }
+
+        const char* readBlock(unsigned& bytes)
+        {
+            if (!read(bytes))
+                return 0L;
+            // pad and bytes are checked separately; their sum can wrap
+            unsigned pad = (8u - (unsigned)(_ptr - _begin) % 8u) % 8u;
+            if (!has(pad))
+                return 0L;
+            _ptr += pad;
+            if (!has(bytes))
+                return 0L;
+            const char* data = _ptr;
+            _ptr += bytes;
+            return data;
+        }
+    };
+
+    // Only these exact classes are encoded; a subclass could hold anything.
+    template<typename T>
+    bool isA(const osg::Object& object)
+    {
+        return typeid(object) == typeid(T);
+    }
+
+    bool hasNodeExtras(const osg::Node& node)
+    {
+        return
+            node.getUpdateCallback() != 0L ||
+            node.getEventCallback() != 0L ||
+            node.getCullCallback() != 0L ||
+            node.getComputeBoundingSphereCallback() != 0L ||
+            node.getUserDataContainer() != 0L;
+    }
+
+    bool hasDrawableExtras(const osg::Drawable& drawable)
+    {
+        return
+            hasNodeExtras(drawable) ||
+            drawable.getDrawCallback() != 0L ||
+            drawable.getComputeBoundingBoxCallback() != 0L ||
+            drawable.getShape() != 0L;
+    }
+
+    template<typename A>
+    osg::Array* makeArray(unsigned numElements, const char* data, unsigned bytes)
+    {
+        if (numElements * sizeof(typename A::ElementDataType) != bytes)
+            return 0L;
+        A* array = new A(numElements);
+        if (bytes > 0u)
+            ::memcpy(&array->front(), data, bytes);
+        return array;
+    }
+
+    osg::Array* makeArray(osg::Array::Type type, unsigned numElements, const char* data, unsigned bytes)
+    {
+        switch(type)
+        {
+        case osg::Array::ByteArrayType:    return makeArray<osg::ByteArray>   (numElements, data, bytes);
+        case osg::Array::ShortArrayType:   return makeArray<osg::ShortArray>  (numElements, data, bytes);
+        case osg::Array::IntArrayType:     return makeArray<osg::IntArray>    (numElements, data, bytes);
+        case osg::Array::UByteArrayType:   return makeArray<osg::UByteArray>  (numElements, data, bytes);
+        case osg::Array::UShortArrayType:  return makeArray<osg::UShortArray> (numElements, data, bytes);
+        case osg::Array::UIntArrayType:    return makeArray<osg::UIntArray>   (numElements, data, bytes);
+        case osg::Array::FloatArrayType:   return makeArray<osg::FloatArray>  (numElements, data, bytes);
+        case osg::Array::DoubleArrayType:  return makeArray<osg::DoubleArray> (numElements, data, bytes);
+        case osg::Array::Vec2ArrayType:    return makeArray<osg::Vec2Array>   (numElements, data, bytes);
+        case osg::Array::Vec3ArrayType:    return makeArray<osg::Vec3Array>   (numElements, data, bytes);
+        case osg::Array::Vec4ArrayType:    return makeArray<osg::Vec4Array>   (numElements, data, bytes);
+        case osg::Array::Vec4ubArrayType:  return makeArray<osg::Vec4ubArray> (numElements, data, bytes);
+        case osg::Array::Vec2dArrayType:   return makeArray<osg::Vec2dArray>  (numElements, data, bytes);
+        case osg::Array::Vec3dArrayType:   return makeArray<osg::Vec3dArray>  (numElements, data, bytes);
+        case osg::Array::Vec4dArrayType:   return makeArray<osg::Vec4dArray>  (numElements, data, bytes);
+        default:                           return 0L;
+        }
+    }
+
+    bool isSupported(const osg::Array* array)
+    {
+        if (!array || array->getUserDataContainer())
+            return false;
+
+        osg::ref_ptr<osg::Array> probe = makeArray(array->getType(), 0u, 0L, 0u);
+        return probe.valid() && typeid(*probe.get()) == typeid(*array);
+    }
+
+    osgDB::ReaderWriter* getStateReaderWriter()
+    {
+        return osgDB::Registry::instance()->getReaderWriterForExtension("osgb");
+    }
+
+    bool serializeStateSet(const osg::StateSet* stateSet, const osgDB::Options* writeOptions, std::string& output)
+    {
+        osgDB::ReaderWriter* rw = getStateReaderWriter();
+        if (!rw)
+            return false;
+
+        std::stringstream buf;
+        osgDB::ReaderWriter::WriteResult r = rw->writeObject(*stateSet, buf, writeOptions);
+        if (!r.success())
+            return false;
+
+        output = buf.str();
+        return true;
+    }
+
+    osg::StateSet* deserializeStateSet(const std::string& data, const osgDB::Options* readOptions)
+    {
+        osgDB::ReaderWriter* rw = getStateReaderWriter();
+        if (!rw)
+            return 0L;
+
+        std::stringstream buf(data);
+        osgDB::ReaderWriter::ReadResult r = rw->readObject(buf, readOptions);
+        if (!r.success())
+            return 0L;
+
+        return dynamic_cast<osg::StateSet*>(r.takeObject());
+    }
+}
+
+//...................................................................
+
+struct BinaryNodeCache::Encoder
+{
+    BinaryNodeCache*      _cache;
+    CacheBin*             _bin;
+    const osgDB::Options* _writeOptions;
+    std::string           _oidUniformName;
+    int                   _oidAttribLocation;
+
+    std::string                         _states; // state table
+    unsigned                            _numStates;
+    std::map<const osg::StateSet*, int> _stateIndex;
+
+    std::string _body;
+    Writer      _out;
+
+    Encoder(BinaryNodeCache* cache, CacheBin* bin, const osgDB::Options* writeOptions) :
+        _cache(cache), _bin(bin), _writeOptions(writeOptions), _numStates(0u), _out(_body)
+    {
+        ObjectIndex* index = Registry::objectIndex();
+        _oidUniformName = index->getObjectIDUniformName();
+        _oidAttribLocation = index->getObjectIDAttribLocation();
+    }
+
+    bool isTagged(const osg::StateSet* stateSet) const
+    {
+        return stateSet && stateSet->getUniform(_oidUniformName) != 0L;
+    }
+
+    // Adds a state to the state table and writes its index (-1 for none).
+    bool writeStateSet(const osg::StateSet* stateSet)
+    {
+        if (!stateSet)
+        {
+            _out.write((int)-1);
+            return true;
+        }
+
+        std::map<const osg::StateSet*, int>::const_iterator i = _stateIndex.find(stateSet);
+        if (i != _stateIndex.end())
+        {
+            _out.write(i->second);
+            return true;
+        }
+
+        std::string data;
+        if (!serializeStateSet(stateSet, _writeOptions, data))
+            return false;
+
+        Writer states(_states);
+
+        // A state holding an object ID, or one that may change, belongs to
+        // this tile alone and can't be shared with others.
+        bool shareable =
+            _bin != 0L &&
+            !isTagged(stateSet) &&
+            stateSet->getDataVariance() != osg::Object::DYNAMIC;
+
+        if (shareable)
+        {
+            std::string key = Stringify() << "state_" << hashToString(data) << "_" << data.size();
+            if (!_cache->writeSharedStateSet(key, data, _bin, _writeOptions))
+                return false;
+
+            states.write((unsigned char)STATE_SHARED);
+            states.writeString(key);
+        }
+        else
+        {
+            states.write((unsigned char)STATE_INLINE);
+            states.writeString(data);
+        }
+
+        int index = (int)_numStates++;
+        _stateIndex[stateSet] = index;
+        _out.write(index);
+        return true;
+    }
+
+    bool writeArray(unsigned char slot, const osg::Array* array)
+    {
+        if (!array)
+            return true;
+
+        if (!isSupported(array))
+            return false;
+
+        _out.write(slot);
+        _out.write((unsigned char)array->getType());
+        _out.write((unsigned char)array->getBinding());
+        _out.write((unsigned char)(array->getNormalize() ? 1 : 0));
+        _out.write((unsigned)array->getNumElements());
+        _out.writeBlock(array->getDataPointer(), array->getTotalDataSize());
+        return true;
+    }
+
+    bool writePrimitiveSet(const osg::PrimitiveSet* p)
+    {
+        if (p->getUserDataContainer())
+            return false;
+
+        osg::PrimitiveSet::Type type = p->getType();
+
+        _out.write((unsigned char)type);
+        _out.write((unsigned)p->getMode());
+        _out.write((int)p->getNumInstances());
+
+        switch(type)
+        {
+        case osg::PrimitiveSet::DrawArraysPrimitiveType:
+            {
+                if (!isA<osg::DrawArrays>(*p))
+                    return false;
+                const osg::DrawArrays* da = static_cast<const osg::DrawArrays*>(p);
+                _out.write((int)da->getFirst());
+                _out.write((int)da->getCount());
+                return true;
+            }
+
+        case osg::PrimitiveSet::DrawArrayLengthsPrimitiveType:
+            {
+                if (!isA<osg::DrawArrayLengths>(*p))
+                    return false;
+                const osg::DrawArrayLengths* dal = static_cast<const osg::DrawArrayLengths*>(p);
+                _out.write((int)dal->getFirst());
+                _out.write((unsigned)dal->size());
+                _out.writeBlock(dal->empty() ? 0L : &dal->front(), dal->size()*sizeof(osg::DrawArrayLengths::value_type));
+                return true;
+            }
+
+        case osg::PrimitiveSet::DrawElementsUBytePrimitiveType:
+        case osg::PrimitiveSet::DrawElementsUShortPrimitiveType:
+        case osg::PrimitiveSet::DrawElementsUIntPrimitiveType:
+            {
+                if (!isA<osg::DrawElementsUByte>(*p) && !isA<osg::DrawElementsUShort>(*p) && !isA<osg::DrawElementsUInt>(*p))
+                    return false;
+                _out.write((unsigned)p->getNumIndices());
+                _out.writeBlock(p->getDataPointer(), p->getTotalDataSize());
+                return true;
+            }
+
+        default:
+            return false;
+        }
+    }
+
+    bool writeGeometry(osg::Drawable* drawable)
+    {
+        if (!drawable || !isA<osg::Geometry>(*drawable) || hasDrawableExtras(*drawable))
+            return false;
+
+        osg::Geometry* geom = drawable->asGeometry();
+
+        const osg::UIntArray* oids = dynamic_cast<const osg::UIntArray*>(
+            geom->getVertexAttribArray(_oidAttribLocation));
+
+        unsigned char flags = 0;
+        if (oids && !oids->empty())        flags |= FLAG_TAGGED;
+        if (geom->getUseVertexBufferObjects()) flags |= FLAG_USE_VBO;
+        if (geom->getUseDisplayList())     flags |= FLAG_USE_DISPLAY_LIST;
+
+        _out.write(flags);
+        _out.writeString(geom->getName());
+        _out.write((unsigned char)geom->getDataVariance());
+
+        if (!writeStateSet(geom->getStateSet()))
+            return false;
+
+        if (geom->getNumTexCoordArrays() > MAX_TEXCOORD_UNITS ||
+            geom->getNumVertexAttribArrays() > MAX_VERTEX_ATTRIBS)
+        {
+            return false;
+        }
+
+        // count the arrays first
+        std::vector< std::pair<unsigned char, const osg::Array*> > arrays;
+        arrays.push_back(std::make_pair((unsigned char)SLOT_VERTEX,          (const osg::Array*)geom->getVertexArray()));
+        arrays.push_back(std::make_pair((unsigned char)SLOT_NORMAL,          (const osg::Array*)geom->getNormalArray()));
+        arrays.push_back(std::make_pair((unsigned char)SLOT_COLOR,           (const osg::Array*)geom->getColorArray()));
+        arrays.push_back(std::make_pair((unsigned char)SLOT_SECONDARY_COLOR, (const osg::Array*)geom->getSecondaryColorArray()));
+        arrays.push_back(std::make_pair((unsigned char)SLOT_FOG_COORD,       (const osg::Array*)geom->getFogCoordArray()));
+        for (unsigned i = 0; i < geom->getNumTexCoordArrays(); ++i)
+            arrays.push_back(std::make_pair((unsigned char)(SLOT_TEXCOORD + i), (const osg::Array*)geom->getTexCoordArray(i)));
+        for (unsigned i = 0; i < geom->getNumVertexAttribArrays(); ++i)
+            arrays.push_back(std::make_pair((unsigned char)(SLOT_VERTEX_ATTRIB + i), (const osg::Array*)geom->getVertexAttribArray(i)));
+
+        unsigned char numArrays = 0;
+        for (unsigned i = 0; i < arrays.size(); ++i)
+            if (arrays[i].second)
+                ++numArrays;
+
+        _out.write(numArrays);
+        for (unsigned i = 0; i < arrays.size(); ++i)
+        {
+            if (!writeArray(arrays[i].first, arrays[i].second))
+                return false;
+        }
+
+        _out.write((unsigned)geom->getNumPrimitiveSets());
+        for (unsigned i = 0; i < geom->getNumPrimitiveSets(); ++i)
+        {
+            if (!writePrimitiveSet(geom->getPrimitiveSet(i)))
+                return false;
+        }
+
+        return true;
+    }
+
+    bool writeNode(osg::Node* node)
+    {
+        if (!node || hasNodeExtras(*node))
+            return false;
+
+        unsigned char type;
+        if      (isA<osg::Group>(*node))             type = NODE_GROUP;
+        else if (isA<osg::Geode>(*node))             type = NODE_GEODE;
+        else if (isA<osg::MatrixTransform>(*node))   type = NODE_MATRIX_TRANSFORM;
+        else if (isA<FeatureSourceIndexNode>(*node)) type = NODE_FEATURE_INDEX;
+        else
+        {
+            OE_DEBUG << LC << "Can't encode a " << node->className() << "\n";
+            return false;
+        }
+
+        unsigned char flags = isTagged(node->getStateSet()) ? FLAG_TAGGED : 0;
+
+        _out.write(type);
+        _out.write(flags);
+        _out.writeString(node->getName());
+        _out.write((unsigned)node->getNodeMask());
+        _out.write((unsigned char)node->getDataVariance());
+
+        if (!writeStateSet(node->getStateSet()))
+            return false;
+
+        if (type == NODE_GEODE)
+        {
+            osg::Geode* geode = node->asGeode();
+            _out.write((unsigned)geode->getNumDrawables());
+            for (unsigned i = 0; i < geode->getNumDrawables(); ++i)
+            {
+                if (!writeGeometry(geode->getDrawable(i)))
+                    return false;
+            }
+            return true;
+        }
+
+        if (type == NODE_MATRIX_TRANSFORM)
+        {
+            osg::MatrixTransform* xform = static_cast<osg::MatrixTransform*>(node);
+            _out.write((unsigned char)xform->getReferenceFrame());
+            const osg::Matrixd& m = xform->getMatrix();
+            for (unsigned i = 0; i < 16; ++i)
+                _out.write((double)m.ptr()[i]);
+        }
+
+        else if (type == NODE_FEATURE_INDEX)
+        {
+            const FeatureSourceIndexNode::FIDMap& fids = static_cast<FeatureSourceIndexNode*>(node)->getFIDMap();
+            _out.write((unsigned)fids.size());
+            for (FeatureSourceIndexNode::FIDMap::const_iterator i = fids.begin(); i != fids.end(); ++i)
+            {
+                _out.write((unsigned long long)i->second->_fid);
+                _out.write((unsigned)i->second->_oid);
+            }
+        }
+
+        osg::Group* group = node->asGroup();
+        _out.write((unsigned)group->getNumChildren());
+        for (unsigned i = 0; i < group->getNumChildren(); ++i)
+        {
+            if (!writeNode(group->getChild(i)))
+                return false;
+        }
+
+        return true;
+    }
+
+    bool encode(osg::Node* node, std::string& record)
+    {
+        if (!writeNode(node))
+            return false;
+
+        record.clear();
+        record.reserve(32u + _states.size() + _body.size());
+        record.append(MAGIC, sizeof(MAGIC));
+
+        Writer out(record);
+        out.write(VERSION);
+        out.write(BYTE_ORDER_ID);
+        out.write(_numStates);
+        record.append(_states);
+
+        // keep the body on the same 8-byte alignment it was written with
+        out.writeBlock(_body.data(), _body.size());
+        return true;
+    }
+};
+
+//...................................................................
+
+struct BinaryNodeCache::Decoder
+{
+    // object ID carriers below one index node, for a walk-free reindex
+    struct IndexEntry
+    {
+        FeatureSourceIndexNode*    _node;
+        std::vector<osg::Drawable*> _drawables;
+        std::vector<osg::Node*>     _nodes;
+    };
+
+    BinaryNodeCache*      _cache;
+    CacheBin*             _bin;
+    const osgDB::Options* _readOptions;
+
+    std::vector< osg::ref_ptr<osg::StateSet> > _states;
+    std::vector<IndexEntry>                    _indexes;
+    std::vector<unsigned>                      _indexStack;
+
+    Decoder(BinaryNodeCache* cache, CacheBin* bin, const osgDB::Options* readOptions) :
+        _cache(cache), _bin(bin), _readOptions(readOptions) { }
+
+    bool readStateSet(Reader& in, osg::ref_ptr<osg::StateSet>& output)
+    {
+        int index;
+        if (!in.read(index))
+            return false;
+        if (index < 0)
+            return true;
+        if ((unsigned)index >= _states.size())
+            return false;
+        output = _states[index].get();
+        return true;
+    }
+
+    bool readStates(Reader& in, unsigned numStates)
+    {
+        // each state is at least a kind byte and a string length, so a
+        // count the record can't hold means it's damaged; don't allocate it.
+        if (numStates > in.remaining() / (sizeof(unsigned char) + sizeof(unsigned)))
+            return false;
+
+        _states.resize(numStates);
+        for (unsigned i = 0; i < numStates; ++i)
+        {
+            unsigned char kind;
+            std::string   data;
+            if (!in.read(kind) || !in.readString(data))
+                return false;
+
+            if (kind == STATE_SHARED)
+            {
+                if (!_cache->getSharedStateSet(data, _bin, _readOptions, _states[i]))
+                {
+                    OE_DEBUG << LC << "Shared state " << data << " is missing\n";
+                    return false;
+                }
+            }
+            else
+            {
+                _states[i] = deserializeStateSet(data, _readOptions);
+                if (!_states[i].valid())
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    osg::Array* readArray(Reader& in, unsigned char& slot)
+    {
+        unsigned char type, binding, normalize;
+        unsigned      numElements, bytes;
+        if (!in.read(slot) || !in.read(type) || !in.read(binding) || !in.read(normalize) || !in.read(numElements))
+            return 0L;
+
+        const char* data = in.readBlock(bytes);
+        if (!data)
+            return 0L;
+
+        osg::Array* array = makeArray((osg::Array::Type)type, numElements, data, bytes);
+        if (array)
+        {
+            array->setBinding((osg::Array::Binding)(signed char)binding);
+            array->setNormalize(normalize != 0);
+        }
+        return array;
+    }
+
+    template<typename DE>
+    osg::PrimitiveSet* readElements(Reader& in, GLenum mode, int numInstances)
+    {
+        unsigned numIndices, bytes;
+        if (!in.read(numIndices))
+            return 0L;
+
+        const char* data = in.readBlock(bytes);
+        if (!data || numIndices * sizeof(typename DE::value_type) != bytes)
+            return 0L;
+
+        DE* de = new DE(mode, numIndices);
+        if (bytes > 0u)
+            ::memcpy(&de->front(), data, bytes);
+        de->setNumInstances(numInstances);
+        return de;
+    }
+
+    osg::PrimitiveSet* readPrimitiveSet(Reader& in)
+    {
+        unsigned char type;
+        unsigned      mode;
+        int           numInstances;
+        if (!in.read(type) || !in.read(mode) || !in.read(numInstances))
+            return 0L;
+
+        switch(type)
+        {
+        case osg::PrimitiveSet::DrawArraysPrimitiveType:
+            {
+                int first, count;
+                if (!in.read(first) || !in.read(count))
+                    return 0L;
+                return new osg::DrawArrays(mode, first, count, numInstances);
+            }
+
+        case osg::PrimitiveSet::DrawArrayLengthsPrimitiveType:
+            {
+                int first;
+                unsigned size, bytes;
+                if (!in.read(first) || !in.read(size))
+                    return 0L;
+                const char* data = in.readBlock(bytes);
+                if (!data || size * sizeof(osg::DrawArrayLengths::value_type) != bytes)
+                    return 0L;
+                osg::DrawArrayLengths* dal = new osg::DrawArrayLengths(mode, first, size);
+                if (bytes > 0u)
+                    ::memcpy(&dal->front(), data, bytes);
+                dal->setNumInstances(numInstances);
+                return dal;
+            }
+
+        case osg::PrimitiveSet::DrawElementsUBytePrimitiveType:
+            return readElements<osg::DrawElementsUByte>(in, mode, numInstances);
+
+        case osg::PrimitiveSet::DrawElementsUShortPrimitiveType:
+            return readElements<osg::DrawElementsUShort>(in, mode, numInstances);
+
+        case osg::PrimitiveSet::DrawElementsUIntPrimitiveType:
+            return readElements<osg::DrawElementsUInt>(in, mode, numInstances);
+
+        default:
+            return 0L;
+        }
+    }
+
+    osg::Geometry* readGeometry(Reader& in)
+    {
+        unsigned char flags, dataVariance;
+        std::string   name;
+        if (!in.read(flags) || !in.readString(name) || !in.read(dataVariance))
+            return 0L;
+
+        osg::ref_ptr<osg::Geometry> geom = new osg::Geometry();
+        geom->setName(name);
+        geom->setDataVariance((osg::Object::DataVariance)dataVariance);
+        geom->setUseDisplayList((flags & FLAG_USE_DISPLAY_LIST) != 0);
+        geom->setUseVertexBufferObjects((flags & FLAG_USE_VBO) != 0);
+
+        osg::ref_ptr<osg::StateSet> stateSet;
+        if (!readStateSet(in, stateSet))
+            return 0L;
+        geom->setStateSet(stateSet.get());
+
+        unsigned char numArrays;
+        if (!in.read(numArrays))
+            return 0L;
+
+        for (unsigned i = 0; i < numArrays; ++i)
+        {
+            unsigned char slot;
+            osg::ref_ptr<osg::Array> array = readArray(in, slot);
+            if (!array.valid())
+                return 0L;
+
+            if      (slot == SLOT_VERTEX)          geom->setVertexArray(array.get());
+            else if (slot == SLOT_NORMAL)          geom->setNormalArray(array.get());
+            else if (slot == SLOT_COLOR)           geom->setColorArray(array.get());
+            else if (slot == SLOT_SECONDARY_COLOR) geom->setSecondaryColorArray(array.get());
+            else if (slot == SLOT_FOG_COORD)       geom->setFogCoordArray(array.get());
+            else if (slot >= SLOT_VERTEX_ATTRIB)   geom->setVertexAttribArray(slot - SLOT_VERTEX_ATTRIB, array.get());
+            else if (slot >= SLOT_TEXCOORD)        geom->setTexCoordArray(slot - SLOT_TEXCOORD, array.get());
+            else                                   return 0L;
+        }
+
+        unsigned numPrimitiveSets;
+        if (!in.read(numPrimitiveSets))
+            return 0L;
+
+        for (unsigned i = 0; i < numPrimitiveSets; ++i)
+        {
+            osg::PrimitiveSet* p = readPrimitiveSet(in);
+            if (!p)
+                return 0L;
+            geom->addPrimitiveSet(p);
+        }
+
+        if ((flags & FLAG_TAGGED) && !_indexStack.empty())
+        {
+            _indexes[_indexStack.back()]._drawables.push_back(geom.get());
+        }
+
+        return geom.release();
+    }
+
+    osg::Node* readNode(Reader& in)
+    {
+        unsigned char type, flags, dataVariance;
+        std::string   name;
+        unsigned      nodeMask;
+        if (!in.read(type) || !in.read(flags) || !in.readString(name) || !in.read(nodeMask) || !in.read(dataVariance))
+            return 0L;
+
+        osg::ref_ptr<osg::StateSet> stateSet;
+        if (!readStateSet(in, stateSet))
+            return 0L;
+
+        osg::ref_ptr<osg::Group> node;
+        bool pushedIndex = false;
+
+        if (type == NODE_GROUP)
+        {
+            node = new osg::Group();
+        }
+
+        else if (type == NODE_GEODE)
+        {
+            osg::ref_ptr<osg::Geode> geode = new osg::Geode();
+            unsigned numDrawables;
+            if (!in.read(numDrawables))
+                return 0L;
+            for (unsigned i = 0; i < numDrawables; ++i)
+            {
+                osg::Geometry* geom = readGeometry(in);
+                if (!geom)
+                    return 0L;
+                geode->addDrawable(geom);
+            }
+            node = geode.get();
+        }
+
+        else if (type == NODE_MATRIX_TRANSFORM)
+        {
+            unsigned char referenceFrame;
+            double m[16];
+            if (!in.read(referenceFrame))
+                return 0L;
+            for (unsigned i = 0; i < 16; ++i)
+                if (!in.read(m[i]))
+                    return 0L;
+
+            osg::MatrixTransform* xform = new osg::MatrixTransform(osg::Matrixd(m));
+            xform->setReferenceFrame((osg::Transform::ReferenceFrame)referenceFrame);
+            node = xform;
+        }
+
+        else if (type == NODE_FEATURE_INDEX)
+        {
+            unsigned size;
+            if (!in.read(size))
+                return 0L;
+
+            FeatureSourceIndexNode::FIDMap fids;
+            for (unsigned i = 0; i < size; ++i)
+            {
+                unsigned long long fid;
+                unsigned oid;
+                if (!in.read(fid) || !in.read(oid))
+                    return 0L;
+                fids[(FeatureID)fid] = new RefIDPair((FeatureID)fid, oid);
+            }
+
+            FeatureSourceIndexNode* indexNode = new FeatureSourceIndexNode();
+            indexNode->setFIDMap(fids);
+            node = indexNode;
+
+            IndexEntry entry;
+            entry._node = indexNode;
+            _indexes.push_back(entry);
+            _indexStack.push_back(_indexes.size()-1);
+            pushedIndex = true;
+        }
+
+        else
+        {
+            return 0L;
+        }
+
+        node->setName(name);
+        node->setNodeMask(nodeMask);
+        node->setDataVariance((osg::Object::DataVariance)dataVariance);
+        node->setStateSet(stateSet.get());
+
+        if ((flags & FLAG_TAGGED) && !_indexStack.empty())
+        {
+            _indexes[_indexStack.back()]._nodes.push_back(node.get());
+        }
+
+        // a geode's drawables were its children
+        if (type != NODE_GEODE)
+        {
+            unsigned numChildren;
+            if (!in.read(numChildren))
+                return 0L;
+            for (unsigned i = 0; i < numChildren; ++i)
+            {
+                osg::Node* child = readNode(in);
+                if (!child)
+                    return 0L;
+                node->addChild(child);
+            }
+        }
+
+        if (pushedIndex)
+            _indexStack.pop_back();
+
+        return node.release();
+    }
+
+    osg::Node* decode(const std::string& record, FeatureSourceIndex* index)
+    {
+        if (!isBinary(record))
+            return 0L;
+
+        Reader in(record);
+        in._ptr += sizeof(MAGIC);
+
+        unsigned version, byteOrder, numStates;
+        if (!in.read(version) || version != VERSION ||
+            !in.read(byteOrder) || byteOrder != BYTE_ORDER_ID ||
+            !in.read(numStates))
+        {
+            return 0L;
+        }
+
+        if (!readStates(in, numStates))
+            return 0L;
+
+        unsigned bodySize;
+        if (!in.readBlock(bodySize))
+            return 0L;
+        in._ptr -= bodySize;
+
+        osg::ref_ptr<osg::Node> node = readNode(in);
+        if (!node.valid() || in._ptr != in._end)
+        {
+            OE_WARN << LC << "Cache record is damaged\n";
+            return 0L;
+        }
+
+        // re-register the object IDs using the table, without walking the graph.
+        if (index)
+        {
+            std::map<ObjectID, ObjectID> oldToNew;
+            for (unsigned i = 0; i < _indexes.size(); ++i)
+            {
+                IndexEntry& entry = _indexes[i];
+                entry._node->setIndex(index);
+                entry._node->reIndex(entry._drawables, entry._nodes, oldToNew);
+            }
+        }
+
+        return node.release();
+    }
+};
+
+//...................................................................
+
+BinaryNodeCache::BinaryNodeCache()
+{
+    //nop
+}
+
+bool
+BinaryNodeCache::isBinary(const std::string& record)
+{
+    return
+        record.size() >= sizeof(MAGIC) &&
+        record.compare(0, sizeof(MAGIC), MAGIC, sizeof(MAGIC)) == 0;
+}
+
+bool
+BinaryNodeCache::encode(osg::Node*            node,
+                        CacheBin*             bin,
+                        const osgDB::Options* writeOptions,
+                        std::string&          record)
+{
+    if (!node)
+        return false;
+
+    if (bin)
+    {
+        bin->prepareForWriting(node, writeOptions);
+    }
+
+    Encoder encoder(this, bin, writeOptions);
+    return encoder.encode(node, record);
+}
+
+osg::Node*
+BinaryNodeCache::decode(const std::string&    record,
+                        CacheBin*             bin,
+                        FeatureSourceIndex*   index,
+                        const osgDB::Options* readOptions)
+{
+    Decoder decoder(this, bin, readOptions);
+    return decoder.decode(record, index);
+}
+
+bool
+BinaryNodeCache::getSharedStateSet(const std::string&           key,
+                                   CacheBin*                    bin,
+                                   const osgDB::Options*        readOptions,
+                                   osg::ref_ptr<osg::StateSet>& output)
+{
+    // a state in use by another tile is simply shared; its textures come along.
+    {
+        Threading::ScopedMutexLock lock(_mutex);
+        StateSetMap::iterator i = _stateSets.find(key);
+        if (i != _stateSets.end() && i->second.lock(output))
+            return true;
+    }
+
+    if (!bin)
+        return false;
+
+    ReadResult r = bin->readString(key, readOptions);
+    if (!r.succeeded())
+        return false;
+
+    osg::ref_ptr<osg::StateSet> stateSet = deserializeStateSet(r.getString(), readOptions);
+    if (!stateSet.valid())
+        return false;
+
+    if (_stateSetCache.valid())
+    {
+        _stateSetCache->share(stateSet, output);
+    }
+    else
+    {
+        output = stateSet.get();
+    }
+
+    Threading::ScopedMutexLock lock(_mutex);
+
+    // another thread may have loaded it in the meantime
+    osg::ref_ptr<osg::StateSet> existing;
+    StateSetMap::iterator i = _stateSets.find(key);
+    if (i != _stateSets.end() && i->second.lock(existing))
+    {
+        output = existing.get();
+        return true;
+    }
+
+    if (_stateSets.size() >= MAX_STATE_SETS)
+    {
+        for (StateSetMap::iterator j = _stateSets.begin(); j != _stateSets.end(); )
+        {
+            osg::ref_ptr<osg::StateSet> live;
+            if (j->second.lock(live))
+                ++j;
+            else
+                _stateSets.erase(j++);
+        }
+    }
+
+    _stateSets[key] = output.get();
+    return true;
+}
+
+bool
+BinaryNodeCache::writeSharedStateSet(const std::string&    key,
+                                     const std::string&    data,
+                                     CacheBin*             bin,
+                                     const osgDB::Options* writeOptions)
+{
+    {
+        Threading::ScopedMutexLock lock(_mutex);
+        if (_written.find(key) != _written.end())
+            return true;
+    }
+
+    if (bin->getRecordStatus(key) != CacheBin::STATUS_OK)
+    {
+        osg::ref_ptr<StringObject> object = new StringObject(data);
+        if (!bin->write(key, object.get(), writeOptions))
+        {
+            OE_WARN << LC << "Failed to write state " << key << " to the cache\n";
+            return false;
+        }
+    }
+
+    Threading::ScopedMutexLock lock(_mutex);
+    _written.insert(key);
+    return true;
+}
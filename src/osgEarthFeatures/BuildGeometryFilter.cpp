@@ -110,19 +110,6 @@ BuildGeometryFilter::processPolygons(FeatureList& features, FilterContext& conte
 {
     osg::Geode* geode = new osg::Geode();
 
-    bool makeECEF = false;
-    const SpatialReference* featureSRS = 0L;
-    //const SpatialReference* mapSRS = 0L;
-    const SpatialReference* outputSRS = 0L;
-
-    // set up the reference system info:
-    if ( context.isGeoreferenced() )
-    {
-        featureSRS = context.extent()->getSRS();
-        outputSRS  = context.getOutputSRS();
-        makeECEF   = context.getOutputSRS()->isGeographic();
-    }
-
     for( FeatureList::iterator f = features.begin(); f != features.end(); ++f )
     {
         Feature* input = f->get();
@@ -147,114 +134,198 @@ BuildGeometryFilter::processPolygons(FeatureList& features, FilterContext& conte
         if (input->getGeometry() == 0L)
             continue;
 
+        double verticalOffset = input->getDouble("__oe_verticalOffset", 0.0);
+
         GeometryIterator parts( input->getGeometry(), false );
         while( parts.hasMore() )
         {
             Geometry* part = parts.next();
 
-            part->removeDuplicates();
+            std::string name;
+            if ( _featureNameExpr.isSet() )
+                name = input->eval( _featureNameExpr.mutable_value(), &context );
+
+            buildPolygonPart( part, poly, name, input->geoInterp(), verticalOffset, input, geode, context );
+        }
+    }
+
+    OE_TEST << LC << "Num drawables = " << geode->getNumDrawables() << "\n";
+    return geode;
+}
+
+osg::Geode*
+BuildGeometryFilter::processPolygons(FeatureBatch& features, const std::vector<unsigned>& rows, FilterContext& context)
+{
+    osg::Geode* geode = new osg::Geode();
+
+    int verticalOffsetCol = features.getAttributeIndex( "__oe_verticalOffset" );
 
-            // skip geometry that is invalid for a polygon
-            if ( part->size() < 3 ) {
-                OE_TEST << LC << "Discarding illegal part (less than 3 verts)\n";
+    for( unsigned i = 0; i < rows.size(); ++i )
+    {
+        unsigned row = rows[i];
+
+        // access the polygon symbol, and bail out if there isn't one
+        const optional<Style>& style = features.style(row);
+        const PolygonSymbol* poly =
+            style.isSet() && style->has<PolygonSymbol>() ? style->get<PolygonSymbol>() :
+            _style.get<PolygonSymbol>();
+
+        if ( !poly ) {
+            OE_TEST << LC << "Discarding feature with no poly symbol\n";
+            continue;
+        }
+
+        if ( !features.hasGeometry(row) )
+            continue;
+
+        // the feature index holds on to Feature objects, so make one only if there's an index.
+        osg::ref_ptr<Feature> feature = context.featureIndex() ? features.createFeature(row) : 0L;
+
+        double verticalOffset = verticalOffsetCol >= 0 ?
+            features.getDouble( row, verticalOffsetCol, 0.0 ) : 0.0;
+
+        std::string name;
+        if ( _featureNameExpr.isSet() )
+            name = features.eval( row, _featureNameExpr.mutable_value(), &context );
+
+        optional<GeoInterpolation> geoInterp = features.getGeoInterp(row);
+
+        unsigned firstPart = features.getFirstPart(row);
+        unsigned endPart   = firstPart + features.getNumParts(row);
+        for( unsigned p = firstPart; p < endPart; ++p )
+        {
+            // holes come along with their polygon.
+            if ( features.getPart(p).hole )
                 continue;
-            }
 
-            // resolve the color:
-            osg::Vec4f primaryColor = poly->fill()->color();
+            osg::ref_ptr<Geometry> part = features.createPartGeometry(p);
+            buildPolygonPart( part.get(), poly, name, geoInterp, verticalOffset, feature.get(), geode, context );
+        }
+    }
 
-            osg::ref_ptr<osg::Geometry> osgGeom = new osg::Geometry();
-            osgGeom->setUseVertexBufferObjects( true );
-            osgGeom->setUseDisplayList( false );
+    OE_TEST << LC << "Num drawables = " << geode->getNumDrawables() << "\n";
+    return geode;
+}
 
-            // are we embedding a feature name?
-            if ( _featureNameExpr.isSet() )
-            {
-                const std::string& name = input->eval( _featureNameExpr.mutable_value(), &context );
-                osgGeom->setName( name );
-            }
+void
+BuildGeometryFilter::buildPolygonPart(Geometry*                         part,
+                                      const PolygonSymbol*              poly,
+                                      const std::string&                name,
+                                      const optional<GeoInterpolation>& geoInterp,
+                                      double                            verticalOffset,
+                                      Feature*                          feature,
+                                      osg::Geode*                       geode,
+                                      FilterContext&                    context)
+{
+    bool makeECEF = false;
+    const SpatialReference* featureSRS = 0L;
+    const SpatialReference* outputSRS = 0L;
 
+    // set up the reference system info:
+    if ( context.isGeoreferenced() )
+    {
+        featureSRS = context.extent()->getSRS();
+        outputSRS  = context.getOutputSRS();
+        makeECEF   = context.getOutputSRS()->isGeographic();
+    }
 
-            // compute localizing matrices or use globals
-            osg::Matrixd w2l, l2w;
-            if (makeECEF)
-            {
-                osgEarth::GeoExtent partExtent(featureSRS, part->getBounds());
-                computeLocalizers(context, partExtent, w2l, l2w);
-            }
-            else
-            {
-                w2l = _world2local;
-                l2w = _local2world;
-            }
+    part->removeDuplicates();
 
-            // collect all the pre-transformation HAT (Z) values.
-            osg::ref_ptr<osg::FloatArray> hats = new osg::FloatArray();
-            hats->reserve( part->size() );
-            for(Geometry::const_iterator i = part->begin(); i != part->end(); ++i )
-                hats->push_back( i->z() );
+    // skip geometry that is invalid for a polygon
+    if ( part->size() < 3 ) {
+        OE_TEST << LC << "Discarding illegal part (less than 3 verts)\n";
+        return;
+    }
 
-            // build the geometry:
-            tileAndBuildPolygon(part, featureSRS, outputSRS, makeECEF, true, osgGeom.get(), w2l);
-            //buildPolygon(part, featureSRS, mapSRS, makeECEF, true, osgGeom, w2l);
+    // resolve the color:
+    osg::Vec4f primaryColor = poly->fill()->color();
 
-            osg::Vec3Array* allPoints = static_cast<osg::Vec3Array*>(osgGeom->getVertexArray());
-            if (allPoints && allPoints->size() > 0)
-            {
-                // subdivide the mesh if necessary to conform to an ECEF globe:
-                if ( makeECEF )
-                {
-                    //convert back to world coords
-                    for( osg::Vec3Array::iterator i = allPoints->begin(); i != allPoints->end(); ++i )
-                    {
-                        osg::Vec3d v(*i);
-                        v = v * l2w;
-                        v = v * _world2local;
+    osg::ref_ptr<osg::Geometry> osgGeom = new osg::Geometry();
+    osgGeom->setUseVertexBufferObjects( true );
+    osgGeom->setUseDisplayList( false );
 
-                        (*i)._v[0] = v[0];
-                        (*i)._v[1] = v[1];
-                        (*i)._v[2] = v[2];
-                    }
+    // are we embedding a feature name?
+    if ( _featureNameExpr.isSet() )
+    {
+        osgGeom->setName( name );
+    }
 
-                    double threshold = osg::DegreesToRadians( *_maxAngle_deg );
-                    //OE_TEST << "Running mesh subdivider with threshold " << *_maxAngle_deg << std::endl;
 
-                    MeshSubdivider ms( _world2local, _local2world );
-                    if ( input->geoInterp().isSet() )
-                        ms.run( *osgGeom, threshold, *input->geoInterp() );
-                    else
-                        ms.run( *osgGeom, threshold, *_geoInterp );
-                }
+    // compute localizing matrices or use globals
+    osg::Matrixd w2l, l2w;
+    if (makeECEF)
+    {
+        osgEarth::GeoExtent partExtent(featureSRS, part->getBounds());
+        computeLocalizers(context, partExtent, w2l, l2w);
+    }
+    else
+    {
+        w2l = _world2local;
+        l2w = _local2world;
+    }
 
-                // assign the primary color array. PER_VERTEX required in order to support
-                // vertex optimization later
-                unsigned count = osgGeom->getVertexArray()->getNumElements();
-                osg::Vec4Array* colors = new osg::Vec4Array(osg::Array::BIND_PER_VERTEX);
-                colors->assign( count, primaryColor );
-                osgGeom->setColorArray( colors );
+    // collect all the pre-transformation HAT (Z) values.
+    osg::ref_ptr<osg::FloatArray> hats = new osg::FloatArray();
+    hats->reserve( part->size() );
+    for(Geometry::const_iterator i = part->begin(); i != part->end(); ++i )
+        hats->push_back( i->z() );
 
-                geode->addDrawable( osgGeom );
+    // build the geometry:
+    tileAndBuildPolygon(part, featureSRS, outputSRS, makeECEF, true, osgGeom.get(), w2l);
+    //buildPolygon(part, featureSRS, mapSRS, makeECEF, true, osgGeom, w2l);
 
-                // record the geometry's primitive set(s) in the index:
-                if ( context.featureIndex() )
-                    context.featureIndex()->tagDrawable( osgGeom.get(), input );
+    osg::Vec3Array* allPoints = static_cast<osg::Vec3Array*>(osgGeom->getVertexArray());
+    if (allPoints && allPoints->size() > 0)
+    {
+        // subdivide the mesh if necessary to conform to an ECEF globe:
+        if ( makeECEF )
+        {
+            //convert back to world coords
+            for( osg::Vec3Array::iterator i = allPoints->begin(); i != allPoints->end(); ++i )
+            {
+                osg::Vec3d v(*i);
+                v = v * l2w;
+                v = v * _world2local;
 
-                // install clamping attributes if necessary
-                if (_style.has<AltitudeSymbol>() &&
-                    _style.get<AltitudeSymbol>()->technique() == AltitudeSymbol::TECHNIQUE_GPU)
-                {
-                    Clamping::applyDefaultClampingAttrs( osgGeom.get(), input->getDouble("__oe_verticalOffset", 0.0) );
-                }
+                (*i)._v[0] = v[0];
+                (*i)._v[1] = v[1];
+                (*i)._v[2] = v[2];
             }
+
+            double threshold = osg::DegreesToRadians( *_maxAngle_deg );
+            //OE_TEST << "Running mesh subdivider with threshold " << *_maxAngle_deg << std::endl;
+
+            MeshSubdivider ms( _world2local, _local2world );
+            if ( geoInterp.isSet() )
+                ms.run( *osgGeom, threshold, *geoInterp );
             else
-            {
-                OE_TEST << LC << "Oh no. buildAndTilePolygon returned nothing.\n";
-            }
+                ms.run( *osgGeom, threshold, *_geoInterp );
         }
-    }
 
-    OE_TEST << LC << "Num drawables = " << geode->getNumDrawables() << "\n";
-    return geode;
+        // assign the primary color array. PER_VERTEX required in order to support
+        // vertex optimization later
+        unsigned count = osgGeom->getVertexArray()->getNumElements();
+        osg::Vec4Array* colors = new osg::Vec4Array(osg::Array::BIND_PER_VERTEX);
+        colors->assign( count, primaryColor );
+        osgGeom->setColorArray( colors );
+
+        geode->addDrawable( osgGeom );
+
+        // record the geometry's primitive set(s) in the index:
+        if ( context.featureIndex() )
+            context.featureIndex()->tagDrawable( osgGeom.get(), feature );
+
+        // install clamping attributes if necessary
+        if (_style.has<AltitudeSymbol>() &&
+            _style.get<AltitudeSymbol>()->technique() == AltitudeSymbol::TECHNIQUE_GPU)
+        {
+            Clamping::applyDefaultClampingAttrs( osgGeom.get(), verticalOffset );
+        }
+    }
+    else
+    {
+        OE_TEST << LC << "Oh no. buildAndTilePolygon returned nothing.\n";
+    }
 }
 
 namespace
@@ -1280,8 +1351,6 @@ namespace
 osg::Node*
 BuildGeometryFilter::push( FeatureList& input, FilterContext& context )
 {
-    osg::ref_ptr<osg::Group> result = new osg::Group();
-
     computeLocalizers( context );
 
     const LineSymbol*    line  = _style.get<LineSymbol>();
@@ -1395,10 +1464,148 @@ BuildGeometryFilter::push( FeatureList& input, FilterContext& context )
 
     // process them separately.
 
+    osg::ref_ptr<osg::Geode> polygonGeode;
     if ( polygons.size() > 0 )
     {
         OE_TEST << LC << "Building " << polygons.size() << " polygons." << std::endl;
-        osg::ref_ptr<osg::Geode> geode = processPolygons(polygons, context);
+        polygonGeode = processPolygons(polygons, context);
+    }
+
+    return assemble( polygonGeode.get(), polygonizedLines, lines, points, context );
+}
+
+osg::Node*
+BuildGeometryFilter::push( FeatureBatch& input, FilterContext& context )
+{
+    // Features crossing the antimeridian are split when building for a projected
+    // map; leave that to the FeatureList path.
+    if (context.getOutputSRS() && !context.getOutputSRS()->isGeographic())
+    {
+        return FeaturesToNodeFilter::push( input, context );
+    }
+
+    computeLocalizers( context );
+
+    const LineSymbol*    line  = _style.get<LineSymbol>();
+    const PolygonSymbol* poly  = _style.get<PolygonSymbol>();
+    const PointSymbol*   point = _style.get<PointSymbol>();
+
+    // Polygons, the bulk of most feature data, are built straight from the batch;
+    // the other kinds are built from Features made from their rows.
+    std::vector<unsigned> polygons;
+    FeatureList lines;
+    FeatureList polygonizedLines;
+    FeatureList points;
+
+    for(unsigned row = 0; row < input.size(); ++row)
+    {
+        const optional<Style>& style = input.style(row);
+
+        // first consider the overall style:
+        bool has_polysymbol     = poly != 0L;
+        bool has_linesymbol     = line != 0L && line->stroke()->widthUnits() == Units::PIXELS;
+        bool has_polylinesymbol = line != 0L && line->stroke()->widthUnits() != Units::PIXELS;
+        bool has_pointsymbol    = point != 0L;
+
+        // if the featue has a style set, that overrides:
+        if ( style.isSet() )
+        {
+            has_polysymbol     = has_polysymbol     || (style->has<PolygonSymbol>());
+            has_linesymbol     = has_linesymbol     || (style->has<LineSymbol>() && style->get<LineSymbol>()->stroke()->widthUnits() == Units::PIXELS);
+            has_polylinesymbol = has_polylinesymbol || (style->has<LineSymbol>() && style->get<LineSymbol>()->stroke()->widthUnits() != Units::PIXELS);
+            has_pointsymbol    = has_pointsymbol    || (style->has<PointSymbol>());
+        }
+
+        // if there's a polygon with outlining disabled, nix the line symbol.
+        if (has_polysymbol)
+        {
+            if (poly && poly->outline() == false)
+                has_linesymbol = false;
+            else if (style.isSet() && style->has<PolygonSymbol>() && style->get<PolygonSymbol>()->outline() == false)
+                has_linesymbol = false;
+        }
+
+        // if no style is set, use the geometry type:
+        if ( !has_polysymbol && !has_linesymbol && !has_polylinesymbol && !has_pointsymbol && input.hasGeometry(row) )
+        {
+            Geometry::Type type = input.getNumParts(row) > 0 ?
+                input.getPart(input.getFirstPart(row)).type :
+                Geometry::TYPE_UNKNOWN;
+
+            Style rowStyle = style.get();
+            switch( type )
+            {
+            default:
+            case Geometry::TYPE_LINESTRING:
+            case Geometry::TYPE_RING:
+                rowStyle.add( new LineSymbol() );
+                has_linesymbol = true;
+                break;
+
+            case Geometry::TYPE_POINTSET:
+                rowStyle.add( new PointSymbol() );
+                has_pointsymbol = true;
+                break;
+
+            case Geometry::TYPE_POLYGON:
+                rowStyle.add( new PolygonSymbol() );
+                has_polysymbol = true;
+                break;
+            }
+            input.setStyle( row, rowStyle );
+        }
+
+        if ( has_polysymbol )
+        {
+            // polygon scripts run against Feature objects.
+            const PolygonSymbol* rowPoly =
+                style.isSet() && style->has<PolygonSymbol>() ? style->get<PolygonSymbol>() : poly;
+
+            if ( rowPoly && rowPoly->script().isSet() )
+            {
+                return FeaturesToNodeFilter::push( input, context );
+            }
+
+            polygons.push_back( row );
+        }
+
+        if ( has_linesymbol || has_polylinesymbol || has_pointsymbol )
+        {
+            osg::ref_ptr<Feature> f = input.createFeature(row);
+
+            if ( has_linesymbol )
+                lines.push_back( f );
+
+            if ( has_polylinesymbol )
+                polygonizedLines.push_back( f );
+
+            if ( has_pointsymbol )
+                points.push_back( f );
+        }
+    }
+
+    osg::ref_ptr<osg::Geode> polygonGeode;
+    if ( polygons.size() > 0 )
+    {
+        OE_TEST << LC << "Building " << polygons.size() << " polygons." << std::endl;
+        polygonGeode = processPolygons(input, polygons, context);
+    }
+
+    return assemble( polygonGeode.get(), polygonizedLines, lines, points, context );
+}
+
+osg::Node*
+BuildGeometryFilter::assemble(osg::Geode*    polygons,
+                              FeatureList&   polygonizedLines,
+                              FeatureList&   lines,
+                              FeatureList&   points,
+                              FilterContext& context)
+{
+    osg::ref_ptr<osg::Group> result = new osg::Group();
+
+    if ( polygons )
+    {
+        osg::ref_ptr<osg::Geode> geode = polygons;
         if ( geode->getNumDrawables() > 0 )
         {
             osgUtil::Optimizer::MergeGeometryVisitor mg;
@@ -1428,7 +1635,7 @@ BuildGeometryFilter::push( FeatureList& input, FilterContext& context )
     if ( polygonizedLines.size() > 0 )
     {
         OE_TEST << LC << "Building " << polygonizedLines.size() << " polygonized lines." << std::endl;
-        bool twosided = polygons.size() > 0 ? false : true;
+        bool twosided = polygons ? false : true;
         osg::ref_ptr< osg::Group > lines = processPolygonizedLines(polygonizedLines, twosided, context);
 
         if (lines->getNumChildren() > 0)
@@ -1023,26 +1023,6 @@ ExtrudeGeometryFilter::process( FeatureList& features, FilterContext& context )
         {
             Geometry* part = iter.next();
 
-            osg::ref_ptr<osg::Geometry> walls = new osg::Geometry();
-            
-            osg::ref_ptr<osg::Geometry> rooflines = 0L;
-            osg::ref_ptr<osg::Geometry> baselines = 0L;
-            osg::ref_ptr<osg::Drawable> outlines  = 0L;
-            
-            if ( part->getType() == Geometry::TYPE_POLYGON )
-            {
-                rooflines = new osg::Geometry();
-
-                // prep the shapes by making sure all polys are open:
-                static_cast<Polygon*>(part)->open();
-            }
-
-            // make a base cap if we're doing stencil volumes.
-            if ( _makeStencilVolume )
-            {
-                baselines = new osg::Geometry();
-            }
-
             // calculate the extrusion height:
             float height;
 
@@ -1059,151 +1039,273 @@ ExtrudeGeometryFilter::process( FeatureList& features, FilterContext& context )
                 height = *_extrusionSymbol->height();
             }
 
-            osg::ref_ptr<osg::StateSet> wallStateSet;
-            osg::ref_ptr<osg::StateSet> roofStateSet;
-
-            // calculate the wall texturing:
-            SkinResource* wallSkin = 0L;
-            if ( _wallSkinSymbol.valid() )
-            {
-                if ( _wallResLib.valid() )
-                {
-                    SkinSymbol querySymbol( *_wallSkinSymbol.get() );
-                    querySymbol.objectHeight() = fabs(height);
-                    wallSkin = _wallResLib->getSkin( &querySymbol, wallSkinPRNG, context.getDBOptions() );
-                }
+            float verticalOffset = (float)input->getDouble("__oe_verticalOffset", 0.0);
 
-                else
-                {
-                    //TODO: simple single texture?
-                }
-            }
+            // Set up for feature naming and feature indexing:
+            std::string name;
+            if ( !_featureNameExpr.empty() )
+                name = input->eval( _featureNameExpr, &context );
 
-            // calculate the rooftop texture:
-            SkinResource* roofSkin = 0L;
-            if ( _roofSkinSymbol.valid() )
-            {
-                if ( _roofResLib.valid() )
-                {
-                    SkinSymbol querySymbol( *_roofSkinSymbol.get() );
-                    roofSkin = _roofResLib->getSkin( &querySymbol, roofSkinPRNG, context.getDBOptions() );
-                }
+            processPart( part, height, verticalOffset, name, input, wallSkinPRNG, roofSkinPRNG, context );
+        }
+    }
 
-                else
-                {
-                    //TODO: simple single texture?
-                }
-            }
+    return true;
+}
 
-            float verticalOffset = (float)input->getDouble("__oe_verticalOffset", 0.0);
+bool
+ExtrudeGeometryFilter::process( FeatureBatch& features, FilterContext& context )
+{
+    // seed our random number generators
+    Random wallSkinPRNG( _wallSkinSymbol.valid()? *_wallSkinSymbol->randomSeed() : 0, Random::METHOD_FAST );
+    Random roofSkinPRNG( _roofSkinSymbol.valid()? *_roofSkinSymbol->randomSeed() : 0, Random::METHOD_FAST );
 
-            // Build the data model for the structure.
-            Structure structure;
-
-            buildStructure(
-                part, 
-                height,
-                _extrusionSymbol->flatten().get(),
-                verticalOffset,
-                wallSkin,
-                roofSkin,
-                structure,
-                context);
-
-            // Create the walls.
-            if ( walls.valid() )
-            {
-                osg::Vec4f wallColor(1,1,1,1), wallBaseColor(1,1,1,1);
+    int verticalOffsetCol = features.getAttributeIndex( "__oe_verticalOffset" );
 
-                if ( _wallPolygonSymbol.valid() )
-                {
-                    wallColor = _wallPolygonSymbol->fill()->color();
-                }
+    FeatureIndexBuilder* index = context.featureIndex();
 
-                if ( _extrusionSymbol->wallGradientPercentage().isSet() )
-                {
-                    wallBaseColor = Color(wallColor).brightness( 1.0 - *_extrusionSymbol->wallGradientPercentage() );
-                }
-                else
-                {
-                    wallBaseColor = wallColor;
-                }
+    for( unsigned row = 0; row < features.size(); ++row )
+    {
+        if ( !features.hasGeometry(row) )
+            continue;
 
-                buildWallGeometry(structure, walls.get(), wallColor, wallBaseColor, wallSkin);
+        // the feature index holds on to Feature objects, so make one only if there's an index.
+        osg::ref_ptr<Feature> feature = index ? features.createFeature(row) : 0L;
 
-                if ( wallSkin )
-                {
-                    // Get a stateset for the individual wall stateset
-                    context.resourceCache()->getOrCreateStateSet(wallSkin, wallStateSet, context.getDBOptions());
-                }
-            }
+        float verticalOffset = verticalOffsetCol >= 0 ?
+            (float)features.getDouble( row, verticalOffsetCol, 0.0 ) : 0.0f;
 
-            // tessellate and add the roofs if necessary:
-            if ( rooflines.valid() )
-            {
-                osg::Vec4f roofColor(1,1,1,1);
-                if ( _roofPolygonSymbol.valid() )
-                {
-                    roofColor = _roofPolygonSymbol->fill()->color();
-                }
+        unsigned firstPart = features.getFirstPart(row);
+        unsigned endPart   = firstPart + features.getNumParts(row);
+        for( unsigned p = firstPart; p < endPart; ++p )
+        {
+            // holes come along with their polygon.
+            if ( features.getPart(p).hole )
+                continue;
 
-                buildRoofGeometry(structure, rooflines.get(), roofColor, roofSkin);
+            osg::ref_ptr<Geometry> part = features.createPartGeometry(p);
 
-                if ( roofSkin )
-                {
-                    // Get a stateset for the individual roof skin
-                    context.resourceCache()->getOrCreateStateSet(roofSkin, roofStateSet, context.getDBOptions());
-                }
-            }
+            // calculate the extrusion height:
+            float height;
 
-            if (_outlineSymbol.valid())
+            if ( _heightExpr.isSet() )
             {
-                outlines = buildOutlineGeometry(structure);
+                height = features.eval( row, _heightExpr.mutable_value(), &context );
             }
-
-            if ( baselines.valid() )
+            else
             {
-                //TODO.
-                osgUtil::Tessellator tess;
-                tess.setTessellationType( osgUtil::Tessellator::TESS_TYPE_GEOMETRY );
-                tess.setWindingType( osgUtil::Tessellator::TESS_WINDING_ODD );
-                tess.retessellatePolygons( *(baselines.get()) );
+                height = *_extrusionSymbol->height();
             }
 
             // Set up for feature naming and feature indexing:
             std::string name;
             if ( !_featureNameExpr.empty() )
-                name = input->eval( _featureNameExpr, &context );
+                name = features.eval( row, _featureNameExpr, &context );
 
-            FeatureIndexBuilder* index = context.featureIndex();
+            processPart( part.get(), height, verticalOffset, name, feature.get(), wallSkinPRNG, roofSkinPRNG, context );
+        }
+    }
 
-            if ( walls.valid() && walls->getVertexArray() && walls->getVertexArray()->getNumElements() > 0 )
-            {
-                addDrawable( walls.get(), wallStateSet.get(), name, input, index );
-            }
+    return true;
+}
 
-            if ( rooflines.valid() && rooflines->getVertexArray() && rooflines->getVertexArray()->getNumElements() > 0 )
-            {
-                addDrawable( rooflines.get(), roofStateSet.get(), name, input, index );
-            }
+void
+ExtrudeGeometryFilter::processPart(Geometry*          part,
+                                   float              height,
+                                   float              verticalOffset,
+                                   const std::string& name,
+                                   Feature*           feature,
+                                   Random&            wallSkinPRNG,
+                                   Random&            roofSkinPRNG,
+                                   FilterContext&     context)
+{
+    osg::ref_ptr<osg::Geometry> walls = new osg::Geometry();
+    
+    osg::ref_ptr<osg::Geometry> rooflines = 0L;
+    osg::ref_ptr<osg::Geometry> baselines = 0L;
+    osg::ref_ptr<osg::Drawable> outlines  = 0L;
+    
+    if ( part->getType() == Geometry::TYPE_POLYGON )
+    {
+        rooflines = new osg::Geometry();
 
-            if ( baselines.valid() && baselines->getVertexArray() && baselines->getVertexArray()->getNumElements() > 0 )
-            {
-                addDrawable( baselines.get(), 0L, name, input, index );
-            }
+        // prep the shapes by making sure all polys are open:
+        static_cast<Polygon*>(part)->open();
+    }
 
-            if ( outlines.valid() )
-            {
-                addDrawable( outlines.get(), 0L, name, input, index );
-            }
+    // make a base cap if we're doing stencil volumes.
+    if ( _makeStencilVolume )
+    {
+        baselines = new osg::Geometry();
+    }
+
+    osg::ref_ptr<osg::StateSet> wallStateSet;
+    osg::ref_ptr<osg::StateSet> roofStateSet;
+
+    // calculate the wall texturing:
+    SkinResource* wallSkin = 0L;
+    if ( _wallSkinSymbol.valid() )
+    {
+        if ( _wallResLib.valid() )
+        {
+            SkinSymbol querySymbol( *_wallSkinSymbol.get() );
+            querySymbol.objectHeight() = fabs(height);
+            wallSkin = _wallResLib->getSkin( &querySymbol, wallSkinPRNG, context.getDBOptions() );
+        }
+
+        else
+        {
+            //TODO: simple single texture?
         }
     }
 
-    return true;
+    // calculate the rooftop texture:
+    SkinResource* roofSkin = 0L;
+    if ( _roofSkinSymbol.valid() )
+    {
+        if ( _roofResLib.valid() )
+        {
+            SkinSymbol querySymbol( *_roofSkinSymbol.get() );
+            roofSkin = _roofResLib->getSkin( &querySymbol, roofSkinPRNG, context.getDBOptions() );
+        }
+
+        else
+        {
+            //TODO: simple single texture?
+        }
+    }
+
+    // Build the data model for the structure.
+    Structure structure;
+
+    buildStructure(
+        part, 
+        height,
+        _extrusionSymbol->flatten().get(),
+        verticalOffset,
+        wallSkin,
+        roofSkin,
+        structure,
+        context);
+
+    // Create the walls.
+    if ( walls.valid() )
+    {
+        osg::Vec4f wallColor(1,1,1,1), wallBaseColor(1,1,1,1);
+
+        if ( _wallPolygonSymbol.valid() )
+        {
+            wallColor = _wallPolygonSymbol->fill()->color();
+        }
+
+        if ( _extrusionSymbol->wallGradientPercentage().isSet() )
+        {
+            wallBaseColor = Color(wallColor).brightness( 1.0 - *_extrusionSymbol->wallGradientPercentage() );
+        }
+        else
+        {
+            wallBaseColor = wallColor;
+        }
+
+        buildWallGeometry(structure, walls.get(), wallColor, wallBaseColor, wallSkin);
+
+        if ( wallSkin )
+        {
+            // Get a stateset for the individual wall stateset
+            context.resourceCache()->getOrCreateStateSet(wallSkin, wallStateSet, context.getDBOptions());
+        }
+    }
+
+    // tessellate and add the roofs if necessary:
+    if ( rooflines.valid() )
+    {
+        osg::Vec4f roofColor(1,1,1,1);
+        if ( _roofPolygonSymbol.valid() )
+        {
+            roofColor = _roofPolygonSymbol->fill()->color();
+        }
+
+        buildRoofGeometry(structure, rooflines.get(), roofColor, roofSkin);
+
+        if ( roofSkin )
+        {
+            // Get a stateset for the individual roof skin
+            context.resourceCache()->getOrCreateStateSet(roofSkin, roofStateSet, context.getDBOptions());
+        }
+    }
+
+    if (_outlineSymbol.valid())
+    {
+        outlines = buildOutlineGeometry(structure);
+    }
+
+    if ( baselines.valid() )
+    {
+        //TODO.
+        osgUtil::Tessellator tess;
+        tess.setTessellationType( osgUtil::Tessellator::TESS_TYPE_GEOMETRY );
+        tess.setWindingType( osgUtil::Tessellator::TESS_WINDING_ODD );
+        tess.retessellatePolygons( *(baselines.get()) );
+    }
+
+    // Set up for feature indexing:
+    FeatureIndexBuilder* index = context.featureIndex();
+
+    if ( walls.valid() && walls->getVertexArray() && walls->getVertexArray()->getNumElements() > 0 )
+    {
+        addDrawable( walls.get(), wallStateSet.get(), name, feature, index );
+    }
+
+    if ( rooflines.valid() && rooflines->getVertexArray() && rooflines->getVertexArray()->getNumElements() > 0 )
+    {
+        addDrawable( rooflines.get(), roofStateSet.get(), name, feature, index );
+    }
+
+    if ( baselines.valid() && baselines->getVertexArray() && baselines->getVertexArray()->getNumElements() > 0 )
+    {
+        addDrawable( baselines.get(), 0L, name, feature, index );
+    }
+
+    if ( outlines.valid() )
+    {
+        addDrawable( outlines.get(), 0L, name, feature, index );
+    }
 }
 
 osg::Node*
 ExtrudeGeometryFilter::push( FeatureList& input, FilterContext& context )
+{
+    if ( !setup( context ) )
+        return new osg::Group();
+
+    // push all the features through the extruder.
+    process( input, context );
+
+    return assemble();
+}
+
+osg::Node*
+ExtrudeGeometryFilter::push( FeatureBatch& input, FilterContext& context )
+{
+    if ( !setup( context ) )
+        return new osg::Group();
+
+    // scripts and height callbacks run against Feature objects.
+    bool needFeatures =
+        _heightCallback.valid() ||
+        (_polySymbol.valid() && _polySymbol->script().isSet()) ||
+        _extrusionSymbol->script().isSet();
+
+    if ( needFeatures )
+        return FeaturesToNodeFilter::push( input, context );
+
+    process( input, context );
+
+    return assemble();
+}
+
+bool
+ExtrudeGeometryFilter::setup( FilterContext& context )
 {
     reset( context );
 
@@ -1211,7 +1313,7 @@ ExtrudeGeometryFilter::push( FeatureList& input, FilterContext& context )
     if ( !_extrusionSymbol.valid() )
     {
         OE_WARN << LC << "Missing required extrusion symbolology; geometry will be empty" << std::endl;
-        return new osg::Group();
+        return false;
     }
 
     // establish the active resource library, if applicable.
@@ -1249,9 +1351,12 @@ ExtrudeGeometryFilter::push( FeatureList& input, FilterContext& context )
     // calculate the localization matrices (_local2world and _world2local)
     computeLocalizers( context );
 
-    // push all the features through the extruder.
-    bool ok = process( input, context );
+    return true;
+}
 
+osg::Node*
+ExtrudeGeometryFilter::assemble()
+{
     // parent geometry with a delocalizer (if necessary)
     osg::Group* group = createDelocalizeGroup();
     
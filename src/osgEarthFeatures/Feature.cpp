@@ -489,6 +489,76 @@ Feature::eval(StringExpression& expr, Session* session) const
     return expr.eval();
 }
 
+void
+Feature::eval(StringExpression& expr, const FeatureList& features, std::vector<std::string>& results, FilterContext const* context)
+{
+    ScriptEngine* engine = context && context->getSession() ? context->getSession()->getScriptEngine() : 0L;
+
+    const StringExpression::Variables& vars = expr.variables();
+    unsigned numFeatures = features.size();
+
+    // resolve every variable for the whole list first; one row per variable.
+    std::vector< std::vector<std::string> > values( vars.size() );
+
+    unsigned v = 0;
+    for( StringExpression::Variables::const_iterator i = vars.begin(); i != vars.end(); ++i, ++v )
+    {
+        std::vector<std::string>& column = values[v];
+        column.resize( numFeatures );
+
+        // features without this attribute get the script result instead:
+        FeatureList           scripted;
+        std::vector<unsigned> scriptedIndex;
+
+        unsigned f = 0;
+        for( FeatureList::const_iterator fi = features.begin(); fi != features.end(); ++fi, ++f )
+        {
+            const AttributeTable& attrs = fi->get()->getAttrs();
+            AttributeTable::const_iterator ai = attrs.find(toLower(i->first));
+            if (ai != attrs.end())
+            {
+                column[f] = ai->second.getString();
+            }
+            else if (engine)
+            {
+                scripted.push_back( fi->get() );
+                scriptedIndex.push_back( f );
+            }
+        }
+
+        if ( !scripted.empty() )
+        {
+            std::vector<ScriptResult> scriptResults;
+            engine->run(i->first, scripted, scriptResults, context);
+
+            for( unsigned r = 0; r < scriptResults.size() && r < scriptedIndex.size(); ++r )
+            {
+                if (scriptResults[r].success())
+                {
+                    column[scriptedIndex[r]] = scriptResults[r].asString();
+                }
+                else
+                {
+                    // Couldn't execute it as code, just take it as a string literal.
+                    column[scriptedIndex[r]] = i->first;
+                    OE_DEBUG << LC << "Feature Script error on '" << expr.expr() << "': " << scriptResults[r].message() << std::endl;
+                }
+            }
+        }
+    }
+
+    results.reserve( results.size() + numFeatures );
+    for( unsigned f = 0; f < numFeatures; ++f )
+    {
+        v = 0;
+        for( StringExpression::Variables::const_iterator i = vars.begin(); i != vars.end(); ++i, ++v )
+        {
+            expr.set( *i, values[v][f] );
+        }
+        results.push_back( expr.eval() );
+    }
+}
+
 
 bool
 Feature::getWorldBound(const SpatialReference* srs,
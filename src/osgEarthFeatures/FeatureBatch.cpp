@@ -0,0 +1,552 @@
+/* -*-c++-*- */
+/* osgEarth - Geospatial SDK for OpenSceneGraph
+ * Copyright 2019 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarthFeatures/FeatureBatch>
+#include <osgEarthFeatures/FilterContext>
+#include <osgEarthFeatures/Session>
+#include <osgEarth/StringUtils>
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
+
+#define LC "[FeatureBatch] "
+
+namespace
+{
+    Geometry* createEmptyGeometry(Geometry::Type type, unsigned capacity)
+    {
+        switch( type )
+        {
+        case Geometry::TYPE_POINTSET:   return new PointSet( capacity );
+        case Geometry::TYPE_LINESTRING: return new LineString( capacity );
+        case Geometry::TYPE_RING:       return new Ring( capacity );
+        case Geometry::TYPE_POLYGON:    return new Polygon( capacity );
+        default:                        return new Geometry( capacity );
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+
+FeatureBatch::FeatureBatch(const SpatialReference* srs) :
+_srs( srs )
+{
+    _rowParts.push_back( 0u );
+    _rowPoints.push_back( 0u );
+}
+
+FeatureBatch::FeatureBatch(const FeatureList& features)
+{
+    _rowParts.push_back( 0u );
+    _rowPoints.push_back( 0u );
+    add( features );
+}
+
+void
+FeatureBatch::clear()
+{
+    _columns.clear();
+    _columnIndex.clear();
+    _stringPool.clear();
+    _stringIndex.clear();
+    _fids.clear();
+    _rowFlags.clear();
+    _geoInterp.clear();
+    _styles.clear();
+    _rowParts.assign( 1, 0u );
+    _rowPoints.assign( 1, 0u );
+    _parts.clear();
+    _points.clear();
+}
+
+void
+FeatureBatch::reserve(unsigned rows, unsigned points)
+{
+    _fids.reserve( rows );
+    _rowFlags.reserve( rows );
+    _geoInterp.reserve( rows );
+    _rowParts.reserve( rows+1 );
+    _rowPoints.reserve( rows+1 );
+    _parts.reserve( rows );
+    _points.reserve( points );
+    for(unsigned c=0; c<_columns.size(); ++c)
+        _columns[c].cells.reserve( rows );
+}
+
+void
+FeatureBatch::add(const FeatureList& features)
+{
+    unsigned numPoints = _points.size();
+    for(FeatureList::const_iterator i = features.begin(); i != features.end(); ++i)
+    {
+        const Geometry* geom = i->get()->getGeometry();
+        if ( geom )
+            numPoints += geom->getTotalPointCount();
+    }
+    reserve( size() + features.size(), numPoints );
+
+    for(FeatureList::const_iterator i = features.begin(); i != features.end(); ++i)
+    {
+        add( i->get() );
+    }
+}
+
+unsigned
+FeatureBatch::add(const Feature* feature)
+{
+    unsigned row = size();
+
+    if ( !_srs.valid() )
+        _srs = feature->getSRS();
+
+    _fids.push_back( feature->getFID() );
+
+    unsigned char flags = 0;
+    if ( feature->getGeometry() )
+        flags |= ROW_HAS_GEOMETRY;
+    if ( feature->getGeometry() && feature->getGeometry()->getType() == Geometry::TYPE_MULTI )
+        flags |= ROW_MULTI;
+    if ( feature->geoInterp().isSet() )
+        flags |= ROW_GEOINTERP;
+    _rowFlags.push_back( flags );
+    _geoInterp.push_back( (unsigned char)feature->geoInterp().get() );
+
+    if ( feature->style().isSet() )
+        _styles[row] = feature->style();
+
+    // geometry:
+    if ( feature->getGeometry() )
+        addGeometry( feature->getGeometry() );
+    _rowParts.push_back( _parts.size() );
+    _rowPoints.push_back( _points.size() );
+
+    // every column gets a cell for the new row.
+    for(unsigned c=0; c<_columns.size(); ++c)
+        _columns[c].cells.push_back( 0 );
+
+    // attributes. Features from the same source nearly always have the same
+    // schema, so try the next column in order before searching the index.
+    const AttributeTable& attrs = feature->getAttrs();
+    unsigned hint = 0;
+    for(AttributeTable::const_iterator a = attrs.begin(); a != attrs.end(); ++a)
+    {
+        unsigned col;
+        if ( hint < _columns.size() && _columns[hint].name == a->first )
+            col = hint;
+        else
+            col = addAttribute( a->first, a->second.first );
+
+        set( row, col, a->second );
+        hint = col+1;
+    }
+
+    return row;
+}
+
+void
+FeatureBatch::addGeometry(const Geometry* geom)
+{
+    if ( geom->getType() == Geometry::TYPE_MULTI )
+    {
+        const GeometryCollection& parts = static_cast<const MultiGeometry*>(geom)->getComponents();
+        for(GeometryCollection::const_iterator i = parts.begin(); i != parts.end(); ++i)
+            addGeometry( i->get() );
+    }
+    else
+    {
+        addPart( geom, geom->getType(), false );
+
+        if ( geom->getType() == Geometry::TYPE_POLYGON )
+        {
+            const RingCollection& holes = static_cast<const Polygon*>(geom)->getHoles();
+            for(RingCollection::const_iterator h = holes.begin(); h != holes.end(); ++h)
+                addPart( h->get(), Geometry::TYPE_RING, true );
+        }
+    }
+}
+
+void
+FeatureBatch::addPart(const Geometry* geom, Geometry::Type type, bool hole)
+{
+    Part part;
+    part.type   = type;
+    part.hole   = hole;
+    part.offset = _points.size();
+    part.count  = geom->size();
+    _parts.push_back( part );
+    _points.insert( _points.end(), geom->begin(), geom->end() );
+}
+
+Feature*
+FeatureBatch::createFeature(unsigned row) const
+{
+    Feature* feature = new Feature( createGeometry(row), _srs.get(), Style(), _fids[row] );
+
+    const optional<Style>& rowStyle = style(row);
+    if ( rowStyle.isSet() )
+        feature->style() = rowStyle;
+
+    if ( _rowFlags[row] & ROW_GEOINTERP )
+        feature->geoInterp() = (GeoInterpolation)_geoInterp[row];
+
+    for(unsigned c=0; c<_columns.size(); ++c)
+    {
+        if ( hasAttr(row, c) )
+            feature->set( _columns[c].name, getValue(row, c) );
+    }
+
+    return feature;
+}
+
+void
+FeatureBatch::toFeatureList(FeatureList& output) const
+{
+    for(unsigned row=0; row<size(); ++row)
+    {
+        output.push_back( createFeature(row) );
+    }
+}
+
+//----------------------------------------------------------------------------
+
+int
+FeatureBatch::getAttributeIndex(const std::string& name) const
+{
+    std::map<std::string, unsigned, CIStringComp>::const_iterator i = _columnIndex.find( name );
+    return i != _columnIndex.end() ? (int)i->second : -1;
+}
+
+unsigned
+FeatureBatch::addAttribute(const std::string& name, AttributeType type)
+{
+    std::map<std::string, unsigned, CIStringComp>::const_iterator i = _columnIndex.find( name );
+    if ( i != _columnIndex.end() )
+        return i->second;
+
+    unsigned col = _columns.size();
+    _columns.push_back( Column() );
+    Column& column = _columns.back();
+    column.name = name;
+    column.type = type;
+    column.cells.assign( size(), 0 );
+    _columnIndex[name] = col;
+    return col;
+}
+
+unsigned
+FeatureBatch::intern(const std::string& value)
+{
+    std::map<std::string, unsigned>::const_iterator i = _stringIndex.find( value );
+    if ( i != _stringIndex.end() )
+        return i->second;
+
+    unsigned index = _stringPool.size();
+    _stringPool.push_back( value );
+    _stringIndex[value] = index;
+    return index;
+}
+
+void
+FeatureBatch::setCell(Column& column, unsigned row, AttributeType type, unsigned char flags)
+{
+    column.cells[row] = (unsigned char)type | flags;
+
+    // the value vectors only grow once a row needs them.
+    if ( (flags & CELL_SET) != 0 )
+    {
+        if ( type == ATTRTYPE_STRING )
+        {
+            if ( column.strings.size() <= row )
+                column.strings.resize( column.cells.size() );
+        }
+        else if ( column.numbers.size() <= row )
+        {
+            column.numbers.resize( column.cells.size() );
+        }
+    }
+}
+
+void
+FeatureBatch::set(unsigned row, unsigned col, const std::string& value)
+{
+    Column& column = _columns[col];
+    setCell( column, row, ATTRTYPE_STRING, CELL_PRESENT | CELL_SET );
+    column.strings[row] = intern( value );
+}
+
+void
+FeatureBatch::set(unsigned row, unsigned col, double value)
+{
+    Column& column = _columns[col];
+    setCell( column, row, ATTRTYPE_DOUBLE, CELL_PRESENT | CELL_SET );
+    column.numbers[row] = value;
+}
+
+void
+FeatureBatch::set(unsigned row, unsigned col, int value)
+{
+    Column& column = _columns[col];
+    setCell( column, row, ATTRTYPE_INT, CELL_PRESENT | CELL_SET );
+    column.numbers[row] = (double)value;
+}
+
+void
+FeatureBatch::set(unsigned row, unsigned col, bool value)
+{
+    Column& column = _columns[col];
+    setCell( column, row, ATTRTYPE_BOOL, CELL_PRESENT | CELL_SET );
+    column.numbers[row] = value ? 1.0 : 0.0;
+}
+
+void
+FeatureBatch::set(unsigned row, unsigned col, const AttributeValue& value)
+{
+    if ( !value.second.set )
+    {
+        setCell( _columns[col], row, value.first, CELL_PRESENT );
+        return;
+    }
+
+    switch( value.first )
+    {
+    case ATTRTYPE_STRING: set( row, col, value.second.stringValue ); break;
+    case ATTRTYPE_DOUBLE: set( row, col, value.second.doubleValue ); break;
+    case ATTRTYPE_INT:    set( row, col, value.second.intValue );    break;
+    case ATTRTYPE_BOOL:   set( row, col, value.second.boolValue );   break;
+    default:              setCell( _columns[col], row, value.first, CELL_PRESENT | CELL_SET ); break;
+    }
+}
+
+void
+FeatureBatch::setNull(unsigned row, unsigned col)
+{
+    Column& column = _columns[col];
+    column.cells[row] &= ~CELL_SET;
+    column.cells[row] |= CELL_PRESENT;
+}
+
+AttributeValue
+FeatureBatch::getValue(unsigned row, unsigned col) const
+{
+    const Column& column = _columns[col];
+    unsigned char cell = column.cells[row];
+
+    AttributeValue value;
+    value.first = (AttributeType)(cell & CELL_TYPE_MASK);
+    value.second.set = (cell & CELL_SET) != 0;
+    value.second.doubleValue = 0.0;
+    value.second.intValue = 0;
+    value.second.boolValue = false;
+
+    if ( value.second.set )
+    {
+        switch( value.first )
+        {
+        case ATTRTYPE_STRING: value.second.stringValue = _stringPool[column.strings[row]]; break;
+        case ATTRTYPE_DOUBLE: value.second.doubleValue = column.numbers[row]; break;
+        case ATTRTYPE_INT:    value.second.intValue = (int)column.numbers[row]; break;
+        case ATTRTYPE_BOOL:   value.second.boolValue = column.numbers[row] != 0.0; break;
+        default: break;
+        }
+    }
+    return value;
+}
+
+std::string
+FeatureBatch::getString(unsigned row, unsigned col) const
+{
+    const Column& column = _columns[col];
+    unsigned char cell = column.cells[row];
+    if ( (cell & CELL_SET) != 0 && (cell & CELL_TYPE_MASK) == ATTRTYPE_STRING )
+        return _stringPool[column.strings[row]];
+    return getValue( row, col ).getString();
+}
+
+double
+FeatureBatch::getDouble(unsigned row, unsigned col, double defaultValue) const
+{
+    const Column& column = _columns[col];
+    unsigned char cell = column.cells[row];
+    if ( (cell & CELL_SET) == 0 )
+        return defaultValue;
+
+    switch( cell & CELL_TYPE_MASK )
+    {
+    case ATTRTYPE_DOUBLE:
+    case ATTRTYPE_INT:
+    case ATTRTYPE_BOOL:   return column.numbers[row];
+    case ATTRTYPE_STRING: return osgEarth::as<double>( _stringPool[column.strings[row]], defaultValue );
+    default:              return defaultValue;
+    }
+}
+
+int
+FeatureBatch::getInt(unsigned row, unsigned col, int defaultValue) const
+{
+    const Column& column = _columns[col];
+    unsigned char cell = column.cells[row];
+    if ( (cell & CELL_SET) != 0 && (cell & CELL_TYPE_MASK) == ATTRTYPE_INT )
+        return (int)column.numbers[row];
+    return getValue( row, col ).getInt( defaultValue );
+}
+
+bool
+FeatureBatch::getBool(unsigned row, unsigned col, bool defaultValue) const
+{
+    const Column& column = _columns[col];
+    unsigned char cell = column.cells[row];
+    if ( (cell & CELL_SET) != 0 && (cell & CELL_TYPE_MASK) == ATTRTYPE_BOOL )
+        return column.numbers[row] != 0.0;
+    return getValue( row, col ).getBool( defaultValue );
+}
+
+double
+FeatureBatch::eval(unsigned row, NumericExpression& expr, const FilterContext* context) const
+{
+    const NumericExpression::Variables& vars = expr.variables();
+    for( NumericExpression::Variables::const_iterator i = vars.begin(); i != vars.end(); ++i )
+    {
+        double val = 0.0;
+        int col = getAttributeIndex( i->first );
+        if ( col >= 0 && hasAttr(row, col) )
+        {
+            val = getDouble( row, col, 0.0 );
+        }
+        else if ( context && context->getSession() && context->getSession()->getScriptEngine() )
+        {
+            // Not an attribute, so it's a script; scripts need a real Feature.
+            osg::ref_ptr<Feature> feature = createFeature( row );
+            return feature->eval( expr, context );
+        }
+
+        expr.set( *i, val );
+    }
+
+    return expr.eval();
+}
+
+const std::string&
+FeatureBatch::eval(unsigned row, StringExpression& expr, const FilterContext* context) const
+{
+    const StringExpression::Variables& vars = expr.variables();
+    for( StringExpression::Variables::const_iterator i = vars.begin(); i != vars.end(); ++i )
+    {
+        int col = getAttributeIndex( i->first );
+        if ( col >= 0 && hasAttr(row, col) )
+        {
+            expr.set( *i, getString(row, col) );
+        }
+        else if ( context && context->getSession() && context->getSession()->getScriptEngine() )
+        {
+            // Not an attribute, so it's a script; scripts need a real Feature.
+            osg::ref_ptr<Feature> feature = createFeature( row );
+            return feature->eval( expr, context );
+        }
+        else
+        {
+            expr.set( *i, EMPTY_STRING );
+        }
+    }
+
+    return expr.eval();
+}
+
+//----------------------------------------------------------------------------
+
+const optional<Style>&
+FeatureBatch::style(unsigned row) const
+{
+    static optional<Style> s_noStyle;
+    std::map<unsigned, optional<Style> >::const_iterator i = _styles.find( row );
+    return i != _styles.end() ? i->second : s_noStyle;
+}
+
+void
+FeatureBatch::setStyle(unsigned row, const Style& style)
+{
+    _styles[row] = style;
+}
+
+optional<GeoInterpolation>
+FeatureBatch::getGeoInterp(unsigned row) const
+{
+    optional<GeoInterpolation> result;
+    if ( _rowFlags[row] & ROW_GEOINTERP )
+        result = (GeoInterpolation)_geoInterp[row];
+    return result;
+}
+
+//----------------------------------------------------------------------------
+
+Bounds
+FeatureBatch::getBounds(unsigned row) const
+{
+    // holes lie inside their polygons, so only the outer parts count.
+    Bounds bounds;
+    for(unsigned p = _rowParts[row]; p < _rowParts[row+1]; ++p)
+    {
+        const Part& part = _parts[p];
+        if ( part.hole )
+            continue;
+        for(unsigned i = part.offset; i < part.offset + part.count; ++i)
+            bounds.expandBy( _points[i].x(), _points[i].y(), _points[i].z() );
+    }
+    return bounds;
+}
+
+Geometry*
+FeatureBatch::createPartGeometry(unsigned p) const
+{
+    const Part& part = _parts[p];
+    Geometry* geom = createEmptyGeometry( part.type, part.count );
+    geom->insert( geom->end(), _points.begin() + part.offset, _points.begin() + part.offset + part.count );
+
+    if ( part.type == Geometry::TYPE_POLYGON && !part.hole )
+    {
+        Polygon* poly = static_cast<Polygon*>(geom);
+        for(unsigned h = p+1; h < _parts.size() && _parts[h].hole; ++h)
+        {
+            const Part& hole = _parts[h];
+            Ring* ring = new Ring( hole.count );
+            ring->insert( ring->end(), _points.begin() + hole.offset, _points.begin() + hole.offset + hole.count );
+            poly->getHoles().push_back( ring );
+        }
+    }
+
+    return geom;
+}
+
+Geometry*
+FeatureBatch::createGeometry(unsigned row) const
+{
+    if ( !hasGeometry(row) )
+        return 0L;
+
+    GeometryCollection parts;
+    for(unsigned p = _rowParts[row]; p < _rowParts[row+1]; ++p)
+    {
+        if ( !_parts[p].hole )
+            parts.push_back( createPartGeometry(p) );
+    }
+
+    if ( (_rowFlags[row] & ROW_MULTI) == 0 && parts.size() == 1 )
+        return parts.front().release();
+
+    return new MultiGeometry( parts );
+}
@@ -90,8 +90,9 @@ FeatureListSource::deleteFeature(FeatureID fid)
     {
         if (itr->get()->getFID() == fid)
         {
+            GeoExtent extent = itr->get()->getExtent();
             _features.erase( itr );
-            dirty();
+            dirtyFeature( fid, extent );
             return true;
         }
     }
@@ -115,6 +116,6 @@ bool FeatureListSource::insertFeature(Feature* feature)
 {
     dirtyFeatureProfile();
     _features.push_back( feature );
-    dirty();
+    dirtyFeature( feature->getFID(), feature->getExtent() );
     return true;
 }
@@ -33,6 +33,9 @@
 #include <osgEarth/ThreadingUtils>
 #include <osgEarth/Utils>
 #include <osgEarth/GLUtils>
+#include <osgEarth/Metrics>
+#include <osgEarth/TaskService>
+#include <osgEarth/StringUtils>
 
 #include <osg/CullFace>
 #include <osg/PagedLOD>
@@ -46,6 +49,8 @@
 
 #include <algorithm>
 #include <iterator>
+#include <cstdlib>
+#include <cstdio>
 
 #define LC "[FeatureModelGraph] " << getName() << ": "
 
@@ -227,6 +232,106 @@ namespace
     };
 }
 
+//---------------------------------------------------------------------------
+
+namespace
+{
+    Threading::Mutex          s_buildServiceMutex;
+    osg::ref_ptr<TaskService> s_buildService;
+
+    // A style group with more than twice this many features is compiled in
+    // pieces of this size, so one big group can use more than one thread.
+    const unsigned FEATURES_PER_COMPILE_TASK = 1000u;
+}
+
+void
+FeatureModelGraph::setBuildTaskService(TaskService* service)
+{
+    Threading::ScopedMutexLock lock(s_buildServiceMutex);
+    s_buildService = service;
+}
+
+TaskService*
+FeatureModelGraph::getBuildTaskService()
+{
+    Threading::ScopedMutexLock lock(s_buildServiceMutex);
+    if (!s_buildService.valid())
+    {
+        int numThreads = 4;
+        const char* env = ::getenv("OSGEARTH_FEATURE_BUILD_THREADS");
+        if (env)
+            numThreads = osg::maximum(as<int>(env, numThreads), 1);
+
+        s_buildService = new TaskService("FeatureModelGraph", numThreads);
+    }
+    return s_buildService.get();
+}
+
+/**
+ * Compiles one style group (or one piece of a large one) into a node. Runs on
+ * the build TaskService, but whichever thread gets to it first runs it: the
+ * tile's own thread runs any task that hasn't started by the time it needs
+ * the result, so a tile never waits on a queued task.
+ */
+struct FeatureModelGraph::CompileTask : public TaskRequest
+{
+    CompileTask(FeatureModelGraph* graph, const Style& style, const FilterContext& context,
+                const osgDB::Options* readOptions, ProgressCallback* progress) :
+        _graph(graph), _style(style), _context(context), _readOptions(readOptions),
+        _progress(progress), _claimed(false), _ok(false), _latency_s(0.0) { }
+
+    void operator()(ProgressCallback*)
+    {
+        if (claim())
+            compile();
+    }
+
+    //! Blocks until the result is available, running the compile here if no one has started it.
+    void wait()
+    {
+        if (claim())
+            compile();
+        else
+            _done.wait();
+    }
+
+    bool claim()
+    {
+        Threading::ScopedMutexLock lock(_claimMutex);
+        if (_claimed)
+            return false;
+        _claimed = true;
+        return true;
+    }
+
+    void compile()
+    {
+        if (!_progress || !_progress->isCanceled())
+        {
+            METRIC_SCOPED_EX("FeatureModelGraph compile", 1, "style", _style.getName().c_str());
+            osg::Timer_t start = osg::Timer::instance()->tick();
+
+            _ok = _graph->compileStyleGroup(_style, _workingSet, _context, _readOptions.get(), _node);
+
+            _latency_s = osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+        }
+        _done.set();
+    }
+
+    FeatureModelGraph*                 _graph;   // caller waits for every task
+    const Style&                       _style;   // ...so it outlives the task's work
+    FeatureList                        _workingSet;
+    FilterContext                      _context;
+    osg::ref_ptr<const osgDB::Options> _readOptions;
+    ProgressCallback*                  _progress;
+    Threading::Mutex                   _claimMutex;
+    bool                               _claimed;
+    Threading::Event                   _done;
+    bool                               _ok;
+    osg::ref_ptr<osg::Node>            _node;
+    double                             _latency_s;
+};
+
 
 //---------------------------------------------------------------------------
 
@@ -269,6 +374,9 @@ FeatureModelGraph::ctor()
     OE_TEST << LC << "ctor" << std::endl;
 
     _nodeCachingImageCache = new osgDB::ObjectCache();
+    _binaryNodeCache = new BinaryNodeCache();
+    _liveTilesPruneSize = 64u;
+    _binaryNodeCache->setStateSetCache(_session->getStateSetCache());
 
     // an FLC that queues feature data on the high-latency thread.
     _defaultFileLocationCallback = new HighLatencyFileLocationCallback();
@@ -706,13 +814,17 @@ FeatureModelGraph::load(unsigned lod, unsigned tileX, unsigned tileY,
     OE_TEST << LC << "load " << lod << "_" << tileX << "_" << tileY << std::endl;
 
     osg::Group* result = 0L;
+    osg::Group* geometry = 0L;
+
+    // tiles of a writable source are tracked so they can be rebuilt in place.
+    osg::ref_ptr<LiveTile> liveTile;
+    bool trackTiles = _session->getFeatureSource()->isWritable();
     
     if ( _useTiledSource )
     {       
         // A "tiled" source has a pre-generted tile hierarchy, but no range information.
         // We will calcluate the LOD ranges here, as a function of the tile radius and the
         // "tile size factor" ... see below.
-        osg::Group* geometry =0L;
         const FeatureProfile* featureProfile = _session->getFeatureSource()->getFeatureProfile();
 
         if ( (int)lod >= featureProfile->getFirstLevel() )
@@ -744,6 +856,9 @@ FeatureModelGraph::load(unsigned lod, unsigned tileX, unsigned tileY,
 
             geometry = buildTile( level, tileExtent, &key, readOptions );
             result = geometry;
+
+            if ( trackTiles )
+                liveTile = new LiveTile( level, tileExtent, &key, readOptions );
         }
 
         // check whether more levels exist below the current level.
@@ -784,7 +899,6 @@ FeatureModelGraph::load(unsigned lod, unsigned tileX, unsigned tileY,
         // current LOD points to an actual FeatureLevel, we build the geometry for that
         // level in the tile.
 
-        osg::Group* geometry = 0L;
         const FeatureLevel* level = _lodmap[lod];
         if ( level )
         {
@@ -797,6 +911,9 @@ FeatureModelGraph::load(unsigned lod, unsigned tileX, unsigned tileY,
                 
             geometry = buildTile( *level, tileExtent, (const TileKey*)0L, readOptions );
             result = geometry;
+
+            if ( trackTiles )
+                liveTile = new LiveTile( *level, tileExtent, (const TileKey*)0L, readOptions );
         }
 
         if ( lod < _lodmap.size()-1 )
@@ -835,6 +952,26 @@ FeatureModelGraph::load(unsigned lod, unsigned tileX, unsigned tileY,
         OE_DEBUG << LC << "Blacklisting: " << uri << std::endl;
     }
 
+    else if ( liveTile.valid() )
+    {
+        // keep the geometry in a group of its own so a rebuild can swap it out.
+        if ( result == geometry )
+        {
+            result = new osg::Group();
+            result->addChild( geometry );
+        }
+
+        liveTile->_parent = result;
+        liveTile->_geometry = geometry;
+
+        Threading::ScopedMutexLock lock( _liveTilesMutex );
+        _liveTiles[uri] = liveTile.get();
+
+        // without edits, nothing else sweeps out the tiles that paged out.
+        if ( _liveTiles.size() >= _liveTilesPruneSize )
+            pruneLiveTiles();
+    }
+
     // Done - run the pre-merge operations.
     runPreMergeOperations(result);
 
@@ -974,6 +1111,8 @@ FeatureModelGraph::readTileFromCache(const std::string&    cacheKey,
 
     if (cacheBin && policy->isCacheReadable())
     {
+        METRIC_SCOPED("FeatureModelGraph cache read");
+
         ++_cacheReads;
 
 #if OSG_VERSION_GREATER_OR_EQUAL(3,6,3)
@@ -991,7 +1130,23 @@ FeatureModelGraph::readTileFromCache(const std::string&    cacheKey,
             return 0L;
         }
 
-        if (rr.succeeded())
+        if (rr.succeeded() && BinaryNodeCache::isBinary(rr.getString()))
+        {
+            // The binary format shares state and restores the feature index
+            // as it goes, so there's no need to walk the graph afterwards.
+#if OSG_VERSION_GREATER_OR_EQUAL(3,6,3)
+            group = dynamic_cast<osg::Group*>(_binaryNodeCache->decode(rr.getString(), cacheBin.get(), _featureIndex.get(), localOptions.get()));
+#else
+            group = dynamic_cast<osg::Group*>(_binaryNodeCache->decode(rr.getString(), cacheBin.get(), _featureIndex.get(), readOptions));
+#endif
+            if (group.valid())
+            {
+                OE_DEBUG << LC << "Loaded from the cache (key = " << cacheKey << ")\n";
+                ++_cacheHits;
+            }
+        }
+
+        else if (rr.succeeded())
         {
             group = dynamic_cast<osg::Group*>(rr.getNode());
             OE_DEBUG << LC << "Loaded from the cache (key = " << cacheKey << ")\n";
@@ -1046,7 +1201,18 @@ FeatureModelGraph::writeTileToCache(const std::string&    cacheKey,
 
     if (cacheBin && policy->isCacheWriteable())
     {
-        cacheBin->writeNode(cacheKey, node, Config(), writeOptions);
+        std::string record;
+        if (_options.binaryNodeCaching() == true &&
+            _binaryNodeCache->encode(node, cacheBin.get(), writeOptions, record))
+        {
+            osg::ref_ptr<StringObject> object = new StringObject(record);
+            cacheBin->write(cacheKey, object.get(), writeOptions);
+        }
+        else
+        {
+            // the tile holds something the binary format doesn't cover.
+            cacheBin->writeNode(cacheKey, node, Config(), writeOptions);
+        }
         OE_DEBUG << LC << "Wrote " << cacheKey << " to cache\n";
     }
     return true;
@@ -1062,7 +1228,8 @@ osg::Group*
 FeatureModelGraph::buildTile(const FeatureLevel& level,
                              const GeoExtent& extent,
                              const TileKey* key,
-                             const osgDB::Options* readOptions)
+                             const osgDB::Options* readOptions,
+                             bool readCache)
 {
     OE_TEST << LC << "buildTile " << (key? key->str(): "no key") << std::endl;
 
@@ -1071,7 +1238,7 @@ FeatureModelGraph::buildTile(const FeatureLevel& level,
     // Try to read it from a cache:
     std::string cacheKey = makeCacheKey(level, extent, key);
 
-    if (_options.nodeCaching() == true)
+    if (readCache && _options.nodeCaching() == true)
     {
         group = readTileFromCache(cacheKey, readOptions);
     }
@@ -1431,22 +1598,44 @@ FeatureModelGraph::queryAndSortIntoStyleGroups(const Query&            query,
     FilterContext context( _session.get(), featureProfile, GeoExtent(featureProfile->getSRS(), bounds), index );
     StringExpression styleExprCopy( styleExpr );
 
-    // visit each feature and run the expression to sort it into a bin.
+    // read all the features, then run the expression over the whole list
+    // at once so a script engine only has to compile it once.
+    FeatureList features;
+    {
+        METRIC_SCOPED("FeatureModelGraph query");
+        while( cursor->hasMore() )
+        {
+            osg::ref_ptr<Feature> feature = cursor->nextFeature();
+            if ( feature.valid() )
+                features.push_back( feature.get() );
+        }
+    }
+
+    // sort each feature into a bin.
     std::map<std::string, FeatureList> styleBins;
-    while( cursor->hasMore() )
     {
-        osg::ref_ptr<Feature> feature = cursor->nextFeature();
-        if ( feature.valid() )
+        METRIC_SCOPED("FeatureModelGraph sort");
+
+        std::vector<std::string> styleStrings;
+        Feature::eval( styleExprCopy, features, styleStrings, &context );
+
+        unsigned f = 0;
+        for( FeatureList::iterator i = features.begin(); i != features.end(); ++i, ++f )
         {
-            const std::string& styleString = feature->eval( styleExprCopy, &context );
+            const std::string& styleString = styleStrings[f];
             if (!styleString.empty() && styleString != "null")
             {
-                styleBins[styleString].push_back( feature.get() );
+                styleBins[styleString].push_back( i->get() );
             }
         }
     }
 
-    // next create a style group per bin.
+    // next resolve a style for each bin.
+    std::vector<Style>       styles;
+    std::vector<FeatureList> workingSets;
+    styles.reserve( styleBins.size() );
+    workingSets.reserve( styleBins.size() );
+
     for( std::map<std::string,FeatureList>::iterator i = styleBins.begin(); i != styleBins.end(); ++i )
     {
         const std::string& styleString = i->first;
@@ -1475,15 +1664,25 @@ FeatureModelGraph::queryAndSortIntoStyleGroups(const Query&            query,
                 combinedStyle = *selectedStyle;
         }
 
-        // if there is a valid style, create the node and add it. (Otherwise we will skip
+        // if there is a valid style, queue the bin for compiling. (Otherwise we will skip
         // the feature.)
         if ( !combinedStyle.empty() )
         {
-            osg::Group* styleGroup = createStyleGroup(combinedStyle, workingSet, context, readOptions);
-            if ( styleGroup )
-                parent->addChild( styleGroup );
+            styles.push_back( combinedStyle );
+            workingSets.push_back( FeatureList() );
+            workingSets.back().swap( workingSet );
         }
     }
+
+    // compile all the style groups at once, and add them in bin order.
+    std::vector<osg::Group*> styleGroups;
+    createStyleGroups( styles, workingSets, context, readOptions, progress, styleGroups );
+
+    for( unsigned i = 0; i < styleGroups.size(); ++i )
+    {
+        if ( styleGroups[i] )
+            parent->addChild( styleGroups[i] );
+    }
 }
 
 
@@ -1491,12 +1690,105 @@ osg::Group*
 FeatureModelGraph::createStyleGroup(const Style&          style, 
                                     FeatureList&          workingSet, 
                                     const FilterContext&  contextPrototype,
-                                    const osgDB::Options* readOptions)
+                                    const osgDB::Options* readOptions,
+                                    ProgressCallback*     progress)
 {
     OE_TEST << LC << "createStyleGroup " << style.getName() << std::endl;
 
-    osg::Group* styleGroup = 0L;
+    std::vector<Style> styles(1, style);
+    std::vector<FeatureList> workingSets(1);
+    workingSets[0].swap( workingSet );
+
+    std::vector<osg::Group*> styleGroups;
+    createStyleGroups( styles, workingSets, contextPrototype, readOptions, progress, styleGroups );
+
+    return styleGroups[0];
+}
+
+void
+FeatureModelGraph::createStyleGroups(const std::vector<Style>&  styles,
+                                     std::vector<FeatureList>&  workingSets,
+                                     const FilterContext&       contextPrototype,
+                                     const osgDB::Options*      readOptions,
+                                     ProgressCallback*          progress,
+                                     std::vector<osg::Group*>&  output)
+{
+    output.assign( styles.size(), (osg::Group*)0L );
+
+    // One task per style group, except that big groups are split into runs of
+    // consecutive features. Tasks are listed in style order, then feature order.
+    std::vector< osg::ref_ptr<CompileTask> > tasks;
+    std::vector<unsigned> taskStyle;
+
+    for( unsigned s = 0; s < styles.size(); ++s )
+    {
+        FeatureList& workingSet = workingSets[s];
+        unsigned numFeatures = workingSet.size();
+        if ( numFeatures == 0 )
+            continue;
+
+        unsigned perTask = numFeatures > 2u*FEATURES_PER_COMPILE_TASK ? FEATURES_PER_COMPILE_TASK : numFeatures;
+
+        while( !workingSet.empty() )
+        {
+            CompileTask* task = new CompileTask( this, styles[s], contextPrototype, readOptions, progress );
+
+            // the last piece takes whatever is left rather than leave a tiny remainder.
+            FeatureList::iterator end = workingSet.end();
+            if ( numFeatures >= 2u*perTask )
+            {
+                end = workingSet.begin();
+                std::advance( end, perTask );
+            }
+            numFeatures -= std::min( numFeatures, perTask );
+
+            task->_workingSet.splice( task->_workingSet.end(), workingSet, workingSet.begin(), end );
+            tasks.push_back( task );
+            taskStyle.push_back( s );
+        }
+    }
+
+    if ( tasks.empty() )
+        return;
+
+    // this thread takes the first one itself.
+    if ( tasks.size() > 1 )
+    {
+        TaskService* service = getBuildTaskService();
+        for( unsigned i = 1; i < tasks.size(); ++i )
+            service->add( tasks[i].get() );
+    }
 
+    // collect the results in order so the tile comes out the same every time.
+    METRIC_SCOPED("FeatureModelGraph merge");
+
+    for( unsigned i = 0; i < tasks.size(); ++i )
+    {
+        CompileTask* task = tasks[i].get();
+        task->wait();
+
+        Metrics::counter("FeatureModelGraph compile time (ms)", styles[taskStyle[i]].getName(), 1000.0*task->_latency_s);
+
+        if ( task->_ok )
+        {
+            osg::Group*& styleGroup = output[taskStyle[i]];
+            if ( !styleGroup )
+                styleGroup = getOrCreateStyleGroupFromFactory( styles[taskStyle[i]] );
+
+            // if it returned a node, add it. (it doesn't necessarily have to)
+            if ( task->_node.valid() )
+                styleGroup->addChild( task->_node.get() );
+        }
+    }
+}
+
+bool
+FeatureModelGraph::compileStyleGroup(const Style&             style,
+                                     FeatureList&             workingSet,
+                                     const FilterContext&     contextPrototype,
+                                     const osgDB::Options*    readOptions,
+                                     osg::ref_ptr<osg::Node>& output)
+{
     FilterContext context(contextPrototype);
 
     // First Crop the feature set to the working extent.
@@ -1530,21 +1822,11 @@ FeatureModelGraph::createStyleGroup(const Style&          style,
     // finally, compile the features into a node.
     if ( workingSet.size() > 0 )
     {
-        osg::ref_ptr<osg::Node> node;
         osg::ref_ptr<FeatureCursor> newCursor = new FeatureListCursor(workingSet);
-
-        if ( createOrUpdateNode( newCursor.get(), style, context, readOptions, node ) )
-        {
-            if ( !styleGroup )
-                styleGroup = getOrCreateStyleGroupFromFactory( style );
-
-            // if it returned a node, add it. (it doesn't necessarily have to)
-            if ( node.valid() )
-                styleGroup->addChild( node.get() );
-        }
+        return createOrUpdateNode( newCursor.get(), style, context, readOptions, output );
     }
 
-    return styleGroup;
+    return false;
 }
 
 
@@ -1581,7 +1863,7 @@ FeatureModelGraph::createStyleGroup(const Style&          style,
         FeatureList workingSet;
         cursor->fill( workingSet );
 
-        styleGroup = createStyleGroup(style, workingSet, context, readOptions);
+        styleGroup = createStyleGroup(style, workingSet, context, readOptions, progress);
     }
 
 
@@ -1658,6 +1940,7 @@ FeatureModelGraph::traverse(osg::NodeVisitor& nv)
     {
         if (!_pendingUpdate && 
              (_dirty ||
+              _numRebuiltTiles > 0u ||
               _session->getFeatureSource()->outOfSyncWith(_featureSourceRev) ||
               (_modelSource.valid() && _modelSource->outOfSyncWith(_modelSourceRev))))
         {
@@ -1674,7 +1957,7 @@ FeatureModelGraph::traverse(osg::NodeVisitor& nv)
         {
             OE_TEST << LC << "pending update detected" << std::endl;
 
-            redraw();
+            update();
             _pendingUpdate = false;
             ADJUST_UPDATE_TRAV_COUNT( this, -1 );
         }
@@ -1711,6 +1994,21 @@ FeatureModelGraph::redraw()
     // clear it out
     removeChildren( 0, getNumChildren() );
 
+    // forget the old tiles and any rebuilds still in flight.
+    {
+        Threading::ScopedMutexLock lock( _liveTilesMutex );
+        _liveTiles.clear();
+        _liveTilesPruneSize = 64u;
+        _rebuiltTiles.clear();
+        _numRebuiltTiles.exchange( 0u );
+    }
+
+    // the data may have changed, so empty tiles may not be empty anymore.
+    {
+        Threading::ScopedWriteLock exclusiveLock( _blacklistMutex );
+        _blacklist.clear();
+    }
+
     // initialize the index if necessary.
     if ( _options.featureIndexing()->enabled() == true )
     {
@@ -1781,6 +2079,249 @@ FeatureModelGraph::redraw()
     _dirty = false;
 }
 
+void
+FeatureModelGraph::update()
+{
+    mergeRebuiltTiles();
+
+    bool featuresChanged = _session->getFeatureSource()->outOfSyncWith( _featureSourceRev );
+    bool modelChanged = _modelSource.valid() && _modelSource->outOfSyncWith( _modelSourceRev );
+
+    // Edits to a writable source only rebuild the tiles they touch; anything
+    // else rebuilds the whole graph.
+    if ( _dirty || modelChanged || (featuresChanged && !rebuildChangedTiles()) )
+    {
+        redraw();
+    }
+}
+
+/**
+ * Rebuilds a live tile in the background. The old tile stays in the graph
+ * until the new one is merged during the update traversal.
+ */
+struct FeatureModelGraph::RebuildTask : public TaskRequest
+{
+    RebuildTask(FeatureModelGraph* graph, LiveTile* tile, unsigned generation) :
+        _graph(graph), _tile(tile), _generation(generation) { }
+
+    void operator()(ProgressCallback* progress)
+    {
+        osg::ref_ptr<FeatureModelGraph> graph;
+        if (!_graph.lock(graph))
+            return;
+
+        // skip the node cache; the cached tile is out of date.
+        osg::ref_ptr<osg::Group> geometry = graph->buildTile(
+            _tile->_level,
+            _tile->_extent,
+            _tile->_hasKey ? &_tile->_key : 0L,
+            _tile->_readOptions.get(),
+            false);
+
+        if (geometry.valid())
+            graph->runPreMergeOperations(geometry.get());
+
+        graph->addRebuiltTile(_tile.get(), _generation, geometry.get());
+    }
+
+    osg::observer_ptr<FeatureModelGraph> _graph;
+    osg::ref_ptr<LiveTile>               _tile;
+    unsigned                             _generation;
+};
+
+bool
+FeatureModelGraph::rebuildChangedTiles()
+{
+    FeatureSource* source = _session->getFeatureSource();
+
+    if ( !source->isWritable() || !(_options.layout().isSet() || _useTiledSource) )
+        return false;
+
+    std::vector<GeoExtent> extents;
+    std::vector<FeatureID> fids;
+    Revision revision = _featureSourceRev;
+    if ( !source->getChanges(revision, extents, fids) )
+        return false;
+
+    // Without an index there's no telling where a feature of unknown extent was.
+    if ( extents.size() < fids.size() && !_featureIndex.valid() )
+        return false;
+
+    // An empty tile was blacklisted and has no PagedLOD to rebuild, so a
+    // change inside one takes a full redraw.
+    {
+        Threading::ScopedReadLock sharedLock( _blacklistMutex );
+        for(std::set<std::string>::const_iterator i = _blacklist.begin(); i != _blacklist.end(); ++i)
+        {
+            unsigned lod, x, y;
+            if ( sscanf(i->c_str(), "%u_%u_%u.", &lod, &x, &y) != 3 )
+                return false;
+
+            GeoExtent tileExtent;
+            if ( _useTiledSource )
+            {
+                // a tiled source serves the tile for its profile's key, which
+                // needn't line up with a subdivision of the feature extent.
+                const FeatureProfile* featureProfile = source->getFeatureProfile();
+                if ( !featureProfile || !featureProfile->getProfile() )
+                    return false;
+
+                unsigned w, h;
+                featureProfile->getProfile()->getNumTiles( lod, w, h );
+                tileExtent = TileKey( lod, x, h - y - 1, featureProfile->getProfile() ).getExtent();
+            }
+            else
+            {
+                tileExtent = lod > 0 ?
+                    s_getTileExtent( lod, x, y, _usableFeatureExtent ) :
+                    _usableFeatureExtent;
+            }
+
+            for(unsigned e = 0; e < extents.size(); ++e)
+            {
+                if ( tileExtent.intersects(extents[e]) )
+                    return false;
+            }
+        }
+    }
+
+    std::set<FeatureID> fidSet( fids.begin(), fids.end() );
+    std::vector< osg::ref_ptr<RebuildTask> > tasks;
+    {
+        Threading::ScopedMutexLock lock( _liveTilesMutex );
+
+        for(LiveTiles::iterator i = _liveTiles.begin(); i != _liveTiles.end(); )
+        {
+            LiveTile* tile = i->second.get();
+
+            // paged out?
+            osg::ref_ptr<osg::Group> parent;
+            if ( !tile->_parent.lock(parent) )
+            {
+                _liveTiles.erase( i++ );
+                continue;
+            }
+
+            const GeoExtent& tileExtent = tile->_hasKey ? tile->_key.getExtent() : tile->_extent;
+
+            bool changed = false;
+            for(unsigned e = 0; e < extents.size() && !changed; ++e)
+            {
+                changed = tileExtent.intersects( extents[e] );
+            }
+
+            // a feature whose extent isn't known: look for it in the tile's index.
+            osg::ref_ptr<osg::Node> geometry;
+            if ( !changed && extents.size() < fids.size() && tile->_geometry.lock(geometry) )
+            {
+                FeatureSourceIndexNode* index = FeatureSourceIndexNode::get( geometry.get() );
+                if ( index )
+                {
+                    const FeatureSourceIndexNode::FIDMap& tileFIDs = index->getFIDMap();
+                    for(std::set<FeatureID>::const_iterator f = fidSet.begin(); f != fidSet.end() && !changed; ++f)
+                    {
+                        changed = tileFIDs.find(*f) != tileFIDs.end();
+                    }
+                }
+            }
+
+            if ( changed )
+            {
+                tasks.push_back( new RebuildTask(this, tile, ++tile->_generation) );
+            }
+
+            ++i;
+        }
+    }
+
+    OE_DEBUG << LC << "Rebuilding " << tasks.size() << " tiles for " << fids.size() << " changed features\n";
+
+    TaskService* service = getBuildTaskService();
+    for(unsigned i = 0; i < tasks.size(); ++i)
+    {
+        service->add( tasks[i].get() );
+    }
+
+    _featureSourceRev = revision;
+    return true;
+}
+
+void
+FeatureModelGraph::pruneLiveTiles()
+{
+    // caller holds _liveTilesMutex.
+    for(LiveTiles::iterator i = _liveTiles.begin(); i != _liveTiles.end(); )
+    {
+        if ( !i->second->_parent.valid() )
+            _liveTiles.erase( i++ );
+        else
+            ++i;
+    }
+
+    // sweep again once the table has doubled, so the cost stays constant per load.
+    _liveTilesPruneSize = osg::maximum( 64u, 2u * (unsigned)_liveTiles.size() );
+}
+
+unsigned
+FeatureModelGraph::getNumLiveTiles() const
+{
+    Threading::ScopedMutexLock lock( _liveTilesMutex );
+    return _liveTiles.size();
+}
+
+void
+FeatureModelGraph::addRebuiltTile(LiveTile* tile, unsigned generation, osg::Node* geometry)
+{
+    RebuiltTile rebuilt;
+    rebuilt._tile = tile;
+    rebuilt._generation = generation;
+    rebuilt._geometry = geometry;
+
+    Threading::ScopedMutexLock lock( _liveTilesMutex );
+    _rebuiltTiles.push_back( rebuilt );
+    ++_numRebuiltTiles;
+}
+
+void
+FeatureModelGraph::mergeRebuiltTiles()
+{
+    std::vector<RebuiltTile> rebuiltTiles;
+    {
+        Threading::ScopedMutexLock lock( _liveTilesMutex );
+        rebuiltTiles.swap( _rebuiltTiles );
+        _numRebuiltTiles.exchange( 0u );
+    }
+
+    for(unsigned i = 0; i < rebuiltTiles.size(); ++i)
+    {
+        RebuiltTile& rebuilt = rebuiltTiles[i];
+        LiveTile* tile = rebuilt._tile.get();
+
+        // a later rebuild of the same tile supersedes this one.
+        if ( rebuilt._generation != tile->_generation )
+            continue;
+
+        osg::ref_ptr<osg::Group> parent;
+        if ( !tile->_parent.lock(parent) )
+            continue;
+
+        osg::ref_ptr<osg::Node> oldGeometry;
+        tile->_geometry.lock( oldGeometry );
+
+        if ( oldGeometry.valid() && rebuilt._geometry.valid() )
+            parent->replaceChild( oldGeometry.get(), rebuilt._geometry.get() );
+        else if ( oldGeometry.valid() )
+            parent->removeChild( oldGeometry.get() );
+        else if ( rebuilt._geometry.valid() )
+            parent->addChild( rebuilt._geometry.get() );
+
+        tile->_geometry = rebuilt._geometry.get();
+
+        if ( rebuilt._geometry.valid() )
+            runPostMergeOperations( rebuilt._geometry.get() );
+    }
+}
+
 void
 FeatureModelGraph::setStyles( StyleSheet* styles )
 {
@@ -215,6 +215,72 @@ FeatureSource::isBlacklisted( FeatureID fid ) const
     return _blacklist.find( fid ) != _blacklist.end();
 }
 
+namespace
+{
+    // how many changes a source remembers for getChanges()
+    const unsigned MAX_CHANGES = 1024u;
+}
+
+void
+FeatureSource::dirtyFeature(FeatureID fid, const GeoExtent& extent)
+{
+    Threading::ScopedMutexLock lock( _changesMutex );
+
+    dirty();
+
+    Change change;
+    Revision revision;
+    sync( revision );
+    change._revision = revision;
+    change._fid = fid;
+    change._extent = extent;
+    _changes.push_back( change );
+
+    if ( _changes.size() > MAX_CHANGES )
+        _changes.pop_front();
+}
+
+bool
+FeatureSource::getChanges(Revision&               revision,
+                          std::vector<GeoExtent>& extents,
+                          std::vector<FeatureID>& fids) const
+{
+    extents.clear();
+    fids.clear();
+
+    Threading::ScopedMutexLock lock( _changesMutex );
+
+    Revision current;
+    sync( current );
+
+    int since = revision;
+    if ( since < 0 || since > (int)current )
+        return false;
+
+    // Every revision in (since, current] has to be a logged change, or the
+    // source was dirtied in some way the log can't describe.
+    int last = since;
+    for(std::deque<Change>::const_iterator i = _changes.begin(); i != _changes.end(); ++i)
+    {
+        if ( i->_revision <= since )
+            continue;
+
+        if ( i->_revision != last + 1 )
+            return false;
+
+        last = i->_revision;
+        if ( i->_extent.isValid() )
+            extents.push_back( i->_extent );
+        fids.push_back( i->_fid );
+    }
+
+    if ( last != (int)current )
+        return false;
+
+    revision = current;
+    return true;
+}
+
 void
 FeatureSource::applyFilters(FeatureList& features, const GeoExtent& extent) const
 {
@@ -108,7 +108,11 @@ FeatureSourceIndexNode::tagDrawable(osg::Drawable* drawable, Feature* feature)
 {
     if ( !feature || !_index.valid() ) return OSGEARTH_OBJECTID_EMPTY;
     RefIDPair* r = _index->tagDrawable( drawable, feature );
-    if ( r ) _fids[ feature->getFID() ] = r;
+    if ( r )
+    {
+        Threading::ScopedMutexLock lock( _fidsMutex );
+        _fids[ feature->getFID() ] = r;
+    }
     return r ? r->_oid : OSGEARTH_OBJECTID_EMPTY;
 }
 
@@ -117,7 +121,11 @@ FeatureSourceIndexNode::tagAllDrawables(osg::Node* node, Feature* feature)
 {
     if ( !feature || !_index.valid() ) return OSGEARTH_OBJECTID_EMPTY;
     RefIDPair* r = _index->tagAllDrawables( node, feature );
-    if ( r ) _fids[ feature->getFID() ] = r;
+    if ( r )
+    {
+        Threading::ScopedMutexLock lock( _fidsMutex );
+        _fids[ feature->getFID() ] = r;
+    }
     return r ? r->_oid : OSGEARTH_OBJECTID_EMPTY;
 }
 
@@ -126,7 +134,11 @@ FeatureSourceIndexNode::tagNode(osg::Node* node, Feature* feature)
 {
     if ( !feature || !_index.valid() ) return OSGEARTH_OBJECTID_EMPTY;
     RefIDPair* r = _index->tagNode( node, feature );
-    if ( r ) _fids[ feature->getFID() ] = r;
+    if ( r )
+    {
+        Threading::ScopedMutexLock lock( _fidsMutex );
+        _fids[ feature->getFID() ] = r;
+    }
     return r ? r->_oid : OSGEARTH_OBJECTID_EMPTY;
 }
 
@@ -249,6 +261,26 @@ FeatureSourceIndexNode::reIndexNode(osg::Node* node, std::map<ObjectID,ObjectID>
     _index->update(node, oldNew, _fids, newFIDMap);
 }
 
+void
+FeatureSourceIndexNode::reIndex(const std::vector<osg::Drawable*>& drawables,
+                                const std::vector<osg::Node*>&     nodes,
+                                std::map<ObjectID,ObjectID>&       oldNew)
+{
+    if ( !_index.valid() ) return;
+
+    ObjectIndex* masterIndex = _index->_masterIndex.get();
+
+    for (unsigned i = 0; i < drawables.size(); ++i)
+        masterIndex->updateObjectIDs(drawables[i], oldNew, _index.get());
+
+    for (unsigned i = 0; i < nodes.size(); ++i)
+        masterIndex->updateObjectID(nodes[i], oldNew, _index.get());
+
+    FIDMap newFIDMap;
+    _index->remap(oldNew, _fids, newFIDMap);
+    _fids.swap(newFIDMap);
+}
+
 FeatureSourceIndexNode* FeatureSourceIndexNode::get(osg::Node* graph)
 {
     return graph ? osgEarth::findTopMostNodeOfType<FeatureSourceIndexNode>(graph) : 0L;
@@ -549,3 +581,28 @@ FeatureSourceIndex::update(osg::Node* node, std::map<ObjectID,ObjectID>& oldToNe
         }
     }
 }
+
+// Installs new local mappings for the entries of a deserialized FID map whose
+// ObjectIDs were replaced. Each entry is looked up once in the old-to-new map
+// instead of scanning the FID map for every mapping.
+void
+FeatureSourceIndex::remap(const std::map<ObjectID,ObjectID>& oldToNew, const FIDMap& oldFIDMap, FIDMap& newFIDMap)
+{
+    Threading::ScopedMutexLock lock(_mutex);
+
+    for (FIDMap::const_iterator j = oldFIDMap.begin(); j != oldFIDMap.end(); ++j)
+    {
+        const RefIDPair* rip = j->second.get();
+        if (!rip)
+            continue;
+
+        std::map<ObjectID, ObjectID>::const_iterator i = oldToNew.find(rip->_oid);
+        if (i != oldToNew.end())
+        {
+            RefIDPair* newrip = new RefIDPair(rip->_fid, i->second);
+            _oids[i->second] = rip->_fid;
+            _fids[rip->_fid] = newrip;
+            newFIDMap[rip->_fid] = newrip;
+        }
+    }
+}
@@ -39,6 +39,19 @@ FeatureFilter::~FeatureFilter()
 {
 }
 
+FilterContext
+FeatureFilter::push(FeatureBatch& input, FilterContext& context)
+{
+    FeatureList features;
+    input.toFeatureList( features );
+
+    FilterContext output = push( features, context );
+
+    input.clear();
+    input.add( features );
+    return output;
+}
+
 /********************************************************************************/
         
 #undef  LC
@@ -132,6 +145,14 @@ FeaturesToNodeFilter::~FeaturesToNodeFilter()
     //nop
 }
 
+osg::Node*
+FeaturesToNodeFilter::push(FeatureBatch& input, FilterContext& context)
+{
+    FeatureList features;
+    input.toFeatureList( features );
+    return push( features, context );
+}
+
 void
 FeaturesToNodeFilter::computeLocalizers( const FilterContext& context )
 {
@@ -76,7 +76,8 @@ _optimizeVertexOrdering( true ),
 _validate              ( false ),
 _maxPolyTilingAngle    ( 45.0f ),
 _useGPULines           ( false ),
-_useOSGTessellator     ( false )
+_useOSGTessellator     ( false ),
+_featureBatching       ( true )
 {
     if (::getenv("OSGEARTH_GPU_SCREEN_SPACE_LINES") != 0L)
     {
@@ -100,7 +101,8 @@ _optimizeVertexOrdering( s_defaults.optimizeVertexOrdering().value() ),
 _validate              ( s_defaults.validate().value() ),
 _maxPolyTilingAngle    ( s_defaults.maxPolygonTilingAngle().value() ),
 _useGPULines           ( s_defaults.useGPUScreenSpaceLines().value() ),
-_useOSGTessellator     ( s_defaults.useOSGTessellator().value() )
+_useOSGTessellator     ( s_defaults.useOSGTessellator().value() ),
+_featureBatching       ( s_defaults.featureBatching().value() )
 {
     fromConfig(conf.getConfig());
 }
@@ -123,6 +125,7 @@ GeometryCompilerOptions::fromConfig( const Config& conf )
     conf.get( "max_polygon_tiling_angle", _maxPolyTilingAngle );
     conf.get( "use_gpu_screen_space_lines", _useGPULines );
     conf.get( "use_osg_tessellator", _useOSGTessellator );
+    conf.get( "feature_batching", _featureBatching );
     
 
     conf.get( "shader_policy", "disable",  _shaderPolicy, SHADERPOLICY_DISABLE );
@@ -149,6 +152,7 @@ GeometryCompilerOptions::getConfig() const
     conf.set( "max_polygon_tiling_angle", _maxPolyTilingAngle );
     conf.set( "use_gpu_screen_space_lines", _useGPULines );
     conf.set( "use_osg_tessellator", _useOSGTessellator );
+    conf.set( "feature_batching", _featureBatching );
 
     conf.set( "shader_policy", "disable",  _shaderPolicy, SHADERPOLICY_DISABLE );
     conf.set( "shader_policy", "inherit",  _shaderPolicy, SHADERPOLICY_INHERIT );
@@ -394,6 +398,14 @@ GeometryCompiler::compile(FeatureList&          workingSet,
         }
     }
 
+    // Extrusion and simple geometry run over a columnar copy of the working set.
+    // Text and icons read the clamped feature list, so they keep the list path.
+    osg::ref_ptr<FeatureBatch> batch;
+    if ( _options.featureBatching() == true && !text && !icon && (extrusion || point || line || polygon) )
+    {
+        batch = new FeatureBatch( workingSet );
+    }
+
     // extruded geometry
     if ( extrusion )
     {
@@ -401,7 +413,7 @@ GeometryCompiler::compile(FeatureList&          workingSet,
         {
             AltitudeFilter clamp;
             clamp.setPropertiesFromStyle( style );
-            sharedCX = clamp.push( workingSet, sharedCX );
+            sharedCX = batch.valid() ? clamp.push( *batch, sharedCX ) : clamp.push( workingSet, sharedCX );
             if ( trackHistory ) history.push_back( "altitude" );
             altRequired = false;
         }
@@ -416,7 +428,7 @@ GeometryCompiler::compile(FeatureList&          workingSet,
         if ( _options.mergeGeometry().isSet() )
             extrude.setMergeGeometry( *_options.mergeGeometry() );
 
-        osg::Node* node = extrude.push( workingSet, sharedCX );
+        osg::Node* node = batch.valid() ? extrude.push( *batch, sharedCX ) : extrude.push( workingSet, sharedCX );
         if ( node )
         {
             if ( trackHistory ) history.push_back( "extrude" );
@@ -432,7 +444,7 @@ GeometryCompiler::compile(FeatureList&          workingSet,
         {
             AltitudeFilter clamp;
             clamp.setPropertiesFromStyle( style );
-            sharedCX = clamp.push( workingSet, sharedCX );
+            sharedCX = batch.valid() ? clamp.push( *batch, sharedCX ) : clamp.push( workingSet, sharedCX );
             if ( trackHistory ) history.push_back( "altitude" );
             altRequired = false;
         }
@@ -456,7 +468,7 @@ GeometryCompiler::compile(FeatureList&          workingSet,
         if (render && render->maxCreaseAngle().isSet())
             filter.maxCreaseAngle() = render->maxCreaseAngle().get();
 
-        osg::Node* node = filter.push( workingSet, sharedCX );
+        osg::Node* node = batch.valid() ? filter.push( *batch, sharedCX ) : filter.push( workingSet, sharedCX );
         if ( node )
         {
             if ( trackHistory ) history.push_back( "geometry" );
@@ -119,16 +119,8 @@ TransformFilter::push( Feature* input, FilterContext& context )
 }
 
 FilterContext
-TransformFilter::push( FeatureList& input, FilterContext& incx )
+TransformFilter::createOutputContext( FilterContext& incx ) const
 {
-    _bbox = osg::BoundingBoxd();
-
-    // first transform all the points into the output SRS, collecting a bounding box as we go:
-    bool ok = true;
-    for( FeatureList::iterator i = input.begin(); i != input.end(); i++ )
-        if ( !push( i->get(), incx ) )
-            ok = false;
-
     FilterContext outcx( incx );
 
     if ( _outputSRS.valid() )
@@ -139,6 +131,22 @@ TransformFilter::push( FeatureList& input, FilterContext& incx )
             outcx.setProfile( new FeatureProfile( incx.profile()->getExtent().transform( _outputSRS.get()) ) );
     }
 
+    return outcx;
+}
+
+FilterContext
+TransformFilter::push( FeatureList& input, FilterContext& incx )
+{
+    _bbox = osg::BoundingBoxd();
+
+    // first transform all the points into the output SRS, collecting a bounding box as we go:
+    bool ok = true;
+    for( FeatureList::iterator i = input.begin(); i != input.end(); i++ )
+        if ( !push( i->get(), incx ) )
+            ok = false;
+
+    FilterContext outcx = createOutputContext( incx );
+
     // set the reference frame to shift data to the centroid. This will
     // prevent floating point precision errors in the openGL pipeline for
     // properly gridded data.
@@ -158,3 +166,53 @@ TransformFilter::push( FeatureList& input, FilterContext& incx )
 
     return outcx;
 }
+
+FilterContext
+TransformFilter::push( FeatureBatch& input, FilterContext& incx )
+{
+    _bbox = osg::BoundingBoxd();
+
+    bool needsSRSXform =
+        _outputSRS.valid() &&
+        ( ! incx.profile()->getSRS()->isEquivalentTo( _outputSRS.get() ) );
+
+    bool needsMatrixXform = !_mat.isIdentity();
+
+    // every feature's points are in one buffer, so each step is a single pass
+    // (and the SRS transform a single call) for the whole batch.
+    std::vector<osg::Vec3d>& points = input.getPoints();
+
+    if ( !points.empty() && (needsSRSXform || _localize || needsMatrixXform) )
+    {
+        // pre-transform the points before doing an SRS transformation.
+        if ( needsMatrixXform )
+        {
+            for( unsigned i=0; i < points.size(); ++i )
+                points[i] = points[i] * _mat;
+        }
+
+        if ( needsSRSXform )
+        {
+            incx.profile()->getSRS()->transform( points, _outputSRS.get() );
+            input.setSRS( _outputSRS.get() );
+        }
+
+        if ( _localize )
+        {
+            for( unsigned i=0; i < points.size(); ++i )
+                _bbox.expandBy( points[i] );
+        }
+    }
+
+    FilterContext outcx = createOutputContext( incx );
+
+    // shift the data to the centroid; see push(FeatureList&).
+    if ( _bbox.valid() && _localize )
+    {
+        osg::Vec3d offset = -_bbox.center();
+        for( unsigned i=0; i < points.size(); ++i )
+            points[i] += offset;
+    }
+
+    return outcx;
+}
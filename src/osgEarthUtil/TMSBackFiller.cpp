@@ -22,20 +22,105 @@
 #include <osgEarthUtil/TMSBackFiller>
 #include <osgEarth/FileUtils>
 #include <osgEarth/ImageMosaic>
+#include <osgEarth/ImageUtils>
 
 #include <osgDB/FileUtils>
 #include <osgDB/FileNameUtils>
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
 
+#include <OpenThreads/Thread>
+
+#include <algorithm>
+
 #define LC "[TMSBackFiller] "
 
 using namespace osgEarth::Util;
 using namespace osgEarth;
 
+namespace
+{
+    // Number of neighboring tiles built by one task.
+    const unsigned int BATCH_SIZE = 16u;
+
+    // Interleaves the bits of x and y so that sorting on the result puts the
+    // tiles of a level in Z-order.
+    unsigned long long zOrder( unsigned int x, unsigned int y )
+    {
+        unsigned long long code = 0ull;
+        for (unsigned int bit = 0; bit < 32; ++bit)
+        {
+            code |= (unsigned long long)((x >> bit) & 1u) << (2*bit);
+            code |= (unsigned long long)((y >> bit) & 1u) << (2*bit + 1);
+        }
+        return code;
+    }
+
+    struct SortByZOrder
+    {
+        bool operator()( const TileKey& lhs, const TileKey& rhs ) const
+        {
+            return zOrder(lhs.getTileX(), lhs.getTileY()) < zOrder(rhs.getTileX(), rhs.getTileY());
+        }
+    };
+}
+
+/**
+ * A batch of neighboring keys, built in one task. Whoever gets to it first
+ * runs it: a task thread, or the backfiller when it waits on the batch.
+ */
+struct TMSBackFiller::Batch : public TaskRequest
+{
+    Batch( TMSBackFiller* filler ) :
+        _filler( filler ), _numWritten( 0 ), _claimed( false ) { }
+
+    virtual void operator()( ProgressCallback* )
+    {
+        if (claim())
+            process();
+    }
+
+    void wait()
+    {
+        if (claim())
+            process();
+        else
+            _done.wait();
+    }
+
+    bool claim()
+    {
+        Threading::ScopedMutexLock lock(_claimMutex);
+        if (_claimed)
+            return false;
+        _claimed = true;
+        return true;
+    }
+
+    void process()
+    {
+        for (unsigned int i = 0; i < _keys.size(); ++i)
+        {
+            if (_filler->processKey( _keys[i] ))
+                ++_numWritten;
+        }
+        _done.set();
+    }
+
+    TMSBackFiller*        _filler;
+    std::vector<TileKey>  _keys;
+    unsigned int          _numWritten;
+    Threading::Mutex      _claimMutex;
+    bool                  _claimed;
+    Threading::Event      _done;
+};
+
 TMSBackFiller::TMSBackFiller() :
+_cache(true),
 _minLevel(0u),
 _maxLevel(0u),
+_numThreads(OpenThreads::GetNumberOfProcessors()),
+_cacheSize(1024u),
 _verbose(false)
 {
     //nop
@@ -45,85 +130,179 @@ _verbose(false)
 void TMSBackFiller::process( const std::string& tms, osgDB::Options* options )
 {               
     std::string fullPath = getFullPath( "", tms );        
+    _tmsPath = fullPath;
     _options = options;
 
-    //Read the tilemap
-    _tileMap = TileMapReaderWriter::read( fullPath, 0 );
-    if (_tileMap)
-    {                        
-        //The max level is where we are going to read data from, so we need to start one level up.
-        osg::ref_ptr< const Profile> profile = _tileMap->createProfile();           
+    unsigned int maxLevel = _maxLevel;
+
+    if (osgDB::getLowerCaseFileExtension(fullPath) == "mbtiles")
+    {
+        // Read and write the tiles through the MBTiles driver.
+        Config conf;
+        conf.set("driver", "mbtiles");
+        conf.set("filename", fullPath);
+
+        _tileSource = TileSourceFactory::create( TileSourceOptions(conf) );
+        if (!_tileSource.valid() ||
+            _tileSource->open( TileSource::MODE_READ | TileSource::MODE_WRITE, options ).isError())
+        {
+            OE_WARN << LC << "Failed to open MBTiles database " << _tmsPath << std::endl;
+            _tileSource = 0L;
+            return;
+        }
+        _profile = _tileSource->getProfile();
+
+        // Don't look for data deeper than the database goes.
+        const DataExtentList& dataExtents = _tileSource->getDataExtents();
+        unsigned int dataMaxLevel = 0u;
+        for (DataExtentList::const_iterator i = dataExtents.begin(); i != dataExtents.end(); ++i)
+        {
+            if (i->maxLevel().isSet())
+                dataMaxLevel = osg::maximum( dataMaxLevel, i->maxLevel().get() );
+        }
+        if (!dataExtents.empty())
+            maxLevel = osg::minimum( maxLevel, dataMaxLevel );
+    }
+    else
+    {
+        //Read the tilemap
+        _tileMap = TileMapReaderWriter::read( fullPath, 0 );
+        if (!_tileMap)
+        {
+            OE_NOTICE << "Failed to load TileMap from " << _tmsPath << std::endl;
+            return;
+        }
+        _profile = _tileMap->createProfile();
+
+        // Don't look for data deeper than the tile map goes.
+        if (!_tileMap->getTileSets().empty())
+            maxLevel = osg::minimum( maxLevel, _tileMap->getMaxLevel() );
+    }
 
+    if (_profile.valid())
+    {                        
         //If the bounds aren't valid just use the full extent of the profile.
         if (!_bounds.valid())
         {                
-            _bounds = profile->getExtent().bounds();
+            _bounds = _profile->getExtent().bounds();
         }
 
+        _cache.clear();
+        if (_cacheSize > 0u)
+            _cache.setMaxSize( _cacheSize );
+
+        //The max level is where we are going to read data from, so we need to start one level up.
+        int firstLevel = maxLevel-1;            
 
-        int firstLevel = _maxLevel-1;            
+        GeoExtent extent( _profile->getSRS(), _bounds );           
 
-        GeoExtent extent( profile->getSRS(), _bounds );           
+        osg::ref_ptr<TaskService> taskService = new TaskService( "TMSBackFiller", osg::maximum(_numThreads, 1u) );
 
-        //Process each level in it's entirety
+        //Process each level in it's entirety. Every other level runs backwards, so the
+        //first parents built are the ones whose children were built last and are still
+        //in the cache.
         for (int level = firstLevel; level >= static_cast<int>(_minLevel); level--)
         {
             if (_verbose) OE_NOTICE << "Processing level " << level << std::endl;                
+            processLevel( level, extent, ((firstLevel - level) & 1) != 0, taskService.get() );
+        }            
+    }
+
+    _cache.clear();
 
-            TileKey ll = profile->createTileKey(extent.xMin(), extent.yMin(), level);
-            TileKey ur = profile->createTileKey(extent.xMax(), extent.yMax(), level);
+    // closing the database commits any pending writes.
+    _tileSource = 0L;
+}
 
-            for (unsigned int x = ll.getTileX(); x <= ur.getTileX(); x++)
-            {
-                for (unsigned int y = ur.getTileY(); y <= ll.getTileY(); y++)
-                {
-                    TileKey key = TileKey(level, x, y, profile.get());
-                    processKey( key );
-                }
-            }                
+void TMSBackFiller::processLevel( unsigned int level, const GeoExtent& extent, bool reverse, TaskService* taskService )
+{
+    TileKey ll = _profile->createTileKey(extent.xMin(), extent.yMin(), level);
+    TileKey ur = _profile->createTileKey(extent.xMax(), extent.yMax(), level);
+    if (!ll.valid() || !ur.valid())
+        return;
 
-        }            
+    std::vector<TileKey> keys;
+    for (unsigned int x = ll.getTileX(); x <= ur.getTileX(); x++)
+    {
+        for (unsigned int y = ur.getTileY(); y <= ll.getTileY(); y++)
+        {
+            keys.push_back( TileKey(level, x, y, _profile.get()) );
+        }
     }
-    else
+
+    // In Z-order, the four children of a tile are next to each other, and a
+    // batch of neighboring parents reads a compact block of the level below.
+    std::sort( keys.begin(), keys.end(), SortByZOrder() );
+    if (reverse)
+        std::reverse( keys.begin(), keys.end() );
+
+    std::vector< osg::ref_ptr<Batch> > batches;
+    for (unsigned int i = 0; i < keys.size(); i += BATCH_SIZE)
+    {
+        Batch* batch = new Batch( this );
+        unsigned int end = osg::minimum( i + BATCH_SIZE, (unsigned int)keys.size() );
+        batch->_keys.assign( keys.begin() + i, keys.begin() + end );
+        batches.push_back( batch );
+    }
+
+    // Queue all but the first; this thread starts on the first, then helps
+    // with any batch that no task thread has taken yet.
+    for (unsigned int i = 1; i < batches.size(); ++i)
     {
-        OE_NOTICE << "Failed to load TileMap from " << _tmsPath << std::endl;
+        taskService->add( batches[i].get() );
     }
+
+    unsigned int numWritten = 0;
+    for (unsigned int i = 0; i < batches.size(); ++i)
+    {
+        batches[i]->wait();
+        numWritten += batches[i]->_numWritten;
+    }
+
+    if (_verbose) OE_NOTICE << "Wrote " << numWritten << " of " << keys.size() << " tiles at level " << level << std::endl;
 }
 
-void TMSBackFiller::processKey( const TileKey& key )
+bool TMSBackFiller::processKey( const TileKey& key )
 {
-    if (_verbose) OE_NOTICE << "Processing key " << key.str() << std::endl;
+    OE_DEBUG << LC << "Processing key " << key.str() << std::endl;
 
     //Get all of the child tiles for this key, load them and mosaic them into a new tile
-    TileKey ulKey = key.createChildKey( 0 );
-    TileKey urKey = key.createChildKey( 1 );
-    TileKey llKey = key.createChildKey( 2 );
-    TileKey lrKey = key.createChildKey( 3 );
-
-    osg::ref_ptr< osg::Image > ul = readTile( ulKey );
-    osg::ref_ptr< osg::Image > ur = readTile( urKey );
-    osg::ref_ptr< osg::Image > ll = readTile( llKey );
-    osg::ref_ptr< osg::Image > lr = readTile( lrKey );
-
-    if (ul.valid() && ur.valid() && ll.valid() && lr.valid())
-    {            
-        //Merge them together
+    TileKey childKeys[4];
+    osg::ref_ptr< osg::Image > children[4];
+    for (unsigned int i = 0; i < 4; ++i)
+    {
+        childKeys[i] = key.createChildKey( i );
+        if (!readTile( childKeys[i], children[i] ))
+            return false;
+    }
+
+    osg::ref_ptr< osg::Image > image = ImageUtils::reduce2x2(
+        children[0].get(), children[1].get(), children[2].get(), children[3].get() );
+
+    if (!image.valid())
+    {
+        //The children don't match in size or format, so merge them together
         ImageMosaic mosaic;
-        mosaic.getImages().push_back( TileImage( ul.get(), ulKey ) );
-        mosaic.getImages().push_back( TileImage( ur.get(), urKey ) );
-        mosaic.getImages().push_back( TileImage( ll.get(), llKey ) );
-        mosaic.getImages().push_back( TileImage( lr.get(), lrKey ) );            
+        for (unsigned int i = 0; i < 4; ++i)
+        {
+            mosaic.getImages().push_back( TileImage( children[i].get(), childKeys[i] ) );
+        }
 
         osg::ref_ptr< osg::Image> merged = mosaic.createImage();
         if (merged.valid())
         {
             //Resize the image so it's the same size as one of the input files
-            osg::ref_ptr<osg::Image> resized;
-            ImageUtils::resizeImage( merged.get(), ul->s(), ul->t(), resized );
-            std::string outputFilename = getFilename( key );                
-            writeTile( key, resized.get() );
+            ImageUtils::resizeImage( merged.get(), children[0]->s(), children[0]->t(), image );
         }
-    }                
+    }
+
+    if (!image.valid() || !writeTile( key, image.get() ))
+        return false;
+
+    if (_cacheSize > 0u)
+        _cache.insert( key, image );
+
+    return true;
 }    
 
 std::string TMSBackFiller::getFilename( const TileKey& key )
@@ -131,18 +310,40 @@ std::string TMSBackFiller::getFilename( const TileKey& key )
     return _tileMap->getURL( key, false );        
 }
 
-osg::Image* TMSBackFiller::readTile( const TileKey& key )
+bool TMSBackFiller::readTile( const TileKey& key, osg::ref_ptr< osg::Image >& output )
 {
-    std::string filename = getFilename( key );
-    osg::ref_ptr< osg::Image> image = osgDB::readRefImageFile( filename );
-    return image.release();
+    if (_cacheSize > 0u)
+    {
+        // Each tile has only one parent, so it won't be needed again.
+        LRUCache< TileKey, osg::ref_ptr< osg::Image > >::Record rec;
+        if (_cache.get( key, rec ))
+        {
+            output = rec.value();
+            _cache.erase( key );
+            return output.valid();
+        }
+    }
+
+    if (_tileSource.valid())
+    {
+        output = _tileSource->createImage( key );
+    }
+    else
+    {
+        output = osgDB::readRefImageFile( getFilename( key ) );
+    }
+    return output.valid();
 }
 
-void TMSBackFiller::writeTile( const TileKey& key, osg::Image* image )
+bool TMSBackFiller::writeTile( const TileKey& key, osg::Image* image )
 {
+    if (_tileSource.valid())
+    {
+        return _tileSource->storeImage( key, image, 0L );
+    }
+
     std::string filename = getFilename( key );
     if ( !osgDB::fileExists( osgDB::getFilePath(filename) ) )
         osgEarth::makeDirectoryForFile( filename );
-    osgDB::writeImageFile( *image, filename, _options.get() );        
+    return osgDB::writeImageFile( *image, filename, _options.get() );        
 }
-     
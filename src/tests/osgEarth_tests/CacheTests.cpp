@@ -24,8 +24,18 @@
 #include <osgEarth/GeoData>
 #include <osgEarth/Registry>
 #include <osgEarth/Cache>
+#include <osgEarth/MemCache>
+
+#include <osgEarthDrivers/cache_filesystem/FileSystemCache>
+#include <osgEarthDrivers/cache_pack/PackCacheOptions>
+#include <osgEarthDrivers/cache_pack/PackCacheMigration>
+#include <osgEarthDrivers/cache_leveldb/LevelDBCacheOptions>
+#include <osgEarthDrivers/cache_rocksdb/RocksDBCacheOptions>
+#include <OpenThreads/Thread>
+#include <iomanip>
 
 using namespace osgEarth;
+using namespace osgEarth::Drivers::PackCache;
 
 TEST_CASE( "Cache" ) {
 
@@ -83,3 +93,263 @@ TEST_CASE( "Cache" ) {
         REQUIRE(r2.failed());
     }  
 }
+
+namespace
+{
+    osg::Image* createTestImage()
+    {
+        osg::Image* image = new osg::Image();
+        image->allocateImage(64, 64, 1, GL_RGBA, GL_UNSIGNED_BYTE); // 16K
+        return image;
+    }
+}
+
+TEST_CASE( "MemCache" ) {
+
+    SECTION("Byte budget is shared across bins")
+    {
+        osg::ref_ptr<MemCacheBudget> budget = new MemCacheBudget(10 * 16384);
+        osg::ref_ptr<MemCache> cache = new MemCache(1000, budget.get());
+
+        CacheBin* a = cache->addBin("a");
+        CacheBin* b = cache->addBin("b");
+
+        for(unsigned i=0; i<20; ++i)
+        {
+            osg::ref_ptr<osg::Image> image = createTestImage();
+            REQUIRE(a->write(Stringify() << i, image.get(), 0L));
+        }
+
+        REQUIRE(budget->getBytes() <= budget->getMaxBytes());
+        REQUIRE(a->getStats()._bytes >= 8u * 16384u);
+        REQUIRE(a->getStats()._evictions > 0u);
+
+        // Bin "b" takes its space from "a", the largest bin.
+        for(unsigned i=0; i<5; ++i)
+        {
+            osg::ref_ptr<osg::Image> image = createTestImage();
+            REQUIRE(b->write(Stringify() << i, image.get(), 0L));
+        }
+
+        REQUIRE(b->getStats()._entries == 5u);
+        REQUIRE(budget->getBytes() <= budget->getMaxBytes());
+        REQUIRE(a->getStats()._entries <= 5u);
+
+        REQUIRE(a->clear());
+        REQUIRE(b->clear());
+        REQUIRE(budget->getBytes() == 0u);
+    }
+
+    SECTION("A scan does not flush frequently used entries")
+    {
+        osg::ref_ptr<MemCache> cache = new MemCache(16, new MemCacheBudget(0u));
+        CacheBin* bin = cache->addBin("scan");
+
+        osg::ref_ptr<StringObject> value = new StringObject("value");
+
+        // populate with hot entries, read repeatedly:
+        for(unsigned i=0; i<16; ++i)
+        {
+            std::string key = Stringify() << "hot" << i;
+            REQUIRE(bin->readObject(key, 0L).failed());
+            REQUIRE(bin->write(key, value.get(), 0L));
+            for(unsigned j=0; j<4; ++j)
+                REQUIRE(bin->readObject(key, 0L).succeeded());
+        }
+
+        // a one-pass scan, e.g. a cache seed:
+        unsigned refused = 0u;
+        for(unsigned i=0; i<1000; ++i)
+        {
+            std::string key = Stringify() << "scan" << i;
+            bin->readObject(key, 0L);
+            if (!bin->write(key, value.get(), 0L))
+                ++refused;
+        }
+
+        for(unsigned i=0; i<16; ++i)
+            REQUIRE(bin->getRecordStatus(Stringify() << "hot" << i) == CacheBin::STATUS_OK);
+
+        REQUIRE(bin->getStats()._rejections > 0u);
+        REQUIRE(bin->getStats()._rejections == refused);
+    }
+}
+
+#ifndef _WIN32
+TEST_CASE( "Pack cache" ) {
+
+    PackCacheOptions options;
+    options.rootPath() = "pack_cache_test";
+
+    {
+        osg::ref_ptr<Cache> cache = CacheFactory::create(options);
+        REQUIRE(cache.valid());
+
+        osg::ref_ptr<CacheBin> bin = cache->addBin("test_bin");
+        REQUIRE(bin.valid());
+        REQUIRE(bin->clear());
+
+        // Write a bunch of records, overwriting half of them
+        for(unsigned i=0; i<1000; ++i)
+        {
+            osg::ref_ptr<StringObject> s = new StringObject(Stringify() << "value " << i);
+            REQUIRE(bin->write(Stringify() << "key " << (i%500), s.get(), 0L));
+        }
+
+        for(unsigned i=0; i<500; ++i)
+        {
+            ReadResult r = bin->readString(Stringify() << "key " << i, 0L);
+            REQUIRE(r.succeeded());
+            REQUIRE(r.getString() == (std::string)(Stringify() << "value " << (i+500)));
+        }
+
+        REQUIRE(bin->remove("key 0"));
+        REQUIRE(bin->readString("key 0", 0L).failed());
+        REQUIRE(bin->getRecordStatus("key 0") == CacheBin::STATUS_NOT_FOUND);
+        REQUIRE(bin->getRecordStatus("key 1") == CacheBin::STATUS_OK);
+        REQUIRE(bin->getStorageSize() > 0u);
+    }
+
+    // Reopen and make sure everything survived
+    {
+        osg::ref_ptr<Cache> cache = CacheFactory::create(options);
+        REQUIRE(cache.valid());
+
+        osg::ref_ptr<CacheBin> bin = cache->addBin("test_bin");
+        REQUIRE(bin.valid());
+
+        REQUIRE(bin->readString("key 0", 0L).failed());
+
+        ReadResult r = bin->readString("key 499", 0L);
+        REQUIRE(r.succeeded());
+        REQUIRE(r.getString() == "value 999");
+
+        REQUIRE(bin->clear());
+        REQUIRE(bin->readString("key 499", 0L).failed());
+    }
+}
+
+TEST_CASE( "Pack cache migration keeps record types" ) {
+
+    osgEarth::Drivers::FileSystemCacheOptions fsOptions;
+    fsOptions.rootPath() = "pack_migration_source";
+
+    PackCacheOptions packOptions;
+    packOptions.rootPath() = "pack_migration_test";
+
+    osg::ref_ptr<osg::Image> image = ImageUtils::createOnePixelImage(osg::Vec4(1, 0, 0, 1));
+
+    osg::ref_ptr<osg::Group> node = new osg::Group();
+    node->setName("migrated_node");
+
+    Config meta("meta");
+    meta.set("source", "migration");
+
+    Config binMeta("bin");
+    binMeta.set("driver", "test");
+
+    {
+        osg::ref_ptr<Cache> fs = CacheFactory::create(fsOptions);
+        REQUIRE(fs.valid());
+        osg::ref_ptr<CacheBin> bin = fs->addBin("test_bin");
+        REQUIRE(bin.valid());
+        REQUIRE(bin->clear());
+        REQUIRE(bin->write("image_key", image.get(), meta, 0L));
+        REQUIRE(bin->write("node_key", node.get(), meta, 0L));
+        REQUIRE(bin->writeMetadata(binMeta));
+    }
+
+    osg::ref_ptr<Cache> pack = CacheFactory::create(packOptions);
+    REQUIRE(pack.valid());
+    REQUIRE(pack->addBin("test_bin")->clear());
+
+    PackCacheMigration migration;
+    REQUIRE(migration.run("pack_migration_source", pack.get()) == 2u);
+    REQUIRE(migration.getNumErrors() == 0u);
+
+    osg::ref_ptr<CacheBin> bin = pack->getBin("test_bin");
+    REQUIRE(bin.valid());
+
+    ReadResult ri = bin->readImage("image_key", 0L);
+    REQUIRE(ri.succeeded());
+    REQUIRE(ImageUtils::areEquivalent(ri.getImage(), image.get()));
+    REQUIRE(ri.metadata().value("source") == "migration");
+
+    ReadResult rn = bin->readNode("node_key", 0L);
+    REQUIRE(rn.succeeded());
+    REQUIRE(rn.getNode()->getName() == "migrated_node");
+
+    REQUIRE(bin->readMetadata().value("driver") == "test");
+
+    REQUIRE(bin->clear());
+}
+#endif
+
+namespace
+{
+    // Writes about 3 MB into a cache limited to 1 MB and waits for the
+    // background eviction to bring it back under the limit.
+    void testBoundedCache(const CacheOptions& options)
+    {
+        const off_t limit = 1048576;
+
+        osg::ref_ptr<Cache> cache = CacheFactory::create(options);
+        if (!cache.valid() || !cache->isOK())
+        {
+            WARN("Cache driver \"" << options.getDriver() << "\" is not available; skipping");
+            return;
+        }
+
+        osg::ref_ptr<CacheBin> bin = cache->addBin("test_bin");
+        REQUIRE(bin.valid());
+        REQUIRE(bin->clear());
+
+        const unsigned count = 3000u;
+        const std::string payload(1024, 'x');
+        for(unsigned i=0; i<count; ++i)
+        {
+            osg::ref_ptr<StringObject> s = new StringObject(payload);
+            REQUIRE(bin->write(Stringify() << "key " << std::setw(5) << std::setfill('0') << i, s.get(), 0L));
+        }
+
+        // overwrites must not count twice:
+        for(unsigned i=count-100u; i<count; ++i)
+        {
+            osg::ref_ptr<StringObject> s = new StringObject(payload);
+            REQUIRE(bin->write(Stringify() << "key " << std::setw(5) << std::setfill('0') << i, s.get(), 0L));
+        }
+
+        for(unsigned i=0; i<100u && cache->getApproximateSize() > limit; ++i)
+        {
+            OpenThreads::Thread::microSleep(50000u);
+        }
+
+        REQUIRE(cache->getApproximateSize() > 0);
+        REQUIRE(cache->getApproximateSize() <= limit);
+        REQUIRE(bin->getRecordStatus("key 00000") == CacheBin::STATUS_NOT_FOUND);
+        REQUIRE(bin->getRecordStatus(Stringify() << "key " << std::setw(5) << std::setfill('0') << (count-1u)) == CacheBin::STATUS_OK);
+
+        REQUIRE(bin->clear());
+    }
+}
+
+#ifndef _WIN32
+TEST_CASE( "Bounded cache" ) {
+
+    SECTION("LevelDB")
+    {
+        Drivers::LevelDBCache::LevelDBCacheOptions options;
+        options.rootPath() = "leveldb_bounded_cache_test";
+        options.maxSizeMB() = 1u;
+        testBoundedCache(options);
+    }
+
+    SECTION("RocksDB")
+    {
+        Drivers::RocksDBCache::RocksDBCacheOptions options;
+        options.rootPath() = "rocksdb_bounded_cache_test";
+        options.maxSizeMB() = 1u;
+        testBoundedCache(options);
+    }
+}
+#endif
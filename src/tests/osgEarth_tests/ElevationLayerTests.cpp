@@ -0,0 +1,290 @@
+/* -*-c++-*- */
+/* osgEarth - Geospatial SDK for OpenSceneGraph
+* Copyright 2019 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/catch.hpp>
+
+#include <osgEarth/Map>
+#include <osgEarth/ElevationLayer>
+#include <osgEarth/HeightFieldUtils>
+#include <osgEarth/Registry>
+#include <osgEarth/TileSource>
+#include <osgEarth/Notify>
+#include <osgEarth/StringUtils>
+#include <osg/Timer>
+
+#include <osgEarthDrivers/gdal/GDALOptions>
+
+using namespace osgEarth;
+using namespace osgEarth::Drivers;
+
+namespace
+{
+    ElevationLayer* createRainierLayer()
+    {
+        GDALOptions gdal;
+        gdal.url() = "../data/mt_rainier_90m.tif";
+        return new ElevationLayer(ElevationLayerOptions("rainier", gdal));
+    }
+
+    osg::HeightField* populate(const Map* map, const TileKey& key, unsigned size)
+    {
+        ElevationLayerVector layers;
+        map->getLayers(layers);
+
+        osg::HeightField* hf = HeightFieldUtils::createReferenceHeightField(key.getExtent(), size, size, 0u, true);
+        layers.populateHeightFieldAndNormalMap(hf, 0L, key, 0L, INTERP_BILINEAR, 0L);
+        return hf;
+    }
+
+    // Heightfields with one height inside a box and no data outside it. The
+    // source reports "dataExtent" as where it has data, and counts its reads.
+    class BoxSource : public TileSource
+    {
+    public:
+        BoxSource(const GeoExtent& box, float height, const GeoExtent& dataExtent) :
+            TileSource(TileSourceOptions()), _box(box), _height(height), _dataExtent(dataExtent)
+        {
+            setPixelsPerTile(17u);
+        }
+
+        Status initialize(const osgDB::Options*)
+        {
+            setProfile(Registry::instance()->getGlobalGeodeticProfile());
+            getDataExtents().push_back(DataExtent(_dataExtent, 0u, 20u));
+            return STATUS_OK;
+        }
+
+        osg::HeightField* createHeightField(const TileKey& key, ProgressCallback*)
+        {
+            ++_reads;
+            const GeoExtent& ex = key.getExtent();
+            unsigned size = getPixelsPerTile();
+            osg::HeightField* hf = HeightFieldUtils::createReferenceHeightField(ex, size, size, 0u, true);
+            for(unsigned r=0; r<size; ++r)
+            {
+                for(unsigned c=0; c<size; ++c)
+                {
+                    double x = ex.xMin() + ex.width()*(double)c/(double)(size-1);
+                    double y = ex.yMin() + ex.height()*(double)r/(double)(size-1);
+                    hf->setHeight(c, r, _box.contains(x, y) ? _height : NO_DATA_VALUE);
+                }
+            }
+            return hf;
+        }
+
+        GeoExtent           _box;
+        float               _height;
+        GeoExtent           _dataExtent;
+        OpenThreads::Atomic _reads;
+    };
+
+    ElevationLayer* createBoxLayer(const std::string& name, BoxSource* source, bool offset =false)
+    {
+        ElevationLayerOptions options(name);
+        options.cachePolicy() = CachePolicy::NO_CACHE;
+        options.offset() = offset;
+        return new ElevationLayer(options, source);
+    }
+
+    GeoExtent westHalf(const GeoExtent& ex)
+    {
+        return GeoExtent(ex.getSRS(), ex.xMin()-1.0, ex.yMin()-1.0, ex.xMin()+0.5*ex.width(), ex.yMax()+1.0);
+    }
+
+    GeoExtent eastHalf(const GeoExtent& ex)
+    {
+        return GeoExtent(ex.getSRS(), ex.xMin()+0.5*ex.width(), ex.yMin()-1.0, ex.xMax()+1.0, ex.yMax()+1.0);
+    }
+
+    // The "i"th of "n" vertical strips across a tile.
+    GeoExtent strip(const GeoExtent& ex, unsigned i, unsigned n)
+    {
+        double w = ex.width()/(double)n;
+        return GeoExtent(ex.getSRS(), ex.xMin()+w*(double)i, ex.yMin()-1.0, ex.xMin()+w*(double)(i+1), ex.yMax()+1.0);
+    }
+
+    GeoExtent world(const GeoExtent& ex)
+    {
+        return GeoExtent(ex.getSRS(), -180.0, -90.0, 180.0, 90.0);
+    }
+
+    // Checks the columns well inside the west and east halves of the tile.
+    bool halvesAre(const osg::HeightField* hf, float west, float east)
+    {
+        unsigned cols = hf->getNumColumns();
+        for(unsigned r=0; r<hf->getNumRows(); ++r)
+        {
+            for(unsigned c=0; c<cols; ++c)
+            {
+                float h = hf->getHeight(c, r);
+                if (c <= cols/4 && fabs(h - west) > 0.001f)
+                    return false;
+                if (c >= 3*cols/4 && fabs(h - east) > 0.001f)
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    // Rainier elevation under "n" layers that each have data in one strip of the tile.
+    Map* createStripMap(const TileKey& key, unsigned n)
+    {
+        Map* map = new Map();
+        map->addLayer(createRainierLayer());
+        for(unsigned i=0; i<n; ++i)
+        {
+            GeoExtent box = strip(key.getExtent(), i, n);
+            map->addLayer(createBoxLayer(Stringify() << "strip" << i, new BoxSource(box, 1000.0f + 100.0f*(float)i, box)));
+        }
+        return map;
+    }
+
+    // Checks the column down the middle of each strip.
+    bool stripsAre(const osg::HeightField* hf, unsigned n)
+    {
+        for(unsigned i=0; i<n; ++i)
+        {
+            unsigned c = (2*i+1)*(hf->getNumColumns()-1)/(2*n);
+            for(unsigned r=0; r<hf->getNumRows(); ++r)
+            {
+                if (fabs(hf->getHeight(c, r) - (1000.0f + 100.0f*(float)i)) > 0.001f)
+                    return false;
+            }
+        }
+        return true;
+    }
+}
+
+TEST_CASE( "ElevationLayerVector resampling fills no-data from the layers below" ) {
+    osg::ref_ptr<Map> map = new Map();
+
+    // a tile that only partly covers the Rainier data:
+    TileKey key = map->getProfile()->createTileKey(-121.76, 46.85, 9);
+    REQUIRE(key.valid());
+    const GeoExtent& ex = key.getExtent();
+
+    // Rainier at the bottom, a layer that claims the world but only has data
+    // in the east half of the tile, and an offset over everything.
+    osg::ref_ptr<ElevationLayer> rainier = createRainierLayer();
+    map->addLayer(rainier.get());
+    map->addLayer(createBoxLayer("east", new BoxSource(eastHalf(ex), 1000.0f, world(ex))));
+    map->addLayer(createBoxLayer("offset", new BoxSource(world(ex), 5.0f, world(ex)), true));
+
+    osg::ref_ptr<osg::HeightField> hf = populate(map.get(), key, 129);
+
+    GeoHeightField source = rainier->createHeightField(key, 0L);
+    REQUIRE(source.valid());
+
+    // The east quarter comes from the box layer. The west quarter falls
+    // through to Rainier wherever Rainier has data; its rows must land in
+    // memory order.
+    unsigned checked = 0u, different = 0u;
+    for(unsigned r=0; r<129; ++r)
+    {
+        for(unsigned c=0; c<129; ++c)
+        {
+            float h = hf->getHeight(c, r);
+            if (c >= 96)
+            {
+                if (fabs(h - 1005.0f) > 0.001f) ++different;
+            }
+            else if (c <= 32)
+            {
+                float expected;
+                double x = ex.xMin() + ex.width()*c/128.0, y = ex.yMin() + ex.height()*r/128.0;
+                if (source.getElevation(ex.getSRS(), x, y, INTERP_BILINEAR, ex.getSRS(), expected) && expected != NO_DATA_VALUE)
+                {
+                    ++checked;
+                    if (fabs(h - (expected + 5.0f)) > 0.01f) ++different;
+                }
+            }
+        }
+    }
+    REQUIRE(checked > 0u);
+    REQUIRE(different == 0u);
+}
+
+TEST_CASE( "ElevationLayerVector resamples stacks of partial layers" ) {
+    const Profile* profile = Registry::instance()->getGlobalGeodeticProfile();
+    TileKey key = profile->createTileKey(-121.76, 46.85, 9);
+
+    unsigned stacks[] = { 1u, 2u, 4u };
+    for(unsigned s=0; s<3; ++s)
+    {
+        osg::ref_ptr<Map> map = createStripMap(key, stacks[s]);
+
+        // warm up any caches
+        osg::ref_ptr<osg::HeightField> hf = populate(map.get(), key, 257);
+
+        const unsigned runs = 5u;
+        osg::Timer_t t0 = osg::Timer::instance()->tick();
+        for(unsigned i=0; i<runs; ++i)
+            hf = populate(map.get(), key, 257);
+        double ms = osg::Timer::instance()->delta_m(t0, osg::Timer::instance()->tick()) / (double)runs;
+
+        OE_INFO << stacks[s] << "-strip stack: " << ms << " ms per 257x257 tile" << std::endl;
+
+        REQUIRE(stripsAre(hf.get(), stacks[s]));
+    }
+}
+
+TEST_CASE( "ElevationLayerVector composites layers in priority order around no-data" ) {
+    osg::ref_ptr<Map> map = new Map();
+    TileKey key = map->getProfile()->createTileKey(10.0, 10.0, 6);
+    const GeoExtent& ex = key.getExtent();
+
+    // the top layer only has data in the west half; the offset applies everywhere.
+    osg::ref_ptr<BoxSource> low = new BoxSource(world(ex), 10.0f, world(ex));
+    osg::ref_ptr<BoxSource> high = new BoxSource(westHalf(ex), 100.0f, westHalf(ex));
+    osg::ref_ptr<BoxSource> offset = new BoxSource(world(ex), 5.0f, world(ex));
+    map->addLayer(createBoxLayer("low", low.get()));
+    map->addLayer(createBoxLayer("high", high.get()));
+    map->addLayer(createBoxLayer("offset", offset.get(), true));
+
+    osg::ref_ptr<osg::HeightField> hf = populate(map.get(), key, 17);
+    REQUIRE(halvesAre(hf.get(), 105.0f, 15.0f));
+}
+
+TEST_CASE( "ElevationLayerVector skips layers below one that covers the tile" ) {
+    osg::ref_ptr<Map> map = new Map();
+    TileKey key = map->getProfile()->createTileKey(10.0, 10.0, 6);
+    const GeoExtent& ex = key.getExtent();
+
+    osg::ref_ptr<BoxSource> low = new BoxSource(world(ex), 10.0f, world(ex));
+    osg::ref_ptr<BoxSource> high = new BoxSource(world(ex), 100.0f, world(ex));
+    map->addLayer(createBoxLayer("low", low.get()));
+    map->addLayer(createBoxLayer("high", high.get()));
+
+    osg::ref_ptr<osg::HeightField> hf = populate(map.get(), key, 17);
+    REQUIRE(halvesAre(hf.get(), 100.0f, 100.0f));
+    REQUIRE((unsigned)low->_reads == 0u);
+
+    SECTION("but still fills holes in the covering layer from below") {
+        // claims the whole world but only has data in the west half:
+        osg::ref_ptr<BoxSource> holes = new BoxSource(westHalf(ex), 50.0f, world(ex));
+        map->addLayer(createBoxLayer("holes", holes.get()));
+
+        hf = populate(map.get(), key, 17);
+        REQUIRE(halvesAre(hf.get(), 50.0f, 100.0f));
+        REQUIRE((unsigned)low->_reads == 0u);
+    }
+}
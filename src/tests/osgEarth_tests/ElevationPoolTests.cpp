@@ -0,0 +1,200 @@
+/* -*-c++-*- */
+/* osgEarth - Geospatial SDK for OpenSceneGraph
+* Copyright 2019 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include <osgEarth/catch.hpp>
+
+#include <osgEarth/Map>
+#include <osgEarth/ElevationPool>
+#include <osgEarth/ElevationLayer>
+#include <osgEarth/Random>
+#include <osgEarth/TaskService>
+#include <osgEarth/ThreadingUtils>
+
+#include <osgEarthDrivers/gdal/GDALOptions>
+
+using namespace osgEarth;
+using namespace osgEarth::Drivers;
+
+namespace
+{
+    Map* createRainierMap()
+    {
+        GDALOptions gdal;
+        gdal.url() = "../data/mt_rainier_90m.tif";
+        Map* map = new Map();
+        map->addLayer(new ElevationLayer(ElevationLayerOptions("rainier", gdal)));
+        return map;
+    }
+
+    // Occupies a TaskService thread until released or canceled, so the
+    // requests queued behind it wait.
+    struct BlockingRequest : public TaskRequest
+    {
+        void operator()(ProgressCallback*)
+        {
+            _started.set();
+            while (!_release.wait(10u) && !wasCanceled());
+        }
+        Threading::Event _started, _release;
+    };
+
+    void createQueryPoints(unsigned num, std::vector<osg::Vec3d>& points)
+    {
+        Random prng(0u);
+        points.resize(num);
+        for(unsigned i=0; i<num; ++i)
+        {
+            points[i].set(-121.9 + 0.4*prng.next(), 46.7 + 0.3*prng.next(), 0.0);
+        }
+    }
+}
+
+TEST_CASE( "ElevationEnvelope::getElevations matches the per-point path" ) {
+
+    osg::ref_ptr<Map> map = createRainierMap();
+    const SpatialReference* wgs84 = SpatialReference::get("wgs84");
+
+    std::vector<osg::Vec3d> points;
+    createQueryPoints(1000, points);
+
+    osg::ref_ptr<ElevationEnvelope> batchEnv = map->getElevationPool()->createEnvelope(wgs84, 12);
+    std::vector<float> batch;
+    unsigned count = batchEnv->getElevations(points, batch);
+    REQUIRE(batch.size() == points.size());
+    REQUIRE(count > 0u);
+
+    osg::ref_ptr<ElevationEnvelope> pointEnv = map->getElevationPool()->createEnvelope(wgs84, 12);
+    for(unsigned i=0; i<points.size(); ++i)
+    {
+        float z = pointEnv->getElevation(points[i].x(), points[i].y());
+        REQUIRE(batch[i] == Approx(z).epsilon(1e-5));
+    }
+}
+
+TEST_CASE( "ElevationPool tile cache counts hits, misses and evictions" ) {
+
+    osg::ref_ptr<Map> map = createRainierMap();
+    const SpatialReference* wgs84 = SpatialReference::get("wgs84");
+    ElevationPool* pool = map->getElevationPool();
+    pool->setMaxEntries(20);
+
+    // Two separate envelopes querying the same point share one pooled tile:
+    osg::ref_ptr<ElevationEnvelope> env1 = pool->createEnvelope(wgs84, 10);
+    env1->getElevation(-121.76, 46.85);
+    REQUIRE(pool->getNumMisses() == 1u);
+
+    osg::ref_ptr<ElevationEnvelope> env2 = pool->createEnvelope(wgs84, 10);
+    env2->getElevation(-121.76, 46.85);
+    REQUIRE(pool->getNumMisses() == 1u);
+    REQUIRE(pool->getNumHits() == 1u);
+
+    // Walk across many tiles; the small budget forces evictions, and the
+    // cache never holds more than it allows.
+    osg::ref_ptr<ElevationEnvelope> env3 = pool->createEnvelope(wgs84, 14);
+    for(unsigned i=0; i<64; ++i)
+        env3->getElevation(-121.9 + 0.006*(double)i, 46.85);
+    REQUIRE(pool->getNumEvictions() > 0u);
+    REQUIRE(pool->getStats()._entries <= 20u);
+}
+
+TEST_CASE( "ElevationPool duplicate queries" ) {
+
+    osg::ref_ptr<Map> map = createRainierMap();
+    ElevationPool* pool = map->getElevationPool();
+    GeoPoint point(SpatialReference::get("wgs84"), -121.76, 46.85, 0.0);
+
+    osg::ref_ptr<TaskService> service = new TaskService("ElevationPoolTest", 1);
+    pool->setTaskService(service.get());
+
+    osg::ref_ptr<BlockingRequest> blocker = new BlockingRequest();
+    service->add(blocker.get());
+    blocker->_started.wait();
+
+    SECTION("All callers get a result, even if the first one gives up")
+    {
+        Future<ElevationSample> first = pool->getElevation(point, 10, 0.0f);
+        Future<ElevationSample> second = pool->getElevation(point, 10, 0.0f);
+        Future<ElevationSample> urgent = pool->getElevation(point, 10, 10.0f);
+        first = Future<ElevationSample>();
+
+        blocker->_release.set();
+
+        osg::ref_ptr<ElevationSample> a = second.get();
+        osg::ref_ptr<ElevationSample> b = urgent.get();
+        REQUIRE(a.valid());
+        REQUIRE(b.valid());
+        REQUIRE(a->elevation == b->elevation);
+        REQUIRE(a->elevation > 1000.0f);
+    }
+
+    SECTION("Dropped queries fail instead of hanging")
+    {
+        Future<ElevationSample> first = pool->getElevation(point, 10, 0.0f);
+        Future<ElevationSample> second = pool->getElevation(point, 10, 5.0f);
+
+        // Shutting the service down drops the queued ops without running them:
+        pool->setTaskService(0L);
+        service = 0L;
+
+        REQUIRE(first.isAvailable());
+        REQUIRE(second.isAvailable());
+        REQUIRE(first.get() == 0L);
+        REQUIRE(second.get() == 0L);
+
+        // ...and the query is no longer pending, so asking again works:
+        Future<ElevationSample> again = pool->getElevation(point, 10, 0.0f);
+        osg::ref_ptr<ElevationSample> sample = again.get();
+        REQUIRE(sample.valid());
+    }
+
+    blocker->_release.set();
+    pool->setTaskService(0L);
+}
+
+TEST_CASE( "ElevationEnvelope batch vs. per-point benchmark", "[.benchmark]" ) {
+
+    osg::ref_ptr<Map> map = createRainierMap();
+    const SpatialReference* wgs84 = SpatialReference::get("wgs84");
+
+    std::vector<osg::Vec3d> points;
+    createQueryPoints(200000, points);
+
+    // warm up the pool so both runs hit the same cached tiles
+    osg::ref_ptr<ElevationEnvelope> env = map->getElevationPool()->createEnvelope(wgs84, 12);
+    std::vector<float> output;
+    env->getElevations(points, output);
+
+    env = map->getElevationPool()->createEnvelope(wgs84, 12);
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+    for(unsigned i=0; i<points.size(); ++i)
+        env->getElevation(points[i].x(), points[i].y());
+    double perPoint = osg::Timer::instance()->delta_s(t0, osg::Timer::instance()->tick());
+
+    env = map->getElevationPool()->createEnvelope(wgs84, 12);
+    t0 = osg::Timer::instance()->tick();
+    env->getElevations(points, output);
+    double batched = osg::Timer::instance()->delta_s(t0, osg::Timer::instance()->tick());
+
+    OE_NOTICE << points.size() << " points: per-point = " << perPoint << "s, batched = " << batched
+        << "s (" << (batched > 0.0 ? perPoint/batched : 0.0) << "x)" << std::endl;
+}
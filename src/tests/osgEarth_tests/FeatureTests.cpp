@@ -22,12 +22,222 @@
 
 #include <osgEarth/catch.hpp>
 
+#include <osgEarthFeatures/BinaryNodeCache>
 #include <osgEarthFeatures/Feature>
+#include <osgEarthFeatures/FeatureBatch>
+#include <osgEarthFeatures/FeatureListSource>
+#include <osgEarthFeatures/FeatureModelGraph>
+#include <osgEarthFeatures/FeatureSourceIndexNode>
+#include <osgEarthFeatures/GeometryCompiler>
 #include <osgEarthFeatures/GeometryUtils>
+#include <osgEarthFeatures/ScriptEngine>
+#include <osgEarthFeatures/Session>
+#include <osgEarthFeatures/TransformFilter>
+#include <osgEarthSymbology/PointSymbol>
+#include <osgEarth/Map>
+#include <osgEarth/MemCache>
+#include <osgEarth/Registry>
+#include <osgEarth/StringUtils>
+#include <osgEarth/TaskService>
+#include <osgEarth/TileKey>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/LOD>
+#include <osg/Material>
+#include <osg/MatrixTransform>
+#include <osg/NodeVisitor>
+#include <osg/Timer>
+#include <osgDB/Registry>
+#include <OpenThreads/Thread>
+#include <sstream>
+
+#include <osgEarthDrivers/feature_ogr/OGRFeatureOptions>
+#include <gdal.h>
 
 using namespace osgEarth;
 using namespace osgEarth::Symbology;
 using namespace osgEarth::Features;
+using namespace osgEarth::Drivers;
+
+namespace
+{
+    // Gathers every vertex under a node, in traversal order.
+    struct CollectVerts : public osg::NodeVisitor
+    {
+        std::vector<osg::Vec3> verts;
+
+        CollectVerts() : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN) { }
+
+        void apply(osg::Geode& geode)
+        {
+            for (unsigned i = 0; i < geode.getNumDrawables(); ++i)
+            {
+                osg::Geometry* geom = geode.getDrawable(i)->asGeometry();
+                osg::Vec3Array* v = geom ? dynamic_cast<osg::Vec3Array*>(geom->getVertexArray()) : 0L;
+                if (v)
+                    verts.insert(verts.end(), v->begin(), v->end());
+            }
+        }
+    };
+
+    std::vector<osg::Vec3> compileVerts(const FeatureList& features, const Style& style, bool batching)
+    {
+        // compile() works in place, so each run gets its own copy.
+        FeatureList workingSet;
+        for (FeatureList::const_iterator i = features.begin(); i != features.end(); ++i)
+            workingSet.push_back(new Feature(*i->get()));
+
+        GeometryCompilerOptions options;
+        options.featureBatching() = batching;
+        options.shaderPolicy() = SHADERPOLICY_INHERIT;
+        options.optimizeStateSharing() = false;
+
+        osg::ref_ptr<osg::Node> node = GeometryCompiler(options).compile(workingSet, style, FilterContext());
+        CollectVerts collect;
+        if (node.valid())
+            node->accept(collect);
+        return collect.verts;
+    }
+
+    // One tile-sized query per quadrant of the world.
+    Query quadrant(unsigned i)
+    {
+        Query query;
+        double x = (i % 2) == 0 ? -180.0 : 0.0;
+        double y = (i / 2) == 0 ? -90.0 : 0.0;
+        query.bounds() = Bounds(x, y, x + 180.0, y + 90.0);
+        return query;
+    }
+
+    // Reads a query to the end, returning the number of features and the sum of their FIDs.
+    void readAll(FeatureSource* source, const Query& query, unsigned& count, FeatureID& fidSum)
+    {
+        count = 0u;
+        fidSum = 0;
+        osg::ref_ptr<FeatureCursor> cursor = source->createFeatureCursor(query, 0L);
+        while (cursor.valid() && cursor->hasMore())
+        {
+            Feature* f = cursor->nextFeature();
+            ++count;
+            fidSum += f->getFID();
+        }
+    }
+
+    // Reads every quadrant several times and checks each against the expected result.
+    class CursorWorker : public OpenThreads::Thread
+    {
+    public:
+        CursorWorker(FeatureSource* source, const unsigned* counts, const FeatureID* fidSums) :
+            _source(source), _counts(counts), _fidSums(fidSums), _ok(true) { }
+
+        void run()
+        {
+            for (unsigned pass = 0; pass < 8; ++pass)
+            {
+                unsigned i = pass % 4;
+                unsigned count;
+                FeatureID fidSum;
+                readAll(_source.get(), quadrant(i), count, fidSum);
+                if (count != _counts[i] || fidSum != _fidSums[i])
+                    _ok = false;
+            }
+        }
+
+        osg::ref_ptr<FeatureSource> _source;
+        const unsigned*  _counts;
+        const FeatureID* _fidSums;
+        bool             _ok;
+    };
+
+    // A writable source whose features are tiled on the global-geodetic profile.
+    class TiledListSource : public FeatureListSource
+    {
+    public:
+        TiledListSource(const GeoExtent& extent) : FeatureListSource(extent)
+        {
+            setFeatureProfile(createFeatureProfile());
+        }
+
+        bool insertFeature(Feature* feature)
+        {
+            // the base class drops the profile on every edit.
+            FeatureListSource::insertFeature(feature);
+            setFeatureProfile(createFeatureProfile());
+            return true;
+        }
+
+    protected:
+        const FeatureProfile* createFeatureProfile()
+        {
+            FeatureProfile* profile = new FeatureProfile(_defaultExtent);
+            profile->setTiled(true);
+            profile->setFirstLevel(1);
+            profile->setMaxLevel(1);
+            profile->setProfile(Registry::instance()->getGlobalGeodeticProfile());
+            return profile;
+        }
+    };
+
+    // Makes an empty node for every style group.
+    class EmptyNodeFactory : public FeatureNodeFactory
+    {
+    public:
+        bool createOrUpdateNode(FeatureCursor* cursor, const Style& style, const FilterContext& context, osg::ref_ptr<osg::Node>& node)
+        {
+            node = new osg::Group();
+            return true;
+        }
+    };
+
+    // Makes a node named after the run of features it was given.
+    class RunNodeFactory : public FeatureNodeFactory
+    {
+    public:
+        bool createOrUpdateNode(FeatureCursor* cursor, const Style& style, const FilterContext& context, osg::ref_ptr<osg::Node>& node)
+        {
+            FeatureList features;
+            cursor->fill(features);
+            if (features.empty())
+                return false;
+
+            node = new osg::Group();
+            node->setName(Stringify() << style.getName() << ":" << features.front()->getFID() << "-" << features.back()->getFID() << ":" << features.size());
+            return true;
+        }
+    };
+
+    // Lists every node under a graph, in traversal order.
+    struct DescribeGraph : public osg::NodeVisitor
+    {
+        std::vector<std::string> nodes;
+
+        DescribeGraph() : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN) { }
+
+        void apply(osg::Node& node)
+        {
+            osg::Group* group = node.asGroup();
+            nodes.push_back(Stringify() << node.className() << " " << node.getName() << " " << (group ? group->getNumChildren() : 0u));
+            traverse(node);
+        }
+    };
+
+    // Number of GDAL datasets open on a file.
+    unsigned numOpenDatasets(const std::string& filename)
+    {
+        unsigned num = 0u;
+#if GDAL_VERSION_MAJOR >= 2
+        GDALDatasetH* datasets = 0L;
+        int count = 0;
+        GDALGetOpenDatasets(&datasets, &count);
+        for (int i = 0; i < count; ++i)
+        {
+            if (endsWith(GDALGetDescription(datasets[i]), filename))
+                ++num;
+        }
+#endif
+        return num;
+    }
+}
 
 TEST_CASE("Feature::splitAcrossDateLine doesn't modify features that don't cross the dateline") {
     osg::ref_ptr< Feature > feature = new Feature(GeometryUtils::geometryFromWKT("POLYGON((-81 26, -40.5 45, -40.5 75.5, -81 60))"), osgEarth::SpatialReference::create("wgs84"));
@@ -105,3 +315,842 @@ TEST_CASE("Feature handles attributes correctly.") {
         REQUIRE(feature->getBool("bool") == false);
     }
 }
+
+TEST_CASE("FeatureBatch round-trips a FeatureList") {
+    osg::ref_ptr<const SpatialReference> wgs84 = SpatialReference::create("wgs84");
+
+    FeatureList input;
+    osg::ref_ptr<Feature> building = new Feature(GeometryUtils::geometryFromWKT("POLYGON((0 0, 10 0, 10 10, 0 10),(2 2, 4 2, 4 4, 2 4))"), wgs84.get(), Style(), 1);
+    building->set("Height", 25.0);
+    building->set("name", std::string("tower"));
+    building->set("levels", 8);
+    building->setNull("roof");
+    input.push_back(building.get());
+
+    osg::ref_ptr<Feature> road = new Feature(GeometryUtils::geometryFromWKT("MULTILINESTRING((0 0, 1 1),(2 2, 3 3, 4 4))"), wgs84.get(), Style(), 2);
+    road->set("name", std::string("tower"));
+    road->set("lanes", 2);
+    input.push_back(road.get());
+
+    osg::ref_ptr<FeatureBatch> batch = new FeatureBatch(input);
+
+    REQUIRE(batch->size() == 2);
+    REQUIRE((int)batch->getPoints().size() == building->getGeometry()->getTotalPointCount() + road->getGeometry()->getTotalPointCount());
+
+    SECTION("Attributes are interned columns") {
+        REQUIRE(batch->getAttributeIndex("HEIGHT") == batch->getAttributeIndex("height"));
+        int height = batch->getAttributeIndex("height");
+        int lanes = batch->getAttributeIndex("lanes");
+        int roof = batch->getAttributeIndex("roof");
+        REQUIRE(height >= 0);
+        REQUIRE(batch->getDouble(0, height) == 25.0);
+        REQUIRE(batch->hasAttr(1, height) == false);
+        REQUIRE(batch->getDouble(1, height, -1.0) == -1.0);
+        REQUIRE(batch->getInt(1, lanes) == 2);
+        REQUIRE(batch->hasAttr(0, roof) == true);
+        REQUIRE(batch->isSet(0, roof) == false);
+    }
+
+    SECTION("Geometry keeps its parts and holes") {
+        REQUIRE(batch->getNumParts(0) == 2);
+        REQUIRE(batch->getPart(batch->getFirstPart(0)).type == Geometry::TYPE_POLYGON);
+        REQUIRE(batch->getPart(batch->getFirstPart(0) + 1).hole == true);
+        REQUIRE(batch->getNumParts(1) == 2);
+    }
+
+    SECTION("Features come back the way they went in") {
+        FeatureList output;
+        batch->toFeatureList(output);
+        REQUIRE(output.size() == 2);
+
+        Feature* f = output.front().get();
+        REQUIRE(f->getFID() == 1);
+        REQUIRE(f->getDouble("height") == 25.0);
+        REQUIRE(f->getString("name") == "tower");
+        REQUIRE(f->getInt("levels") == 8);
+        REQUIRE(f->hasAttr("roof") == true);
+        REQUIRE(f->isSet("roof") == false);
+        REQUIRE(f->hasAttr("lanes") == false);
+        REQUIRE(f->getGeometry()->getType() == Geometry::TYPE_POLYGON);
+        REQUIRE(static_cast<Polygon*>(f->getGeometry())->getHoles().size() == 1);
+
+        Feature* g = output.back().get();
+        REQUIRE(g->getGeometry()->getType() == Geometry::TYPE_MULTI);
+        REQUIRE(g->getGeometry()->getTotalPointCount() == road->getGeometry()->getTotalPointCount());
+        REQUIRE(g->getInt("lanes") == 2);
+    }
+
+    SECTION("Expressions read the columns") {
+        NumericExpression expr("[height] * 2");
+        REQUIRE(batch->eval(0, expr, 0L) == 50.0);
+
+        StringExpression name("[name]");
+        REQUIRE(batch->eval(1, name, 0L) == "tower");
+    }
+}
+
+TEST_CASE("TransformFilter gives the same result for a FeatureBatch and a FeatureList") {
+    osg::ref_ptr<const SpatialReference> wgs84 = SpatialReference::create("wgs84");
+
+    FeatureList features;
+    for (unsigned i = 0; i < 10; ++i)
+    {
+        Geometry* geom = GeometryUtils::geometryFromWKT("POLYGON((0 0, 10 0, 10 10, 0 10))");
+        features.push_back(new Feature(geom, wgs84.get()));
+    }
+    osg::ref_ptr<FeatureBatch> batch = new FeatureBatch(features);
+
+    TransformFilter filter(osg::Matrixd::translate(1.0, 2.0, 3.0));
+    filter.setLocalizeCoordinates(true);
+
+    FilterContext cx;
+    filter.push(features, cx);
+    filter.push(*batch.get(), cx);
+
+    FeatureList output;
+    batch->toFeatureList(output);
+
+    FeatureList::iterator a = features.begin(), b = output.begin();
+    for (; a != features.end(); ++a, ++b)
+    {
+        const Geometry* ga = a->get()->getGeometry();
+        const Geometry* gb = b->get()->getGeometry();
+        REQUIRE(ga->size() == gb->size());
+        for (unsigned i = 0; i < ga->size(); ++i)
+        {
+            REQUIRE((*ga)[i] == (*gb)[i]);
+        }
+    }
+}
+
+TEST_CASE("GeometryCompiler gives the same geometry with and without feature batching") {
+    osg::ref_ptr<const SpatialReference> wgs84 = SpatialReference::create("wgs84");
+
+    FeatureList features;
+    for (unsigned i = 0; i < 5; ++i)
+    {
+        Geometry* geom = GeometryUtils::geometryFromWKT("POLYGON((0 0, 10 0, 10 10, 0 10),(2 2, 4 2, 4 4, 2 4))");
+        for (Geometry::iterator p = geom->begin(); p != geom->end(); ++p)
+            p->x() += 20.0 * i;
+        Feature* f = new Feature(geom, wgs84.get(), Style(), i);
+        f->set("height", 10.0 + i);
+        features.push_back(f);
+    }
+
+    Style style;
+    style.getOrCreate<PolygonSymbol>()->fill()->color() = Color::White;
+    style.getOrCreate<AltitudeSymbol>()->verticalOffset() = NumericExpression(5.0);
+
+    SECTION("Polygons") {
+        std::vector<osg::Vec3> list = compileVerts(features, style, false);
+        std::vector<osg::Vec3> batch = compileVerts(features, style, true);
+        REQUIRE(list.size() > 0);
+        REQUIRE(list == batch);
+    }
+
+    SECTION("Extrusions") {
+        style.getOrCreate<ExtrusionSymbol>()->heightExpression() = NumericExpression("[height]");
+        std::vector<osg::Vec3> list = compileVerts(features, style, false);
+        std::vector<osg::Vec3> batch = compileVerts(features, style, true);
+        REQUIRE(list.size() > 0);
+        REQUIRE(list == batch);
+    }
+}
+
+TEST_CASE("Feature::eval over a FeatureList matches evaluating each Feature") {
+    osg::ref_ptr<const SpatialReference> wgs84 = SpatialReference::create("wgs84");
+
+    FeatureList features;
+    for (unsigned i = 0; i < 5; ++i)
+    {
+        Feature* feature = new Feature(GeometryUtils::geometryFromWKT("POINT(0 0)"), wgs84.get(), Style(), i);
+        feature->set("name", std::string(Stringify() << "f" << i));
+        if (i % 2 == 0)
+            feature->set("kind", std::string("even"));
+        features.push_back(feature);
+    }
+
+    StringExpression expr("[name]:[kind]");
+
+    std::vector<std::string> results;
+    Feature::eval(expr, features, results, 0L);
+    REQUIRE(results.size() == features.size());
+
+    unsigned i = 0;
+    for (FeatureList::iterator f = features.begin(); f != features.end(); ++f, ++i)
+    {
+        REQUIRE(results[i] == f->get()->eval(expr, (const FilterContext*)0L));
+    }
+    REQUIRE(results[0] == "f0:even");
+    REQUIRE(results[1] == "f1:");
+}
+
+TEST_CASE("BinaryNodeCache round-trips a tile") {
+    osg::Geometry* geom = new osg::Geometry();
+    osg::Vec3Array* verts = new osg::Vec3Array();
+    verts->push_back(osg::Vec3(0, 0, 0));
+    verts->push_back(osg::Vec3(1, 0, 0));
+    verts->push_back(osg::Vec3(1, 1, 0));
+    geom->setVertexArray(verts);
+    osg::Vec4Array* colors = new osg::Vec4Array(osg::Array::BIND_OVERALL);
+    colors->push_back(osg::Vec4(1, 0, 0, 1));
+    geom->setColorArray(colors);
+    osg::DrawElementsUShort* tris = new osg::DrawElementsUShort(GL_TRIANGLES);
+    tris->push_back(0); tris->push_back(1); tris->push_back(2);
+    geom->addPrimitiveSet(tris);
+
+    osg::Geode* geode = new osg::Geode();
+    geode->addDrawable(geom);
+    osg::MatrixTransform* xform = new osg::MatrixTransform(osg::Matrix::translate(10, 20, 30));
+    xform->addChild(geode);
+    osg::ref_ptr<osg::Group> tile = new osg::Group();
+    tile->setName("tile");
+    tile->addChild(xform);
+
+    osg::ref_ptr<BinaryNodeCache> codec = new BinaryNodeCache();
+
+    std::string record;
+    REQUIRE(codec->encode(tile.get(), 0L, 0L, record));
+    REQUIRE(BinaryNodeCache::isBinary(record));
+
+    osg::ref_ptr<osg::Group> out = dynamic_cast<osg::Group*>(codec->decode(record, 0L, 0L, 0L));
+    REQUIRE(out.valid());
+    REQUIRE(out->getName() == "tile");
+    REQUIRE(out->getNumChildren() == 1);
+
+    osg::MatrixTransform* outXform = dynamic_cast<osg::MatrixTransform*>(out->getChild(0));
+    REQUIRE(outXform != 0L);
+    REQUIRE(outXform->getMatrix() == xform->getMatrix());
+
+    osg::Geode* outGeode = dynamic_cast<osg::Geode*>(outXform->getChild(0));
+    REQUIRE(outGeode != 0L);
+    REQUIRE(outGeode->getNumDrawables() == 1);
+
+    osg::Geometry* outGeom = outGeode->getDrawable(0)->asGeometry();
+    REQUIRE(outGeom != 0L);
+    osg::Vec3Array* outVerts = dynamic_cast<osg::Vec3Array*>(outGeom->getVertexArray());
+    REQUIRE(outVerts != 0L);
+    REQUIRE(*outVerts == *verts);
+    osg::Vec4Array* outColors = dynamic_cast<osg::Vec4Array*>(outGeom->getColorArray());
+    REQUIRE(outColors != 0L);
+    REQUIRE(outColors->getBinding() == osg::Array::BIND_OVERALL);
+    REQUIRE(outGeom->getNumPrimitiveSets() == 1);
+    osg::DrawElementsUShort* outTris = dynamic_cast<osg::DrawElementsUShort*>(outGeom->getPrimitiveSet(0));
+    REQUIRE(outTris != 0L);
+    REQUIRE(*outTris == *tris);
+
+    // A damaged record doesn't decode
+    REQUIRE(codec->decode(record.substr(0, record.size()-1), 0L, 0L, 0L) == 0L);
+
+    // ...and neither does one whose state count is larger than the record
+    // (magic, version and byte order come first)
+    std::string huge = record;
+    unsigned numStates = 0xFFFFFFFFu;
+    huge.replace(12, sizeof(numStates), (const char*)&numStates, sizeof(numStates));
+    REQUIRE(codec->decode(huge, 0L, 0L, 0L) == 0L);
+
+    // ...or one whose vertex block claims more bytes than the record holds,
+    // including a length that wraps around when the padding is added to it.
+    std::string vertData((const char*)&verts->front(), verts->size() * sizeof(osg::Vec3));
+    unsigned vertBytes = (unsigned)vertData.size();
+    std::string::size_type dataPos = record.find(vertData);
+    REQUIRE(dataPos != std::string::npos);
+    std::string::size_type lengthPos = record.rfind(std::string((const char*)&vertBytes, sizeof(vertBytes)), dataPos - sizeof(vertBytes));
+    REQUIRE(lengthPos != std::string::npos);
+    unsigned pad = (unsigned)(dataPos - lengthPos - sizeof(vertBytes));
+
+    std::vector<unsigned> badLengths;
+    badLengths.push_back(vertBytes + 1u);
+    badLengths.push_back(0xFFFFFFFFu);
+    if (pad > 0u)
+        badLengths.push_back(0u - pad);
+    for (unsigned i = 0; i < badLengths.size(); ++i)
+    {
+        std::string corrupt = record;
+        corrupt.replace(lengthPos, sizeof(unsigned), (const char*)&badLengths[i], sizeof(unsigned));
+        REQUIRE(codec->decode(corrupt, 0L, 0L, 0L) == 0L);
+    }
+
+    // Nodes the format doesn't cover make encode() fail
+    tile->addChild(new osg::LOD());
+    REQUIRE(codec->encode(tile.get(), 0L, 0L, record) == false);
+}
+
+TEST_CASE("BinaryNodeCache decodes through a cache bin and a feature index") {
+    const SpatialReference* wgs84 = SpatialReference::create("wgs84");
+    osg::ref_ptr<FeatureListSource> source = new FeatureListSource(GeoExtent(wgs84, -180, -90, 180, 90));
+    FeatureList features;
+    for (unsigned i = 0; i < 3; ++i)
+    {
+        Feature* f = new Feature(GeometryUtils::geometryFromWKT("POINT(0 0)"), wgs84);
+        f->setFID(10 + i);
+        source->insertFeature(f);
+        features.push_back(f);
+    }
+    REQUIRE(source->open().isOK());
+
+    osg::ref_ptr<FeatureSourceIndex> index = new FeatureSourceIndex(source.get(), Registry::objectIndex(), FeatureSourceIndexOptions());
+
+    // one state shared by every geometry; the encoder puts it in a record of its own
+    osg::ref_ptr<osg::StateSet> state = new osg::StateSet();
+    osg::Material* material = new osg::Material();
+    material->setDiffuse(osg::Material::FRONT_AND_BACK, osg::Vec4(1, 0, 0, 1));
+    state->setAttributeAndModes(material);
+
+    osg::ref_ptr<FeatureSourceIndexNode> tile = new FeatureSourceIndexNode(index.get());
+    osg::Geode* geode = new osg::Geode();
+    tile->addChild(geode);
+    for (unsigned i = 0; i < features.size(); ++i)
+    {
+        osg::Geometry* geom = new osg::Geometry();
+        osg::Vec3Array* verts = new osg::Vec3Array();
+        verts->push_back(osg::Vec3(i, 0, 0));
+        verts->push_back(osg::Vec3(i + 1, 0, 0));
+        verts->push_back(osg::Vec3(i + 1, 1, 0));
+        geom->setVertexArray(verts);
+        geom->addPrimitiveSet(new osg::DrawArrays(GL_TRIANGLES, 0, 3));
+        geom->setStateSet(state.get());
+        tile->tagDrawable(geom, features[i].get());
+        geode->addDrawable(geom);
+    }
+
+    osg::ref_ptr<MemCache> cache = new MemCache(100);
+    osg::ref_ptr<CacheBin> bin = cache->addBin("tiles");
+
+    std::string record;
+    osg::ref_ptr<BinaryNodeCache> writer = new BinaryNodeCache();
+    REQUIRE(writer->encode(tile.get(), bin.get(), 0L, record));
+
+    // Page the tile out, which takes its features out of the index.
+    tile = 0L;
+    REQUIRE(index->getObjectID(10) == OSGEARTH_OBJECTID_EMPTY);
+
+    // A new reader has no state in memory, so it has to come from the bin.
+    osg::ref_ptr<BinaryNodeCache> reader = new BinaryNodeCache();
+    REQUIRE(reader->decode(record, 0L, index.get(), 0L) == 0L);
+
+    osg::ref_ptr<osg::Node> out = reader->decode(record, bin.get(), index.get(), 0L);
+    FeatureSourceIndexNode* outIndex = dynamic_cast<FeatureSourceIndexNode*>(out.get());
+    REQUIRE(outIndex != 0L);
+    REQUIRE(outIndex->getIndex() == index.get());
+    REQUIRE(outIndex->getFIDMap().size() == features.size());
+
+    osg::Geode* outGeode = dynamic_cast<osg::Geode*>(outIndex->getChild(0));
+    REQUIRE(outGeode != 0L);
+    REQUIRE(outGeode->getNumDrawables() == features.size());
+
+    unsigned location = Registry::objectIndex()->getObjectIDAttribLocation();
+    for (unsigned i = 0; i < features.size(); ++i)
+    {
+        osg::Geometry* geom = outGeode->getDrawable(i)->asGeometry();
+        REQUIRE(geom != 0L);
+
+        // the object IDs in the tile are registered again, and lead back to the features
+        ObjectIDArray* ids = dynamic_cast<ObjectIDArray*>(geom->getVertexAttribArray(location));
+        REQUIRE(ids != 0L);
+        REQUIRE(ids->size() == 3u);
+        REQUIRE((*ids)[0] == index->getObjectID(10 + i));
+        osg::ref_ptr<Feature> feature = index->getFeature((*ids)[0]);
+        REQUIRE(feature.valid());
+        REQUIRE(feature->getFID() == (FeatureID)(10 + i));
+
+        // and the state is shared, as it was when written
+        REQUIRE(geom->getStateSet() != 0L);
+        REQUIRE(geom->getStateSet() == outGeode->getDrawable(0)->getStateSet());
+        osg::Material* outMaterial = dynamic_cast<osg::Material*>(geom->getStateSet()->getAttribute(osg::StateAttribute::MATERIAL));
+        REQUIRE(outMaterial != 0L);
+        REQUIRE(outMaterial->getDiffuse(osg::Material::FRONT) == osg::Vec4(1, 0, 0, 1));
+    }
+}
+
+TEST_CASE("BinaryNodeCache vs. osgb tile load benchmark", "[.benchmark]") {
+    // A tile of extruded buildings, like the ones a FeatureModelGraph caches.
+    osg::ref_ptr<const SpatialReference> wgs84 = SpatialReference::create("wgs84");
+    FeatureList features;
+    for (unsigned i = 0; i < 2000u; ++i)
+    {
+        double x = 0.001 * (i % 50), y = 0.001 * (i / 50);
+        Feature* f = new Feature(GeometryUtils::geometryFromWKT(Stringify()
+            << "POLYGON((" << x << " " << y << ", " << x + 0.0008 << " " << y << ", "
+            << x + 0.0008 << " " << y + 0.0008 << ", " << x << " " << y + 0.0008 << "))"), wgs84.get(), Style(), i);
+        f->set("height", 10.0 + (i % 20));
+        features.push_back(f);
+    }
+
+    Style style;
+    style.getOrCreate<PolygonSymbol>()->fill()->color() = Color::White;
+    style.getOrCreate<ExtrusionSymbol>()->heightExpression() = NumericExpression("[height]");
+
+    GeometryCompilerOptions options;
+    options.shaderPolicy() = SHADERPOLICY_INHERIT;
+    osg::ref_ptr<osg::Group> tile = new osg::Group();
+    tile->addChild(GeometryCompiler(options).compile(features, style, FilterContext()));
+
+    osg::ref_ptr<MemCache> cache = new MemCache(100);
+    osg::ref_ptr<CacheBin> bin = cache->addBin("tiles");
+    osg::ref_ptr<BinaryNodeCache> codec = new BinaryNodeCache();
+
+    std::string record;
+    if (!codec->encode(tile.get(), bin.get(), 0L, record))
+    {
+        WARN("The building tile holds something the binary format doesn't cover; skipping");
+        return;
+    }
+
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension("osgb");
+    REQUIRE(rw != 0L);
+    std::stringstream buf;
+    REQUIRE(rw->writeNode(*tile.get(), buf).success());
+    std::string osgb = buf.str();
+
+    // warm cache: both formats read from memory, and shared state is already loaded
+    const unsigned runs = 50u;
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+    for (unsigned i = 0; i < runs; ++i)
+    {
+        osg::ref_ptr<osg::Node> node = codec->decode(record, bin.get(), 0L, 0L);
+        REQUIRE(node.valid());
+    }
+    double binary = osg::Timer::instance()->delta_s(t0, osg::Timer::instance()->tick());
+
+    t0 = osg::Timer::instance()->tick();
+    for (unsigned i = 0; i < runs; ++i)
+    {
+        std::istringstream in(osgb);
+        osgDB::ReaderWriter::ReadResult r = rw->readNode(in);
+        REQUIRE(r.validNode());
+    }
+    double osgbTime = osg::Timer::instance()->delta_s(t0, osg::Timer::instance()->tick());
+
+    OE_NOTICE << "Building tile, " << features.size() << " features (" << record.size() << " bytes binary, "
+        << osgb.size() << " bytes osgb), " << runs << " loads: binary = " << binary << "s, osgb = " << osgbTime
+        << "s (" << (binary > 0.0 ? osgbTime/binary : 0.0) << "x)" << std::endl;
+}
+
+TEST_CASE("FeatureSource reports which features changed") {
+    const SpatialReference* wgs84 = SpatialReference::create("wgs84");
+    osg::ref_ptr<FeatureListSource> source = new FeatureListSource(GeoExtent(wgs84, -180, -90, 180, 90));
+
+    Revision revision;
+    source->sync(revision);
+
+    osg::ref_ptr<Feature> a = new Feature(GeometryUtils::geometryFromWKT("POINT(10 10)"), wgs84);
+    osg::ref_ptr<Feature> b = new Feature(GeometryUtils::geometryFromWKT("POINT(-20 5)"), wgs84);
+    a->setFID(1);
+    b->setFID(2);
+    source->insertFeature(a.get());
+    source->insertFeature(b.get());
+    source->deleteFeature(a->getFID());
+
+    std::vector<GeoExtent> extents;
+    std::vector<FeatureID> fids;
+    REQUIRE(source->getChanges(revision, extents, fids));
+    REQUIRE(source->inSyncWith(revision));
+    REQUIRE(fids.size() == 3);
+    REQUIRE(extents.size() == 3);
+    REQUIRE(fids[1] == 2);
+    REQUIRE(fids[2] == 1);
+    REQUIRE(extents[1].contains(-20, 5));
+
+    // Nothing new since then
+    REQUIRE(source->getChanges(revision, extents, fids));
+    REQUIRE(fids.empty());
+
+    // A plain dirty() can't be localized
+    source->dirty();
+    REQUIRE(source->getChanges(revision, extents, fids) == false);
+}
+
+namespace
+{
+    FeatureList createScriptFeatures(const SpatialReference* srs)
+    {
+        FeatureList features;
+        for (unsigned i = 0; i < 3; ++i)
+        {
+            Feature* feature = new Feature(GeometryUtils::geometryFromWKT("POINT(0 0)"), srs, Style(), i);
+            feature->set("name", std::string(Stringify() << "f" << i));
+            feature->set("count", (int)(i * 10));
+            features.push_back(feature);
+        }
+        return features;
+    }
+
+    ScriptEngine* createJavaScriptEngine(const std::string& profile)
+    {
+        ScriptEngine* engine = ScriptEngineFactory::create("javascript", "", true);
+        if (engine)
+            engine->setProfile(profile);
+        else
+            WARN("JavaScript engine is not available; skipping");
+        return engine;
+    }
+}
+
+TEST_CASE("FeatureModelGraph rebuilds only the tiles an edit touches") {
+    const SpatialReference* wgs84 = SpatialReference::create("wgs84");
+    osg::ref_ptr<TiledListSource> source = new TiledListSource(GeoExtent(wgs84, -180, -90, 180, 90));
+
+    // one feature in each quarter of the world, so no tile is empty
+    const char* wkt[] = { "POINT(-100 -45)", "POINT(100 -45)", "POINT(-100 45)", "POINT(100 45)" };
+    for (unsigned i = 0; i < 4; ++i)
+    {
+        Feature* f = new Feature(GeometryUtils::geometryFromWKT(wkt[i]), wgs84);
+        f->setFID(i + 1);
+        source->insertFeature(f);
+    }
+    REQUIRE(source->open().isOK());
+
+    osg::ref_ptr<Map> map = new Map();
+    osg::ref_ptr<Session> session = new Session(map.get(), new StyleSheet(), source.get(), 0L);
+    osg::ref_ptr<FeatureModelGraph> graph = new FeatureModelGraph(session.get(), FeatureModelSourceOptions(), new EmptyNodeFactory(), 0L);
+
+    // Load the four level-one tiles. Tile (1,1,1) is the profile key from
+    // -90 to 0 longitude, which isn't the second quarter of the feature extent.
+    std::vector< osg::ref_ptr<osg::Group> > tiles;
+    std::vector< osg::ref_ptr<osg::Node> > before;
+    for (unsigned y = 0; y < 2; ++y)
+    {
+        for (unsigned x = 0; x < 2; ++x)
+        {
+            osg::Group* tile = dynamic_cast<osg::Group*>(graph->load(1, x, y, Stringify() << "1_" << x << "_" << y << ".osgearth_pseudo_fmg", 0L));
+            REQUIRE(tile != 0L);
+            REQUIRE(tile->getNumChildren() == 1);
+            tiles.push_back(tile);
+            before.push_back(tile->getChild(0));
+        }
+    }
+
+    osg::ref_ptr<Feature> edit = new Feature(GeometryUtils::geometryFromWKT("POLYGON((-50 40, -40 40, -40 50, -50 50))"), wgs84);
+    edit->setFID(5);
+    source->insertFeature(edit.get());
+
+    // Rebuilds run in the background and are merged during an update traversal.
+    osg::NodeVisitor events(osg::NodeVisitor::EVENT_VISITOR, osg::NodeVisitor::TRAVERSE_NONE);
+    osg::NodeVisitor updates(osg::NodeVisitor::UPDATE_VISITOR, osg::NodeVisitor::TRAVERSE_NONE);
+    for (unsigned i = 0; i < 500 && tiles[3]->getChild(0) == before[3].get(); ++i)
+    {
+        graph->traverse(events);
+        graph->traverse(updates);
+        OpenThreads::Thread::microSleep(10000u);
+    }
+
+    // give any other rebuild a chance to land too
+    for (unsigned i = 0; i < 10; ++i)
+    {
+        graph->traverse(events);
+        graph->traverse(updates);
+        OpenThreads::Thread::microSleep(10000u);
+    }
+
+    REQUIRE(tiles[3]->getChild(0) != before[3].get());
+    for (unsigned i = 0; i < 3; ++i)
+    {
+        REQUIRE(tiles[i]->getChild(0) == before[i].get());
+    }
+}
+
+TEST_CASE("FeatureModelGraph forgets tiles that paged out") {
+    const SpatialReference* wgs84 = SpatialReference::create("wgs84");
+    osg::ref_ptr<TiledListSource> source = new TiledListSource(GeoExtent(wgs84, -180, -90, 180, 90));
+
+    const char* wkt[] = { "POINT(-100 -45)", "POINT(100 -45)", "POINT(-100 45)", "POINT(100 45)" };
+    for (unsigned i = 0; i < 4; ++i)
+    {
+        Feature* f = new Feature(GeometryUtils::geometryFromWKT(wkt[i]), wgs84);
+        f->setFID(i + 1);
+        source->insertFeature(f);
+    }
+    REQUIRE(source->open().isOK());
+
+    osg::ref_ptr<Map> map = new Map();
+    osg::ref_ptr<Session> session = new Session(map.get(), new StyleSheet(), source.get(), 0L);
+    osg::ref_ptr<FeatureModelGraph> graph = new FeatureModelGraph(session.get(), FeatureModelSourceOptions(), new EmptyNodeFactory(), 0L);
+
+    // Page through many tiles without editing anything. Each one gets its own
+    // URI, as a different tile would; only the first four stay loaded.
+    std::vector< osg::ref_ptr<osg::Node> > kept;
+    for (unsigned round = 0; round < 100; ++round)
+    {
+        for (unsigned i = 0; i < 4; ++i)
+        {
+            osg::ref_ptr<osg::Node> tile = graph->load(1, i % 2, i / 2, Stringify() << "1_" << (i % 2) << "_" << (i / 2) << "_" << round << ".osgearth_pseudo_fmg", 0L);
+            REQUIRE(tile.valid());
+            if (round == 0)
+                kept.push_back(tile.get());
+        }
+    }
+
+    REQUIRE(graph->getNumLiveTiles() >= kept.size());
+    REQUIRE(graph->getNumLiveTiles() <= 64u);
+}
+
+TEST_CASE("FeatureModelGraph builds the same multi-style tile every time") {
+    const SpatialReference* wgs84 = SpatialReference::create("wgs84");
+    osg::ref_ptr<TiledListSource> source = new TiledListSource(GeoExtent(wgs84, -180, -90, 180, 90));
+
+    // A grid of points in one tile. Most go in the "big" bin, which is large
+    // enough to be compiled in several pieces; the rest alternate between two
+    // small bins.
+    GeoExtent extent = TileKey(1, 0, 0, Registry::instance()->getGlobalGeodeticProfile()).getExtent();
+    for (unsigned i = 0; i < 4000u; ++i)
+    {
+        double x = extent.xMin() + 5.0 + (double)(i % 80u);
+        double y = extent.yMin() + 5.0 + (double)(i / 80u);
+        Feature* f = new Feature(new PointSet(), wgs84);
+        f->getGeometry()->push_back(osg::Vec3d(x, y, 0.0));
+        f->setFID(i + 1);
+        f->set("class", (i % 10u) == 0u ? "a" : (i % 10u) == 1u ? "b" : "big");
+        source->insertFeature(f);
+    }
+    REQUIRE(source->open().isOK());
+
+    osg::ref_ptr<StyleSheet> sheet = new StyleSheet();
+    const char* names[] = { "a", "b", "big" };
+    for (unsigned i = 0; i < 3; ++i)
+    {
+        Style style(names[i]);
+        style.getOrCreate<PointSymbol>()->size() = (float)(i + 1);
+        sheet->addStyle(style);
+    }
+    StyleSelector selector;
+    selector.styleExpression() = StringExpression("[class]");
+    sheet->selectors().push_back(selector);
+
+    osg::ref_ptr<Map> map = new Map();
+    osg::ref_ptr<Session> session = new Session(map.get(), sheet.get(), source.get(), 0L);
+    osg::ref_ptr<FeatureModelGraph> graph = new FeatureModelGraph(session.get(), FeatureModelSourceOptions(), new RunNodeFactory(), 0L);
+
+    FeatureModelGraph::setBuildTaskService(new TaskService("FeatureTests", 4));
+
+    std::vector<std::string> runs[2];
+    for (unsigned r = 0; r < 2; ++r)
+    {
+        osg::ref_ptr<osg::Node> tile = graph->load(1, 0, 0, Stringify() << "1_0_0_" << r << ".osgearth_pseudo_fmg", 0L);
+        REQUIRE(tile.valid());
+
+        DescribeGraph describe;
+        tile->accept(describe);
+        runs[r] = describe.nodes;
+    }
+
+    FeatureModelGraph::setBuildTaskService(0L);
+
+    // one group per style, in bin order, and the big one in three pieces.
+    osg::Group* tile = dynamic_cast<osg::Group*>(graph->load(1, 0, 0, "1_0_0_2.osgearth_pseudo_fmg", 0L));
+    REQUIRE(tile != 0L);
+    REQUIRE(tile->getNumChildren() == 3);
+    REQUIRE(tile->getChild(0)->asGroup()->getNumChildren() == 1);
+    REQUIRE(tile->getChild(1)->asGroup()->getNumChildren() == 1);
+    REQUIRE(tile->getChild(2)->asGroup()->getNumChildren() == 3);
+    REQUIRE(tile->getChild(2)->asGroup()->getChild(0)->getName() == "big:3-1250:1000");
+
+    REQUIRE(runs[0].size() == runs[1].size());
+    for (unsigned i = 0; i < runs[0].size(); ++i)
+    {
+        REQUIRE(runs[0][i] == runs[1][i]);
+    }
+}
+
+TEST_CASE("OGR feature source reads a GeoPackage from several threads") {
+    OGRFeatureOptions options;
+    options.url() = "../data/cities.gpkg";
+
+    osg::ref_ptr<FeatureSource> source = FeatureSource::create(options);
+    REQUIRE(source.valid());
+    REQUIRE(source->open().isOK());
+
+    // expected results, read on this thread
+    unsigned counts[4];
+    FeatureID fidSums[4];
+    unsigned total = 0u;
+    for (unsigned i = 0; i < 4; ++i)
+    {
+        readAll(source.get(), quadrant(i), counts[i], fidSums[i]);
+        total += counts[i];
+    }
+    REQUIRE(total > 0u);
+
+    const unsigned numThreads = 4u;
+    for (unsigned round = 0; round < 2; ++round)
+    {
+        std::vector<CursorWorker*> workers;
+        for (unsigned i = 0; i < numThreads; ++i)
+            workers.push_back(new CursorWorker(source.get(), counts, fidSums));
+        for (unsigned i = 0; i < numThreads; ++i)
+            workers[i]->start();
+
+        bool ok = true;
+        for (unsigned i = 0; i < numThreads; ++i)
+        {
+            workers[i]->join();
+            ok = ok && workers[i]->_ok;
+            delete workers[i];
+        }
+        REQUIRE(ok);
+
+        // Handles go back to the pool, so there is never more than one per
+        // reading thread, plus the source's own.
+        REQUIRE(numOpenDatasets("cities.gpkg") <= numThreads + 1u);
+    }
+
+    source = 0L;
+    REQUIRE(numOpenDatasets("cities.gpkg") == 0u);
+}
+
+TEST_CASE("JavaScript engine over several features, minimal profile") {
+    osg::ref_ptr<ScriptEngine> engine = createJavaScriptEngine("");
+    if (!engine.valid())
+        return;
+
+    osg::ref_ptr<const SpatialReference> wgs84 = SpatialReference::create("wgs84");
+    FeatureList features = createScriptFeatures(wgs84.get());
+    const std::string read = "feature.id + ':' + feature.properties.name + ':' + feature.properties.count";
+
+    SECTION("Read properties")
+    {
+        std::vector<ScriptResult> results;
+        engine->run(read, features, results);
+        REQUIRE(results.size() == 3u);
+        REQUIRE(results[0].asString() == "0:f0:0");
+        REQUIRE(results[1].asString() == "1:f1:10");
+        REQUIRE(results[2].asString() == "2:f2:20");
+
+        // one at a time, out of order:
+        REQUIRE(engine->run(read, features.back().get()).asString() == "2:f2:20");
+        REQUIRE(engine->run(read, features.front().get()).asString() == "0:f0:0");
+
+        // names are case-sensitive, like any javascript property:
+        REQUIRE(engine->run("typeof feature.properties.NAME", features.front().get()).asString() == "undefined");
+        REQUIRE(engine->run("'name' in feature.properties", features.front().get()).asBool());
+    }
+
+    SECTION("Write properties")
+    {
+        // writes are visible to the rest of the script...
+        ScriptResult r = engine->run(
+            "feature.properties.name = 'changed'; feature.properties.extra = 1;"
+            "feature.properties.name + ':' + feature.properties.extra + ':' + ('extra' in feature.properties)",
+            features.front().get());
+        REQUIRE(r.success());
+        REQUIRE(r.asString() == "changed:1:true");
+
+        // ...but don't reach the Feature, the next feature, or the next run:
+        REQUIRE(features.front()->getString("name") == "f0");
+        REQUIRE(engine->run(read, features.back().get()).asString() == "2:f2:20");
+        REQUIRE(engine->run("typeof feature.properties.extra", features.back().get()).asString() == "undefined");
+        REQUIRE(engine->run(read, features.front().get()).asString() == "0:f0:0");
+
+        std::vector<ScriptResult> results;
+        engine->run("feature.properties.count = feature.properties.count + 1; feature.properties.count", features, results);
+        REQUIRE(results.size() == 3u);
+        REQUIRE(results[0].asString() == "1");
+        REQUIRE(results[2].asString() == "21");
+        REQUIRE(features.back()->getInt("count") == 20);
+    }
+
+    SECTION("Null feature")
+    {
+        REQUIRE(engine->run(read, features.front().get()).asString() == "0:f0:0");
+
+        // once the last feature is gone, the script must not see it:
+        features.clear();
+        ScriptResult r = engine->run("typeof feature.properties.name", 0L);
+        REQUIRE(r.success());
+        REQUIRE(r.asString() == "undefined");
+
+        REQUIRE(engine->run("1 + 2", 0L).asString() == "3");
+        REQUIRE(engine->run("1 + 2", 0L).asString() == "3");
+    }
+}
+
+TEST_CASE("JavaScript engine over several features, full profile") {
+    osg::ref_ptr<ScriptEngine> engine = createJavaScriptEngine("full");
+    if (!engine.valid())
+        return;
+
+    osg::ref_ptr<const SpatialReference> wgs84 = SpatialReference::create("wgs84");
+    FeatureList features = createScriptFeatures(wgs84.get());
+
+    SECTION("Read properties")
+    {
+        std::vector<ScriptResult> results;
+        engine->run("feature.attributes.name + ':' + feature.geometry.type", features, results);
+        REQUIRE(results.size() == 3u);
+        REQUIRE(results[0].asString() == "f0:Point");
+        REQUIRE(results[2].asString() == "f2:Point");
+    }
+
+    SECTION("Write properties")
+    {
+        std::vector<ScriptResult> results;
+        engine->run("feature.properties.name = feature.properties.name + '!'; feature.save(); feature.properties.name", features, results);
+        REQUIRE(results.size() == 3u);
+        for (unsigned i = 0; i < 3; ++i)
+            REQUIRE(results[i].success());
+
+        REQUIRE(features.front()->getString("name") == "f0!");
+        REQUIRE(features.back()->getString("name") == "f2!");
+        REQUIRE(features.back()->getInt("count") == 20);
+        REQUIRE(features.back()->getGeometry() != 0L);
+    }
+
+    SECTION("Null feature")
+    {
+        REQUIRE(engine->run("feature.properties.name", features.front().get()).asString() == "f0");
+
+        features.clear();
+        REQUIRE(engine->run("1 + 2", 0L).asString() == "3");
+
+        // the old feature object can no longer reach the deleted feature:
+        ScriptResult r = engine->run("feature.save(); 4", 0L);
+        REQUIRE(r.asString() == "4");
+    }
+}
+
+TEST_CASE("JavaScript style selector benchmark", "[.benchmark]") {
+    // The selector from feature_scripted_styling_2.earth, over features with
+    // as many attributes as a typical countries dataset.
+    Script script(
+        "function getStyleClass() {"
+        "    var pop = parseInt(feature.properties.pop_cntry);"
+        "    if      ( pop <= 14045470 )  return 'p1';"
+        "    else if ( pop <= 43410900 )  return 'p2';"
+        "    else if ( pop <= 97228750 )  return 'p3';"
+        "    else if ( pop <= 258833000 ) return 'p4';"
+        "    else                         return 'p5';"
+        "}");
+
+    osg::ref_ptr<const SpatialReference> wgs84 = SpatialReference::create("wgs84");
+    FeatureList features;
+    for (unsigned i = 0; i < 20000u; ++i)
+    {
+        Feature* feature = new Feature(GeometryUtils::geometryFromWKT("POLYGON((0 0, 1 0, 1 1, 0 1, 0 0))"), wgs84.get(), Style(), i);
+        feature->set("pop_cntry", (int)(i * 15000));
+        for (unsigned a = 0; a < 30u; ++a)
+            feature->set(Stringify() << "attr" << a, std::string(Stringify() << "value " << a << " of " << i));
+        features.push_back(feature);
+    }
+
+    const char* profiles[] = { "", "full" };
+    for (unsigned p = 0; p < 2; ++p)
+    {
+        osg::ref_ptr<ScriptEngine> engine = ScriptEngineFactory::createWithProfile(script, profiles[p], "", true);
+        if (!engine.valid())
+        {
+            WARN("JavaScript engine is not available; skipping");
+            return;
+        }
+
+        std::vector<ScriptResult> results;
+        osg::Timer_t t0 = osg::Timer::instance()->tick();
+        engine->run("getStyleClass()", features, results);
+        double s = osg::Timer::instance()->delta_s(t0, osg::Timer::instance()->tick());
+
+        REQUIRE(results.size() == features.size());
+        REQUIRE(results.back().asString() == "p5");
+
+        OE_NOTICE << features.size() << " features, profile \"" << (p == 0 ? "minimal" : profiles[p]) << "\": "
+            << s << "s (" << (s > 0.0 ? features.size()/s : 0.0) << " features/s)" << std::endl;
+    }
+}
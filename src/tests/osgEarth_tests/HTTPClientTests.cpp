@@ -0,0 +1,257 @@
+/* -*-c++-*- */
+/* osgEarth - Geospatial SDK for OpenSceneGraph
+* Copyright 2019 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/catch.hpp>
+
+#include <osgEarth/HTTPClient>
+#include <osgEarth/Progress>
+#include <osgEarth/ThreadingUtils>
+#include <osgEarth/StringUtils>
+#include <OpenThreads/Atomic>
+#include <osg/Timer>
+
+// The stand-in server below uses BSD sockets.
+#ifndef _WIN32
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string.h>
+
+using namespace osgEarth;
+
+namespace HTTPClientTest
+{
+    class LocalServer;
+
+    // Sets the per-host connection limit, and puts back the old one on the
+    // way out so other tests see the default.
+    struct ScopedMaxConnectionsPerHost
+    {
+        ScopedMaxConnectionsPerHost(unsigned value) : _saved(HTTPClient::getMaxConnectionsPerHost())
+        {
+            HTTPClient::setMaxConnectionsPerHost(value);
+        }
+
+        ~ScopedMaxConnectionsPerHost()
+        {
+            HTTPClient::setMaxConnectionsPerHost(_saved);
+        }
+
+        unsigned _saved;
+    };
+
+    // Serves keep-alive HTTP/1.1 requests on one accepted socket.
+    class Connection : public OpenThreads::Thread
+    {
+    public:
+        Connection(int fd, LocalServer* server) : _fd(fd), _server(server) { }
+        void run();
+        int _fd;
+        LocalServer* _server;
+    };
+
+    /**
+     * Minimal HTTP server on the loopback interface. Every GET is answered
+     * after a short delay with its own path as the body, except "/missing"
+     * (404) and anything containing "slow" (long delay).
+     */
+    class LocalServer : public OpenThreads::Thread
+    {
+    public:
+        LocalServer(unsigned delay_ms) :
+            _delay_ms(delay_ms), _inflight(0), _maxInflight(0), _done(false)
+        {
+            _fd = ::socket(AF_INET, SOCK_STREAM, 0);
+            int one = 1;
+            ::setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            sockaddr_in addr;
+            ::memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port = 0;
+            ::bind(_fd, (sockaddr*)&addr, sizeof(addr));
+            ::listen(_fd, 64);
+            socklen_t len = sizeof(addr);
+            ::getsockname(_fd, (sockaddr*)&addr, &len);
+            _port = ntohs(addr.sin_port);
+            start();
+        }
+
+        ~LocalServer()
+        {
+            _done = true;
+            ::shutdown(_fd, SHUT_RDWR);
+            ::close(_fd);
+            join();
+
+            // connections call back into begin()/end(), so don't hold the lock while joining.
+            std::vector<Connection*> connections;
+            {
+                Threading::ScopedMutexLock lock(_mutex);
+                connections.swap(_connections);
+            }
+            for(unsigned i=0; i<connections.size(); ++i)
+                ::shutdown(connections[i]->_fd, SHUT_RDWR);
+            for(unsigned i=0; i<connections.size(); ++i)
+            {
+                connections[i]->join();
+                ::close(connections[i]->_fd);
+                delete connections[i];
+            }
+        }
+
+        std::string url(const std::string& path) const
+        {
+            return Stringify() << "http://127.0.0.1:" << _port << path;
+        }
+
+        void run()
+        {
+            while(!_done)
+            {
+                int fd = ::accept(_fd, 0L, 0L);
+                if (fd < 0)
+                    break;
+                Threading::ScopedMutexLock lock(_mutex);
+                Connection* c = new Connection(fd, this);
+                _connections.push_back(c);
+                c->start();
+            }
+        }
+
+        unsigned getNumConnections()
+        {
+            Threading::ScopedMutexLock lock(_mutex);
+            return _connections.size();
+        }
+
+        void begin()
+        {
+            Threading::ScopedMutexLock lock(_mutex);
+            ++_requests;
+            _maxInflight = osg::maximum(++_inflight, _maxInflight);
+        }
+
+        void end()
+        {
+            Threading::ScopedMutexLock lock(_mutex);
+            --_inflight;
+        }
+
+        int _fd;
+        int _port;
+        unsigned _delay_ms;
+        Threading::Mutex _mutex;
+        std::vector<Connection*> _connections;
+        OpenThreads::Atomic _requests;
+        unsigned _inflight;
+        unsigned _maxInflight;
+        volatile bool _done;
+    };
+
+    void Connection::run()
+    {
+        std::string buf;
+        char temp[4096];
+        while(true)
+        {
+            std::string::size_type end;
+            while((end = buf.find("\r\n\r\n")) == std::string::npos)
+            {
+                ssize_t n = ::recv(_fd, temp, sizeof(temp), 0);
+                if (n <= 0)
+                    return;
+                buf.append(temp, n);
+            }
+
+            // "GET /path HTTP/1.1"
+            std::string requestLine = buf.substr(0, buf.find("\r\n"));
+            buf.erase(0, end+4);
+            std::string::size_type s0 = requestLine.find(' ');
+            std::string::size_type s1 = requestLine.find(' ', s0+1);
+            std::string path = requestLine.substr(s0+1, s1-s0-1);
+
+            _server->begin();
+            bool slow = path.find("slow") != std::string::npos;
+            OpenThreads::Thread::microSleep(1000u * (slow ? 2000u : _server->_delay_ms));
+            _server->end();
+
+            std::string status = path == "/missing" ? "404 Not Found" : "200 OK";
+            std::string response = Stringify()
+                << "HTTP/1.1 " << status << "\r\n"
+                << "Content-Type: text/plain\r\n"
+                << "Content-Length: " << path.size() << "\r\n\r\n"
+                << path;
+            ::send(_fd, response.data(), response.size(), MSG_NOSIGNAL);
+        }
+    }
+}
+
+TEST_CASE( "HTTPClient::getAsync keeps requests in flight and honors the per-host limit" ) {
+    HTTPClient::globalInit();
+    HTTPClientTest::ScopedMaxConnectionsPerHost limit(3u);
+
+    HTTPClientTest::LocalServer server(30u);
+
+    const unsigned num = 24;
+    std::vector< Threading::Future<AsyncHTTPResponse> > results;
+    for(unsigned i=0; i<num; ++i)
+        results.push_back(HTTPClient::getAsync(HTTPRequest(server.url(Stringify() << "/tile/" << i))));
+
+    for(unsigned i=0; i<num; ++i)
+    {
+        osg::ref_ptr<AsyncHTTPResponse> r = results[i].get();
+        REQUIRE(r.valid());
+        REQUIRE(r->getResponse().isOK());
+        REQUIRE(r->getResponse().getNumParts() == 1u);
+        REQUIRE(r->getResponse().getPartAsString(0) == (std::string)(Stringify() << "/tile/" << i));
+    }
+
+    // Requests overlapped, never exceeded the limit, and reused connections.
+    REQUIRE(server._maxInflight > 1u);
+    REQUIRE(server._maxInflight <= 3u);
+    REQUIRE(server.getNumConnections() <= 3u);
+    REQUIRE((unsigned)server._requests == num);
+
+    Threading::Future<AsyncHTTPResponse> missing = HTTPClient::getAsync(HTTPRequest(server.url("/missing")));
+    REQUIRE(missing.get()->getResponse().getCode() == 404u);
+}
+
+TEST_CASE( "HTTPClient::getAsync cancels through the ProgressCallback" ) {
+    HTTPClient::globalInit();
+    HTTPClientTest::LocalServer server(10u);
+
+    osg::ref_ptr<ProgressCallback> progress = new ProgressCallback();
+    Threading::Future<AsyncHTTPResponse> slow = HTTPClient::getAsync(HTTPRequest(server.url("/slow")), 0L, progress.get());
+    OpenThreads::Thread::microSleep(100000);
+    progress->cancel();
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    osg::ref_ptr<AsyncHTTPResponse> r = slow.get();
+    REQUIRE(r.valid());
+    REQUIRE(r->getResponse().isCancelled());
+    REQUIRE(osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick()) < 1.0);
+}
+
+#endif // _WIN32
@@ -0,0 +1,100 @@
+/* -*-c++-*- */
+/* osgEarth - Geospatial SDK for OpenSceneGraph
+* Copyright 2019 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/catch.hpp>
+
+#include <osgEarth/ImageUtils>
+
+#include <cstring>
+
+using namespace osgEarth;
+
+TEST_CASE( "ImageUtils::reduce2x2 builds a parent tile from its children" ) {
+
+    osg::ref_ptr<osg::Image> children[4];
+    for(unsigned i=0; i<4; ++i)
+    {
+        children[i] = new osg::Image();
+        children[i]->allocateImage(4, 4, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+        memset(children[i]->data(), 10*(i+1), children[i]->getTotalSizeInBytes());
+    }
+
+    // one 2x2 block with distinct values in the upper-left child
+    children[0]->data(0,0)[0] = 0;
+    children[0]->data(1,0)[0] = 4;
+    children[0]->data(0,1)[0] = 8;
+    children[0]->data(1,1)[0] = 12;
+
+    osg::ref_ptr<osg::Image> parent = ImageUtils::reduce2x2(
+        children[0].get(), children[1].get(), children[2].get(), children[3].get());
+
+    REQUIRE(parent.valid());
+    REQUIRE(parent->s() == 4);
+    REQUIRE(parent->t() == 4);
+
+    // image rows run bottom-up, so the upper children are in the top half.
+    REQUIRE(parent->data(0,2)[0] == 6);
+    REQUIRE(parent->data(0,2)[1] == 10);
+    REQUIRE(parent->data(2,2)[0] == 20);
+    REQUIRE(parent->data(0,0)[0] == 30);
+    REQUIRE(parent->data(2,0)[0] == 40);
+
+    SECTION("Children must match") {
+        osg::ref_ptr<osg::Image> small = new osg::Image();
+        small->allocateImage(2, 2, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+        osg::ref_ptr<osg::Image> bad = ImageUtils::reduce2x2(
+            children[0].get(), children[1].get(), children[2].get(), small.get());
+        REQUIRE(!bad.valid());
+    }
+}
+
+TEST_CASE( "ImageUtils::reduce2x2 averages float tiles" ) {
+
+    osg::ref_ptr<osg::Image> children[4];
+    for(unsigned i=0; i<4; ++i)
+    {
+        children[i] = new osg::Image();
+        children[i]->allocateImage(4, 4, 1, GL_LUMINANCE, GL_FLOAT);
+
+        ImageUtils::PixelWriter write(children[i].get());
+        for(int t=0; t<4; ++t)
+            for(int s=0; s<4; ++s)
+                write(osg::Vec4(1000.0f*(float)(i+1) + (float)(s + 4*t), 0, 0, 0), s, t);
+    }
+
+    osg::ref_ptr<osg::Image> parent = ImageUtils::reduce2x2(
+        children[0].get(), children[1].get(), children[2].get(), children[3].get());
+
+    REQUIRE(parent.valid());
+    REQUIRE(parent->s() == 4);
+    REQUIRE(parent->t() == 4);
+    REQUIRE(parent->getDataType() == GL_FLOAT);
+
+    // each output pixel is the mean of a 2x2 block; the block at (0,0) in a
+    // child holds base+0, base+1, base+4 and base+5.
+    ImageUtils::PixelReader read(parent.get());
+    REQUIRE(read(0, 2).r() == Approx(1002.5f));
+    REQUIRE(read(1, 3).r() == Approx(1012.5f));
+    REQUIRE(read(2, 2).r() == Approx(2002.5f));
+    REQUIRE(read(0, 0).r() == Approx(3002.5f));
+    REQUIRE(read(3, 1).r() == Approx(4012.5f));
+}
@@ -23,6 +23,9 @@
 #include <osgEarth/catch.hpp>
 
 #include <osgEarth/SpatialReference>
+#include <osgEarth/Notify>
+#include <OpenThreads/Thread>
+#include <osg/Timer>
 
 using namespace osgEarth;
 
@@ -90,3 +93,125 @@ TEST_CASE("Plate Carre SpatialReferences can be created") {
     REQUIRE(!plateCarre->isGeodetic());
     REQUIRE(plateCarre->isProjected());
 }
+
+namespace SRSThreadTest
+{
+    // UTM zone 32N spelled as tmerc, so the transforms go through OGR
+    // rather than the closed-form UTM path.
+    const char* UTM32N_TMERC = "+proj=tmerc +lat_0=0 +lon_0=9 +k=0.9996 +x_0=500000 +y_0=0 +datum=WGS84 +units=m +no_defs";
+
+    // Transforms a block of geographic points to UTM in fixed-size batches.
+    class Worker : public OpenThreads::Thread
+    {
+    public:
+        Worker(const SpatialReference* from, const SpatialReference* to, unsigned first, unsigned count) :
+            _from(from), _to(to), _first(first), _count(count), _ok(true) { }
+
+        void run()
+        {
+            const unsigned batchSize = 10000u;
+            std::vector<osg::Vec3d> points;
+            for(unsigned i=_first; i<_first+_count; i += batchSize)
+            {
+                unsigned n = osg::minimum(batchSize, _first+_count-i);
+                points.resize(n);
+                for(unsigned j=0; j<n; ++j)
+                    points[j].set(6.0 + 0.000001*(double)((i+j)%1000000u), 45.0 + 0.000001*(double)((i+j)%777777u), 0.0);
+
+                if (!_from->transform(points, _to.get()))
+                    _ok = false;
+
+                if (i == _first && !points.empty())
+                    _firstResult = points.front();
+            }
+        }
+
+        osg::ref_ptr<const SpatialReference> _from, _to;
+        unsigned   _first, _count;
+        bool       _ok;
+        osg::Vec3d _firstResult;
+    };
+
+    // Runs numPoints transforms spread over numThreads threads; returns seconds.
+    double run(unsigned numPoints, unsigned numThreads, bool& ok, std::vector<osg::Vec3d>* firstResults =0L)
+    {
+        osg::ref_ptr<const SpatialReference> wgs84 = SpatialReference::get("wgs84");
+        osg::ref_ptr<const SpatialReference> utm = SpatialReference::get(UTM32N_TMERC);
+
+        std::vector<Worker*> workers;
+        unsigned perThread = numPoints / numThreads;
+        for(unsigned i=0; i<numThreads; ++i)
+            workers.push_back(new Worker(wgs84.get(), utm.get(), i*perThread, perThread));
+
+        osg::Timer_t t0 = osg::Timer::instance()->tick();
+        for(unsigned i=0; i<numThreads; ++i)
+            workers[i]->start();
+
+        ok = true;
+        for(unsigned i=0; i<numThreads; ++i)
+        {
+            workers[i]->join();
+            ok = ok && workers[i]->_ok;
+            if (firstResults)
+                firstResults->push_back(workers[i]->_firstResult);
+            delete workers[i];
+        }
+        return osg::Timer::instance()->delta_s(t0, osg::Timer::instance()->tick());
+    }
+}
+
+TEST_CASE( "SpatialReference transforms from several threads match single-threaded results" ) {
+    const unsigned numThreads = 4, numPoints = 40000;
+
+    bool ok;
+    std::vector<osg::Vec3d> threaded;
+    SRSThreadTest::run(numPoints, numThreads, ok, &threaded);
+    REQUIRE(ok);
+    REQUIRE(threaded.size() == numThreads);
+
+    // each worker's first point, transformed again on this thread:
+    osg::ref_ptr<const SpatialReference> wgs84 = SpatialReference::get("wgs84");
+    osg::ref_ptr<const SpatialReference> utm = SpatialReference::get(SRSThreadTest::UTM32N_TMERC);
+    for(unsigned i=0; i<numThreads; ++i)
+    {
+        unsigned k = i*(numPoints/numThreads);
+        osg::Vec3d in(6.0 + 0.000001*(double)(k%1000000u), 45.0 + 0.000001*(double)(k%777777u), 0.0), out;
+        REQUIRE(wgs84->transform(in, utm.get(), out));
+        REQUIRE((out-threaded[i]).length() < 1e-6);
+    }
+}
+
+TEST_CASE( "SpatialReferences with the same WKT transform alike" ) {
+    // same zone, parameters in a different order: two SRS objects, one WKT.
+    osg::ref_ptr<const SpatialReference> wgs84 = SpatialReference::get("wgs84");
+    osg::ref_ptr<const SpatialReference> utm1 = SpatialReference::get(SRSThreadTest::UTM32N_TMERC);
+    osg::ref_ptr<const SpatialReference> utm2 = SpatialReference::get("+proj=tmerc +lon_0=9 +lat_0=0 +k=0.9996 +x_0=500000 +y_0=0 +datum=WGS84 +units=m +no_defs");
+    REQUIRE(utm1.get() != utm2.get());
+    REQUIRE(utm1->getWKT() == utm2->getWKT());
+
+    osg::Vec3d in(9.5, 45.0, 0.0), out1, out2, back;
+    REQUIRE(wgs84->transform(in, utm1.get(), out1));
+    REQUIRE(wgs84->transform(in, utm2.get(), out2));
+    REQUIRE((out1-out2).length() < 1e-9);
+
+    REQUIRE(utm2->transform(out1, wgs84.get(), back));
+    REQUIRE((back-in).length() < 1e-9);
+}
+
+TEST_CASE( "SpatialReference transform thread scaling benchmark", "[.benchmark]" ) {
+    const unsigned numPoints = 10000000u;
+    unsigned maxThreads = osg::maximum(OpenThreads::GetNumberOfProcessors(), 1);
+
+    double single = 0.0;
+    for(unsigned numThreads = 1; numThreads <= maxThreads; numThreads *= 2)
+    {
+        bool ok;
+        double s = SRSThreadTest::run(numPoints, numThreads, ok);
+        REQUIRE(ok);
+        if (numThreads == 1)
+            single = s;
+
+        OE_NOTICE << numPoints << " points, " << numThreads << " threads: " << s << "s ("
+            << (s > 0.0 ? single/s : 0.0) << "x)" << std::endl;
+    }
+}
@@ -0,0 +1,155 @@
+/* -*-c++-*- */
+/* osgEarth - Geospatial SDK for OpenSceneGraph
+* Copyright 2019 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/catch.hpp>
+
+#include <osgEarth/SpatialReference>
+#include <osgEarth/Notify>
+#include <osg/Timer>
+
+using namespace osgEarth;
+
+namespace
+{
+    const char* UTM32N_TMERC = "+proj=tmerc +lat_0=0 +lon_0=9 +k=0.9996 +x_0=500000 +y_0=0 +datum=WGS84 +units=m +no_defs";
+
+    void createGrid(double lonMin, double lonMax, double latMin, double latMax, unsigned n, std::vector<osg::Vec3d>& out)
+    {
+        out.clear();
+        for(unsigned i=0; i<n; ++i)
+            for(unsigned j=0; j<n; ++j)
+                out.push_back(osg::Vec3d(
+                    lonMin + (lonMax-lonMin)*(double)i/(double)(n-1),
+                    latMin + (latMax-latMin)*(double)j/(double)(n-1),
+                    0.0));
+    }
+
+    double maxXYDifference(const std::vector<osg::Vec3d>& a, const std::vector<osg::Vec3d>& b)
+    {
+        double d = 0.0;
+        for(unsigned i=0; i<a.size(); ++i)
+            d = osg::maximum(d, osg::maximum(fabs(a[i].x()-b[i].x()), fabs(a[i].y()-b[i].y())));
+        return d;
+    }
+}
+
+TEST_CASE( "Geographic to spherical mercator uses the closed-form projection" ) {
+    osg::ref_ptr<const SpatialReference> wgs84 = SpatialReference::get("wgs84");
+    osg::ref_ptr<const SpatialReference> merc = SpatialReference::get("spherical-mercator");
+
+    osg::Vec3d out;
+    REQUIRE(wgs84->transform(osg::Vec3d(180.0, 0.0, 0.0), merc.get(), out));
+    REQUIRE(fabs(out.x() - 20037508.342789244) < 1e-6);
+    REQUIRE(fabs(out.y()) < 1e-6);
+
+    REQUIRE(wgs84->transform(osg::Vec3d(0.0, 85.051128779806592, 0.0), merc.get(), out));
+    REQUIRE(fabs(out.y() - 20037508.342789244) < 1e-3);
+
+    SECTION("and round-trips to 1e-9 degrees") {
+        std::vector<osg::Vec3d> points, original;
+        createGrid(-180.0, 180.0, -85.0, 85.0, 101, points);
+        original = points;
+        REQUIRE(wgs84->transform(points, merc.get()));
+        REQUIRE(merc->transform(points, wgs84.get()));
+        REQUIRE(maxXYDifference(points, original) < 1e-9);
+    }
+}
+
+TEST_CASE( "Geographic to UTM uses the closed-form projection" ) {
+    osg::ref_ptr<const SpatialReference> wgs84 = SpatialReference::get("wgs84");
+    osg::ref_ptr<const SpatialReference> utm38n = SpatialReference::get("+proj=utm +zone=38 +datum=WGS84 +units=m +no_defs");
+    REQUIRE(utm38n.valid());
+
+    // reference value from GeographicLib (GeoConvert -u)
+    osg::Vec3d out;
+    REQUIRE(wgs84->transform(osg::Vec3d(44.4, 33.3, 0.0), utm38n.get(), out));
+    REQUIRE(fabs(out.x() - 444140.54) < 0.01);
+    REQUIRE(fabs(out.y() - 3684706.36) < 0.01);
+
+    SECTION("and round-trips to 1e-9 degrees, including the southern hemisphere") {
+        osg::ref_ptr<const SpatialReference> utm38s = SpatialReference::get("+proj=utm +zone=38 +south +datum=WGS84 +units=m +no_defs");
+        REQUIRE(utm38s.valid());
+
+        std::vector<osg::Vec3d> points, original;
+        createGrid(41.0, 49.0, 0.0, 84.0, 101, points);
+        original = points;
+        REQUIRE(wgs84->transform(points, utm38n.get()));
+        REQUIRE(utm38n->transform(points, wgs84.get()));
+        REQUIRE(maxXYDifference(points, original) < 1e-9);
+
+        createGrid(41.0, 49.0, -80.0, 0.0, 101, points);
+        original = points;
+        REQUIRE(wgs84->transform(points, utm38s.get()));
+        REQUIRE(utm38s->transform(points, wgs84.get()));
+        REQUIRE(maxXYDifference(points, original) < 1e-9);
+    }
+}
+
+TEST_CASE( "Closed-form UTM transforms match OGR to 1e-9 degrees" ) {
+    osg::ref_ptr<const SpatialReference> wgs84 = SpatialReference::get("wgs84");
+    osg::ref_ptr<const SpatialReference> utm = SpatialReference::get("+proj=utm +zone=32 +datum=WGS84 +units=m +no_defs");
+    osg::ref_ptr<const SpatialReference> tmerc = SpatialReference::get(UTM32N_TMERC);
+    REQUIRE(utm.valid());
+    REQUIRE(tmerc.valid());
+
+    std::vector<osg::Vec3d> input, points;
+    createGrid(6.0, 12.0, 0.0, 80.0, 101, input);
+
+    // closed-form forward, OGR inverse:
+    points = input;
+    REQUIRE(wgs84->transform(points, utm.get()));
+    REQUIRE(tmerc->transform(points, wgs84.get()));
+    REQUIRE(maxXYDifference(points, input) < 1e-9);
+
+    // OGR forward, closed-form inverse:
+    points = input;
+    REQUIRE(wgs84->transform(points, tmerc.get()));
+    REQUIRE(utm->transform(points, wgs84.get()));
+    REQUIRE(maxXYDifference(points, input) < 1e-9);
+}
+
+TEST_CASE( "Closed-form SRS transforms vs. OGR benchmark", "[.benchmark]" ) {
+    osg::ref_ptr<const SpatialReference> wgs84 = SpatialReference::get("wgs84");
+    osg::ref_ptr<const SpatialReference> utm = SpatialReference::get("+proj=utm +zone=32 +datum=WGS84 +units=m +no_defs");
+
+    // same projection spelled as tmerc, which is not on the fast path:
+    osg::ref_ptr<const SpatialReference> tmerc = SpatialReference::get(UTM32N_TMERC);
+
+    std::vector<osg::Vec3d> input, fast, ogr;
+    createGrid(6.0, 12.0, 30.0, 70.0, 1000, input);
+
+    fast = input;
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+    REQUIRE(wgs84->transform(fast, utm.get()));
+    double fast_s = osg::Timer::instance()->delta_s(t0, osg::Timer::instance()->tick());
+
+    ogr = input;
+    t0 = osg::Timer::instance()->tick();
+    REQUIRE(wgs84->transform(ogr, tmerc.get()));
+    double ogr_s = osg::Timer::instance()->delta_s(t0, osg::Timer::instance()->tick());
+
+    OE_NOTICE << input.size() << " points geographic->UTM: closed-form = " << fast_s << "s, OGR = " << ogr_s
+        << "s (" << (fast_s > 0.0 ? ogr_s/fast_s : 0.0) << "x); max difference = "
+        << maxXYDifference(fast, ogr) << " m" << std::endl;
+
+    REQUIRE(maxXYDifference(fast, ogr) < 1e-3);
+}
@@ -22,6 +22,8 @@
 
 #include <osgEarth/catch.hpp>
 #include <osgEarth/ThreadingUtils>
+#include <osgEarth/TaskService>
+#include <osgEarth/Containers>
 
 using namespace osgEarth;
 
@@ -132,4 +134,290 @@ TEST_CASE( "ReadWriteMutex can handle multiple read locks from the same thread w
     REQUIRE(!thread2.isRunning());
     REQUIRE(elapsedTime < maxTimeSeconds);
 }
-*/
\ No newline at end of file
+*/
+
+namespace ThreadLocalPointerTest
+{
+    OpenThreads::Atomic cleanups;
+
+    void OE_THREAD_LOCAL_CLEANUP cleanup(void* ptr)
+    {
+        delete static_cast<unsigned*>(ptr);
+        ++cleanups;
+    }
+
+    // Sets its own value, yields to the other threads, then checks it.
+    class Worker : public OpenThreads::Thread
+    {
+    public:
+        Worker(Threading::ThreadLocalPointer& ptr, unsigned value) : _ptr(ptr), _value(value), _ok(false) { }
+
+        void run()
+        {
+            bool startedNull = _ptr.get() == 0L;
+            _ptr.set(new unsigned(_value));
+            for(unsigned i=0; i<100; ++i)
+                OpenThreads::Thread::YieldCurrentThread();
+            _ok = startedNull && *static_cast<unsigned*>(_ptr.get()) == _value;
+        }
+
+        Threading::ThreadLocalPointer& _ptr;
+        unsigned _value;
+        bool     _ok;
+    };
+}
+
+TEST_CASE( "ThreadLocalPointer keeps a value per thread and cleans up on thread exit" ) {
+    const unsigned numThreads = 8;
+    Threading::ThreadLocalPointer ptr(ThreadLocalPointerTest::cleanup);
+    ThreadLocalPointerTest::cleanups = 0;
+
+    std::vector<ThreadLocalPointerTest::Worker*> workers;
+    for(unsigned i=0; i<numThreads; ++i)
+        workers.push_back(new ThreadLocalPointerTest::Worker(ptr, i+1));
+    for(unsigned i=0; i<numThreads; ++i)
+        workers[i]->start();
+    for(unsigned i=0; i<numThreads; ++i)
+    {
+        workers[i]->join();
+        REQUIRE(workers[i]->_ok);
+        delete workers[i];
+    }
+
+    REQUIRE(ptr.get() == 0L);
+    REQUIRE((unsigned)ThreadLocalPointerTest::cleanups == numThreads);
+}
+
+namespace TaskServiceTest
+{
+    struct CountingTask : public TaskRequest
+    {
+        CountingTask(OpenThreads::Atomic& count, float priority) : TaskRequest(priority), _count(count) { }
+        void operator()(ProgressCallback*) { ++_count; }
+        OpenThreads::Atomic& _count;
+    };
+
+    // Adds requests to a queue as fast as it can.
+    struct Producer : public OpenThreads::Thread
+    {
+        Producer(TaskRequestQueue* queue, OpenThreads::Atomic& count, unsigned num) :
+            _queue(queue), _count(count), _num(num) { }
+
+        void run()
+        {
+            for(unsigned i=0; i<_num; ++i)
+                _queue->add(new CountingTask(_count, 0.0f));
+        }
+
+        TaskRequestQueue*    _queue;
+        OpenThreads::Atomic& _count;
+        unsigned             _num;
+    };
+}
+
+TEST_CASE( "TaskRequestQueue priority buckets preserve priority order" ) {
+    float values[] = { -1e9f, -100.0f, -1.0f, 0.0f, 0.5f, 1.0f, 100.0f, 1e9f, FLT_MAX };
+    for(unsigned i=1; i<sizeof(values)/sizeof(values[0]); ++i)
+    {
+        REQUIRE(TaskRequestQueue::getPriorityBucket(values[i-1]) <= TaskRequestQueue::getPriorityBucket(values[i]));
+    }
+    REQUIRE(TaskRequestQueue::getPriorityBucket(FLT_MAX) == TaskRequestQueue::NUM_PRIORITY_BUCKETS-1);
+}
+
+TEST_CASE( "TaskService runs all queued requests before honoring a PoisonPill" ) {
+    OpenThreads::Atomic count;
+    const unsigned num = 2000;
+
+    osg::ref_ptr<TaskService> service = new TaskService("test", 4, 100);
+    for(unsigned i=0; i<num; ++i)
+        service->add(new TaskServiceTest::CountingTask(count, (float)(i%7)));
+    service->add(new PoisonPill());
+
+    while(service->areThreadsRunning())
+        OpenThreads::Thread::microSleep(1000);
+
+    REQUIRE((unsigned)count == num);
+}
+
+TEST_CASE( "TaskService shuts down with more than one PoisonPill" ) {
+    OpenThreads::Atomic count;
+    const unsigned num = 2000;
+
+    osg::ref_ptr<TaskService> service = new TaskService("test", 4);
+    for(unsigned i=0; i<num; ++i)
+    {
+        service->add(new TaskServiceTest::CountingTask(count, (float)(i%7)));
+
+        // the count may never wrap below zero while workers take requests
+        REQUIRE(service->getNumRequests() <= num);
+    }
+    service->add(new PoisonPill());
+    service->add(new PoisonPill());
+    service->add(new PoisonPill());
+
+    for(unsigned i=0; i<10000u && service->areThreadsRunning(); ++i)
+        OpenThreads::Thread::microSleep(1000);
+
+    REQUIRE(service->areThreadsRunning() == false);
+    REQUIRE((unsigned)count == num);
+    REQUIRE(service->getNumRequests() == 0u);
+}
+
+TEST_CASE( "Bounded TaskRequestQueue holds no more than its maximum size" ) {
+    OpenThreads::Atomic count;
+    const unsigned maxSize = 4, numProducers = 8, perProducer = 50;
+
+    osg::ref_ptr<TaskRequestQueue> queue = new TaskRequestQueue(maxSize, 2);
+
+    std::vector<TaskServiceTest::Producer*> producers;
+    for(unsigned i=0; i<numProducers; ++i)
+    {
+        producers.push_back(new TaskServiceTest::Producer(queue.get(), count, perProducer));
+        producers.back()->start();
+    }
+
+    // the producers block on the full queue; take their requests one by one
+    for(unsigned i=0; i<numProducers*perProducer; ++i)
+    {
+        REQUIRE(queue->getNumRequests() <= maxSize);
+        osg::ref_ptr<TaskRequest> request = queue->get(i%2u);
+        REQUIRE(request.valid());
+    }
+
+    for(unsigned i=0; i<numProducers; ++i)
+    {
+        producers[i]->join();
+        delete producers[i];
+    }
+
+    REQUIRE(queue->getNumRequests() == 0u);
+    REQUIRE(queue->isFull() == false);
+}
+
+TEST_CASE( "TaskService runs requests on threads added after a PoisonPill" ) {
+    OpenThreads::Atomic count;
+    const unsigned num = 100;
+
+    osg::ref_ptr<TaskService> service = new TaskService("test", 2);
+    service->add(new PoisonPill());
+
+    for(unsigned i=0; i<10000u && service->areThreadsRunning(); ++i)
+        OpenThreads::Thread::microSleep(1000);
+    REQUIRE(service->areThreadsRunning() == false);
+
+    service->setNumThreads(3);
+    for(unsigned i=0; i<num; ++i)
+        service->add(new TaskServiceTest::CountingTask(count, 0.0f));
+
+    for(unsigned i=0; i<10000u && (unsigned)count < num; ++i)
+        OpenThreads::Thread::microSleep(1000);
+
+    REQUIRE((unsigned)count == num);
+    REQUIRE(service->areThreadsRunning() == true);
+}
+
+namespace ShardedMapTest
+{
+    struct IntHash {
+        unsigned operator()(unsigned key) const { return key * 2654435761u; }
+    };
+
+    typedef ShardedMap<unsigned, unsigned, IntHash> Map;
+
+    // Each thread inserts its own range of keys, erases the odd ones,
+    // and looks up the rest.
+    class Worker : public OpenThreads::Thread
+    {
+    public:
+        Worker(Map& map, unsigned first, unsigned count) :
+            _map(map), _first(first), _count(count), _errors(0u) { }
+
+        void run()
+        {
+            for(unsigned k=_first; k<_first+_count; ++k)
+                if (!_map.insert(k, k*2u)) ++_errors;
+
+            for(unsigned k=_first+1; k<_first+_count; k+=2)
+                if (!_map.erase(k)) ++_errors;
+
+            for(unsigned k=_first; k<_first+_count; ++k)
+            {
+                unsigned value = 0u;
+                bool found = _map.get(k, value);
+                if (found != ((k-_first)%2u == 0u) || (found && value != k*2u))
+                    ++_errors;
+            }
+        }
+
+        Map&     _map;
+        unsigned _first, _count, _errors;
+    };
+
+    struct Count : public Map::ConstFunctor
+    {
+        Count(unsigned& count) : _count(count) { }
+        void operator()(const Map::Map& shard) const { _count += shard.size(); }
+        unsigned& _count;
+    };
+}
+
+TEST_CASE( "ShardedMap handles concurrent inserts and erases" ) {
+    const unsigned numThreads = 8, perThread = 20000;
+
+    ShardedMapTest::Map map;
+    std::vector<ShardedMapTest::Worker*> workers;
+    for(unsigned i=0; i<numThreads; ++i)
+        workers.push_back(new ShardedMapTest::Worker(map, i*perThread, perThread));
+
+    for(unsigned i=0; i<numThreads; ++i)
+        workers[i]->start();
+
+    unsigned errors = 0u;
+    for(unsigned i=0; i<numThreads; ++i)
+    {
+        workers[i]->join();
+        errors += workers[i]->_errors;
+        delete workers[i];
+    }
+
+    REQUIRE(errors == 0u);
+    REQUIRE(map.size() == numThreads*perThread/2u);
+
+    unsigned counted = 0u;
+    map.forEach(ShardedMapTest::Count(counted));
+    REQUIRE(counted == map.size());
+
+    std::vector<unsigned> values;
+    map.clear(&values);
+    REQUIRE(values.size() == numThreads*perThread/2u);
+    REQUIRE(map.empty());
+}
+
+TEST_CASE( "ShardedMap cursor visits each entry once per pass" ) {
+    ShardedMapTest::Map map(4u);
+    for(unsigned i=0; i<10u; ++i)
+        map.insert(i, i);
+
+    ShardedMapTest::Map::Cursor cursor;
+    std::set<unsigned> seen;
+    for(unsigned pass=0; pass<5u; ++pass)
+    {
+        ShardedMapTest::Map::Map batch;
+        map.getNext(cursor, 2u, batch);
+        REQUIRE(batch.size() == 2u);
+        for(ShardedMapTest::Map::Map::const_iterator i = batch.begin(); i != batch.end(); ++i)
+            REQUIRE(seen.insert(i->first).second);
+    }
+    REQUIRE(seen.size() == 10u);
+
+    // asking for more than there is returns each entry once:
+    ShardedMapTest::Map::Map all;
+    map.getNext(cursor, 20u, all);
+    REQUIRE(all.size() == 10u);
+
+    ShardedMapTest::Map empty;
+    ShardedMapTest::Map::Cursor emptyCursor;
+    ShardedMapTest::Map::Map none;
+    empty.getNext(emptyCursor, 4u, none);
+    REQUIRE(none.empty());
+}
@@ -0,0 +1,162 @@
+/* -*-c++-*- */
+/* osgEarth - Geospatial SDK for OpenSceneGraph
+* Copyright 2019 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarth/catch.hpp>
+#include <osgEarth/TileVisitor>
+#include <osgEarth/Registry>
+#include <osgEarth/ThreadingUtils>
+#include <osgDB/FileUtils>
+#include <cstdio>
+#include <set>
+#include <sstream>
+#include <vector>
+
+using namespace osgEarth;
+
+namespace TileVisitorTest
+{
+    // Records every key it handles, and prunes the subtrees under tiles with odd x.
+    class RecordingHandler : public TileHandler
+    {
+    public:
+        virtual bool handleTile(const TileKey& key, const TileVisitor& tv)
+        {
+            Threading::ScopedMutexLock lock(_mutex);
+            _keys.insert(key.str());
+            return (key.getTileX() & 1u) == 0u;
+        }
+
+        Threading::Mutex      _mutex;
+        std::set<std::string> _keys;
+    };
+
+    // Keeps the keys in the order they were handled.
+    class OrderedHandler : public TileHandler
+    {
+    public:
+        virtual bool handleTile(const TileKey& key, const TileVisitor& tv)
+        {
+            _keys.push_back(key.str());
+            return true;
+        }
+
+        std::vector<std::string> _keys;
+    };
+
+    // Reads back everything written to a temporary file.
+    std::string readAll(FILE* file)
+    {
+        fflush(file);
+        rewind(file);
+        std::string result;
+        char buf[256];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), file)) > 0)
+            result.append(buf, n);
+        return result;
+    }
+}
+
+TEST_CASE("LevelParallelTileVisitor visits the same tiles as TileVisitor") {
+    const Profile* profile = Registry::instance()->getGlobalGeodeticProfile();
+
+    osg::ref_ptr<TileVisitorTest::RecordingHandler> expected = new TileVisitorTest::RecordingHandler();
+    osg::ref_ptr<TileVisitor> visitor = new TileVisitor(expected.get());
+    visitor->setMinLevel(1);
+    visitor->setMaxLevel(6);
+    visitor->run(profile);
+
+    osg::ref_ptr<TileVisitorTest::RecordingHandler> actual = new TileVisitorTest::RecordingHandler();
+    osg::ref_ptr<LevelParallelTileVisitor> parallel = new LevelParallelTileVisitor(actual.get());
+    parallel->setMinLevel(1);
+    parallel->setMaxLevel(6);
+    parallel->setNumThreads(4);
+    parallel->setBatchSize(7);
+    parallel->run(profile);
+
+    REQUIRE(expected->_keys.size() > 100u);
+    REQUIRE(actual->_keys == expected->_keys);
+}
+
+TEST_CASE("LevelParallelTileVisitor doesn't repeat a completed run") {
+    const Profile* profile = Registry::instance()->getGlobalGeodeticProfile();
+    std::string checkpoint = "LevelParallelTileVisitor.checkpoint";
+    ::remove(checkpoint.c_str());
+
+    osg::ref_ptr<TileVisitorTest::RecordingHandler> first = new TileVisitorTest::RecordingHandler();
+    osg::ref_ptr<LevelParallelTileVisitor> visitor = new LevelParallelTileVisitor(first.get());
+    visitor->setMaxLevel(4);
+    visitor->setCheckpointFile(checkpoint);
+    visitor->run(profile);
+    REQUIRE(!first->_keys.empty());
+    REQUIRE(osgDB::fileExists(checkpoint));
+
+    // The checkpoint says there is nothing left to do
+    osg::ref_ptr<TileVisitorTest::RecordingHandler> second = new TileVisitorTest::RecordingHandler();
+    visitor->setTileHandler(second.get());
+    visitor->run(profile);
+    REQUIRE(second->_keys.empty());
+
+    ::remove(checkpoint.c_str());
+}
+
+TEST_CASE("TileKeyStreamVisitor replies ready, then done after each batch") {
+    const Profile* profile = Registry::instance()->getGlobalGeodeticProfile();
+
+    osg::ref_ptr<TileVisitorTest::OrderedHandler> handler = new TileVisitorTest::OrderedHandler();
+    osg::ref_ptr<TileKeyStreamVisitor> visitor = new TileKeyStreamVisitor();
+    visitor->setTileHandler(handler.get());
+
+    FILE* reply = tmpfile();
+    REQUIRE(reply != 0L);
+
+    SECTION("Batches")
+    {
+        std::istringstream input(
+            "0, 0, 0\n"
+            "1, 3, 1\n"
+            "1, 2, 0\n"
+            "\n"
+            "\n"
+            "2, 5, 2\n"
+            "\n");
+        visitor->process(profile, input, reply);
+
+        REQUIRE(TileVisitorTest::readAll(reply) == "ready\ndone 3\ndone 0\ndone 1\n");
+        REQUIRE(handler->_keys.size() == 4u);
+        REQUIRE(handler->_keys[0] == TileKey(0, 0, 0, profile).str());
+        REQUIRE(handler->_keys[1] == TileKey(1, 3, 1, profile).str());
+        REQUIRE(handler->_keys[2] == TileKey(1, 2, 0, profile).str());
+        REQUIRE(handler->_keys[3] == TileKey(2, 5, 2, profile).str());
+    }
+
+    SECTION("A batch without its empty line is not handled")
+    {
+        std::istringstream input("1, 0, 0\n");
+        visitor->process(profile, input, reply);
+
+        REQUIRE(TileVisitorTest::readAll(reply) == "ready\n");
+        REQUIRE(handler->_keys.empty());
+    }
+
+    fclose(reply);
+}